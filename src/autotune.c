@@ -0,0 +1,297 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+#include "autotune.h"
+#include "boids.h"
+#include "spatial_hash.h"
+#include "neighbor_list.h"
+#include "predators.h"
+#include "knn_graph.h"
+#include "recorder.h"
+#include "frame_timer.h"
+
+#define CACHE_LINE 512
+
+typedef struct Schedule {
+    int kind;
+    int chunk;
+} Schedule;
+
+static const float cell_factors[] = { 0.5f, 2.0f / 3.0f, 1.0f, 4.0f / 3.0f, 1.5f, 2.0f };
+
+static const Schedule schedules[] = {
+    { omp_sched_static, 0 },
+    { omp_sched_static, 64 },
+    { omp_sched_dynamic, 64 },
+    { omp_sched_dynamic, 256 },
+    { omp_sched_guided, 0 },
+};
+
+// What a trial changes, put back afterwards
+typedef struct SavedState {
+    float *boid[4];
+    BoidInfo *info;
+    float *predator[4];
+    size_t frame;
+    NeighborListStats stats;
+} SavedState;
+
+typedef struct TuneKey {
+    char cpu[256];
+    int threads;
+    int width, height;
+    size_t boids;        // boid count rounded up to a power of two
+    char interaction[32];
+} TuneKey;
+
+const char *schedule_name(int schedule, int chunk, char *buffer, size_t size)
+{
+    const char *kind = schedule == omp_sched_dynamic ? "dynamic"
+                     : schedule == omp_sched_guided ? "guided"
+                     : schedule == omp_sched_auto ? "auto" : "static";
+    if (chunk > 0) snprintf(buffer, size, "%s,%d", kind, chunk);
+    else snprintf(buffer, size, "%s", kind);
+    return buffer;
+}
+
+static void *copy_array(const void *src, size_t bytes)
+{
+    void *p = malloc(bytes ? bytes : 1);
+    if (!p) {
+        fprintf(stderr, "Failed to allocate autotune state!\n");
+        exit(1);
+    }
+    if (bytes) memcpy(p, src, bytes);
+    return p;
+}
+
+static void save_state(SavedState *s)
+{
+    float *boid[4] = { boids.x, boids.y, boids.vx, boids.vy };
+    float *predator[4] = { predators.x, predators.y, predators.vx, predators.vy };
+    for (int a = 0; a < 4; a++) {
+        s->boid[a] = copy_array(boid[a], boidCount * sizeof(float));
+        s->predator[a] = copy_array(predator[a], predatorCount * sizeof(float));
+    }
+    s->info = copy_array(boids.info, boidCount * sizeof(BoidInfo));
+    s->frame = frameCounter;
+    s->stats = neighborListStats;
+}
+
+// Puts the state back and rebuilds everything derived from it
+static void restore_state(SavedState *s)
+{
+    float *boid[4] = { boids.x, boids.y, boids.vx, boids.vy };
+    float *predator[4] = { predators.x, predators.y, predators.vx, predators.vy };
+    for (int a = 0; a < 4; a++) {
+        memcpy(boid[a], s->boid[a], boidCount * sizeof(float));
+        memcpy(predator[a], s->predator[a], predatorCount * sizeof(float));
+        free(s->boid[a]);
+        free(s->predator[a]);
+    }
+    memcpy(boids.info, s->info, boidCount * sizeof(BoidInfo));
+    free(s->info);
+    frameCounter = s->frame;
+    neighborListStats = s->stats;
+
+    build_spatial_grid();
+    InvalidateNeighborLists();
+    build_predator_grid();
+    if (knnK > 0) BuildKnnGraph();
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Median microseconds per step with the current cell size and schedule
+static double trial(void)
+{
+    const float frameTime = 1.0f / 60.0f;
+    double samples[AUTOTUNE_STEPS];
+    for (int i = 0; i < AUTOTUNE_WARMUP + AUTOTUNE_STEPS; i++) {
+        frameCounter++;
+        uint64_t start = TimerNow();
+        UpdateBoids(frameTime, 1.0f, 1.0f, 1.0f);
+        if (i >= AUTOTUNE_WARMUP) samples[i - AUTOTUNE_WARMUP] = (TimerNow() - start) * 1e-3;
+    }
+    qsort(samples, AUTOTUNE_STEPS, sizeof(double), compare_double);
+    return samples[AUTOTUNE_STEPS / 2];
+}
+
+static void read_cpu_model(char *out, size_t size)
+{
+    snprintf(out, size, "unknown");
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if (!f) return;
+    char line[CACHE_LINE];
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "model name", 10) != 0) continue;
+        const char *value = strchr(line, ':');
+        if (!value) break;
+        value += strspn(value + 1, " ") + 1;
+        snprintf(out, size, "%s", value);
+        for (char *c = out; *c; c++) {
+            if (*c == '\t' || *c == '\n') *c = ' ';
+        }
+        size_t n = strlen(out);
+        while (n > 0 && out[n - 1] == ' ') out[--n] = '\0';
+        break;
+    }
+    fclose(f);
+}
+
+static void current_key(TuneKey *key)
+{
+    read_cpu_model(key->cpu, sizeof(key->cpu));
+    key->threads = omp_get_max_threads();
+    key->width = SCREEN_WIDTH;
+    key->height = SCREEN_HEIGHT;
+    key->boids = 1;
+    while (key->boids < boidCount) key->boids <<= 1;
+    snprintf(key->interaction, sizeof(key->interaction), "%s", flock_interaction_name(flockInteraction));
+}
+
+// Parses one cache line; false if it is malformed
+static bool parse_line(const char *line, TuneKey *key, TuneChoice *choice)
+{
+    *key = (TuneKey){0};
+    *choice = (TuneChoice){0};
+    return sscanf(line, "%255[^\t]\t%d\t%d\t%d\t%zu\t%31[^\t]\t%d\t%d\t%d\t%lf",
+                  key->cpu, &key->threads, &key->width, &key->height, &key->boids, key->interaction,
+                  &choice->cellSize, &choice->schedule, &choice->chunk, &choice->stepUs) == 10;
+}
+
+static bool same_key(const TuneKey *a, const TuneKey *b)
+{
+    return strcmp(a->cpu, b->cpu) == 0 && a->threads == b->threads && a->width == b->width &&
+           a->height == b->height && a->boids == b->boids && strcmp(a->interaction, b->interaction) == 0;
+}
+
+static bool read_cache(const char *path, const TuneKey *key, TuneChoice *out)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) return false;
+    char line[CACHE_LINE];
+    bool found = false;
+    while (!found && fgets(line, sizeof(line), f)) {
+        TuneKey entry;
+        TuneChoice choice;
+        if (parse_line(line, &entry, &choice) && same_key(&entry, key)) {
+            *out = choice;
+            found = true;
+        }
+    }
+    fclose(f);
+    return found;
+}
+
+// Rewrites the cache with this key's line replaced
+static void write_cache(const char *path, const TuneKey *key, const TuneChoice *choice)
+{
+    char temp[1024];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    FILE *out = fopen(temp, "w");
+    if (!out) {
+        fprintf(stderr, "Failed to write %s\n", temp);
+        return;
+    }
+    FILE *in = fopen(path, "r");
+    if (in) {
+        char line[CACHE_LINE];
+        while (fgets(line, sizeof(line), in)) {
+            TuneKey entry;
+            TuneChoice old;
+            if (parse_line(line, &entry, &old) && !same_key(&entry, key)) fputs(line, out);
+        }
+        fclose(in);
+    }
+    fprintf(out, "%s\t%d\t%d\t%d\t%zu\t%s\t%d\t%d\t%d\t%.1f\n",
+            key->cpu, key->threads, key->width, key->height, key->boids, key->interaction,
+            choice->cellSize, choice->schedule, choice->chunk, choice->stepUs);
+    if (fclose(out) != 0 || rename(temp, path) != 0) {
+        fprintf(stderr, "Failed to write %s\n", path);
+        remove(temp);
+    }
+}
+
+static void report(const TuneChoice *choice)
+{
+    char name[32];
+    fprintf(stderr, "Autotune: cell %d px, force schedule %s, %.0f us per step (%s)\n",
+            choice->cellSize, schedule_name(choice->schedule, choice->chunk, name, sizeof(name)),
+            choice->stepUs, choice->cached ? "cached" : "measured");
+}
+
+static TuneChoice tune(void)
+{
+    char name[32];
+    SavedState saved;
+    save_state(&saved);
+
+    // Cell size first, with the default schedule
+    forceSchedule = omp_sched_static;
+    forceChunk = 0;
+    const int start = cellSize;
+    TuneChoice best = { .cellSize = start, .schedule = forceSchedule, .chunk = forceChunk };
+    best.stepUs = trial();
+    fprintf(stderr, "  cell %3d px, static: %.0f us\n", best.cellSize, best.stepUs);
+    for (size_t c = 0; c < sizeof(cell_factors) / sizeof(cell_factors[0]); c++) {
+        int size = (int)lroundf(NEIGHBOR_RADIUS * cell_factors[c]);
+        if (size == start || !SetCellSize(size)) continue;
+        double us = trial();
+        fprintf(stderr, "  cell %3d px, static: %.0f us\n", size, us);
+        if (us < best.stepUs * (1.0 - AUTOTUNE_MARGIN)) {
+            best.cellSize = size;
+            best.stepUs = us;
+        }
+    }
+    SetCellSize(best.cellSize);
+
+    // Then the schedule, the default being the one already timed
+    for (size_t s = 1; s < sizeof(schedules) / sizeof(schedules[0]); s++) {
+        forceSchedule = schedules[s].kind;
+        forceChunk = schedules[s].chunk;
+        double us = trial();
+        fprintf(stderr, "  cell %3d px, %s: %.0f us\n", best.cellSize,
+                schedule_name(forceSchedule, forceChunk, name, sizeof(name)), us);
+        if (us < best.stepUs * (1.0 - AUTOTUNE_MARGIN)) {
+            best.schedule = forceSchedule;
+            best.chunk = forceChunk;
+            best.stepUs = us;
+        }
+    }
+    forceSchedule = best.schedule;
+    forceChunk = best.chunk;
+
+    restore_state(&saved);
+    return best;
+}
+
+TuneChoice Autotune(const char *path, bool retune)
+{
+    TuneChoice choice = { .cellSize = cellSize, .schedule = forceSchedule, .chunk = forceChunk };
+    if (IsRecording()) {
+        fprintf(stderr, "Autotune: not while recording\n");
+        return choice;
+    }
+
+    TuneKey key;
+    current_key(&key);
+    if (path && !retune && read_cache(path, &key, &choice) && SetCellSize(choice.cellSize)) {
+        choice.cached = true;
+        forceSchedule = choice.schedule;
+        forceChunk = choice.chunk;
+    } else {
+        choice = tune();
+        if (path) write_cache(path, &key, &choice);
+    }
+    report(&choice);
+    return choice;
+}
@@ -0,0 +1,42 @@
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Grid cell size and force pass schedule, tuned per machine.
+//
+// Short timed runs of UpdateBoids() on the current world and boids: first
+// each candidate cell size (fractions and multiples of NEIGHBOR_RADIUS that
+// divide the world) with the static schedule, then each candidate OpenMP
+// schedule at the fastest cell size. A candidate has to beat the best so far
+// by AUTOTUNE_MARGIN to win, so noise does not move the defaults. The boids,
+// predators and frameCounter are restored afterwards, so tuning does not
+// advance the simulation.
+//
+// The choice is cached as one line per machine and setup: CPU model, thread
+// count, world size, boid count rounded up to a power of two and interaction
+// mode. Call on the simulation thread, or before it starts.
+
+#define AUTOTUNE_CACHE "boids_tune.cache"
+#define AUTOTUNE_WARMUP 2        // untimed steps per trial
+#define AUTOTUNE_STEPS 8         // timed steps per trial, the median is kept
+#define AUTOTUNE_MARGIN 0.03     // fraction a candidate must be faster by
+
+typedef struct TuneChoice {
+    int cellSize;
+    int schedule;       // omp_sched_t of the force pass
+    int chunk;          // 0 for the schedule's default
+    double stepUs;      // median step time of the choice
+    bool cached;        // read from the cache rather than measured
+} TuneChoice;
+
+// Applies the choice cached in `path` for this machine and setup, or tunes,
+// applies and caches one. retune ignores the cache; a NULL path skips it.
+// Not while recording: the trials would be recorded.
+TuneChoice Autotune(const char *path, bool retune);
+
+// "static", "dynamic,64", ... into buffer
+const char *schedule_name(int schedule, int chunk, char *buffer, size_t size);
+
+#endif // AUTOTUNE_H
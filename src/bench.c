@@ -0,0 +1,693 @@
+// Headless benchmark driver for the simulation core.
+//
+// Runs InitBoids/UpdateBoids for a fixed number of steps without a window and
+// reports throughput and per-step latency as CSV or JSON.
+//
+// Usage:
+//   ./boids_bench --boids 10000 --steps 1000 --threads 8 --format json
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <omp.h>
+
+#include "boids.h"
+#include "normal_random.h"
+#include "spatial_hash.h"
+#include "flock_kernel.h"
+#include "flock_pairs.h"
+#include "neighbor_list.h"
+#include "predators.h"
+#include "density_field.h"
+#include "knn_graph.h"
+#include "spatial_query.h"
+#include "autotune.h"
+#include "boid_order.h"
+#include "recorder.h"
+#include "frame_timer.h"
+#include "domain.h"
+#include "species.h"
+
+typedef struct BenchOptions {
+    size_t boids;
+    size_t predators;
+    int steps;
+    int warmup;
+    int width;
+    int height;
+    int cell_size;
+    int autotune; // 0 off, 1 through the cache, 2 ignoring it
+    int threads;
+    uint64_t seed;
+    bool json;
+    bool checksum;
+    bool check_kernels;
+    int kernel; // FlockKernelIsa, or -1 for the widest supported
+    FlockInteraction interaction;
+    float skin;
+    int density_blur;
+    int knn; // neighbour graph k, 0 for none
+    int reorder; // frames between space-filling-curve reorders, 0 for none
+    int queries; // batched spatial queries after the timed steps, 0 for none
+    float far_radius; // radius of the summed queries
+    const char *record; // recording of the timed steps, or NULL
+    const char *timings; // per-stage timings of the timed steps, or NULL
+    int workers; // worker processes for the timed steps, 0 to run in this one
+    TransportKind transport;
+    int species; // species with the default matrix (species.h)
+    const char *species_file; // or read from this file, or NULL
+} BenchOptions;
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static int compare_double(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static uint64_t fnv1a(uint64_t hash, const void *data, size_t size)
+{
+    const unsigned char *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+// Hash of the final boid state and spatial index, for comparing runs
+static uint64_t state_checksum(void)
+{
+    uint64_t hash = 14695981039346656037ull;
+    size_t n = boidCount;
+    hash = fnv1a(hash, boids.x, n * sizeof(float));
+    hash = fnv1a(hash, boids.y, n * sizeof(float));
+    hash = fnv1a(hash, boids.vx, n * sizeof(float));
+    hash = fnv1a(hash, boids.vy, n * sizeof(float));
+    hash = fnv1a(hash, predators.x, predatorCount * sizeof(float));
+    hash = fnv1a(hash, predators.y, predatorCount * sizeof(float));
+    hash = fnv1a(hash, grid.cell_start, ((size_t)grid.width * grid.height + 1) * sizeof(uint32_t));
+    hash = fnv1a(hash, grid.cell_boids, grid.count * sizeof(uint32_t));
+    return hash;
+}
+
+// Error of value against reference, relative to scale (see flock_kernel.h)
+static float max_error(float reference, float value, float scale, float worst)
+{
+    float error = fabsf(value - reference) / (1.0f + scale);
+    return error > worst ? error : worst;
+}
+
+// Folds the error of b against the reference sums a into worst.
+// separation_scale is the summed magnitude of a's separation terms.
+static void compare_sums(const FlockSums *a, const FlockSums *b, float separation_scale,
+                         float *worst, size_t *count_mismatches)
+{
+    if (a->neighborCount != b->neighborCount || a->nearNeighborCount != b->nearNeighborCount ||
+        a->coincident != b->coincident) (*count_mismatches)++;
+    float velocity_scale = a->neighborCount * MAX_SPEED;
+    float offset_scale = a->neighborCount * NEIGHBOR_RADIUS;
+    *worst = max_error(a->separation_x, b->separation_x, separation_scale, *worst);
+    *worst = max_error(a->separation_y, b->separation_y, separation_scale, *worst);
+    *worst = max_error(a->alignment_x, b->alignment_x, velocity_scale, *worst);
+    *worst = max_error(a->alignment_y, b->alignment_y, velocity_scale, *worst);
+    *worst = max_error(a->offset_x, b->offset_x, offset_scale, *worst);
+    *worst = max_error(a->offset_y, b->offset_y, offset_scale, *worst);
+}
+
+// Scalar gather sums of boid i, the reference for every check, and the
+// summed magnitude of its separation terms
+static FlockSums reference_sums(size_t i, float *separation_scale)
+{
+    int width = (int)ceilf(NEIGHBOR_RADIUS / cellSize);
+    FlockKernelFn scalar = flock_kernel_get(FLOCK_KERNEL_SCALAR);
+    uint32_t cell = grid.boid_cell[i];
+    CellRange ranges[GRID_MAX_RANGES];
+    int range_count = grid_cell_ranges(cell % grid.width, cell / grid.width, width, ranges);
+
+    FlockSums sums = {0};
+    *separation_scale = 0.0f;
+    for (int r = 0; r < range_count; r++) {
+        scalar(boids.x[i], boids.y[i], (uint32_t)i, grid.cell_boids + ranges[r].begin,
+               ranges[r].end - ranges[r].begin, &sums);
+        for (uint32_t k = ranges[r].begin; k < ranges[r].end; k++) {
+            float dist = DistanceOnTorusSquared(BoidPosition(i), BoidPosition(grid.cell_boids[k]));
+            if (dist > 0.0f && dist < PROTECTED_RADIUS * PROTECTED_RADIUS) *separation_scale += 1.0f / sqrtf(dist);
+        }
+    }
+    return sums;
+}
+
+// With more than one species, runs every supported species kernel over every
+// boid's neighbourhood and compares the sums against the scalar one
+static bool check_species_kernels(void)
+{
+    if (speciesCount == 1) return true;
+    bool ok = true;
+    int width = (int)ceilf(NEIGHBOR_RADIUS / cellSize);
+    FlockSpeciesKernelFn scalar = flock_species_kernel_get(FLOCK_KERNEL_SCALAR);
+    BuildSpeciesRows();
+
+    for (int isa = FLOCK_KERNEL_SCALAR + 1; isa < FLOCK_KERNEL_COUNT; isa++) {
+        FlockSpeciesKernelFn kernel = flock_species_kernel_get((FlockKernelIsa)isa);
+        if (!kernel) continue;
+
+        float worst = 0.0f;
+        size_t count_mismatches = 0;
+        for (size_t i = 0; i < boidCount; i++) {
+            const FlockSpeciesRow *row = &speciesRows[boids.info[i].species];
+            uint32_t cell = grid.boid_cell[i];
+            CellRange ranges[GRID_MAX_RANGES];
+            int range_count = grid_cell_ranges(cell % grid.width, cell / grid.width, width, ranges);
+            FlockSpeciesSums a = {0}, b = {0};
+            float separation_scale = 0.0f;
+            for (int r = 0; r < range_count; r++) {
+                const uint32_t *candidates = grid.cell_boids + ranges[r].begin;
+                uint32_t count = ranges[r].end - ranges[r].begin;
+                scalar(boids.x[i], boids.y[i], (uint32_t)i, candidates, count, row, &a);
+                kernel(boids.x[i], boids.y[i], (uint32_t)i, candidates, count, row, &b);
+                for (uint32_t k = 0; k < count; k++) {
+                    float dist = DistanceOnTorusSquared(BoidPosition(i), BoidPosition(candidates[k]));
+                    if (dist > 0.0f && dist < PROTECTED_RADIUS * PROTECTED_RADIUS) {
+                        separation_scale += row->separation[boids.info[candidates[k]].species] / sqrtf(dist);
+                    }
+                }
+            }
+            compare_sums(&a.sums, &b.sums, separation_scale, &worst, &count_mismatches);
+            float scale = a.sums.neighborCount * NEIGHBOR_RADIUS;
+            worst = max_error(a.matched, b.matched, a.sums.neighborCount, worst);
+            worst = max_error(a.flee_x, b.flee_x, scale, worst);
+            worst = max_error(a.flee_y, b.flee_y, scale, worst);
+        }
+
+        bool pass = count_mismatches == 0 && worst <= FLOCK_KERNEL_TOLERANCE;
+        fprintf(stderr, "kernel %-7s %-9s max error %.3g, count mismatches %zu: %s\n",
+                flock_kernel_name((FlockKernelIsa)isa), "species", worst, count_mismatches, pass ? "ok" : "FAILED");
+        ok = ok && pass;
+    }
+    return ok;
+}
+
+// Runs every supported kernel, gathering and symmetric, over every boid's
+// neighbourhood and compares the sums against the scalar gather. Returns
+// false if any exceeds the documented tolerance.
+static bool check_kernels(void)
+{
+    bool ok = true;
+    int width = (int)ceilf(NEIGHBOR_RADIUS / cellSize);
+    FlockKernelIsa selected = flock_kernel_current();
+
+    for (int isa = FLOCK_KERNEL_SCALAR; isa < FLOCK_KERNEL_COUNT; isa++) {
+        FlockKernelFn kernel = flock_kernel_get((FlockKernelIsa)isa);
+        if (!kernel) {
+            fprintf(stderr, "kernel %-7s unsupported on this CPU\n", flock_kernel_name((FlockKernelIsa)isa));
+            continue;
+        }
+
+        for (int mode = 0; mode < FLOCK_INTERACTION_COUNT; mode++) {
+            if (mode == FLOCK_GATHER && isa == FLOCK_KERNEL_SCALAR) continue; // the reference
+
+            flock_kernel_select((FlockKernelIsa)isa);
+            if (mode == FLOCK_SYMMETRIC && !ComputeSymmetricFlockSums()) {
+                fprintf(stderr, "world too small for the symmetric stencil\n");
+                continue;
+            }
+            if (mode == FLOCK_NEIGHBOR_LIST && !ComputeNeighborListFlockSums()) {
+                fprintf(stderr, "neighbour list radius too large for the grid\n");
+                continue;
+            }
+
+            float worst = 0.0f;
+            size_t count_mismatches = 0;
+            for (size_t i = 0; i < boidCount; i++) {
+                float separation_scale;
+                FlockSums a = reference_sums(i, &separation_scale);
+                FlockSums b = {0};
+                if (mode == FLOCK_SYMMETRIC) {
+                    b = SymmetricFlockSums(i);
+                } else if (mode == FLOCK_NEIGHBOR_LIST) {
+                    b = NeighborListFlockSums(i);
+                } else {
+                    uint32_t cell = grid.boid_cell[i];
+                    CellRange ranges[GRID_MAX_RANGES];
+                    int range_count = grid_cell_ranges(cell % grid.width, cell / grid.width, width, ranges);
+                    for (int r = 0; r < range_count; r++) {
+                        kernel(boids.x[i], boids.y[i], (uint32_t)i, grid.cell_boids + ranges[r].begin,
+                               ranges[r].end - ranges[r].begin, &b);
+                    }
+                }
+                compare_sums(&a, &b, separation_scale, &worst, &count_mismatches);
+            }
+
+            bool pass = count_mismatches == 0 && worst <= FLOCK_KERNEL_TOLERANCE;
+            fprintf(stderr, "kernel %-7s %-9s max error %.3g, count mismatches %zu: %s\n",
+                    flock_kernel_name((FlockKernelIsa)isa), flock_interaction_name((FlockInteraction)mode),
+                    worst, count_mismatches, pass ? "ok" : "FAILED");
+            ok = ok && pass;
+        }
+    }
+    flock_kernel_select(selected);
+    return ok && check_species_kernels();
+}
+
+// Nearest-rank percentile of an ascending array
+static double percentile(const double *sorted, int n, double p)
+{
+    int rank = (int)(p / 100.0 * n + 0.5);
+    if (rank < 1) rank = 1;
+    if (rank > n) rank = n;
+    return sorted[rank - 1];
+}
+
+#define BENCH_QUERY_K 8
+#define BENCH_QUERY_MAX 256 // radius results kept per query
+
+// Batches of radius and nearest queries at points spread evenly over the
+// world, as an analysis pass would issue them between ticks
+static bool time_queries(size_t count, float far_radius)
+{
+    Vec2 *points = malloc(count * sizeof(Vec2));
+    uint32_t *out = malloc(count * BENCH_QUERY_MAX * sizeof(uint32_t));
+    size_t *found = malloc(count * sizeof(size_t));
+    RadiusSums *sums = malloc(count * sizeof(RadiusSums));
+    bool ok = points && out && found && sums;
+    if (!ok) {
+        fprintf(stderr, "Failed to allocate query buffers!\n");
+        goto done;
+    }
+    for (size_t q = 0; q < count; q++) {
+        // Additive recurrence on the plastic number: low discrepancy, no RNG
+        double a = q * 0.7548776662466927, b = q * 0.5698402909980532;
+        points[q] = (Vec2){ (float)((a - floor(a)) * SCREEN_WIDTH), (float)((b - floor(b)) * SCREEN_HEIGHT) };
+    }
+
+    double t0 = now_ns();
+    QueryRadiusBatch(points, count, NEIGHBOR_RADIUS, out, BENCH_QUERY_MAX, found);
+    double t1 = now_ns();
+    QueryNearestBatch(points, count, BENCH_QUERY_K, out, NULL);
+    double t2 = now_ns();
+    QueryRadiusSumsBatch(points, count, far_radius, sums);
+    double t3 = now_ns();
+
+    // The boid by boid reference, and how far the cell moments are from it
+    double worst = 0.0;
+    #pragma omp parallel for schedule(static) reduction(max: worst)
+    for (size_t q = 0; q < count; q++) {
+        RadiusSums exact = QueryRadiusSumsExact(points[q], far_radius, QUERY_NONE);
+        double scale = (double)exact.count + 1.0;
+        double error = fabs(sums[q].count - exact.count) / scale;
+        error = fmax(error, fabs(sums[q].offset.x - exact.offset.x) / (scale * far_radius));
+        error = fmax(error, fabs(sums[q].offset.y - exact.offset.y) / (scale * far_radius));
+        error = fmax(error, fabs(sums[q].velocity.x - exact.velocity.x) / (scale * MAX_SPEED));
+        error = fmax(error, fabs(sums[q].velocity.y - exact.velocity.y) / (scale * MAX_SPEED));
+        error = fmax(error, fabs(sums[q].spread - exact.spread) / (scale * far_radius * far_radius));
+        if (error > worst) worst = error;
+    }
+    double t4 = now_ns();
+
+    size_t total = 0;
+    for (size_t q = 0; q < count; q++) total += found[q];
+    fprintf(stderr, "Queries: %zu radius %.0f in %.0f ns each (%.1f boids on average), %zu %d-nearest in %.0f ns each\n",
+            count, NEIGHBOR_RADIUS, (t1 - t0) / count, (double)total / count,
+            count, BENCH_QUERY_K, (t2 - t1) / count);
+    fprintf(stderr, "Sums within %.0f: %.0f ns each from cell moments, %.0f ns boid by boid, worst scaled difference %.2g\n",
+            far_radius, (t3 - t2) / count, (t4 - t3) / count, worst);
+done:
+    free(sums);
+    free(points);
+    free(out);
+    free(found);
+    return ok;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+        "Usage: %s [options]\n"
+        "  -n, --boids N      number of boids (default %d)\n"
+        "  -p, --predators N  number of predators (default %d)\n"
+        "  -s, --steps N      timed steps (default 1000)\n"
+        "  -w, --warmup N     untimed warmup steps (default 50)\n"
+        "  -W, --width PX     world width (default 1920)\n"
+        "  -H, --height PX    world height (default 1080)\n"
+        "      --cell-size PX grid cell edge, dividing the world (default %d)\n"
+        "      --autotune     pick the cell size and force schedule for this machine, cached in %s\n"
+        "      --retune       the same, ignoring the cache\n"
+        "  -t, --threads N    OpenMP threads (default: OpenMP's choice)\n"
+        "  -S, --seed N       random seed (default 1)\n"
+        "  -f, --format FMT   csv or json (default csv)\n"
+        "  -c, --checksum     also report a hash of the final state (comparable at equal cell sizes)\n"
+        "  -k, --kernel ISA   scalar, sse4.2, avx2 or avx512 (default: widest supported)\n"
+        "  -i, --interaction MODE  gather, symmetric or lists (default gather)\n"
+        "      --skin PX      neighbour list skin (default %.0f)\n"
+        "      --density-blur N  cells each way the density field is blurred over (default %d)\n"
+        "      --reorder N    put the boids in Hilbert curve order every N steps (default %d, 0 for never)\n"
+        "      --knn K        also build the k-nearest-neighbour graph every step (K up to %d)\n"
+        "      --queries N    time N radius, N 8-nearest and N summed queries in batches after the steps\n"
+        "      --far-radius R radius of the summed queries (default %.0f)\n"
+        "      --record FILE  record the timed steps for replay in the viewer\n"
+        "      --timings FILE write per-stage timings, as Chrome trace JSON if FILE ends in .json, else CSV\n"
+        "      --workers N    run the timed steps in N worker processes, one strip of the world each\n"
+        "      --transport T  shm or socket, between the workers (default shm)\n"
+        "      --species N    N species, each flocking only with its own kind (default 1, up to %d)\n"
+        "      --species-file FILE  species and interaction matrix from FILE (see species.h)\n"
+        "      --check-kernels  compare every supported kernel and mode against scalar and exit\n",
+        program, DEFAULT_BOIDS, DEFAULT_PREDATORS, DEFAULT_CELL_SIZE, AUTOTUNE_CACHE, DEFAULT_NEIGHBOR_LIST_SKIN, DEFAULT_DENSITY_BLUR,
+        DEFAULT_REORDER_INTERVAL, KNN_MAX_K,
+        PREDATOR_VISUAL_RADIUS, MAX_SPECIES);
+}
+
+static bool parse_options(int argc, char **argv, BenchOptions *opt)
+{
+    static const struct option long_options[] = {
+        { "boids",   required_argument, NULL, 'n' },
+        { "predators", required_argument, NULL, 'p' },
+        { "steps",   required_argument, NULL, 's' },
+        { "warmup",  required_argument, NULL, 'w' },
+        { "width",   required_argument, NULL, 'W' },
+        { "height",  required_argument, NULL, 'H' },
+        { "cell-size", required_argument, NULL, 'Z' },
+        { "autotune", no_argument,      NULL, 'A' },
+        { "retune",  no_argument,       NULL, 'U' },
+        { "threads", required_argument, NULL, 't' },
+        { "seed",    required_argument, NULL, 'S' },
+        { "format",  required_argument, NULL, 'f' },
+        { "checksum", no_argument,      NULL, 'c' },
+        { "kernel",  required_argument, NULL, 'k' },
+        { "interaction", required_argument, NULL, 'i' },
+        { "skin",    required_argument, NULL, 'L' },
+        { "density-blur", required_argument, NULL, 'D' },
+        { "reorder", required_argument, NULL, 'O' },
+        { "knn",     required_argument, NULL, 'G' },
+        { "queries", required_argument, NULL, 'Q' },
+        { "far-radius", required_argument, NULL, 'F' },
+        { "record",  required_argument, NULL, 'R' },
+        { "timings", required_argument, NULL, 'T' },
+        { "workers", required_argument, NULL, 'X' },
+        { "transport", required_argument, NULL, 'Y' },
+        { "species", required_argument, NULL, 'V' },
+        { "species-file", required_argument, NULL, 'P' },
+        { "check-kernels", no_argument, NULL, 'K' },
+        { "help",    no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int c;
+    while ((c = getopt_long(argc, argv, "n:p:s:w:W:H:t:S:f:ck:i:h", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'n': opt->boids = strtoul(optarg, NULL, 10); break;
+            case 'p': opt->predators = strtoul(optarg, NULL, 10); break;
+            case 's': opt->steps = atoi(optarg); break;
+            case 'w': opt->warmup = atoi(optarg); break;
+            case 'W': opt->width = atoi(optarg); break;
+            case 'H': opt->height = atoi(optarg); break;
+            case 'Z': opt->cell_size = atoi(optarg); break;
+            case 'A': opt->autotune = 1; break;
+            case 'U': opt->autotune = 2; break;
+            case 't': opt->threads = atoi(optarg); break;
+            case 'S': opt->seed = strtoull(optarg, NULL, 10); break;
+            case 'f':
+                if (strcmp(optarg, "json") == 0) opt->json = true;
+                else if (strcmp(optarg, "csv") == 0) opt->json = false;
+                else return false;
+                break;
+            case 'c': opt->checksum = true; break;
+            case 'K': opt->check_kernels = true; break;
+            case 'k':
+                opt->kernel = -1;
+                for (int isa = 0; isa < FLOCK_KERNEL_COUNT; isa++) {
+                    if (strcmp(optarg, flock_kernel_name((FlockKernelIsa)isa)) == 0) opt->kernel = isa;
+                }
+                if (opt->kernel < 0) {
+                    fprintf(stderr, "Unknown kernel '%s'\n", optarg);
+                    return false;
+                }
+                break;
+            case 'i':
+                opt->interaction = FLOCK_INTERACTION_COUNT;
+                for (int mode = 0; mode < FLOCK_INTERACTION_COUNT; mode++) {
+                    if (strcmp(optarg, flock_interaction_name((FlockInteraction)mode)) == 0) opt->interaction = mode;
+                }
+                if (opt->interaction == FLOCK_INTERACTION_COUNT) {
+                    fprintf(stderr, "Unknown interaction mode '%s'\n", optarg);
+                    return false;
+                }
+                break;
+            case 'L': opt->skin = strtof(optarg, NULL); break;
+            case 'D': opt->density_blur = atoi(optarg); break;
+            case 'O': opt->reorder = atoi(optarg); break;
+            case 'G': opt->knn = atoi(optarg); break;
+            case 'Q': opt->queries = atoi(optarg); break;
+            case 'F': opt->far_radius = strtof(optarg, NULL); break;
+            case 'R': opt->record = optarg; break;
+            case 'T': opt->timings = optarg; break;
+            case 'X': opt->workers = atoi(optarg); break;
+            case 'Y':
+                opt->transport = transport_kind(optarg);
+                if (opt->transport == TRANSPORT_KIND_COUNT) {
+                    fprintf(stderr, "Unknown transport %s\n", optarg);
+                    return false;
+                }
+                break;
+            case 'V': opt->species = atoi(optarg); break;
+            case 'P': opt->species_file = optarg; break;
+            default: return false;
+        }
+    }
+
+    if (opt->boids == 0 || opt->boids >= UINT32_MAX) {
+        fprintf(stderr, "Boid count must be between 1 and %u\n", UINT32_MAX - 1);
+        return false;
+    }
+    if (opt->predators >= UINT32_MAX) {
+        fprintf(stderr, "Predator count must be below %u\n", UINT32_MAX);
+        return false;
+    }
+    if (!(opt->skin >= 0.0f)) {
+        fprintf(stderr, "Skin must be non-negative\n");
+        return false;
+    }
+    if (opt->density_blur < 0) {
+        fprintf(stderr, "Density blur must be non-negative\n");
+        return false;
+    }
+    if (opt->reorder < 0) {
+        fprintf(stderr, "Reorder interval must be non-negative\n");
+        return false;
+    }
+    if (opt->knn < 0 || opt->knn > KNN_MAX_K) {
+        fprintf(stderr, "k must be between 0 and %d\n", KNN_MAX_K);
+        return false;
+    }
+    if (opt->queries < 0 || !(opt->far_radius > 0.0f)) {
+        fprintf(stderr, "Query count must be non-negative and the radius positive\n");
+        return false;
+    }
+    if (opt->workers < 0 || opt->workers > DOMAIN_MAX_WORKERS) {
+        fprintf(stderr, "Workers must be between 0 and %d\n", DOMAIN_MAX_WORKERS);
+        return false;
+    }
+    if (opt->species < 1 || opt->species > MAX_SPECIES) {
+        fprintf(stderr, "Species must be between 1 and %d\n", MAX_SPECIES);
+        return false;
+    }
+    if (opt->steps <= 0 || opt->warmup < 0) {
+        fprintf(stderr, "Steps must be positive and warmup non-negative\n");
+        return false;
+    }
+    if (opt->cell_size <= 0 || opt->width < 3 * opt->cell_size || opt->height < 3 * opt->cell_size) {
+        fprintf(stderr, "World must be at least 3 x 3 cells\n");
+        return false;
+    }
+    return true;
+}
+
+int main(int argc, char **argv)
+{
+    BenchOptions opt = {
+        .boids = DEFAULT_BOIDS,
+        .predators = DEFAULT_PREDATORS,
+        .steps = 1000,
+        .warmup = 50,
+        .width = 1920,
+        .height = 1080,
+        .cell_size = DEFAULT_CELL_SIZE,
+        .autotune = 0,
+        .threads = 0,
+        .seed = 1,
+        .json = false,
+        .checksum = false,
+        .check_kernels = false,
+        .kernel = -1,
+        .interaction = FLOCK_GATHER,
+        .skin = DEFAULT_NEIGHBOR_LIST_SKIN,
+        .density_blur = DEFAULT_DENSITY_BLUR,
+        .reorder = DEFAULT_REORDER_INTERVAL,
+        .far_radius = PREDATOR_VISUAL_RADIUS,
+        .record = NULL,
+        .timings = NULL,
+        .workers = 0,
+        .transport = TRANSPORT_SHM,
+        .species = 1,
+        .species_file = NULL,
+    };
+    if (!parse_options(argc, argv, &opt)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (opt.threads > 0) omp_set_num_threads(opt.threads);
+    int threads = omp_get_max_threads();
+
+    if (opt.kernel >= 0 && !flock_kernel_select((FlockKernelIsa)opt.kernel)) {
+        fprintf(stderr, "Kernel %s is not supported on this CPU\n", flock_kernel_name((FlockKernelIsa)opt.kernel));
+        return 1;
+    }
+
+    flockInteraction = opt.interaction;
+    neighborListSkin = opt.skin;
+    densityBlur = opt.density_blur;
+    knnK = opt.knn;
+    reorderInterval = opt.reorder;
+    cellSize = opt.cell_size;
+    SetWorldDimensions(opt.width, opt.height);
+    if (!SetCellSize(cellSize)) {
+        fprintf(stderr, "Cell size %d does not fit a %d x %d world\n", cellSize, SCREEN_WIDTH, SCREEN_HEIGHT);
+        return 1;
+    }
+    if (opt.species_file ? !LoadSpecies(opt.species_file) : !SetSpeciesCount(opt.species)) return 1;
+    if (speciesCount > 1 && opt.interaction != FLOCK_GATHER) {
+        fprintf(stderr, "More than one species only runs with --interaction gather\n");
+        return 1;
+    }
+    random_seed(opt.seed);
+    predatorCount = opt.predators;
+    InitBoids(opt.boids);
+    if (opt.autotune) Autotune(AUTOTUNE_CACHE, opt.autotune == 2);
+
+    const float frameTime = 1.0f / 60.0f;
+    for (int i = 0; i < opt.warmup; i++) {
+        frameCounter++;
+        UpdateBoids(frameTime, 1.0f, 1.0f, 1.0f);
+    }
+
+    if (opt.check_kernels) return check_kernels() ? 0 : 1;
+    if (opt.workers > 0 && !StartDomain(opt.workers, opt.transport)) return 1;
+
+    double *samples = malloc((size_t)opt.steps * sizeof(double));
+    if (!samples) {
+        fprintf(stderr, "Failed to allocate sample buffer!\n");
+        return 1;
+    }
+
+    neighborListStats = (NeighborListStats){0};
+    if (opt.record) StartRecording(opt.record);
+    TimerClear();
+    double start = now_ns();
+    for (int i = 0; i < opt.steps; i++) {
+        frameCounter++;
+        double t0 = now_ns();
+        if (domainWorkers > 0) DomainStep(frameTime, 1.0f, 1.0f, 1.0f, i == opt.steps - 1);
+        else UpdateBoids(frameTime, 1.0f, 1.0f, 1.0f);
+        samples[i] = now_ns() - t0;
+    }
+    double total_ns = now_ns() - start;
+
+    if (domainWorkers > 0) {
+        fprintf(stderr, "Workers over %s (boids, halo boids, predators):", transport_name(opt.transport));
+        for (int k = 0; k < domainWorkers; k++) {
+            fprintf(stderr, " %zu/%zu/%zu", domainStats[k].boids, domainStats[k].halo, domainStats[k].predators);
+        }
+        fprintf(stderr, "\n");
+        StopDomain();
+    }
+
+    if (opt.timings) {
+        size_t length = strlen(opt.timings);
+        bool json = length >= 5 && strcmp(opt.timings + length - 5, ".json") == 0;
+        if (!(json ? WriteTimerTrace(opt.timings) : WriteTimerCsv(opt.timings))) {
+            fprintf(stderr, "Failed to write %s\n", opt.timings);
+            return 1;
+        }
+    }
+
+    if (knnK > 0) {
+        static TimerSummary summary;
+        UpdateTimerSummary(&summary);
+        fprintf(stderr, "k-NN graph, k = %d: p50 %.3f ms, p99 %.3f ms per build\n",
+                knnK, summary.p50[STAGE_KNN], summary.p99[STAGE_KNN]);
+    }
+
+    if (reorderStats.reorders > 0) {
+        const ReorderStats *order = &reorderStats;
+        bool after = order->ns_after > 0.0f; // the steps after the last reorder have run
+        fprintf(stderr, "Reordered %zu times, force pass per boid around the last: %.1f ns before",
+                order->reorders, order->ns_before);
+        if (after) fprintf(stderr, ", %.1f after", order->ns_after);
+        if (order->misses < 0.0f) fprintf(stderr, " (no cache counters)\n");
+        else if (after) fprintf(stderr, "; LLC misses %.3f before, %.3f after\n", order->misses_before, order->misses_after);
+        else fprintf(stderr, "; LLC misses %.3f before\n", order->misses_before);
+    }
+
+    if (opt.queries > 0 && !time_queries((size_t)opt.queries, opt.far_radius)) return 1;
+
+    if (opt.record) {
+        StopRecording();
+        RecorderStats recorded = GetRecorderStats();
+        fprintf(stderr, "Recorded %zu frames (%zu keyframes, %zu dropped), %.1f bytes per boid-frame\n",
+                recorded.frames, recorded.keyframes, recorded.dropped,
+                recorded.frames ? (double)recorded.bytes / ((double)recorded.frames * (boidCount + predatorCount)) : 0.0);
+    }
+
+    qsort(samples, opt.steps, sizeof(double), compare_double);
+    double steps_per_sec = opt.steps / (total_ns * 1e-9);
+    double ns_per_boid = total_ns / ((double)opt.steps * boidCount);
+    double p50_us = percentile(samples, opt.steps, 50.0) * 1e-3;
+    double p99_us = percentile(samples, opt.steps, 99.0) * 1e-3;
+
+    uint64_t checksum = opt.checksum ? state_checksum() : 0;
+
+    // Neighbour list counters, reported in list mode only
+    bool lists = flockInteraction == FLOCK_NEIGHBOR_LIST;
+    const NeighborListStats *stats = &neighborListStats;
+    double hit_rate = stats->entries ? (double)stats->hits / stats->entries : 0.0;
+    char schedule[32];
+    schedule_name(forceSchedule, forceChunk, schedule, sizeof(schedule));
+
+    if (opt.json) {
+        printf("{\"boids\": %zu, \"predators\": %zu, \"width\": %d, \"height\": %d, \"cell_size\": %d, \"schedule\": \"%s\", \"threads\": %d, \"workers\": %d, \"species\": %d, \"kernel\": \"%s\", \"interaction\": \"%s\", \"steps\": %d, "
+               "\"steps_per_sec\": %.3f, \"ns_per_boid_update\": %.3f, "
+               "\"p50_step_us\": %.3f, \"p99_step_us\": %.3f",
+               boidCount, predatorCount, SCREEN_WIDTH, SCREEN_HEIGHT, cellSize, schedule, threads, opt.workers, speciesCount,
+               flock_kernel_name(flock_kernel_current()), flock_interaction_name(flockInteraction), opt.steps,
+               steps_per_sec, ns_per_boid, p50_us, p99_us);
+        if (lists) printf(", \"skin\": %.1f, \"list_rebuilds\": %zu, \"list_hit_rate\": %.4f",
+                          neighborListSkin, stats->rebuilds, hit_rate);
+        if (opt.checksum) printf(", \"checksum\": \"%016" PRIx64 "\"", checksum);
+        printf("}\n");
+    } else {
+        printf("boids,predators,width,height,cell_size,schedule,threads,workers,species,kernel,interaction,steps,steps_per_sec,ns_per_boid_update,p50_step_us,p99_step_us%s%s\n",
+               lists ? ",skin,list_rebuilds,list_hit_rate" : "", opt.checksum ? ",checksum" : "");
+        printf("%zu,%zu,%d,%d,%d,\"%s\",%d,%d,%d,%s,%s,%d,%.3f,%.3f,%.3f,%.3f",
+               boidCount, predatorCount, SCREEN_WIDTH, SCREEN_HEIGHT, cellSize, schedule, threads, opt.workers, speciesCount,
+               flock_kernel_name(flock_kernel_current()), flock_interaction_name(flockInteraction), opt.steps,
+               steps_per_sec, ns_per_boid, p50_us, p99_us);
+        if (lists) printf(",%.1f,%zu,%.4f", neighborListSkin, stats->rebuilds, hit_rate);
+        if (opt.checksum) printf(",%016" PRIx64, checksum);
+        printf("\n");
+    }
+
+    free(samples);
+    return 0;
+}
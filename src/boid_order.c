@@ -0,0 +1,233 @@
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "boid_order.h"
+#include "boids.h"
+#include "spatial_hash.h"
+#include "neighbor_list.h"
+#include "recorder.h"
+#include "species.h"
+
+BoidOrder boidOrder = { .frame = SENTINEL };
+ReorderStats reorderStats = { .misses = -1.0f, .misses_before = -1.0f, .misses_after = -1.0f };
+int reorderInterval = DEFAULT_REORDER_INTERVAL;
+
+// Grid cells in curve order, for the grid size they were made for
+static uint32_t *cellOrder = NULL;
+static int orderWidth = 0, orderHeight = 0;
+static BoidInfo *infoScratch = NULL;
+static size_t infoCapacity = 0;
+
+// The last REORDER_SAMPLE_FRAMES force passes, and the passes since the reorder
+static float sampleNs[REORDER_SAMPLE_FRAMES], sampleMisses[REORDER_SAMPLE_FRAMES];
+static size_t samples = 0;
+static size_t after = 0;
+static double afterNs = 0.0, afterMisses = 0.0;
+
+static atomic_bool counters = true;
+static __thread int missFd = -2; // -2 until opened, -1 if that failed
+
+static void *order_realloc(void *ptr, size_t size) {
+    void *p = realloc(ptr, size);
+    if (!p) {
+        fprintf(stderr, "Failed to allocate boid order!\n");
+        exit(1);
+    }
+    return p;
+}
+
+// Distance along the Hilbert curve filling an n x n square, n a power of two
+static uint64_t hilbert_index(uint32_t n, uint32_t x, uint32_t y) {
+    uint64_t d = 0;
+    for (uint32_t s = n / 2; s > 0; s /= 2) {
+        uint32_t rx = (x & s) > 0;
+        uint32_t ry = (y & s) > 0;
+        d += (uint64_t)s * s * ((3 * rx) ^ ry);
+        if (ry == 0) {
+            if (rx == 1) {
+                x = n - 1 - x;
+                y = n - 1 - y;
+            }
+            uint32_t t = x;
+            x = y;
+            y = t;
+        }
+    }
+    return d;
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a;
+    uint64_t y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Sorts the cells by their distance along the curve over the smallest
+// power-of-two square holding the grid
+static void make_cell_order(void) {
+    const size_t cells = (size_t)grid.width * grid.height;
+    uint32_t n = 1;
+    while (n < (uint32_t)grid.width || n < (uint32_t)grid.height) n <<= 1;
+
+    uint64_t *keys = order_realloc(NULL, cells * sizeof(uint64_t));
+    for (size_t c = 0; c < cells; c++) {
+        uint32_t x = (uint32_t)(c % grid.width), y = (uint32_t)(c / grid.width);
+        keys[c] = hilbert_index(n, x, y) << 32 | c;
+    }
+    qsort(keys, cells, sizeof(uint64_t), compare_u64);
+
+    cellOrder = order_realloc(cellOrder, cells * sizeof(uint32_t));
+    for (size_t c = 0; c < cells; c++) cellOrder[c] = (uint32_t)keys[c];
+    free(keys);
+    orderWidth = grid.width;
+    orderHeight = grid.height;
+}
+
+// First of boids[begin .. end), ascending, that is at least slot
+static uint32_t lower_bound(const uint32_t *boids, uint32_t begin, uint32_t end, size_t slot) {
+    while (begin < end) {
+        uint32_t mid = begin + (end - begin) / 2;
+        if (boids[mid] < slot) begin = mid + 1;
+        else end = mid;
+    }
+    return begin;
+}
+
+bool ReorderDue(void) {
+    return reorderInterval > 0 && frameCounter % (size_t)reorderInterval == 0 && !IsRecording();
+}
+
+// Gathers one float array into the scratch array and swaps the two
+static void permute_floats(float **array, float **scratch) {
+    float *src = *array, *dst = *scratch;
+    const uint32_t *from = boidOrder.from;
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < boidCount; i++) dst[i] = src[from[i]];
+    *array = dst;
+    *scratch = src;
+}
+
+void ReorderBoids(void) {
+    if (grid.count != boidCount) return;
+    if (grid.width != orderWidth || grid.height != orderHeight) make_cell_order();
+
+    if (boidCount > boidOrder.capacity) {
+        boidOrder.from = order_realloc(boidOrder.from, boidCount * sizeof(uint32_t));
+        boidOrder.capacity = boidCount;
+    }
+    if (boidCount > infoCapacity) {
+        infoScratch = order_realloc(infoScratch, boidCount * sizeof(BoidInfo));
+        infoCapacity = boidCount;
+    }
+
+    // Each species keeps its own slots (species.h): the boids of a cell are
+    // in slot order, so each species is one run of it. The curve is cut
+    // into blocks of about equal boids, where each species' block starts.
+    size_t k = 0;
+    const size_t cells = (size_t)grid.width * grid.height;
+    size_t blockEnd[SPECIES_BLOCKS];
+    if (speciesCount > 1) {
+        size_t seen = 0, c = 0;
+        for (int b = 0; b < SPECIES_BLOCKS; b++) {
+            while (c < cells && seen < boidCount * (b + 1) / SPECIES_BLOCKS) {
+                seen += grid.cell_start[cellOrder[c] + 1] - grid.cell_start[cellOrder[c]];
+                c++;
+            }
+            blockEnd[b] = c;
+        }
+        blockEnd[SPECIES_BLOCKS - 1] = cells;
+    }
+    for (int s = 0; s < speciesCount; s++) {
+        int block = 0;
+        if (speciesCount > 1) speciesBlockStart[s][0] = k;
+        for (size_t c = 0; c < cells; c++) {
+            while (speciesCount > 1 && c == blockEnd[block]) speciesBlockStart[s][++block] = k;
+            uint32_t cell = cellOrder[c];
+            uint32_t begin = grid.cell_start[cell], end = grid.cell_start[cell + 1];
+            if (speciesCount > 1) {
+                begin = lower_bound(grid.cell_boids, begin, end, speciesStart[s]);
+                end = lower_bound(grid.cell_boids, begin, end, species_end(s));
+            }
+            for (uint32_t j = begin; j < end; j++) {
+                boidOrder.from[k++] = grid.cell_boids[j];
+            }
+        }
+        while (speciesCount > 1 && block < SPECIES_BLOCKS) speciesBlockStart[s][++block] = k;
+    }
+    boidOrder.count = boidCount;
+    boidOrder.frame = frameCounter;
+
+    // ux and uy are scratch between ticks, so each array is gathered into
+    // one of them and the two swapped
+    permute_floats(&boids.x, &boids.ux);
+    permute_floats(&boids.y, &boids.ux);
+    permute_floats(&boids.vx, &boids.ux);
+    permute_floats(&boids.vy, &boids.ux);
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < boidCount; i++) infoScratch[i] = boids.info[boidOrder.from[i]];
+    memcpy(boids.info, infoScratch, boidCount * sizeof(BoidInfo));
+    InvalidateNeighborLists();
+
+    float ns = 0.0f, misses = 0.0f;
+    size_t kept = samples < REORDER_SAMPLE_FRAMES ? samples : REORDER_SAMPLE_FRAMES;
+    for (size_t s = 0; s < kept; s++) {
+        ns += sampleNs[s];
+        misses += sampleMisses[s];
+    }
+    reorderStats.reorders++;
+    reorderStats.ns_before = kept ? ns / kept : 0.0f;
+    reorderStats.misses_before = !counters ? -1.0f : kept ? misses / kept : 0.0f;
+    reorderStats.ns_after = 0.0f;
+    reorderStats.misses_after = counters ? 0.0f : -1.0f;
+    samples = 0;
+    after = 0;
+    afterNs = afterMisses = 0.0;
+}
+
+uint64_t ThreadCacheMisses(void) {
+    if (missFd == -2) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        missFd = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (missFd < 0) {
+            missFd = -1;
+            atomic_store(&counters, false);
+        }
+    }
+    uint64_t count = 0;
+    if (missFd < 0 || read(missFd, &count, sizeof(count)) != sizeof(count)) return 0;
+    return count;
+}
+
+void NoteForcePass(uint64_t ns, uint64_t misses, size_t boids) {
+    if (boids == 0) return;
+    const bool counted = atomic_load(&counters);
+    float perNs = (float)ns / boids;
+    float perMiss = counted ? (float)misses / boids : -1.0f;
+    reorderStats.ns = perNs;
+    reorderStats.misses = perMiss;
+
+    sampleNs[samples % REORDER_SAMPLE_FRAMES] = perNs;
+    sampleMisses[samples % REORDER_SAMPLE_FRAMES] = perMiss;
+    samples++;
+
+    if (boidOrder.frame != SENTINEL && after < REORDER_SAMPLE_FRAMES) {
+        afterNs += perNs;
+        afterMisses += perMiss;
+        if (++after == REORDER_SAMPLE_FRAMES) {
+            reorderStats.ns_after = (float)(afterNs / after);
+            reorderStats.misses_after = counted ? (float)(afterMisses / after) : -1.0f;
+        }
+    }
+}
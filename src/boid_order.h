@@ -0,0 +1,64 @@
+#ifndef BOID_ORDER_H
+#define BOID_ORDER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Space-filling-curve order of the boid slots.
+//
+// As the flock moves, boids that are neighbours in space drift apart in the
+// arrays, so the neighbour gathers and the static chunks of the force pass
+// touch memory all over. Every reorderInterval frames ReorderBoids() permutes
+// the slots to follow a Hilbert curve over the grid cells, the boids of one
+// cell staying in grid order and each species in its own slots (species.h).
+// It runs after the commit, from the grid of the
+// tick before (a boid has moved at most MAX_SPEED since), and the grid is
+// rebuilt from the new slots straight after.
+//
+// Whatever holds a slot across a reorder is remapped through boidOrder.from:
+// the neighbour lists are invalidated, the kNN graph and the pick are rebuilt
+// after the grid anyway, the simulation thread permutes its snapshot's
+// previous positions, and BoidInfo.id moves with its boid. Recordings store
+// boids by slot, so nothing is reordered while recording.
+
+#define DEFAULT_REORDER_INTERVAL 120   // frames, 0 for never
+#define REORDER_SAMPLE_FRAMES 8        // force passes averaged either side of a reorder
+
+typedef struct BoidOrder {
+    uint32_t *from;     // after a reorder, slot i holds the boid that was in slot from[i]
+    size_t count;
+    size_t frame;       // frameCounter of the last reorder, SENTINEL before the first
+    size_t capacity;
+} BoidOrder;
+
+// The force pass around the last reorder, per boid. Cache misses are the
+// last-level read misses of the threads in the pass, -1 where the kernel
+// has no hardware counters for us.
+typedef struct ReorderStats {
+    size_t reorders;
+    float ns;                   // the latest force pass
+    float misses;
+    float ns_before;            // over the REORDER_SAMPLE_FRAMES before the last reorder
+    float misses_before;
+    float ns_after;             // and after it, 0 until they have run
+    float misses_after;
+} ReorderStats;
+
+extern BoidOrder boidOrder;
+extern ReorderStats reorderStats;
+extern int reorderInterval;
+
+// Whether this tick reorders
+bool ReorderDue(void);
+// Permutes every boid array along the curve and invalidates the neighbour
+// lists; build_spatial_grid() next
+void ReorderBoids(void);
+
+// Last-level cache read misses of the calling thread so far, 0 without
+// counters (see reorderStats)
+uint64_t ThreadCacheMisses(void);
+// Folds one force pass into reorderStats
+void NoteForcePass(uint64_t ns, uint64_t misses, size_t boids);
+
+#endif // BOID_ORDER_H
@@ -1,20 +1,133 @@
 #include <stdio.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 #include <stdbool.h>
 #include <omp.h>
 
 #include "boids.h"
-#include "torus.h"
 #include "spatial_hash.h"
 #include "normal_random.h"
+#include "flock_kernel.h"
+#include "flock_pairs.h"
+#include "neighbor_list.h"
+#include "predators.h"
+#include "knn_graph.h"
+#include "boid_order.h"
+#include "recorder.h"
+#include "frame_timer.h"
+#include "species.h"
+
+
+int SCREEN_WIDTH;
+int SCREEN_HEIGHT;
+float HALF_SCREEN_WIDTH;
+float HALF_SCREEN_HEIGHT;
+size_t frameCounter = 0;
+
+Boids boids = {0};
+size_t boidCount = 0;
+size_t boidCapacity = 0;
+size_t boidHaloCount = 0;
+
+static uint32_t nextBoidId = 0; // slots move (boid_order.h), so ids are handed out in turn
+
+FlockInteraction flockInteraction = FLOCK_GATHER;
+int forceSchedule = omp_sched_static;
+int forceChunk = 0;
+
+const char *flock_interaction_name(FlockInteraction mode) {
+    static const char *names[FLOCK_INTERACTION_COUNT] = { "gather", "symmetric", "lists" };
+    return mode < FLOCK_INTERACTION_COUNT ? names[mode] : "unknown";
+}
 
+// Moves one array into a fresh 64-byte aligned block, keeping the first
+// `used` elements
+static void *resize_boid_array(void *old, size_t used, size_t capacity, size_t size) {
+    void *p = NULL;
+    if (posix_memalign(&p, 64, capacity * size) != 0) {
+        fprintf(stderr, "Failed to allocate boid arrays!\n");
+        exit(1);
+    }
+    if (old) {
+        memcpy(p, old, used * size);
+        free(old);
+    }
+    return p;
+}
 
+// Makes room for `slots` boids, keeping the slots in use. Grows geometrically and hands memory back once mostly unused.
+static void ReserveBoids(size_t slots) {
+    size_t capacity = boidCapacity;
+    if (slots > capacity) {
+        capacity = capacity * 2 > slots ? capacity * 2 : slots;
+    } else if (slots < capacity / 4) {
+        capacity = slots * 2;
+    } else {
+        return;
+    }
 
-Boid boids[MAX_BOIDS + 1]; // +1 for predator
+    size_t used = boidCapacity ? boidCount : 0;
+    if (used > slots) used = slots;
+    boids.x = resize_boid_array(boids.x, used, capacity, sizeof(float));
+    boids.y = resize_boid_array(boids.y, used, capacity, sizeof(float));
+    boids.vx = resize_boid_array(boids.vx, used, capacity, sizeof(float));
+    boids.vy = resize_boid_array(boids.vy, used, capacity, sizeof(float));
+    boids.ux = resize_boid_array(boids.ux, used, capacity, sizeof(float));
+    boids.uy = resize_boid_array(boids.uy, used, capacity, sizeof(float));
+    boids.info = resize_boid_array(boids.info, used, capacity, sizeof(BoidInfo));
+    boidCapacity = capacity;
+}
+
+// Places slots [first, end) at random, keyed on the current frame and the slot
+static void RandomizeBoids(size_t first, size_t end) {
+    if (end <= first) return;
+    const size_t count = end - first;
+    random_uniform_fill(boids.x + first, count, RANDOM_POSITION_X, frameCounter, first, 0.0f, SCREEN_WIDTH);
+    random_uniform_fill(boids.y + first, count, RANDOM_POSITION_Y, frameCounter, first, 0.0f, SCREEN_HEIGHT);
+    // Heading and speed go through ux and uy
+    random_uniform_fill(boids.ux + first, count, RANDOM_HEADING, frameCounter, first, 0.0f, 2.0f * PI);
+    random_normal_fill(boids.uy + first, count, RANDOM_SPEED, frameCounter, first, 4.0f, 3.0f);
+
+    #pragma omp parallel for schedule(static)
+    for (size_t i = first; i < end; i++) {
+        float angle = boids.ux[i];
+        float speed = boids.uy[i];
+        boids.vx[i] = cosf(angle) * speed;
+        boids.vy[i] = sinf(angle) * speed;
+        boids.ux[i] = boids.vx[i];
+        boids.uy[i] = boids.vy[i];
+        boids.info[i] = (BoidInfo){ .id = nextBoidId + (uint32_t)(i - first), .neighborCount = -1, .nearNeighborCount = -1 };
+    }
+    nextBoidId += (uint32_t)count;
+}
+
+void SetWorldDimensions(int width, int height)
+{
+    SCREEN_WIDTH = (width/cellSize)*cellSize;
+    SCREEN_HEIGHT = (height/cellSize)*cellSize;
+    HALF_SCREEN_WIDTH = SCREEN_WIDTH / 2.0f;
+    HALF_SCREEN_HEIGHT = SCREEN_HEIGHT / 2.0f;
+}
+
+bool SetCellSize(int size)
+{
+    if (size <= 0 || SCREEN_WIDTH % size != 0 || SCREEN_HEIGHT % size != 0) return false;
+    if (SCREEN_WIDTH / size < 3 || SCREEN_HEIGHT / size < 3) return false;
+    if (ceil_div((int)PREDATOR_VISUAL_RADIUS, size) > GRID_MAX_REACH) return false;
+    if (size == cellSize) return true;
+
+    cellSize = size;
+    init_spatial_grid(boidCount);
+    build_spatial_grid();
+    InvalidateNeighborLists();
+    init_predator_grid();
+    if (knnK > 0) BuildKnnGraph();
+    return true;
+}
 
-Vector2 Vector2SubtractTorus(Vector2 a, Vector2 b) {
-    Vector2 diff = { a.x - b.x, a.y - b.y };
+Vec2 Vector2SubtractTorus(Vec2 a, Vec2 b) {
+    Vec2 diff = { a.x - b.x, a.y - b.y };
 
     if (diff.x >  HALF_SCREEN_WIDTH) diff.x -= SCREEN_WIDTH;
     if (diff.x < -HALF_SCREEN_WIDTH) diff.x += SCREEN_WIDTH;
@@ -25,7 +138,7 @@ Vector2 Vector2SubtractTorus(Vector2 a, Vector2 b) {
     return diff;
 }
 
-float DistanceOnTorus(Vector2 a, Vector2 b)
+float DistanceOnTorus(Vec2 a, Vec2 b)
 {
     float dx = fabsf(a.x - b.x);
     float dy = fabsf(a.y - b.y);
@@ -36,7 +149,7 @@ float DistanceOnTorus(Vector2 a, Vector2 b)
     return sqrtf(dx * dx + dy * dy);
 }
 
-float DistanceOnTorusSquared(Vector2 a, Vector2 b)
+float DistanceOnTorusSquared(Vec2 a, Vec2 b)
 {
     float dx = fabsf(a.x - b.x);
     float dy = fabsf(a.y - b.y);
@@ -47,30 +160,47 @@ float DistanceOnTorusSquared(Vector2 a, Vector2 b)
     return dx * dx + dy * dy;
 }
 
-void InitBoids() {
-    // Initialize spatial hash
-    init_spatial_hash();
+void InitBoids(size_t count) {
+    flock_kernel_init();
+
+    boidCount = 0;
+    nextBoidId = 0;
+    ReserveBoids(count);
+    boidCount = count;
 
     // Initialize boids
-    for (int i = 0; i < MAX_BOIDS; i++) {
-        boids[i].index = i;
-        boids[i].position = (Vector2){ GetRandomValue(0, SCREEN_WIDTH), GetRandomValue(0, SCREEN_HEIGHT) };
-        float angle = GetRandomValue(0, 360) * DEG2RAD;
-        float speed = random_normal(4.0f, 3.0f);
-        boids[i].velocity = Vector2Scale((Vector2){ cosf(angle), sinf(angle) }, speed);
-        boids[i].isPredator = false;
-        boids[i].neighborCount = -1;
-        boids[i].nearNeighborCount = -1;
-        insert_boid(&boids[i]);
-    }
-    // Predator
-    boids[PREDATOR_INDEX].position = (Vector2){ HALF_SCREEN_WIDTH, HALF_SCREEN_HEIGHT };
-    printf("Predator position: (%.2f, %.2f)\n", boids[PREDATOR_INDEX].position.x, boids[PREDATOR_INDEX].position.y);
-    boids[PREDATOR_INDEX].velocity = (Vector2){ PREDATOR_SPEED, PREDATOR_SPEED };
-    boids[PREDATOR_INDEX].isPredator = true;
+    RandomizeBoids(0, boidCount);
+    GroupSpecies(0, boidCount);
+
+    init_spatial_grid(boidCount);
+    build_spatial_grid();
+    InvalidateNeighborLists();
+
+    InitPredators(predatorCount);
+}
+
+void ResizeBoids(size_t count) {
+    if (count < boidCount) boidCount = count;
+    ReserveBoids(count);
+    boidCount = count;
+}
+
+void SetBoidCount(size_t count) {
+    size_t old = boidCount;
+    if (count == old) return;
+
+    if (count > old) ReserveBoids(count);
+    RandomizeBoids(old, count);
+    GroupSpecies(old, count);
+    if (count < old) ReserveBoids(count);
+    boidCount = count;
+
+    init_spatial_grid(boidCount);
+    build_spatial_grid();
+    InvalidateNeighborLists();
 }
 
-Vector2 Vector2Wrap(Vector2 v, float width, float height)
+Vec2 Vector2Wrap(Vec2 v, float width, float height)
 {
     if (v.x < 0) v.x += width;
     else if (v.x >= width) v.x -= width;
@@ -81,149 +211,159 @@ Vector2 Vector2Wrap(Vector2 v, float width, float height)
     return v;
 }
 
-void UpdateBoids(float alignmentWeight, float cohesionWeight, float separationWeight)
+// The forces on boid i, of species s, into its update
+static inline void steer_boid(size_t i, int s, FlockInteraction interaction,
+                              float alignmentWeight, float cohesionWeight, float separationWeight)
 {
-    // Parallel update stage
-    #pragma omp parallel for schedule(static)
-    for (size_t boid_index = 0; boid_index < MAX_BOIDS; boid_index++) { 
-        Boid* self = &boids[boid_index];
-
-        // Initialize updates
-        self->velocity_update = self->velocity;
-        self->predated = false;
-
-        // Compute flocking forces
-        // ComputeFlockForces() is a function that computes the alignment, cohesion, and separation forces
-        FlockForces forces = ComputeFlockForces(self);
-        self->neighborCount = forces.neighborCount;
-        self->nearNeighborCount = forces.nearNeighborCount;
-
-        // Apply flocking behaviour
-        if (forces.neighborCount > 0) {
-            Vector2 align_force = Vector2Subtract(forces.alignment, self->velocity);
-            self->velocity_update = Vector2Add(self->velocity_update, Vector2Scale(align_force, MATCH_FACTOR * alignmentWeight));
-
-            Vector2 cohesion_force = Vector2Subtract(forces.cohesion, self->position);
-            self->velocity_update = Vector2Add(self->velocity_update, Vector2Scale(cohesion_force, CENTER_FACTOR * cohesionWeight));
-        }
-        self->velocity_update = Vector2Add(self->velocity_update, Vector2Scale(forces.separation, AVOID_FACTOR * separationWeight));
+    const SpeciesParams *params = &species[s];
+    const float match = params->match * alignmentWeight;
+    const float center = params->center * cohesionWeight;
+    const float avoid = params->avoid * separationWeight;
+
+    // Initialize updates
+    boids.ux[i] = boids.vx[i];
+    boids.uy[i] = boids.vy[i];
+
+    // Compute flocking forces
+    // ComputeFlockForces() is a function that computes the alignment, cohesion, and separation forces
+    FlockForces forces;
+    if (speciesCount > 1) {
+        forces = ComputeSpeciesFlockForces(i, s);
+        boids.ux[i] -= forces.flee.x * params->flee;
+        boids.uy[i] -= forces.flee.y * params->flee;
+    } else if (interaction == FLOCK_SYMMETRIC) {
+        FlockSums sums = SymmetricFlockSums(i);
+        forces = FlockForcesFromSums(i, &sums);
+    } else if (interaction == FLOCK_NEIGHBOR_LIST) {
+        FlockSums sums = NeighborListFlockSums(i);
+        forces = FlockForcesFromSums(i, &sums);
+    } else {
+        forces = ComputeFlockForces(i);
     }
+    boids.info[i].neighborCount = forces.neighborCount;
+    boids.info[i].nearNeighborCount = forces.nearNeighborCount;
 
-    // Adjust predator to move towards densest nearby area of boids.
-    // Also adjust boids to avoid predator.
-    boids[PREDATOR_INDEX].velocity = Vector2ClampValue(
-                                        Vector2Add(boids[PREDATOR_INDEX].velocity, PreditorAjustment()),
-                                        MIN_SPEED, PREDATOR_SPEED);
-    boids[PREDATOR_INDEX].position = Vector2Wrap(
-                                        Vector2Add(
-                                            boids[PREDATOR_INDEX].position,
-                                            Vector2Scale(
-                                                boids[PREDATOR_INDEX].velocity,
-                                                GetFrameTime() * 60.0f)),
-                                        SCREEN_WIDTH, SCREEN_HEIGHT);
+    // Apply flocking behaviour
+    if (forces.neighborCount > 0) {
+        boids.ux[i] += (forces.alignment.x - boids.vx[i]) * match;
+        boids.uy[i] += (forces.alignment.y - boids.vy[i]) * match;
 
-    // Commit updates and rebuild spatial hash (serial)
-    clear_spatial_hash();
-    for (size_t i = 0; i < MAX_BOIDS; i++) {
-        boids[i].velocity = Vector2ClampValue(boids[i].velocity_update, MIN_SPEED, MAX_SPEED);
-        float frameTime = GetFrameTime();
-        if (frameTime == 0.0f) {
-            frameTime = 1.0f / 60.0f; // fix wierd behaviour at startup
-        }
-        boids[i].position = Vector2Wrap(
-                                Vector2Add(
-                                    boids[i].position,
-                                    Vector2Scale(
-                                        boids[i].velocity,
-                                        frameTime * 60.0f)),
-                                SCREEN_WIDTH, SCREEN_HEIGHT);
-        insert_boid(&boids[i]);
+        boids.ux[i] += (forces.cohesion.x - boids.x[i]) * center;
+        boids.uy[i] += (forces.cohesion.y - boids.y[i]) * center;
     }
-    insert_boid(&boids[MAX_BOIDS]);
-
+    boids.ux[i] += forces.separation.x * avoid;
+    boids.uy[i] += forces.separation.y * avoid;
+
+    // Flee the predators nearby
+    bool predated;
+    Vec2 flee = PredatorAvoidance(boids.x[i], boids.y[i], grid.boid_cell[i], &predated);
+    boids.ux[i] += flee.x * params->predator;
+    boids.uy[i] += flee.y * params->predator;
+    boids.info[i].predated = predated;
 }
 
-int number_drawn = 0;
-Vector3 Vector2ToVector3(Vector2 v) {
-    return (Vector3){ v.x, 0.0f, v.y};
-}
-
-Vector3 Shift(Vector3 position)
+void UpdateBoids(float frameTime, float alignmentWeight, float cohesionWeight, float separationWeight)
 {
-    return (Vector3){position.x - HALF_SCREEN_WIDTH, position.y + 100.0f, position.z - HALF_SCREEN_HEIGHT};  
-}
-
-
-void DrawBoid3D(Boid *boid) {
-    number_drawn++;
-    Vector3 position = Shift(Vector2ToVector3(boid->position));
-    Vector3 velocity = Vector2ToVector3(boid->velocity);
-    Vector3 dir = Vector3Normalize(velocity);
-
-    Vector3 forward = {1, 0, 0};
-
-    // Cross product gives the rotation axis
-    Vector3 axis = Vector3CrossProduct(forward, dir);
-    float angle = acosf(Vector3DotProduct(forward, dir));
-
-    if (Vector3Length(axis) < 0.001f) axis = (Vector3){ 0, 1, 0 }; // fallback
-
-    DrawModelEx(dart, position, axis, RAD2DEG * angle, (Vector3){ 3.0f, 3.0f, 3.0f }, WHITE);
-}
-
-void DrawBoid3DTorus(Boid *boid) {
-    number_drawn++;
-    float scale = 3.0f;
-    dart.transform = get_torus_transform(boid, scale);
-    DrawModel(dart, (Vector3){0, 0, 0}, 1.0f, WHITE);
-}
-
-void DrawPreditor3D() {
-    number_drawn++;
-
-    Boid *predator = &boids[MAX_BOIDS];
-
-    Vector3 position = Shift(Vector2ToVector3(predator->position));
-    Vector3 velocity = Vector2ToVector3(predator->velocity);
-    Vector3 dir = Vector3Normalize(velocity);
-
-    Vector3 forward = {1, 0, 0};
-
-    // Cross product gives the rotation axis
-    Vector3 axis = Vector3CrossProduct(forward, dir);
-    float angle = acosf(Vector3DotProduct(forward, dir));
-
-    if (Vector3Length(axis) < 0.001f) axis = (Vector3){ 0, 1, 0 }; // fallback
-
-    DrawModelEx(dart, position, axis, RAD2DEG * angle, (Vector3){ 10.0f, 10.0f, 10.0f }, RED);
-}
-
-void DrawPreditor3DTorus() {
-    number_drawn++;
+    if (frameTime == 0.0f) {
+        frameTime = 1.0f / 60.0f; // fix wierd behaviour at startup
+    }
+    const float step = frameTime * 60.0f;
+
+    // The symmetric and list modes compute every boid's sums up front; each
+    // falls back to the gather when it cannot handle the current world, and
+    // more than one species always gathers
+    uint64_t stageStart = TimerNow();
+    const bool mixed = speciesCount > 1;
+    if (mixed) BuildSpeciesRows();
+    FlockInteraction interaction = mixed ? FLOCK_GATHER : flockInteraction;
+    if (interaction == FLOCK_SYMMETRIC && !ComputeSymmetricFlockSums()) interaction = FLOCK_GATHER;
+    if (interaction == FLOCK_NEIGHBOR_LIST && !ComputeNeighborListFlockSums()) interaction = FLOCK_GATHER;
+    uint64_t stageEnd = TimerNow();
+    if (interaction != FLOCK_GATHER) TimerRecord(STAGE_INTERACTIONS, 0, stageStart, stageEnd);
+
+    // Parallel update stage; each thread also times its own share
+    stageStart = stageEnd;
+    const size_t updated = boidCount - boidHaloCount;
+    uint64_t forceMisses = 0;
+    omp_set_schedule((omp_sched_t)forceSchedule, forceChunk);
+    #pragma omp parallel reduction(+:forceMisses)
+    {
+        uint64_t threadStart = TimerNow();
+        uint64_t missStart = ThreadCacheMisses();
+        if (mixed) {
+            // Block by block along the curve, every species in each (species.h);
+            // handed out one at a time, as a block holds many boids
+            #pragma omp for schedule(dynamic, 1) nowait
+            for (int b = 0; b < SPECIES_BLOCKS; b++) {
+                for (int s = 0; s < speciesCount; s++) {
+                    const size_t end = speciesBlockStart[s][b + 1] < updated ? speciesBlockStart[s][b + 1] : updated;
+                    for (size_t i = speciesBlockStart[s][b]; i < end; i++) {
+                        steer_boid(i, s, interaction, alignmentWeight, cohesionWeight, separationWeight);
+                    }
+                }
+            }
+        } else {
+            #pragma omp for schedule(runtime) nowait
+            for (size_t i = 0; i < updated; i++) {
+                steer_boid(i, 0, interaction, alignmentWeight, cohesionWeight, separationWeight);
+            }
+        }
+        forceMisses += ThreadCacheMisses() - missStart;
+        TimerRecord(STAGE_FORCES, TIMER_THREAD_LANE(omp_get_thread_num()), threadStart, TimerNow());
+    }
+    stageEnd = TimerNow();
+    TimerRecord(STAGE_FORCES, 0, stageStart, stageEnd);
+    NoteForcePass(stageEnd - stageStart, forceMisses, updated);
+
+    // Predators move towards the densest nearby area of boids, seeing the
+    // boids before they move
+    stageStart = stageEnd;
+    UpdatePredators(step);
+    stageEnd = TimerNow();
+    TimerRecord(STAGE_PREDATOR, 0, stageStart, stageEnd);
+
+    // Commit updates, within each species' speed limits, and rebuild spatial grid
+    stageStart = stageEnd;
+    #pragma omp parallel
+    for (int s = 0; s < speciesCount; s++) {
+        const float minSpeed = species[s].minSpeed, maxSpeed = species[s].maxSpeed;
+        const size_t end = species_end(s) < updated ? species_end(s) : updated;
+        #pragma omp for schedule(static) nowait
+        for (size_t i = speciesStart[s]; i < end; i++) {
+            Vec2 velocity = Vec2ClampValue((Vec2){ boids.ux[i], boids.uy[i] }, minSpeed, maxSpeed);
+            Vec2 position = Vector2Wrap(Vec2Add(BoidPosition(i), Vec2Scale(velocity, step)),
+                                        SCREEN_WIDTH, SCREEN_HEIGHT);
+            boids.vx[i] = velocity.x;
+            boids.vy[i] = velocity.y;
+            boids.x[i] = position.x;
+            boids.y[i] = position.y;
+        }
+    }
+    stageEnd = TimerNow();
+    TimerRecord(STAGE_COMMIT, 0, stageStart, stageEnd);
+
+    // Every so often put the slots back in spatial order, from the old grid
+    if (ReorderDue()) {
+        ReorderBoids();
+        stageStart = stageEnd;
+        stageEnd = TimerNow();
+        TimerRecord(STAGE_REORDER, 0, stageStart, stageEnd);
+    }
 
-    Boid *predator = &boids[MAX_BOIDS];
-    float scale = 10.0f;
-    dart.transform = get_torus_transform(predator, scale);
-    DrawModel(dart, (Vector3){0, 0, 0}, 1.0f, RED);
-}
+    build_spatial_grid();
+    stageStart = stageEnd;
+    stageEnd = TimerNow();
+    TimerRecord(STAGE_GRID, 0, stageStart, stageEnd);
 
-void DrawBoids3D() {
-    number_drawn = 0;
-    Matrix transform = {
-        1.0f, 0.0f, 0.0f, 0.0f,
-        0.0f, 1.0f, 0.0f, 0.0f,
-        0.0f, 0.0f, 1.0f, 0.0f,
-        0.0f, 0.0f, 0.0f, 1.0f
-    };
-    dart.transform = transform;
-    for (int i = 0; i < MAX_BOIDS; i++) DrawBoid3D(&boids[i]);
-    DrawPreditor3D();
-}
+    if (knnK > 0) {
+        BuildKnnGraph();
+        stageStart = stageEnd;
+        stageEnd = TimerNow();
+        TimerRecord(STAGE_KNN, 0, stageStart, stageEnd);
+    }
 
-void DrawBoids3DTorus() {
-    number_drawn = 0;
-    for (int i = 0; i < MAX_BOIDS; i++) DrawBoid3DTorus(&boids[i]);
-    DrawPreditor3DTorus();
-    //if (mousePressed) DrawMouse(boids[MOUSE_INDEX]);
+    if (IsRecording()) {
+        RecordFrame(frameTime);
+        TimerRecord(STAGE_RECORD, 0, stageEnd, TimerNow());
+    }
 }
-
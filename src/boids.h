@@ -1,15 +1,13 @@
 #ifndef BOIDS_H
 #define BOIDS_H
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 
-#include "raylib.h"
-#include "raymath.h"
+#include "vec2.h"
 
-#define MAX_BOIDS 10000
+#define DEFAULT_BOIDS 10000
 #define BOID_HEIGHT 10.0f
-#define PREDATOR_INDEX MAX_BOIDS 
-#define MOUSE_INDEX (MAX_BOIDS + 1)
-
 
 #define NEIGHBOR_RADIUS 50.0f
 #define PROTECTED_RADIUS 10.0f
@@ -39,41 +37,69 @@ extern int SCREEN_HEIGHT;
 extern float HALF_SCREEN_WIDTH;
 extern float HALF_SCREEN_HEIGHT;
 
-extern Model dart;
-
-extern bool drawFullGlyph;
-extern bool drawDensity;
-extern bool nearestNeighboursNetwork;
 
-
-// Boid structure
-typedef struct Boid {
-    size_t index; // Unique index for each boid
-    Vector2 position;
-    Vector2 velocity;
-    Vector2 velocity_update;
+// Boid state, stored as structure-of-arrays.
+// The neighbour loop only touches the hot position/velocity arrays; the
+// bookkeeping fields live apart in BoidInfo so they never share its cache lines.
+typedef struct BoidInfo {
+    uint32_t id; // Unique for each boid, and kept when it changes slot (boid_order.h)
     int neighborCount;
     int nearNeighborCount;
-    bool predated;
-    bool isPredator;
-} Boid;
-
-extern Boid *debugBoid;
-
-extern Boid boids[MAX_BOIDS+1];
-
-void init_spatial_hash(void);
-void clear_spatial_hash(void);
-void insert_boid(Boid* p);
-
-void InitBoids(void);
-void UpdateBoids(float alignmentWeight, float cohesionWeight, float separationWeight);
-void DrawBoids3D(void);
-void DrawBoids3DTorus(void);
-Vector3 Vector2ToVector3(Vector2 v);
-Vector3 Shift(Vector3 position);
+    bool predated; // within PREDATOR_RADIUS of a predator
+    uint8_t species; // species.h
+} BoidInfo;
+
+typedef struct Boids {
+    float *x;   // position
+    float *y;
+    float *vx;  // velocity
+    float *vy;
+    float *ux;  // velocity update, committed at the end of the frame
+    float *uy;
+    BoidInfo *info;
+} Boids;
+
+extern Boids boids; // boidCount slots in use; the predators live in predators.h
+extern size_t boidCount; // Active boids
+extern size_t boidCapacity; // Allocated slots
+// Trailing slots that are another process's boids (domain.h): the grid and
+// the neighbour sums see them, the force pass and the commit skip them
+extern size_t boidHaloCount;
+
+static inline Vec2 BoidPosition(size_t i) { return (Vec2){ boids.x[i], boids.y[i] }; }
+static inline Vec2 BoidVelocity(size_t i) { return (Vec2){ boids.vx[i], boids.vy[i] }; }
+
+// How UpdateBoids evaluates the neighbour interactions
+typedef enum FlockInteraction {
+    FLOCK_GATHER = 0,      // each boid scans the grid cells around it
+    FLOCK_SYMMETRIC,       // half stencil, each pair once (flock_pairs.h)
+    FLOCK_NEIGHBOR_LIST,   // cached Verlet lists (neighbor_list.h)
+    FLOCK_INTERACTION_COUNT
+} FlockInteraction;
+
+extern FlockInteraction flockInteraction;
+const char *flock_interaction_name(FlockInteraction mode);
+
+// Sets the torus world size, rounded down to whole grid cells
+void SetWorldDimensions(int width, int height);
+// Changes the grid cell size and rebuilds everything sized by it. False, with
+// nothing changed, unless the size divides the world into at least 3 x 3
+// cells and the predators can see across it within GRID_MAX_REACH cells.
+bool SetCellSize(int size);
+
+// Schedule of the force pass, as an omp_sched_t and chunk (0 for the
+// default); autotune.h picks them per machine
+extern int forceSchedule;
+extern int forceChunk;
+
+// Also places predatorCount predators (predators.h)
+void InitBoids(size_t count);
+// Grows or shrinks the population at runtime; new boids are placed at random
+void SetBoidCount(size_t count);
+// Sets boidCount, keeping the slots' contents and leaving new slots and the
+// grid for the caller to fill and rebuild
+void ResizeBoids(size_t count);
+void UpdateBoids(float frameTime, float alignmentWeight, float cohesionWeight, float separationWeight);
 
-extern int number_drawn;
-extern bool flat;
 extern size_t frameCounter;
 #endif // BOIDS_H
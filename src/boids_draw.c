@@ -0,0 +1,590 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <omp.h>
+
+#include "rlgl.h"
+
+#include "boids_draw.h"
+#include "spatial_hash.h"
+#include "torus.h"
+#include "frame_timer.h"
+
+int number_drawn = 0;
+bool drawInstanced = true;
+Material dartInstancedMaterial;
+bool drawCulling = true;
+DrawStats drawStats = { 0 };
+
+// What the cull pass makes of a dart. The visible ones are drawn in this
+// order, so the boid transforms come first and the predators' after them.
+enum { LOD_FULL = 0, LOD_SIMPLE, LOD_PREDATOR, LOD_POINT, LOD_CULLED, LOD_CLASSES };
+
+#define BOID_SCALE 3.0f
+#define PREDATOR_SCALE 10.0f
+
+// Per-frame instance transforms, grown as needed
+static Matrix *instanceTransforms = NULL;
+static float *instanceX = NULL, *instanceY = NULL; // interpolated positions, by slot
+static float *instanceVX = NULL, *instanceVY = NULL; // the visible darts, in draw order
+static float *visibleX = NULL, *visibleY = NULL;
+static unsigned char *dartClass = NULL;             // LOD_* of each slot
+static uint32_t *drawOrder = NULL;                  // visible slots, grouped by class
+static Vector3 *streakVertices = NULL;              // two per LOD_POINT dart
+static size_t instanceCapacity = 0;
+static size_t *threadClassCounts = NULL;            // LOD_CLASSES per thread
+static int threadCapacity = 0;
+
+// The dart's bounds and its stand-in, made on first use
+static Mesh simpleDart = { 0 };
+static float dartRadius = 0.0f;   // from its origin, unscaled
+static float dartLength = 0.0f;
+
+// What the cull pass tests against, for one frame
+typedef struct CullView {
+    Vector4 planes[6];      // inward, normalised; a point p is inside if p.xyz . plane.xyz + plane.w >= 0
+    Vector3 eye;
+    float radius[2];        // bounding radius of a boid and a predator dart
+    float backfaceCos[2];   // on the torus, darts whose normal is this far from facing away are hidden
+    float fullDistance2;    // squared distance up to which boid darts get the full mesh
+    float simpleDistance2;  // and the stand-in
+} CullView;
+
+// Neighbour network, up to NETWORK_PIECES line pieces per edge
+#define NETWORK_PIECES 3
+static Vector3 *networkVertices = NULL; // 2 * NETWORK_PIECES per edge
+static unsigned char *networkPieces = NULL;
+static size_t networkCapacity = 0;      // edges
+
+// Density overlay, one texel per grid cell
+static Texture2D densityTexture = { 0 };
+static Color *densityPixels = NULL;
+
+static void *ReallocInstances(void *p, size_t size) {
+    p = realloc(p, size);
+    if (!p) {
+        fprintf(stderr, "Failed to allocate instance transforms!\n");
+        exit(1);
+    }
+    return p;
+}
+
+static Matrix *ReserveInstances(size_t count) {
+    if (count > instanceCapacity) {
+        instanceTransforms = ReallocInstances(instanceTransforms, count * sizeof(Matrix));
+        instanceX = ReallocInstances(instanceX, count * sizeof(float));
+        instanceY = ReallocInstances(instanceY, count * sizeof(float));
+        instanceVX = ReallocInstances(instanceVX, count * sizeof(float));
+        instanceVY = ReallocInstances(instanceVY, count * sizeof(float));
+        visibleX = ReallocInstances(visibleX, count * sizeof(float));
+        visibleY = ReallocInstances(visibleY, count * sizeof(float));
+        dartClass = ReallocInstances(dartClass, count);
+        drawOrder = ReallocInstances(drawOrder, count * sizeof(uint32_t));
+        streakVertices = ReallocInstances(streakVertices, 2 * count * sizeof(Vector3));
+        instanceCapacity = count;
+    }
+    int threads = omp_get_max_threads();
+    if (threads > threadCapacity) {
+        threadClassCounts = ReallocInstances(threadClassCounts, (size_t)threads * LOD_CLASSES * sizeof(size_t));
+        threadCapacity = threads;
+    }
+    return instanceTransforms;
+}
+
+// A four-faced stand-in for the dart, nose to tail over its bounding box
+static Mesh GenSimpleDartMesh(BoundingBox box) {
+    const float midY = 0.5f * (box.min.y + box.max.y), midZ = 0.5f * (box.min.z + box.max.z);
+    const Vector3 nose = { box.max.x, midY, midZ };
+    const Vector3 tailLeft = { box.min.x, box.min.y, box.min.z };
+    const Vector3 tailRight = { box.min.x, box.min.y, box.max.z };
+    const Vector3 top = { box.min.x, box.max.y, midZ };
+    const Vector3 faces[4][3] = {
+        { nose, tailLeft, tailRight }, { nose, top, tailLeft },
+        { nose, tailRight, top }, { tailLeft, top, tailRight },
+    };
+    const Vector3 centre = Vector3Scale(Vector3Add(Vector3Add(nose, top), Vector3Add(tailLeft, tailRight)), 0.25f);
+
+    Mesh mesh = { 0 };
+    mesh.vertexCount = 12;
+    mesh.triangleCount = 4;
+    mesh.vertices = MemAlloc(mesh.vertexCount * 3 * sizeof(float));
+    mesh.normals = MemAlloc(mesh.vertexCount * 3 * sizeof(float));
+    mesh.texcoords = MemAlloc(mesh.vertexCount * 2 * sizeof(float));
+    for (int f = 0; f < 4; f++) {
+        Vector3 a = faces[f][0], b = faces[f][1], c = faces[f][2];
+        Vector3 normal = Vector3Normalize(Vector3CrossProduct(Vector3Subtract(b, a), Vector3Subtract(c, a)));
+        // Wind every face outwards
+        if (Vector3DotProduct(normal, Vector3Subtract(a, centre)) < 0.0f) {
+            Vector3 t = b; b = c; c = t;
+            normal = Vector3Negate(normal);
+        }
+        const Vector3 corners[3] = { a, b, c };
+        for (int k = 0; k < 3; k++) {
+            float *v = mesh.vertices + (f * 3 + k) * 3, *n = mesh.normals + (f * 3 + k) * 3;
+            v[0] = corners[k].x; v[1] = corners[k].y; v[2] = corners[k].z;
+            n[0] = normal.x; n[1] = normal.y; n[2] = normal.z;
+        }
+    }
+    UploadMesh(&mesh, false);
+    return mesh;
+}
+
+static void InitDartLod(void) {
+    BoundingBox box = GetModelBoundingBox(dart);
+    for (int k = 0; k < 8; k++) {
+        Vector3 corner = { (k & 1) ? box.max.x : box.min.x, (k & 2) ? box.max.y : box.min.y,
+                           (k & 4) ? box.max.z : box.min.z };
+        dartRadius = fmaxf(dartRadius, Vector3Length(corner));
+    }
+    dartLength = box.max.x - box.min.x;
+    simpleDart = GenSimpleDartMesh(box);
+}
+
+// The frustum of the current 3D mode, from rlgl's matrices
+static CullView MakeCullView(void) {
+    CullView view;
+    Matrix modelview = rlGetMatrixModelview(), projection = rlGetMatrixProjection();
+    Matrix m = MatrixMultiply(modelview, projection);
+    const Vector4 rows[4] = {
+        { m.m0, m.m4, m.m8, m.m12 }, { m.m1, m.m5, m.m9, m.m13 },
+        { m.m2, m.m6, m.m10, m.m14 }, { m.m3, m.m7, m.m11, m.m15 },
+    };
+    // left, right, bottom, top, near, far
+    for (int k = 0; k < 6; k++) {
+        const Vector4 r = rows[k / 2];
+        const float sign = (k % 2 == 0) ? 1.0f : -1.0f;
+        Vector4 plane = { rows[3].x + sign * r.x, rows[3].y + sign * r.y, rows[3].z + sign * r.z, rows[3].w + sign * r.w };
+        float length = sqrtf(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+        view.planes[k] = (Vector4){ plane.x / length, plane.y / length, plane.z / length, plane.w / length };
+    }
+    Matrix inverse = MatrixInvert(modelview);
+    view.eye = (Vector3){ inverse.m12, inverse.m13, inverse.m14 };
+
+    view.radius[0] = dartRadius * BOID_SCALE;
+    view.radius[1] = dartRadius * PREDATOR_SCALE;
+
+    // A dart at height h over the tube is hidden once the line of sight runs
+    // into the tube, which for a tube of radius r takes a normal at more than
+    // asin(r / (r + h)) from the viewer; a sphere of the tube's radius bends
+    // away fastest, so this holds all round. Nothing is hidden from inside.
+    const float R = get_torus_major_radius(), r = get_torus_minor_radius();
+    const float ring = sqrtf(view.eye.x * view.eye.x + view.eye.z * view.eye.z) - R;
+    const bool inside = ring * ring + view.eye.y * view.eye.y < r * r;
+    for (int k = 0; k < 2; k++) {
+        float ratio = r / (r + BOID_HEIGHT + view.radius[k]);
+        view.backfaceCos[k] = inside || !drawCulling ? INFINITY : sqrtf(1.0f - ratio * ratio);
+    }
+
+    // Length on screen is length * m5 * (height / 2) / distance
+    const float pixels = dartLength * BOID_SCALE * projection.m5 * 0.5f * GetScreenHeight();
+    view.fullDistance2 = (pixels / LOD_FULL_PIXELS) * (pixels / LOD_FULL_PIXELS);
+    view.simpleDistance2 = (pixels / LOD_SIMPLE_PIXELS) * (pixels / LOD_SIMPLE_PIXELS);
+    return view;
+}
+
+// Where the dart at (x, y) is drawn, and the surface normal under it
+static Vector3 DartPosition(float x, float y, Vector3 *normal) {
+    if (flat) {
+        *normal = (Vector3){ 0.0f, 1.0f, 0.0f };
+        return Shift((Vector3){ x, 0.0f, y });
+    }
+    TorusCoords coords = get_torus_coords(x, y);
+    *normal = get_torus_normal_fast(&coords);
+    return Vector3Add(get_torus_position_fast(&coords), Vector3Scale(*normal, BOID_HEIGHT));
+}
+
+static int ClassifyDart(const CullView *view, float x, float y, bool predator, bool lod) {
+    if (!drawCulling) return predator ? LOD_PREDATOR : LOD_FULL;
+    Vector3 normal;
+    const Vector3 p = DartPosition(x, y, &normal);
+    const float radius = view->radius[predator];
+    for (int k = 0; k < 6; k++) {
+        const Vector4 plane = view->planes[k];
+        if (p.x * plane.x + p.y * plane.y + p.z * plane.z + plane.w < -radius) return LOD_CULLED;
+    }
+    const Vector3 sight = Vector3Subtract(p, view->eye);
+    const float distance2 = Vector3DotProduct(sight, sight);
+    if (!flat && Vector3DotProduct(normal, sight) > view->backfaceCos[predator] * sqrtf(distance2)) return LOD_CULLED;
+    if (predator) return LOD_PREDATOR;
+    if (!lod || distance2 < view->fullDistance2) return LOD_FULL;
+    return distance2 < view->simpleDistance2 ? LOD_SIMPLE : LOD_POINT;
+}
+
+// Interpolates every slot, classifies it and sorts the visible slots into
+// drawOrder by class, each thread keeping a contiguous share in slot order.
+// classStart gets where each class begins.
+static void CullDarts(const BoidSnapshot *snapshot, float alpha, bool lod, size_t classStart[LOD_CLASSES + 1]) {
+    if (dartLength == 0.0f) InitDartLod();
+    const size_t count = snapshot->count, slots = count + snapshot->predators;
+    ReserveInstances(slots);
+    const CullView view = MakeCullView();
+
+    #pragma omp parallel
+    {
+        const int thread = omp_get_thread_num(), threads = omp_get_num_threads();
+        const size_t begin = slots * thread / threads, end = slots * (thread + 1) / threads;
+        size_t *counts = threadClassCounts + (size_t)thread * LOD_CLASSES;
+        for (int c = 0; c < LOD_CLASSES; c++) counts[c] = 0;
+        for (size_t i = begin; i < end; i++) {
+            Vec2 p = SnapshotPosition(snapshot, i, alpha);
+            instanceX[i] = p.x;
+            instanceY[i] = p.y;
+            int c = ClassifyDart(&view, p.x, p.y, i >= count, lod);
+            dartClass[i] = (unsigned char)c;
+            counts[c]++;
+        }
+        #pragma omp barrier
+        #pragma omp single
+        {
+            // Turn the counts into each thread's first slot per class
+            size_t next = 0;
+            for (int c = 0; c < LOD_CLASSES; c++) {
+                classStart[c] = next;
+                for (int t = 0; t < threads; t++) {
+                    size_t n = threadClassCounts[(size_t)t * LOD_CLASSES + c];
+                    threadClassCounts[(size_t)t * LOD_CLASSES + c] = next;
+                    next += n;
+                }
+            }
+            classStart[LOD_CLASSES] = next;
+        }
+        for (size_t i = begin; i < end; i++) {
+            if (dartClass[i] != LOD_CULLED) drawOrder[counts[dartClass[i]]++] = (uint32_t)i;
+        }
+    }
+
+    const size_t visible = classStart[LOD_CULLED];
+    #pragma omp parallel for schedule(static)
+    for (size_t k = 0; k < visible; k++) {
+        uint32_t i = drawOrder[k];
+        visibleX[k] = instanceX[i];
+        visibleY[k] = instanceY[i];
+        instanceVX[k] = snapshot->vx[i];
+        instanceVY[k] = snapshot->vy[i];
+    }
+
+    drawStats.full = (int)(classStart[LOD_SIMPLE] - classStart[LOD_FULL]);
+    drawStats.simple = (int)(classStart[LOD_PREDATOR] - classStart[LOD_SIMPLE]);
+    drawStats.points = (int)(classStart[LOD_CULLED] - classStart[LOD_POINT]);
+    drawStats.culled = (int)(slots - visible);
+}
+
+// One line along each far dart's heading, in one batch without lighting
+static void DrawDartStreaks(size_t first, size_t end) {
+    if (end <= first) return;
+    const float half = 0.5f * dartLength * BOID_SCALE;
+    #pragma omp parallel for schedule(static)
+    for (size_t k = first; k < end; k++) {
+        float x = visibleX[k], y = visibleY[k], vx = instanceVX[k], vy = instanceVY[k];
+        Vector3 normal, heading;
+        Vector3 p = DartPosition(x, y, &normal);
+        if (flat) {
+            heading = (Vector3){ vx, 0.0f, vy };
+        } else {
+            TorusCoords coords = get_torus_coords(x, y);
+            heading = Vector3Add(Vector3Scale(get_theta_tangent_fast(&coords), vx),
+                                 Vector3Scale(get_phi_tangent_fast(&coords), vy));
+        }
+        heading = Vector3Scale(Vector3Normalize(heading), half);
+        streakVertices[2 * (k - first)] = Vector3Subtract(p, heading);
+        streakVertices[2 * (k - first) + 1] = Vector3Add(p, heading);
+    }
+
+    EndShaderMode();
+    rlBegin(RL_LINES);
+    rlColor4ub(230, 230, 230, 255);
+    for (size_t v = 0; v < 2 * (end - first); v++) rlVertex3f(streakVertices[v].x, streakVertices[v].y, streakVertices[v].z);
+    rlEnd();
+    BeginShaderMode(dart.materials[0].shader);
+}
+
+// Same frame as get_torus_transform with the plane's normal as up: columns
+// are forward, up and forward x up, scaled, then the shifted position
+static Matrix DartTransformFlat(Vec2 position, float vx, float vy, float scale) {
+    Vector3 p = Shift((Vector3){ position.x, 0.0f, position.y });
+    float length = sqrtf(vx * vx + vy * vy);
+    float c = 1.0f, s = 0.0f;
+    if (length > 0.0f) { c = vx / length; s = vy / length; }
+    return (Matrix){
+        c * scale, 0.0f,  -s * scale, p.x,
+        0.0f,      scale, 0.0f,       p.y,
+        s * scale, 0.0f,  c * scale,  p.z,
+        0.0f,      0.0f,  0.0f,       1.0f
+    };
+}
+
+// One instanced call per mesh and colour, transforms laid out as the classes:
+// full boids, simple boids, predators; then the streaks
+static void DrawDartInstances(const Matrix *transforms, const size_t classStart[LOD_CLASSES + 1]) {
+    const size_t full = classStart[LOD_SIMPLE], simple = classStart[LOD_PREDATOR] - full;
+    const size_t predators = classStart[LOD_POINT] - classStart[LOD_PREDATOR];
+    Color tint = dartInstancedMaterial.maps[MATERIAL_MAP_DIFFUSE].color;
+    dartInstancedMaterial.maps[MATERIAL_MAP_DIFFUSE].color = WHITE;
+    for (int m = 0; m < dart.meshCount && full > 0; m++) {
+        DrawMeshInstanced(dart.meshes[m], dartInstancedMaterial, transforms, (int)full);
+    }
+    if (simple > 0) DrawMeshInstanced(simpleDart, dartInstancedMaterial, transforms + full, (int)simple);
+    dartInstancedMaterial.maps[MATERIAL_MAP_DIFFUSE].color = RED;
+    for (int m = 0; m < dart.meshCount && predators > 0; m++) {
+        DrawMeshInstanced(dart.meshes[m], dartInstancedMaterial, transforms + classStart[LOD_PREDATOR], (int)predators);
+    }
+    dartInstancedMaterial.maps[MATERIAL_MAP_DIFFUSE].color = tint;
+    DrawDartStreaks(classStart[LOD_POINT], classStart[LOD_CULLED]);
+    number_drawn = (int)classStart[LOD_CULLED];
+}
+
+Texture2D UpdateDensityTexture(const BoidSnapshot *snapshot) {
+    const int width = snapshot->field_width, height = snapshot->field_height;
+    if (width == 0 || height == 0) return densityTexture;
+    const size_t cells = (size_t)width * height;
+
+    if (densityTexture.id == 0 || densityTexture.width != width || densityTexture.height != height) {
+        if (densityTexture.id != 0) UnloadTexture(densityTexture);
+        Image image = GenImageColor(width, height, BLACK);
+        densityTexture = LoadTextureFromImage(image);
+        UnloadImage(image);
+        // Cells blend into each other and across the seam of the torus
+        SetTextureFilter(densityTexture, TEXTURE_FILTER_BILINEAR);
+        SetTextureWrap(densityTexture, TEXTURE_WRAP_REPEAT);
+        Color *pixels = realloc(densityPixels, cells * sizeof(Color));
+        if (!pixels) {
+            fprintf(stderr, "Failed to allocate density overlay!\n");
+            exit(1);
+        }
+        densityPixels = pixels;
+    }
+
+    float peak = 0.0f;
+    #pragma omp parallel for schedule(static) reduction(max:peak)
+    for (size_t c = 0; c < cells; c++) peak = fmaxf(peak, snapshot->density[c]);
+
+    // Brightness from the density, hue from the mean heading
+    const float scale = peak > 0.0f ? 1.0f / peak : 0.0f;
+    #pragma omp parallel for schedule(static)
+    for (size_t c = 0; c < cells; c++) {
+        float value = sqrtf(snapshot->density[c] * scale);
+        float hue = atan2f(snapshot->momentum_y[c], snapshot->momentum_x[c]) * RAD2DEG + 180.0f;
+        densityPixels[c] = ColorFromHSV(hue, 0.7f, value);
+    }
+    UpdateTexture(densityTexture, densityPixels);
+    return densityTexture;
+}
+
+Vector3 Vector2ToVector3(Vec2 v) {
+    return (Vector3){ v.x, 0.0f, v.y};
+}
+
+Vector3 Shift(Vector3 position)
+{
+    return (Vector3){position.x - HALF_SCREEN_WIDTH, position.y + 100.0f, position.z - HALF_SCREEN_HEIGHT};  
+}
+
+void DrawCells(Vec2 position) {
+
+    int cell_x = (int)(position.x / cellSize);
+    int cell_y = (int)(position.y / cellSize);
+
+    for (int dx = -1; dx <= 1; ++dx) {  
+        for (int dy = -1; dy <= 1; ++dy) {
+            int nx = cell_x + dx;
+            int ny = cell_y + dy;
+            DrawRectangleLines(WRAP_MOD(nx, grid.width) * cellSize, WRAP_MOD(ny, grid.height) * cellSize, cellSize, cellSize, BLUE);
+        }
+    }
+}
+
+// Draws the dart for slot i of a snapshot on the flat plane
+static void DrawDart3D(const BoidSnapshot *snapshot, size_t i, float alpha, float scale, Color color) {
+    number_drawn++;
+    Vec2 p = SnapshotPosition(snapshot, i, alpha);
+    Vector3 position = Shift((Vector3){ p.x, 0.0f, p.y });
+    Vector3 velocity = { snapshot->vx[i], 0.0f, snapshot->vy[i] };
+    Vector3 dir = Vector3Normalize(velocity);
+
+    Vector3 forward = {1, 0, 0};
+
+    // Cross product gives the rotation axis
+    Vector3 axis = Vector3CrossProduct(forward, dir);
+    float angle = acosf(Vector3DotProduct(forward, dir));
+
+    if (Vector3Length(axis) < 0.001f) axis = (Vector3){ 0, 1, 0 }; // fallback
+
+    DrawModelEx(dart, position, axis, RAD2DEG * angle, (Vector3){ scale, scale, scale }, color);
+}
+
+// Draws the dart for slot i of a snapshot on the torus
+static void DrawDart3DTorus(const BoidSnapshot *snapshot, size_t i, float alpha, float scale, Color color) {
+    number_drawn++;
+    Vec2 p = SnapshotPosition(snapshot, i, alpha);
+    dart.transform = get_torus_transform(p.x, p.y, snapshot->vx[i], snapshot->vy[i], scale);
+    DrawModel(dart, (Vector3){0, 0, 0}, 1.0f, color);
+}
+
+void DrawBoids3D(const BoidSnapshot *snapshot, float alpha) {
+    number_drawn = 0;
+    if (snapshot->count == 0 && snapshot->x == NULL) return; // nothing published yet
+
+    uint64_t start = TimerNow();
+    size_t classStart[LOD_CLASSES + 1];
+    CullDarts(snapshot, alpha, drawInstanced, classStart);
+    if (drawInstanced) {
+        const size_t darts = classStart[LOD_POINT], predatorsFrom = classStart[LOD_PREDATOR];
+        Matrix *transforms = instanceTransforms;
+        #pragma omp parallel for schedule(static)
+        for (size_t k = 0; k < darts; k++) {
+            transforms[k] = DartTransformFlat((Vec2){ visibleX[k], visibleY[k] }, instanceVX[k], instanceVY[k],
+                                              k < predatorsFrom ? BOID_SCALE : PREDATOR_SCALE);
+        }
+        uint64_t built = TimerNow();
+        TimerRecord(STAGE_TRANSFORMS, 0, start, built);
+        DrawDartInstances(transforms, classStart);
+        TimerRecord(STAGE_DRAW, 0, built, TimerNow());
+        return;
+    }
+
+    // Transforms are built per call here, so they count as drawing
+    Matrix transform = {
+        1.0f, 0.0f, 0.0f, 0.0f,
+        0.0f, 1.0f, 0.0f, 0.0f,
+        0.0f, 0.0f, 1.0f, 0.0f,
+        0.0f, 0.0f, 0.0f, 1.0f
+    };
+    dart.transform = transform;
+    for (size_t k = 0; k < classStart[LOD_CULLED]; k++) {
+        uint32_t i = drawOrder[k];
+        bool predator = i >= snapshot->count;
+        DrawDart3D(snapshot, i, alpha, predator ? PREDATOR_SCALE : BOID_SCALE, predator ? RED : WHITE);
+    }
+    TimerRecord(STAGE_DRAW, 0, start, TimerNow());
+}
+
+// A world point where the darts fly, on the plane or above the torus
+static Vector3 SurfacePoint(float x, float y) {
+    if (flat) return Shift((Vector3){ x, 0.0f, y });
+    TorusCoords coords = get_torus_coords(x, y);
+    return Vector3Add(get_torus_position_fast(&coords),
+                      Vector3Scale(get_torus_normal_fast(&coords), BOID_HEIGHT));
+}
+
+// Splits the shortest way from (x, y) along (dx, dy) where it crosses the
+// seams, each piece shifted back into the world; returns the pieces
+static int NetworkEdge(float x, float y, float dx, float dy, Vector3 *out) {
+    const float width = (float)SCREEN_WIDTH, height = (float)SCREEN_HEIGHT;
+    // |dx| is at most half the world, so each seam is crossed at most once
+    float t[NETWORK_PIECES + 1] = { 0.0f, 1.0f, 1.0f, 1.0f };
+    int cuts = 1;
+    if (x + dx < 0.0f) t[cuts++] = -x / dx;
+    else if (x + dx >= width) t[cuts++] = (width - x) / dx;
+    if (y + dy < 0.0f) t[cuts++] = -y / dy;
+    else if (y + dy >= height) t[cuts++] = (height - y) / dy;
+    if (cuts == 3 && t[2] < t[1]) { float s = t[1]; t[1] = t[2]; t[2] = s; }
+    t[cuts] = 1.0f;
+
+    for (int p = 0; p < cuts; p++) {
+        float mid = 0.5f * (t[p] + t[p + 1]);
+        float shift_x = floorf((x + dx * mid) / width) * width;
+        float shift_y = floorf((y + dy * mid) / height) * height;
+        out[2 * p] = SurfacePoint(x + dx * t[p] - shift_x, y + dy * t[p] - shift_y);
+        out[2 * p + 1] = SurfacePoint(x + dx * t[p + 1] - shift_x, y + dy * t[p + 1] - shift_y);
+    }
+    return cuts;
+}
+
+void DrawNeighbourNetwork(const BoidSnapshot *snapshot, float alpha) {
+    const size_t count = snapshot->count;
+    const int k = snapshot->knn_k;
+    if (k <= 0 || count == 0) return;
+
+    uint64_t start = TimerNow();
+    const size_t edges = count * k;
+    if (edges > networkCapacity) {
+        Vector3 *v = realloc(networkVertices, edges * 2 * NETWORK_PIECES * sizeof(Vector3));
+        unsigned char *p = realloc(networkPieces, edges);
+        if (!v || !p) {
+            fprintf(stderr, "Failed to allocate the neighbour network!\n");
+            exit(1);
+        }
+        networkVertices = v;
+        networkPieces = p;
+        networkCapacity = edges;
+    }
+    ReserveInstances(count);
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < count; i++) {
+        Vec2 p = SnapshotPosition(snapshot, i, alpha);
+        instanceX[i] = p.x;
+        instanceY[i] = p.y;
+    }
+
+    #pragma omp parallel for schedule(static)
+    for (size_t e = 0; e < edges; e++) {
+        size_t i = e / k;
+        uint32_t j = snapshot->knn[e];
+        networkPieces[e] = 0;
+        if (j == KNN_NONE) continue;
+        Vec2 d = Vector2SubtractTorus((Vec2){ instanceX[j], instanceY[j] }, (Vec2){ instanceX[i], instanceY[i] });
+        networkPieces[e] = (unsigned char)NetworkEdge(instanceX[i], instanceY[i], d.x, d.y,
+                                                      networkVertices + e * 2 * NETWORK_PIECES);
+    }
+
+    // One batch of lines
+    rlBegin(RL_LINES);
+    rlColor4ub(SKYBLUE.r, SKYBLUE.g, SKYBLUE.b, 160);
+    for (size_t e = 0; e < edges; e++) {
+        const Vector3 *v = networkVertices + e * 2 * NETWORK_PIECES;
+        for (int p = 0; p < 2 * networkPieces[e]; p++) rlVertex3f(v[p].x, v[p].y, v[p].z);
+    }
+    rlEnd();
+    TimerRecord(STAGE_DRAW, 0, start, TimerNow());
+}
+
+bool PickWorldPoint(Ray ray, Vec2 *point) {
+    if (!flat) return get_torus_ray_hit(ray, BOID_HEIGHT, point);
+
+    // The plane the darts fly in
+    float height = Shift((Vector3){ 0.0f, 0.0f, 0.0f }).y;
+    if (ray.direction.y == 0.0f) return false;
+    float t = (height - ray.position.y) / ray.direction.y;
+    if (t < 0.0f) return false;
+    float x = ray.position.x + t * ray.direction.x + HALF_SCREEN_WIDTH;
+    float y = ray.position.z + t * ray.direction.z + HALF_SCREEN_HEIGHT;
+    if (x < 0.0f || x >= SCREEN_WIDTH || y < 0.0f || y >= SCREEN_HEIGHT) return false;
+    *point = (Vec2){ x, y };
+    return true;
+}
+
+void DrawPickedBoid(const BoidSnapshot *snapshot, float alpha) {
+    if (snapshot->picked >= snapshot->count) return;
+    Vec2 p = SnapshotPosition(snapshot, snapshot->picked, alpha);
+    DrawSphereWires(SurfacePoint(p.x, p.y), PICK_RADIUS, 8, 8, GOLD);
+}
+
+void DrawBoids3DTorus(const BoidSnapshot *snapshot, float alpha) {
+    number_drawn = 0;
+    if (snapshot->count == 0 && snapshot->x == NULL) return; // nothing published yet
+
+    uint64_t start = TimerNow();
+    size_t classStart[LOD_CLASSES + 1];
+    CullDarts(snapshot, alpha, drawInstanced, classStart);
+    if (drawInstanced) {
+        const size_t boidDarts = classStart[LOD_PREDATOR];
+        const size_t predators = classStart[LOD_POINT] - boidDarts;
+        Matrix *transforms = instanceTransforms;
+        get_torus_transforms(visibleX, visibleY, instanceVX, instanceVY, boidDarts, BOID_SCALE, transforms);
+        get_torus_transforms(visibleX + boidDarts, visibleY + boidDarts, instanceVX + boidDarts, instanceVY + boidDarts,
+                             predators, PREDATOR_SCALE, transforms + boidDarts);
+        uint64_t built = TimerNow();
+        TimerRecord(STAGE_TRANSFORMS, 0, start, built);
+        DrawDartInstances(transforms, classStart);
+        TimerRecord(STAGE_DRAW, 0, built, TimerNow());
+        return;
+    }
+
+    for (size_t k = 0; k < classStart[LOD_CULLED]; k++) {
+        uint32_t i = drawOrder[k];
+        bool predator = i >= snapshot->count;
+        DrawDart3DTorus(snapshot, i, alpha, predator ? PREDATOR_SCALE : BOID_SCALE, predator ? RED : WHITE);
+    }
+    TimerRecord(STAGE_DRAW, 0, start, TimerNow());
+    //if (mousePressed) DrawMouse(boids[MOUSE_INDEX]);
+}
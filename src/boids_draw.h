@@ -0,0 +1,58 @@
+#ifndef BOIDS_DRAW_H
+#define BOIDS_DRAW_H
+#include <stdbool.h>
+
+#include "raylib.h"
+#include "raymath.h"
+
+#include "boids.h"
+#include "sim_thread.h"
+
+extern Model dart;
+// dart's material with the instancing lighting shader
+extern Material dartInstancedMaterial;
+// Draw all darts with one instanced call instead of one call per boid
+extern bool drawInstanced;
+
+extern bool drawFullGlyph;
+extern bool drawDensity;
+extern bool nearestNeighboursNetwork;
+extern bool flat;
+
+// Draw a snapshot, `alpha` of the way from its previous tick to its own
+void DrawBoids3D(const BoidSnapshot *snapshot, float alpha);
+void DrawBoids3DTorus(const BoidSnapshot *snapshot, float alpha);
+// The snapshot's k-nearest-neighbour graph as one batch of lines, split
+// where edges cross the seams of the world
+void DrawNeighbourNetwork(const BoidSnapshot *snapshot, float alpha);
+void DrawCells(Vec2 position);
+// The world point a screen ray points at, on the plane or torus as drawn;
+// false if it misses the world
+bool PickWorldPoint(Ray ray, Vec2 *point);
+// Marks the snapshot's picked boid
+void DrawPickedBoid(const BoidSnapshot *snapshot, float alpha);
+// The snapshot's density field as a texture, one texel per grid cell, laid
+// out like the world; id 0 if the snapshot has no field
+Texture2D UpdateDensityTexture(const BoidSnapshot *snapshot);
+Vector3 Vector2ToVector3(Vec2 v);
+Vector3 Shift(Vector3 position);
+
+// Culling and level of detail of the instanced darts. Every frame a parallel
+// pass drops the darts outside the view frustum and, on the torus, those on
+// the far side of the tube, then picks a mesh by how long each dart is on
+// screen: the full dart, a four-faced stand-in, or a streak of one line.
+#define LOD_FULL_PIXELS 12.0f    // darts at least this long get the full mesh
+#define LOD_SIMPLE_PIXELS 3.0f   // and down to this the stand-in
+
+typedef struct DrawStats {
+    int full;       // boids drawn with each mesh, predators always full
+    int simple;
+    int points;
+    int culled;     // boids and predators not drawn
+} DrawStats;
+
+extern bool drawCulling; // off draws every dart in full, as before
+extern DrawStats drawStats;
+
+extern int number_drawn;
+#endif // BOIDS_DRAW_H
@@ -0,0 +1,150 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+#include "density_field.h"
+#include "spatial_hash.h"
+#include "boids.h"
+
+DensityField densityField = {0};
+CellMoments cellMoments = {0};
+int densityBlur = DEFAULT_DENSITY_BLUR;
+
+// Blurred channels: count, offset x, offset y, momentum x, momentum y. The
+// raw moments add the second moments of the offsets, which are not blurred.
+#define DENSITY_CHANNELS 5
+#define MOMENT_CHANNELS 8
+
+static float *raw[DENSITY_CHANNELS];   // cellMoments' first channels
+static float *rows[DENSITY_CHANNELS];  // after the row pass
+
+static float **field_channel(int channel) {
+    float **channels[DENSITY_CHANNELS] = {
+        &densityField.count, &densityField.offset_x, &densityField.offset_y,
+        &densityField.momentum_x, &densityField.momentum_y
+    };
+    return channels[channel];
+}
+
+static float **moment_channel(int channel) {
+    float **channels[MOMENT_CHANNELS] = {
+        &cellMoments.count, &cellMoments.sum_x, &cellMoments.sum_y,
+        &cellMoments.sum_vx, &cellMoments.sum_vy,
+        &cellMoments.sum_xx, &cellMoments.sum_xy, &cellMoments.sum_yy
+    };
+    return channels[channel];
+}
+
+static void density_realloc(float **array, size_t cells) {
+    float *p = realloc(*array, cells * sizeof(float));
+    if (!p) {
+        fprintf(stderr, "Failed to allocate density field!\n");
+        exit(1);
+    }
+    *array = p;
+}
+
+void init_density_field(void) {
+    densityField.width = grid.width;
+    densityField.height = grid.height;
+    size_t cells = (size_t)grid.width * grid.height;
+    for (int ch = 0; ch < MOMENT_CHANNELS; ch++) {
+        density_realloc(moment_channel(ch), cells);
+        memset(*moment_channel(ch), 0, cells * sizeof(float));
+    }
+    for (int ch = 0; ch < DENSITY_CHANNELS; ch++) {
+        raw[ch] = *moment_channel(ch);
+        density_realloc(&rows[ch], cells);
+        density_realloc(field_channel(ch), cells);
+    }
+}
+
+void accumulate_density_cells(size_t c0, size_t c1) {
+    for (size_t c = c0; c < c1; c++) {
+        const float center_x = ((float)(c % grid.width) + 0.5f) * cellSize;
+        const float center_y = ((float)(c / grid.width) + 0.5f) * cellSize;
+        float ox = 0.0f, oy = 0.0f, mx = 0.0f, my = 0.0f;
+        float oxx = 0.0f, oxy = 0.0f, oyy = 0.0f;
+        for (uint32_t k = grid.cell_start[c]; k < grid.cell_start[c + 1]; k++) {
+            uint32_t j = grid.cell_boids[k];
+            float dx = boids.x[j] - center_x, dy = boids.y[j] - center_y;
+            ox += dx;
+            oy += dy;
+            oxx += dx * dx;
+            oxy += dx * dy;
+            oyy += dy * dy;
+            mx += boids.vx[j];
+            my += boids.vy[j];
+        }
+        cellMoments.count[c] = (float)(grid.cell_start[c + 1] - grid.cell_start[c]);
+        cellMoments.sum_x[c] = ox;
+        cellMoments.sum_y[c] = oy;
+        cellMoments.sum_vx[c] = mx;
+        cellMoments.sum_vy[c] = my;
+        cellMoments.sum_xx[c] = oxx;
+        cellMoments.sum_xy[c] = oxy;
+        cellMoments.sum_yy[c] = oyy;
+    }
+}
+
+// Offsets [*lo, *hi] of a blur `reach` cells each way, clamped so a world
+// narrower than the block counts each cell once
+static void blur_span(int reach, int cells, int *lo, int *hi) {
+    *lo = -reach;
+    *hi = reach;
+    if (2 * reach + 1 > cells) {
+        *lo = -((cells - 1) / 2);
+        *hi = *lo + cells - 1;
+    }
+}
+
+// One pass of the separable box blur. `axis` is the offset channel that moves
+// with the step (1 along rows, 2 along columns): each source cell's offsets
+// are re-centred on the destination cell.
+static void blur_pass(float *const *src, float *const *dst, int axis) {
+    const int width = densityField.width, height = densityField.height;
+    const bool along_rows = axis == 1;
+    int lo, hi;
+    blur_span(densityField.blur, along_rows ? width : height, &lo, &hi);
+
+    #pragma omp parallel for schedule(static)
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            float sums[DENSITY_CHANNELS] = {0};
+            for (int d = lo; d <= hi; d++) {
+                size_t s = along_rows ? (size_t)y * width + WRAP_MOD(x + d, width)
+                                      : (size_t)WRAP_MOD(y + d, height) * width + x;
+                float n = src[0][s];
+                sums[0] += n;
+                for (int ch = 1; ch < DENSITY_CHANNELS; ch++) sums[ch] += src[ch][s];
+                sums[axis] += n * (float)(d * cellSize);
+            }
+            size_t c = (size_t)y * width + x;
+            for (int ch = 0; ch < DENSITY_CHANNELS; ch++) dst[ch][c] = sums[ch];
+        }
+    }
+}
+
+void blur_density_field(void) {
+    densityField.blur = densityBlur < 0 ? 0 : densityBlur;
+    float *out[DENSITY_CHANNELS];
+    for (int ch = 0; ch < DENSITY_CHANNELS; ch++) out[ch] = *field_channel(ch);
+    blur_pass(raw, rows, 1);
+    blur_pass(rows, out, 2);
+}
+
+DensitySample SampleDensity(float x, float y) {
+    uint32_t c = grid_cell_of(x, y);
+    Vec2 center = { ((float)(c % densityField.width) + 0.5f) * cellSize,
+                    ((float)(c / densityField.width) + 0.5f) * cellSize };
+    DensitySample sample = { .count = densityField.count[c], .centroid = center };
+    if (sample.count > 0.0f) {
+        float inv = 1.0f / sample.count;
+        Vec2 offset = { densityField.offset_x[c] * inv, densityField.offset_y[c] * inv };
+        sample.centroid = Vector2Wrap(Vec2Add(center, offset), SCREEN_WIDTH, SCREEN_HEIGHT);
+        sample.velocity = (Vec2){ densityField.momentum_x[c] * inv, densityField.momentum_y[c] * inv };
+    }
+    return sample;
+}
@@ -0,0 +1,60 @@
+#ifndef DENSITY_FIELD_H
+#define DENSITY_FIELD_H
+
+#include <stddef.h>
+
+#include "vec2.h"
+
+// Per-cell density and momentum of the boids.
+//
+// build_spatial_grid() fills in the raw moments of every grid cell (boids,
+// their summed offset from the cell centre and its second moments, and their
+// summed velocity) straight after its scatter, each thread over its own share
+// of the cells. The raw moments stay in cellMoments for far-field queries
+// (spatial_query.h). The first ones are then box blurred densityBlur cells
+// each way, so every cell holds the sums of the whole block around it,
+// offsets taken from its own centre. Predators sample the field to steer, and
+// the viewer draws it as an overlay.
+
+// Blocks as wide as a predator can see
+#define DEFAULT_DENSITY_BLUR 3
+
+typedef struct DensityField {
+    int width;                      // cells across, as the grid
+    int height;
+    int blur;                       // cells each way the field is blurred over
+    float *count;                   // boids in the block of each cell
+    float *offset_x, *offset_y;     // their summed offsets from the cell centre
+    float *momentum_x, *momentum_y; // their summed velocities
+} DensityField;
+
+// Raw moments of each grid cell, offsets from the cell centre, as of the last
+// grid build
+typedef struct CellMoments {
+    float *count;
+    float *sum_x, *sum_y;              // summed offsets
+    float *sum_vx, *sum_vy;            // summed velocities
+    float *sum_xx, *sum_xy, *sum_yy;   // summed products of the offsets
+} CellMoments;
+
+typedef struct DensitySample {
+    float count;     // boids in the block
+    Vec2 centroid;   // their centre of mass, wrapped onto the torus
+    Vec2 velocity;   // their mean velocity
+} DensitySample;
+
+extern DensityField densityField;
+extern CellMoments cellMoments;
+extern int densityBlur; // cells, 0 for the raw per-cell sums
+
+// Sizes the field for the grid; from init_spatial_grid()
+void init_density_field(void);
+// Raw moments of cells [c0, c1) from the freshly built grid
+void accumulate_density_cells(size_t c0, size_t c1);
+// Box blur of the raw moments into the field
+void blur_density_field(void);
+
+// The blurred block around the cell containing (x, y)
+DensitySample SampleDensity(float x, float y);
+
+#endif // DENSITY_FIELD_H
@@ -0,0 +1,616 @@
+#include <errno.h>
+#include <libgen.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <omp.h>
+
+#include "domain.h"
+#include "boids.h"
+#include "spatial_hash.h"
+#include "neighbor_list.h"
+#include "predators.h"
+#include "density_field.h"
+#include "knn_graph.h"
+#include "boid_order.h"
+#include "recorder.h"
+#include "flock_kernel.h"
+#include "species.h"
+
+enum { DOMAIN_INIT = 1, DOMAIN_READY, DOMAIN_STEP, DOMAIN_STOP };
+enum { SIDE_LEFT = 0, SIDE_RIGHT = 1 };
+
+// Everything a worker needs to take over its strip; followed by its boids
+// and predators
+typedef struct DomainInit {
+    uint32_t type;
+    int32_t width, height, cell_size;
+    int32_t workers, strip;
+    int32_t x0, x1;             // the strip's columns, [x0, x1) in world units
+    float halo;
+    uint64_t frame;
+    int32_t interaction, kernel, density_blur, schedule, chunk, threads;
+    float skin;
+    uint32_t boids, predators;
+} DomainInit;
+
+typedef struct DomainCommand {
+    uint32_t type;
+    int32_t interaction;
+    uint64_t frame;
+    float frame_time, alignment, cohesion, separation;
+    uint32_t gather;
+} DomainCommand;
+
+// A worker's answer to a step; followed by its boids and predators if gathered
+typedef struct DomainReply {
+    uint32_t type;
+    uint32_t boids, predators, halo;
+    uint32_t gathered;
+} DomainReply;
+
+typedef struct BoidRecord {
+    float x, y, vx, vy;
+    uint32_t id;
+    uint32_t predated;
+} BoidRecord;
+
+typedef struct PredatorRecord {
+    float x, y, vx, vy;
+} PredatorRecord;
+
+// What one worker sends a neighbour each tick; the four runs of records follow
+typedef struct EdgeHeader {
+    uint32_t boid_migrants, boid_halo;
+    uint32_t predator_migrants, predator_halo;
+} EdgeHeader;
+
+int domainWorkers = 0;
+TransportKind domainTransport = TRANSPORT_SHM;
+DomainWorkerStats domainStats[DOMAIN_MAX_WORKERS];
+
+static Transport *transport = NULL;
+static pid_t workerPids[DOMAIN_MAX_WORKERS];
+static Message command = {0}, reply = {0};
+// The slot each boid id had when the workers started, where gathering puts
+// it back; UINT32_MAX for ids not in use
+static uint32_t *idSlots = NULL;
+static size_t idSlotCount = 0;
+
+// The worker's strip
+static int workerCount = 0, strip = 0;
+static float stripX0 = 0.0f, stripX1 = 0.0f, halo = 0.0f;
+static Message outbox[2] = {0}, inbox[2] = {0};
+// Migrants still within the halo of the strip they left, which that strip
+// keeps as halo: its neighbours cannot send them, having not had them yet
+static Message leftBoids = {0}, leftPredators = {0};
+
+float domain_halo(void) {
+    float reach = NEIGHBOR_RADIUS > PREDATOR_RADIUS ? NEIGHBOR_RADIUS : PREDATOR_RADIUS;
+    return (float)(ceil_div((int)ceilf(reach), cellSize) * cellSize);
+}
+
+// Left edge of strip k of n, in whole cells
+static int strip_edge(int k, int n) {
+    return (int)((long)k * grid.width / n) * cellSize;
+}
+
+static BoidRecord boid_record(size_t i) {
+    return (BoidRecord){ boids.x[i], boids.y[i], boids.vx[i], boids.vy[i],
+                         boids.info[i].id, boids.info[i].predated };
+}
+
+static void set_boid(size_t i, const BoidRecord *r) {
+    boids.x[i] = r->x;
+    boids.y[i] = r->y;
+    boids.vx[i] = r->vx;
+    boids.vy[i] = r->vy;
+    boids.info[i] = (BoidInfo){ .id = r->id, .neighborCount = -1, .nearNeighborCount = -1, .predated = r->predated };
+}
+
+static PredatorRecord predator_record(size_t p) {
+    return (PredatorRecord){ predators.x[p], predators.y[p], predators.vx[p], predators.vy[p] };
+}
+
+static void set_predator(size_t p, const PredatorRecord *r) {
+    predators.x[p] = r->x;
+    predators.y[p] = r->y;
+    predators.vx[p] = r->vx;
+    predators.vy[p] = r->vy;
+}
+
+static void domain_fail(const char *what) {
+    fprintf(stderr, "Domain: %s!\n", what);
+    exit(1);
+}
+
+// ---------------------------------------------------------------------------
+// Coordinator
+
+// The worker executable, next to this program's
+static void worker_path(char *path, size_t size) {
+    char self[PATH_MAX];
+    ssize_t n = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if (n <= 0) {
+        snprintf(path, size, "%s", DOMAIN_WORKER);
+        return;
+    }
+    self[n] = '\0';
+    snprintf(path, size, "%s/%s", dirname(self), DOMAIN_WORKER);
+}
+
+static bool start_worker(int rank, const char *path) {
+    char rankArg[16], ranksArg[16], address[256];
+    snprintf(rankArg, sizeof(rankArg), "%d", rank);
+    snprintf(ranksArg, sizeof(ranksArg), "%d", transport->ranks);
+    transport->address(transport, rank, address, sizeof(address));
+    char *argv[] = { (char *)path, "--rank", rankArg, "--ranks", ranksArg,
+                     "--transport", (char *)transport_name(transport->kind),
+                     "--address", address, NULL };
+
+    // Only async-signal-safe calls between fork and exec: the OpenMP runtime
+    // cannot be used in the child
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "Domain: cannot fork a worker: %s\n", strerror(errno));
+        return false;
+    }
+    if (pid == 0) {
+        transport->prepare_child(transport, rank);
+        execv(path, argv);
+        _exit(127);
+    }
+    workerPids[rank - 1] = pid;
+    return true;
+}
+
+static void pack_init(Message *m, int k, int threads) {
+    const int x0 = strip_edge(k, domainWorkers), x1 = strip_edge(k + 1, domainWorkers);
+    m->size = 0;
+    DomainInit *init = message_append(m, NULL, sizeof(DomainInit));
+    *init = (DomainInit){
+        .type = DOMAIN_INIT, .width = SCREEN_WIDTH, .height = SCREEN_HEIGHT, .cell_size = cellSize,
+        .workers = domainWorkers, .strip = k, .x0 = x0, .x1 = x1, .halo = domain_halo(),
+        .frame = frameCounter, .interaction = flockInteraction, .kernel = flock_kernel_current(),
+        .density_blur = densityBlur, .schedule = forceSchedule, .chunk = forceChunk,
+        .threads = threads, .skin = neighborListSkin,
+    };
+    uint32_t boidsIn = 0, predatorsIn = 0;
+    for (size_t i = 0; i < boidCount; i++) {
+        if (boids.x[i] < x0 || boids.x[i] >= x1) continue;
+        BoidRecord r = boid_record(i);
+        message_append(m, &r, sizeof(r));
+        boidsIn++;
+    }
+    for (size_t p = 0; p < predatorCount; p++) {
+        if (predators.x[p] < x0 || predators.x[p] >= x1) continue;
+        PredatorRecord r = predator_record(p);
+        message_append(m, &r, sizeof(r));
+        predatorsIn++;
+    }
+    // Appending may have moved the buffer
+    init = (DomainInit *)m->data;
+    init->boids = boidsIn;
+    init->predators = predatorsIn;
+    domainStats[k] = (DomainWorkerStats){ boidsIn, predatorsIn, 0 };
+}
+
+bool StartDomain(int workers, TransportKind kind) {
+    if (domainWorkers > 0) StopDomain();
+    if (workers <= 0) return true;
+    if (workers > DOMAIN_MAX_WORKERS) {
+        fprintf(stderr, "Domain: at most %d workers\n", DOMAIN_MAX_WORKERS);
+        return false;
+    }
+    const int haloCells = (int)domain_halo() / cellSize;
+    if (grid.width / workers < 2 * haloCells) {
+        fprintf(stderr, "Domain: %d cells across cannot be split into %d strips of %d cells\n",
+                grid.width, workers, 2 * haloCells);
+        return false;
+    }
+    if (boidCount > UINT32_MAX) {
+        fprintf(stderr, "Domain: too many boids\n");
+        return false;
+    }
+    if (speciesCount > 1) {
+        fprintf(stderr, "Domain: only one species can be split over workers\n");
+        return false;
+    }
+
+    char path[PATH_MAX + 32];
+    worker_path(path, sizeof(path));
+    if (access(path, X_OK) != 0) {
+        fprintf(stderr, "Domain: cannot run %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    transport = OpenTransport(kind, workers + 1);
+    if (!transport) return false;
+    domainWorkers = workers;
+    domainTransport = kind;
+
+    // The workers hand the boids back by id, each to the slot it started in
+    idSlotCount = 0;
+    for (size_t i = 0; i < boidCount; i++) {
+        if (boids.info[i].id >= idSlotCount) idSlotCount = (size_t)boids.info[i].id + 1;
+    }
+    free(idSlots);
+    idSlots = malloc((idSlotCount ? idSlotCount : 1) * sizeof(uint32_t));
+    if (!idSlots) {
+        fprintf(stderr, "Failed to allocate domain id map!\n");
+        exit(1);
+    }
+    memset(idSlots, 0xff, idSlotCount * sizeof(uint32_t));
+    for (size_t i = 0; i < boidCount; i++) idSlots[boids.info[i].id] = (uint32_t)i;
+    int threads = omp_get_max_threads() / workers;
+    if (threads < 1) threads = 1;
+    for (int k = 0; k < workers; k++) {
+        if (!start_worker(k + 1, path)) {
+            domainWorkers = k;
+            StopDomain();
+            return false;
+        }
+    }
+    for (int k = 0; k < workers; k++) {
+        pack_init(&command, k, threads);
+        if (!TransportSend(transport, k + 1, &command)) domain_fail("a worker did not start");
+    }
+    for (int k = 0; k < workers; k++) {
+        if (!TransportReceive(transport, k + 1, &reply) || reply.size < sizeof(uint32_t) ||
+            *(uint32_t *)reply.data != DOMAIN_READY) {
+            fprintf(stderr, "Domain: worker %d did not start\n", k + 1);
+            StopDomain();
+            return false;
+        }
+    }
+    transport->attached(transport);
+    fprintf(stderr, "Domain: %d workers over %s, %d threads each\n", workers, transport_name(kind), threads);
+    return true;
+}
+
+// Puts one worker's gathered boids and predators into the global arrays
+static size_t merge_reply(int k, size_t predator) {
+    const DomainReply *r = (const DomainReply *)reply.data;
+    domainStats[k] = (DomainWorkerStats){ r->boids, r->predators, r->halo };
+    if (!r->gathered) return predator;
+
+    const BoidRecord *b = (const BoidRecord *)(reply.data + sizeof(DomainReply));
+    for (uint32_t j = 0; j < r->boids; j++) {
+        if (b[j].id >= idSlotCount || idSlots[b[j].id] >= boidCount) domain_fail("a worker sent an unknown boid");
+        set_boid(idSlots[b[j].id], &b[j]);
+    }
+    const PredatorRecord *p = (const PredatorRecord *)(b + r->boids);
+    if (predator + r->predators > predatorCount) ResizePredators(predator + r->predators);
+    for (uint32_t j = 0; j < r->predators; j++) set_predator(predator + j, &p[j]);
+    return predator + r->predators;
+}
+
+void DomainStep(float frameTime, float alignmentWeight, float cohesionWeight, float separationWeight, bool gather) {
+    if (domainWorkers == 0) return;
+    gather = gather || IsRecording();
+
+    command.size = 0;
+    DomainCommand c = {
+        .type = DOMAIN_STEP, .interaction = flockInteraction, .frame = frameCounter,
+        .frame_time = frameTime, .alignment = alignmentWeight, .cohesion = cohesionWeight,
+        .separation = separationWeight, .gather = gather,
+    };
+    message_append(&command, &c, sizeof(c));
+    // Every worker gets its command before any answer is awaited, as the
+    // workers exchange with each other before answering
+    for (int k = 0; k < domainWorkers; k++) {
+        if (!TransportSend(transport, k + 1, &command)) domain_fail("lost a worker");
+    }
+    size_t predator = 0;
+    for (int k = 0; k < domainWorkers; k++) {
+        if (!TransportReceive(transport, k + 1, &reply) || reply.size < sizeof(DomainReply)) {
+            domain_fail("lost a worker");
+        }
+        predator = merge_reply(k, predator);
+    }
+    if (!gather) return;
+
+    if (predator != predatorCount) ResizePredators(predator);
+    build_spatial_grid();
+    build_predator_grid();
+    if (knnK > 0) BuildKnnGraph();
+    if (IsRecording()) RecordFrame(frameTime);
+}
+
+void StopDomain(void) {
+    if (!transport) return;
+    command.size = 0;
+    uint32_t stop = DOMAIN_STOP;
+    message_append(&command, &stop, sizeof(stop));
+    for (int k = 0; k < domainWorkers; k++) TransportSend(transport, k + 1, &command);
+    transport->close(transport);
+    transport = NULL;
+    for (int k = 0; k < domainWorkers; k++) waitpid(workerPids[k], NULL, 0);
+    domainWorkers = 0;
+    free(idSlots);
+    idSlots = NULL;
+    idSlotCount = 0;
+    InvalidateNeighborLists();
+}
+
+// ---------------------------------------------------------------------------
+// Worker
+
+static void worker_init(const Message *m) {
+    const DomainInit *init = (const DomainInit *)m->data;
+    workerCount = init->workers;
+    strip = init->strip;
+    stripX0 = (float)init->x0;
+    stripX1 = (float)init->x1;
+    halo = init->halo;
+
+    flock_kernel_init();
+    flock_kernel_select((FlockKernelIsa)init->kernel);
+    omp_set_num_threads(init->threads);
+    cellSize = init->cell_size;
+    SetWorldDimensions(init->width, init->height);
+    frameCounter = init->frame;
+    flockInteraction = (FlockInteraction)init->interaction;
+    densityBlur = init->density_blur;
+    forceSchedule = init->schedule;
+    forceChunk = init->chunk;
+    neighborListSkin = init->skin;
+    reorderInterval = 0;
+    knnK = 0;
+
+    const BoidRecord *b = (const BoidRecord *)(m->data + sizeof(DomainInit));
+    ResizeBoids(init->boids);
+    for (uint32_t j = 0; j < init->boids; j++) set_boid(j, &b[j]);
+    const PredatorRecord *p = (const PredatorRecord *)(b + init->boids);
+    ResizePredators(init->predators);
+    for (uint32_t j = 0; j < init->predators; j++) set_predator(j, &p[j]);
+
+    init_spatial_grid(boidCount);
+    build_spatial_grid();
+    init_predator_grid();
+}
+
+static bool in_strip(float x) {
+    return x >= stripX0 && x < stripX1;
+}
+
+// The neighbour a position outside the strip has gone to, through the
+// nearer edge round the torus, and how far past that edge it is
+static int crossing_side(float x, float *past) {
+    float right = x - stripX1, left = stripX0 - x;
+    if (right < 0.0f) right += SCREEN_WIDTH;
+    if (left < 0.0f) left += SCREEN_WIDTH;
+    *past = right < left ? right : left;
+    return right < left ? SIDE_RIGHT : SIDE_LEFT;
+}
+
+static void move_boid(size_t to, size_t from) {
+    boids.x[to] = boids.x[from];
+    boids.y[to] = boids.y[from];
+    boids.vx[to] = boids.vx[from];
+    boids.vy[to] = boids.vy[from];
+    boids.info[to] = boids.info[from];
+}
+
+static void move_predator(size_t to, size_t from) {
+    predators.x[to] = predators.x[from];
+    predators.y[to] = predators.y[from];
+    predators.vx[to] = predators.vx[from];
+    predators.vy[to] = predators.vy[from];
+}
+
+// Drops the halos and moves everything that left the strip, and copies of
+// everything near its edges, into the outboxes
+static void pack_outboxes(void) {
+    EdgeHeader header[2] = {0};
+    boidCount -= boidHaloCount;
+    boidHaloCount = 0;
+    predatorCount -= predatorHaloCount;
+    predatorHaloCount = 0;
+    for (int side = 0; side < 2; side++) {
+        outbox[side].size = 0;
+        message_append(&outbox[side], NULL, sizeof(EdgeHeader));
+    }
+    leftBoids.size = leftPredators.size = 0;
+
+    for (size_t i = 0; i < boidCount;) {
+        if (in_strip(boids.x[i])) {
+            i++;
+            continue;
+        }
+        float past;
+        int side = crossing_side(boids.x[i], &past);
+        BoidRecord r = boid_record(i);
+        message_append(&outbox[side], &r, sizeof(r));
+        if (past < halo) message_append(&leftBoids, &r, sizeof(r));
+        header[side].boid_migrants++;
+        move_boid(i, --boidCount);
+    }
+    for (size_t i = 0; i < boidCount; i++) {
+        BoidRecord r = boid_record(i);
+        if (boids.x[i] < stripX0 + halo) {
+            message_append(&outbox[SIDE_LEFT], &r, sizeof(r));
+            header[SIDE_LEFT].boid_halo++;
+        }
+        if (boids.x[i] >= stripX1 - halo) {
+            message_append(&outbox[SIDE_RIGHT], &r, sizeof(r));
+            header[SIDE_RIGHT].boid_halo++;
+        }
+    }
+
+    for (size_t p = 0; p < predatorCount;) {
+        if (in_strip(predators.x[p])) {
+            p++;
+            continue;
+        }
+        float past;
+        int side = crossing_side(predators.x[p], &past);
+        PredatorRecord r = predator_record(p);
+        message_append(&outbox[side], &r, sizeof(r));
+        if (past < halo) message_append(&leftPredators, &r, sizeof(r));
+        header[side].predator_migrants++;
+        move_predator(p, --predatorCount);
+    }
+    for (size_t p = 0; p < predatorCount; p++) {
+        PredatorRecord r = predator_record(p);
+        if (predators.x[p] < stripX0 + halo) {
+            message_append(&outbox[SIDE_LEFT], &r, sizeof(r));
+            header[SIDE_LEFT].predator_halo++;
+        }
+        if (predators.x[p] >= stripX1 - halo) {
+            message_append(&outbox[SIDE_RIGHT], &r, sizeof(r));
+            header[SIDE_RIGHT].predator_halo++;
+        }
+    }
+
+    for (int side = 0; side < 2; side++) memcpy(outbox[side].data, &header[side], sizeof(EdgeHeader));
+}
+
+// Appends the migrants from both neighbours, then their halos and the
+// migrants that just left
+static void unpack_inboxes(void) {
+    EdgeHeader header[2];
+    const BoidRecord *migrants[2], *boidHalo[2];
+    const PredatorRecord *predatorMigrants[2], *predatorHalo[2];
+    const size_t leftBoidCount = leftBoids.size / sizeof(BoidRecord);
+    const size_t leftPredatorCount = leftPredators.size / sizeof(PredatorRecord);
+    size_t boidsIn = 0, haloIn = leftBoidCount, predatorsIn = 0, predatorHaloIn = leftPredatorCount;
+    for (int side = 0; side < 2; side++) {
+        if (inbox[side].size < sizeof(EdgeHeader)) domain_fail("short message from a neighbour");
+        memcpy(&header[side], inbox[side].data, sizeof(EdgeHeader));
+        migrants[side] = (const BoidRecord *)(inbox[side].data + sizeof(EdgeHeader));
+        boidHalo[side] = migrants[side] + header[side].boid_migrants;
+        predatorMigrants[side] = (const PredatorRecord *)(boidHalo[side] + header[side].boid_halo);
+        predatorHalo[side] = predatorMigrants[side] + header[side].predator_migrants;
+        boidsIn += header[side].boid_migrants;
+        haloIn += header[side].boid_halo;
+        predatorsIn += header[side].predator_migrants;
+        predatorHaloIn += header[side].predator_halo;
+    }
+
+    size_t i = boidCount;
+    ResizeBoids(boidCount + boidsIn + haloIn);
+    for (int side = 0; side < 2; side++) {
+        for (uint32_t j = 0; j < header[side].boid_migrants; j++) set_boid(i++, &migrants[side][j]);
+    }
+    for (int side = 0; side < 2; side++) {
+        for (uint32_t j = 0; j < header[side].boid_halo; j++) set_boid(i++, &boidHalo[side][j]);
+    }
+    for (size_t j = 0; j < leftBoidCount; j++) set_boid(i++, (const BoidRecord *)leftBoids.data + j);
+    boidHaloCount = haloIn;
+
+    size_t p = predatorCount;
+    ResizePredators(predatorCount + predatorsIn + predatorHaloIn);
+    for (int side = 0; side < 2; side++) {
+        for (uint32_t j = 0; j < header[side].predator_migrants; j++) set_predator(p++, &predatorMigrants[side][j]);
+    }
+    for (int side = 0; side < 2; side++) {
+        for (uint32_t j = 0; j < header[side].predator_halo; j++) set_predator(p++, &predatorHalo[side][j]);
+    }
+    for (size_t j = 0; j < leftPredatorCount; j++) set_predator(p++, (const PredatorRecord *)leftPredators.data + j);
+    predatorHaloCount = predatorHaloIn;
+}
+
+// Edge i joins strip i to strip i + 1. Even edges go first, then odd ones,
+// then with an odd number of strips the one that wraps round, so each
+// worker is in at most one exchange at a time.
+static int edge_phase(int edge) {
+    return workerCount % 2 == 1 && edge == workerCount - 1 ? 2 : edge % 2;
+}
+
+static bool exchange_edges(Transport *t) {
+    if (workerCount == 1) return true; // the strip is the whole torus
+    pack_outboxes();
+    for (int phase = 0; phase < 3; phase++) {
+        for (int edge = 0; edge < workerCount; edge++) {
+            if (edge_phase(edge) != phase) continue;
+            const int right = (edge + 1) % workerCount;
+            int side, peer;
+            if (strip == edge) {
+                side = SIDE_RIGHT;
+                peer = right;
+            } else if (strip == right) {
+                side = SIDE_LEFT;
+                peer = edge;
+            } else {
+                continue;
+            }
+            if (!t->exchange(t, peer + 1, &outbox[side], &inbox[side])) return false;
+        }
+    }
+    unpack_inboxes();
+
+    // Slots have changed, so everything indexed by them is rebuilt
+    if (boidCount > grid.capacity) init_spatial_grid(boidCount);
+    build_spatial_grid();
+    InvalidateNeighborLists();
+    build_predator_grid();
+    return true;
+}
+
+static void pack_reply(Message *m, bool gather) {
+    const size_t owned = boidCount - boidHaloCount, ownedPredators = predatorCount - predatorHaloCount;
+    m->size = 0;
+    DomainReply r = { DOMAIN_STEP, (uint32_t)owned, (uint32_t)ownedPredators, (uint32_t)boidHaloCount, gather };
+    message_append(m, &r, sizeof(r));
+    if (!gather) return;
+    BoidRecord *b = message_append(m, NULL, owned * sizeof(BoidRecord));
+    for (size_t i = 0; i < owned; i++) b[i] = boid_record(i);
+    PredatorRecord *p = message_append(m, NULL, ownedPredators * sizeof(PredatorRecord));
+    for (size_t j = 0; j < ownedPredators; j++) p[j] = predator_record(j);
+}
+
+int RunDomainWorker(Transport *t) {
+    Message in = {0}, out = {0};
+    if (!TransportReceive(t, 0, &in) || in.size < sizeof(DomainInit) ||
+        ((const DomainInit *)in.data)->type != DOMAIN_INIT) {
+        fprintf(stderr, "Domain worker %d: no start-up message\n", t->rank);
+        return 1;
+    }
+    worker_init(&in);
+    uint32_t ready = DOMAIN_READY;
+    message_append(&out, &ready, sizeof(ready));
+    if (!TransportSend(t, 0, &out)) return 1;
+
+    int status = 0;
+    for (;;) {
+        if (!TransportReceive(t, 0, &in) || in.size < sizeof(uint32_t)) {
+            status = 1;
+            break;
+        }
+        if (*(const uint32_t *)in.data != DOMAIN_STEP) break;
+        if (in.size < sizeof(DomainCommand)) {
+            fprintf(stderr, "Domain worker %d: short step command\n", t->rank);
+            status = 1;
+            break;
+        }
+        DomainCommand c;
+        memcpy(&c, in.data, sizeof(c));
+        frameCounter = c.frame;
+        flockInteraction = (FlockInteraction)c.interaction;
+        if (!exchange_edges(t)) {
+            status = 1;
+            break;
+        }
+        UpdateBoids(c.frame_time, c.alignment, c.cohesion, c.separation);
+        pack_reply(&out, c.gather);
+        if (!TransportSend(t, 0, &out)) {
+            status = 1;
+            break;
+        }
+    }
+    message_free(&in);
+    message_free(&out);
+    for (int side = 0; side < 2; side++) {
+        message_free(&outbox[side]);
+        message_free(&inbox[side]);
+    }
+    message_free(&leftBoids);
+    message_free(&leftPredators);
+    t->close(t);
+    return status;
+}
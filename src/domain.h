@@ -0,0 +1,66 @@
+#ifndef DOMAIN_H
+#define DOMAIN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "transport.h"
+
+// Domain decomposition over worker processes.
+//
+// StartDomain() splits the torus into vertical strips of whole grid cells
+// and starts one boids_worker process per strip, over a transport.h
+// transport, handing each the boids and predators in its strip. Every
+// DomainStep() is then one tick on all of them:
+//  - each worker sends its two neighbours the boids and predators that have
+//    crossed into their strip, and copies of the ones within domain_halo()
+//    of their shared edge, and takes theirs in return; the strips wrap round;
+//  - it keeps the crossers and appends the copies as halo slots
+//    (boidHaloCount, predatorHaloCount), which the grid and the neighbour
+//    sums see but the force pass and the commit skip, along with copies of
+//    its own leavers still within the halo, and runs UpdateBoids();
+//  - when asked to gather, it sends its own boids and predators back and the
+//    coordinator puts them in the global arrays, each boid back in the slot
+//    its BoidInfo.id had at the start, and rebuilds its grid, so snapshots and recordings work as before.
+//
+// The neighbour exchanges go in two phases (three for an odd number of
+// strips) in which every worker talks to at most one neighbour, so no two
+// exchanges can wait on each other. Flocking and fleeing look no further
+// than the halo, so they come out as in one process up to float rounding;
+// a predator's density lookups reach further and, near a strip edge, only
+// see the boids of the next strip that are in its halo. Worker slots change
+// every tick, so their neighbour lists are rebuilt every tick and nothing is
+// reordered (boid_order.h).
+
+#define DOMAIN_WORKER "boids_worker"   // looked for next to the running program
+#define DOMAIN_MAX_WORKERS 64
+
+// Population of one worker after the last step
+typedef struct DomainWorkerStats {
+    size_t boids;
+    size_t predators;
+    size_t halo;        // boids copied in from the neighbours
+} DomainWorkerStats;
+
+extern int domainWorkers;   // 0 while the simulation runs in this process
+extern TransportKind domainTransport;
+extern DomainWorkerStats domainStats[DOMAIN_MAX_WORKERS];
+
+// Width of the band along a strip edge that neighbours copy, in world units
+float domain_halo(void);
+
+// Hands the current boids and predators to `workers` processes. False, with
+// a message, if the world cannot be split that finely (every strip must be
+// two halos wide), there is more than one species (species.h) or the
+// workers cannot be started.
+bool StartDomain(int workers, TransportKind kind);
+// One tick on the workers, frameCounter already advanced. gather brings
+// their state back into boids and predators; recording needs it every tick.
+void DomainStep(float frameTime, float alignmentWeight, float cohesionWeight, float separationWeight, bool gather);
+void StopDomain(void);
+
+// The worker side: serves the coordinator until told to stop. Returns the
+// exit status.
+int RunDomainWorker(Transport *transport);
+
+#endif // DOMAIN_H
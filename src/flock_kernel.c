@@ -0,0 +1,696 @@
+#include <stddef.h>
+
+#include "flock_kernel.h"
+#include "boids.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FLOCK_KERNEL_X86 1
+#include <immintrin.h>
+#endif
+
+// Boid indices are used as signed 32-bit gather offsets, so the vector
+// kernels assume fewer than 2^31 boids.
+
+typedef struct WorldExtent {
+    float width, height;
+    float half_width, half_height;
+} WorldExtent;
+
+static inline WorldExtent world_extent(void) {
+    return (WorldExtent){ (float)SCREEN_WIDTH, (float)SCREEN_HEIGHT, HALF_SCREEN_WIDTH, HALF_SCREEN_HEIGHT };
+}
+
+// One candidate, shared by the scalar kernel and the vector kernels' tails
+static inline void flock_step(float px, float py, uint32_t self, uint32_t j,
+                              WorldExtent world, FlockSums *sums) {
+    if (j == self) return;
+
+    float dx = boids.x[j] - px;
+    float dy = boids.y[j] - py;
+    dx -= (dx > world.half_width) ? world.width : 0.0f;
+    dx += (dx < -world.half_width) ? world.width : 0.0f;
+    dy -= (dy > world.half_height) ? world.height : 0.0f;
+    dy += (dy < -world.half_height) ? world.height : 0.0f;
+
+    float dist = dx * dx + dy * dy;
+    if (dist == 0.0f) {
+        sums->coincident++;
+    } else if (dist < PROTECTED_RADIUS * PROTECTED_RADIUS) {
+        sums->separation_x -= dx / dist;
+        sums->separation_y -= dy / dist;
+        sums->nearNeighborCount++;
+    } else if (dist < NEIGHBOR_RADIUS * NEIGHBOR_RADIUS) {
+        sums->alignment_x += boids.vx[j];
+        sums->alignment_y += boids.vy[j];
+        sums->offset_x += dx;
+        sums->offset_y += dy;
+        sums->neighborCount++;
+    }
+}
+
+static void flock_kernel_scalar(float px, float py, uint32_t self,
+                                const uint32_t *candidates, uint32_t count,
+                                FlockSums *sums) {
+    WorldExtent world = world_extent();
+    for (uint32_t k = 0; k < count; k++) {
+        flock_step(px, py, self, candidates[k], world, sums);
+    }
+}
+
+// Species of slot j: the number of species that start at or below it
+static inline int species_of(uint32_t j, const FlockSpeciesRow *row) {
+    int s = 0;
+    for (int k = 0; k + 1 < row->count; k++) s += (int32_t)j > row->before[k];
+    return s;
+}
+
+// One candidate of the species kernels, as flock_step
+static inline void flock_species_step(float px, float py, uint32_t self, uint32_t j,
+                                      WorldExtent world, const FlockSpeciesRow *row,
+                                      FlockSpeciesSums *sums) {
+    if (j == self) return;
+    int s = species_of(j, row);
+    if (row->heeded[s] == 0.0f) return;
+
+    float dx = boids.x[j] - px;
+    float dy = boids.y[j] - py;
+    dx -= (dx > world.half_width) ? world.width : 0.0f;
+    dx += (dx < -world.half_width) ? world.width : 0.0f;
+    dy -= (dy > world.half_height) ? world.height : 0.0f;
+    dy += (dy < -world.half_height) ? world.height : 0.0f;
+
+    float dist = dx * dx + dy * dy;
+    if (dist == 0.0f) {
+        sums->sums.coincident++;
+    } else if (dist < PROTECTED_RADIUS * PROTECTED_RADIUS) {
+        float separation = row->separation[s];
+        sums->sums.separation_x -= dx / dist * separation;
+        sums->sums.separation_y -= dy / dist * separation;
+        sums->sums.nearNeighborCount++;
+    } else if (dist < NEIGHBOR_RADIUS * NEIGHBOR_RADIUS) {
+        float alignment = row->alignment[s], cohesion = row->cohesion[s], flee = row->flee[s];
+        sums->sums.alignment_x += boids.vx[j] * alignment;
+        sums->sums.alignment_y += boids.vy[j] * alignment;
+        sums->sums.offset_x += dx * cohesion;
+        sums->sums.offset_y += dy * cohesion;
+        sums->flee_x += dx * flee;
+        sums->flee_y += dy * flee;
+        sums->matched += alignment;
+        sums->sums.neighborCount++;
+    }
+}
+
+static void flock_species_kernel_scalar(float px, float py, uint32_t self,
+                                        const uint32_t *candidates, uint32_t count,
+                                        const FlockSpeciesRow *row, FlockSpeciesSums *sums) {
+    WorldExtent world = world_extent();
+    for (uint32_t k = 0; k < count; k++) {
+        flock_species_step(px, py, self, candidates[k], world, row, sums);
+    }
+}
+
+#ifdef FLOCK_KERNEL_X86
+
+__attribute__((target("sse4.2")))
+static inline float hsum128(__m128 v) {
+    __m128 shuf = _mm_movehdup_ps(v);
+    __m128 sums = _mm_add_ps(v, shuf);
+    shuf = _mm_movehl_ps(shuf, sums);
+    return _mm_cvtss_f32(_mm_add_ss(sums, shuf));
+}
+
+__attribute__((target("sse4.2")))
+static inline int hsum128i(__m128i v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(v);
+}
+
+// Minimum-image offset: subtract or add one period where |d| exceeds half
+#define WRAP128(d, half, full) \
+    _mm_add_ps(_mm_sub_ps((d), _mm_and_ps(_mm_cmpgt_ps((d), (half)), (full))), \
+               _mm_and_ps(_mm_cmplt_ps((d), _mm_sub_ps(_mm_setzero_ps(), (half))), (full)))
+
+__attribute__((target("sse4.2")))
+static void flock_kernel_sse42(float px, float py, uint32_t self,
+                               const uint32_t *candidates, uint32_t count,
+                               FlockSums *sums) {
+    WorldExtent world = world_extent();
+    const __m128 vpx = _mm_set1_ps(px), vpy = _mm_set1_ps(py);
+    const __m128 width = _mm_set1_ps(world.width), half_width = _mm_set1_ps(world.half_width);
+    const __m128 height = _mm_set1_ps(world.height), half_height = _mm_set1_ps(world.half_height);
+    const __m128 protected2 = _mm_set1_ps(PROTECTED_RADIUS * PROTECTED_RADIUS);
+    const __m128 neighbor2 = _mm_set1_ps(NEIGHBOR_RADIUS * NEIGHBOR_RADIUS);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128i vself = _mm_set1_epi32((int)self);
+
+    __m128 sep_x = zero, sep_y = zero, align_x = zero, align_y = zero, off_x = zero, off_y = zero;
+    __m128i near_n = _mm_setzero_si128(), neighbor_n = _mm_setzero_si128(), same_n = _mm_setzero_si128();
+
+    uint32_t k = 0;
+    for (; k + 4 <= count; k += 4) {
+        const uint32_t *j = candidates + k;
+        __m128i idx = _mm_loadu_si128((const __m128i *)j);
+        __m128 xj = _mm_set_ps(boids.x[j[3]], boids.x[j[2]], boids.x[j[1]], boids.x[j[0]]);
+        __m128 yj = _mm_set_ps(boids.y[j[3]], boids.y[j[2]], boids.y[j[1]], boids.y[j[0]]);
+        __m128 vxj = _mm_set_ps(boids.vx[j[3]], boids.vx[j[2]], boids.vx[j[1]], boids.vx[j[0]]);
+        __m128 vyj = _mm_set_ps(boids.vy[j[3]], boids.vy[j[2]], boids.vy[j[1]], boids.vy[j[0]]);
+
+        __m128 valid = _mm_castsi128_ps(_mm_xor_si128(_mm_cmpeq_epi32(idx, vself), _mm_set1_epi32(-1)));
+        __m128 dx = WRAP128(_mm_sub_ps(xj, vpx), half_width, width);
+        __m128 dy = WRAP128(_mm_sub_ps(yj, vpy), half_height, height);
+        __m128 dist = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+
+        __m128 same = _mm_and_ps(valid, _mm_cmpeq_ps(dist, zero));
+        __m128 inside = _mm_andnot_ps(same, valid);
+        __m128 is_near = _mm_and_ps(inside, _mm_cmplt_ps(dist, protected2));
+        __m128 is_neighbor = _mm_andnot_ps(is_near, _mm_and_ps(inside, _mm_cmplt_ps(dist, neighbor2)));
+
+        __m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), dist);
+        sep_x = _mm_sub_ps(sep_x, _mm_and_ps(is_near, _mm_mul_ps(dx, inv)));
+        sep_y = _mm_sub_ps(sep_y, _mm_and_ps(is_near, _mm_mul_ps(dy, inv)));
+        align_x = _mm_add_ps(align_x, _mm_and_ps(is_neighbor, vxj));
+        align_y = _mm_add_ps(align_y, _mm_and_ps(is_neighbor, vyj));
+        off_x = _mm_add_ps(off_x, _mm_and_ps(is_neighbor, dx));
+        off_y = _mm_add_ps(off_y, _mm_and_ps(is_neighbor, dy));
+
+        // Masks are all ones (-1) per selected lane
+        near_n = _mm_sub_epi32(near_n, _mm_castps_si128(is_near));
+        neighbor_n = _mm_sub_epi32(neighbor_n, _mm_castps_si128(is_neighbor));
+        same_n = _mm_sub_epi32(same_n, _mm_castps_si128(same));
+    }
+
+    sums->separation_x += hsum128(sep_x);
+    sums->separation_y += hsum128(sep_y);
+    sums->alignment_x += hsum128(align_x);
+    sums->alignment_y += hsum128(align_y);
+    sums->offset_x += hsum128(off_x);
+    sums->offset_y += hsum128(off_y);
+    sums->nearNeighborCount += hsum128i(near_n);
+    sums->neighborCount += hsum128i(neighbor_n);
+    sums->coincident += hsum128i(same_n);
+
+    for (; k < count; k++) flock_step(px, py, self, candidates[k], world, sums);
+}
+
+// SSE has no 8-lane permute, so the weights are picked lane by lane
+#define ROW128(weights, s0, s1, s2, s3) _mm_set_ps((weights)[s3], (weights)[s2], (weights)[s1], (weights)[s0])
+
+__attribute__((target("sse4.2")))
+static void flock_species_kernel_sse42(float px, float py, uint32_t self,
+                                       const uint32_t *candidates, uint32_t count,
+                                       const FlockSpeciesRow *row, FlockSpeciesSums *sums) {
+    WorldExtent world = world_extent();
+    const __m128 vpx = _mm_set1_ps(px), vpy = _mm_set1_ps(py);
+    const __m128 width = _mm_set1_ps(world.width), half_width = _mm_set1_ps(world.half_width);
+    const __m128 height = _mm_set1_ps(world.height), half_height = _mm_set1_ps(world.half_height);
+    const __m128 protected2 = _mm_set1_ps(PROTECTED_RADIUS * PROTECTED_RADIUS);
+    const __m128 neighbor2 = _mm_set1_ps(NEIGHBOR_RADIUS * NEIGHBOR_RADIUS);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128i vself = _mm_set1_epi32((int)self);
+    __m128i before[FLOCK_KERNEL_SPECIES - 1];
+    for (int b = 0; b + 1 < row->count; b++) before[b] = _mm_set1_epi32(row->before[b]);
+
+    __m128 sep_x = zero, sep_y = zero, align_x = zero, align_y = zero, off_x = zero, off_y = zero;
+    __m128 flee_x = zero, flee_y = zero, matched = zero;
+    __m128i near_n = _mm_setzero_si128(), neighbor_n = _mm_setzero_si128(), same_n = _mm_setzero_si128();
+
+    uint32_t k = 0;
+    for (; k + 4 <= count; k += 4) {
+        const uint32_t *j = candidates + k;
+        __m128i idx = _mm_loadu_si128((const __m128i *)j);
+        __m128 xj = _mm_set_ps(boids.x[j[3]], boids.x[j[2]], boids.x[j[1]], boids.x[j[0]]);
+        __m128 yj = _mm_set_ps(boids.y[j[3]], boids.y[j[2]], boids.y[j[1]], boids.y[j[0]]);
+        __m128 vxj = _mm_set_ps(boids.vx[j[3]], boids.vx[j[2]], boids.vx[j[1]], boids.vx[j[0]]);
+        __m128 vyj = _mm_set_ps(boids.vy[j[3]], boids.vy[j[2]], boids.vy[j[1]], boids.vy[j[0]]);
+
+        __m128i species = _mm_setzero_si128();
+        for (int b = 0; b + 1 < row->count; b++) species = _mm_sub_epi32(species, _mm_cmpgt_epi32(idx, before[b]));
+        int s0 = _mm_extract_epi32(species, 0), s1 = _mm_extract_epi32(species, 1);
+        int s2 = _mm_extract_epi32(species, 2), s3 = _mm_extract_epi32(species, 3);
+        __m128 w_align = ROW128(row->alignment, s0, s1, s2, s3);
+        __m128 w_cohesion = ROW128(row->cohesion, s0, s1, s2, s3);
+        __m128 w_separation = ROW128(row->separation, s0, s1, s2, s3);
+        __m128 w_flee = ROW128(row->flee, s0, s1, s2, s3);
+        __m128 heeded = _mm_cmpneq_ps(ROW128(row->heeded, s0, s1, s2, s3), zero);
+
+        __m128 valid = _mm_andnot_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(idx, vself)), heeded);
+        __m128 dx = WRAP128(_mm_sub_ps(xj, vpx), half_width, width);
+        __m128 dy = WRAP128(_mm_sub_ps(yj, vpy), half_height, height);
+        __m128 dist = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+
+        __m128 same = _mm_and_ps(valid, _mm_cmpeq_ps(dist, zero));
+        __m128 inside = _mm_andnot_ps(same, valid);
+        __m128 is_near = _mm_and_ps(inside, _mm_cmplt_ps(dist, protected2));
+        __m128 is_neighbor = _mm_andnot_ps(is_near, _mm_and_ps(inside, _mm_cmplt_ps(dist, neighbor2)));
+
+        __m128 inv = _mm_div_ps(w_separation, dist);
+        sep_x = _mm_sub_ps(sep_x, _mm_and_ps(is_near, _mm_mul_ps(dx, inv)));
+        sep_y = _mm_sub_ps(sep_y, _mm_and_ps(is_near, _mm_mul_ps(dy, inv)));
+        align_x = _mm_add_ps(align_x, _mm_and_ps(is_neighbor, _mm_mul_ps(vxj, w_align)));
+        align_y = _mm_add_ps(align_y, _mm_and_ps(is_neighbor, _mm_mul_ps(vyj, w_align)));
+        off_x = _mm_add_ps(off_x, _mm_and_ps(is_neighbor, _mm_mul_ps(dx, w_cohesion)));
+        off_y = _mm_add_ps(off_y, _mm_and_ps(is_neighbor, _mm_mul_ps(dy, w_cohesion)));
+        flee_x = _mm_add_ps(flee_x, _mm_and_ps(is_neighbor, _mm_mul_ps(dx, w_flee)));
+        flee_y = _mm_add_ps(flee_y, _mm_and_ps(is_neighbor, _mm_mul_ps(dy, w_flee)));
+        matched = _mm_add_ps(matched, _mm_and_ps(is_neighbor, w_align));
+
+        near_n = _mm_sub_epi32(near_n, _mm_castps_si128(is_near));
+        neighbor_n = _mm_sub_epi32(neighbor_n, _mm_castps_si128(is_neighbor));
+        same_n = _mm_sub_epi32(same_n, _mm_castps_si128(same));
+    }
+
+    sums->sums.separation_x += hsum128(sep_x);
+    sums->sums.separation_y += hsum128(sep_y);
+    sums->sums.alignment_x += hsum128(align_x);
+    sums->sums.alignment_y += hsum128(align_y);
+    sums->sums.offset_x += hsum128(off_x);
+    sums->sums.offset_y += hsum128(off_y);
+    sums->flee_x += hsum128(flee_x);
+    sums->flee_y += hsum128(flee_y);
+    sums->matched += hsum128(matched);
+    sums->sums.nearNeighborCount += hsum128i(near_n);
+    sums->sums.neighborCount += hsum128i(neighbor_n);
+    sums->sums.coincident += hsum128i(same_n);
+
+    for (; k < count; k++) flock_species_step(px, py, self, candidates[k], world, row, sums);
+}
+
+__attribute__((target("avx2")))
+static inline float hsum256(__m256 v) {
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    return hsum128(_mm_add_ps(lo, hi));
+}
+
+__attribute__((target("avx2")))
+static inline int hsum256i(__m256i v) {
+    __m128i lo = _mm256_castsi256_si128(v);
+    __m128i hi = _mm256_extracti128_si256(v, 1);
+    return hsum128i(_mm_add_epi32(lo, hi));
+}
+
+#define WRAP256(d, half, full) \
+    _mm256_add_ps(_mm256_sub_ps((d), _mm256_and_ps(_mm256_cmp_ps((d), (half), _CMP_GT_OQ), (full))), \
+                  _mm256_and_ps(_mm256_cmp_ps((d), _mm256_sub_ps(_mm256_setzero_ps(), (half)), _CMP_LT_OQ), (full)))
+
+__attribute__((target("avx2")))
+static void flock_kernel_avx2(float px, float py, uint32_t self,
+                              const uint32_t *candidates, uint32_t count,
+                              FlockSums *sums) {
+    WorldExtent world = world_extent();
+    const __m256 vpx = _mm256_set1_ps(px), vpy = _mm256_set1_ps(py);
+    const __m256 width = _mm256_set1_ps(world.width), half_width = _mm256_set1_ps(world.half_width);
+    const __m256 height = _mm256_set1_ps(world.height), half_height = _mm256_set1_ps(world.half_height);
+    const __m256 protected2 = _mm256_set1_ps(PROTECTED_RADIUS * PROTECTED_RADIUS);
+    const __m256 neighbor2 = _mm256_set1_ps(NEIGHBOR_RADIUS * NEIGHBOR_RADIUS);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256i vself = _mm256_set1_epi32((int)self);
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+    __m256 sep_x = zero, sep_y = zero, align_x = zero, align_y = zero, off_x = zero, off_y = zero;
+    __m256i near_n = _mm256_setzero_si256(), neighbor_n = _mm256_setzero_si256(), same_n = _mm256_setzero_si256();
+
+    for (uint32_t k = 0; k < count; k += 8) {
+        // Lanes past the end of the run are masked off, including their loads
+        __m256i live = _mm256_cmpgt_epi32(_mm256_set1_epi32((int)(count - k)), lane);
+        __m256i idx = _mm256_maskload_epi32((const int *)(candidates + k), live);
+        __m256 live_ps = _mm256_castsi256_ps(live);
+        __m256 xj = _mm256_mask_i32gather_ps(zero, boids.x, idx, live_ps, 4);
+        __m256 yj = _mm256_mask_i32gather_ps(zero, boids.y, idx, live_ps, 4);
+        __m256 vxj = _mm256_mask_i32gather_ps(zero, boids.vx, idx, live_ps, 4);
+        __m256 vyj = _mm256_mask_i32gather_ps(zero, boids.vy, idx, live_ps, 4);
+
+        __m256 valid = _mm256_castsi256_ps(_mm256_andnot_si256(_mm256_cmpeq_epi32(idx, vself), live));
+        __m256 dx = WRAP256(_mm256_sub_ps(xj, vpx), half_width, width);
+        __m256 dy = WRAP256(_mm256_sub_ps(yj, vpy), half_height, height);
+        __m256 dist = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+
+        __m256 same = _mm256_and_ps(valid, _mm256_cmp_ps(dist, zero, _CMP_EQ_OQ));
+        __m256 inside = _mm256_andnot_ps(same, valid);
+        __m256 is_near = _mm256_and_ps(inside, _mm256_cmp_ps(dist, protected2, _CMP_LT_OQ));
+        __m256 is_neighbor = _mm256_andnot_ps(is_near, _mm256_and_ps(inside, _mm256_cmp_ps(dist, neighbor2, _CMP_LT_OQ)));
+
+        __m256 inv = _mm256_div_ps(_mm256_set1_ps(1.0f), dist);
+        sep_x = _mm256_sub_ps(sep_x, _mm256_and_ps(is_near, _mm256_mul_ps(dx, inv)));
+        sep_y = _mm256_sub_ps(sep_y, _mm256_and_ps(is_near, _mm256_mul_ps(dy, inv)));
+        align_x = _mm256_add_ps(align_x, _mm256_and_ps(is_neighbor, vxj));
+        align_y = _mm256_add_ps(align_y, _mm256_and_ps(is_neighbor, vyj));
+        off_x = _mm256_add_ps(off_x, _mm256_and_ps(is_neighbor, dx));
+        off_y = _mm256_add_ps(off_y, _mm256_and_ps(is_neighbor, dy));
+
+        near_n = _mm256_sub_epi32(near_n, _mm256_castps_si256(is_near));
+        neighbor_n = _mm256_sub_epi32(neighbor_n, _mm256_castps_si256(is_neighbor));
+        same_n = _mm256_sub_epi32(same_n, _mm256_castps_si256(same));
+    }
+
+    sums->separation_x += hsum256(sep_x);
+    sums->separation_y += hsum256(sep_y);
+    sums->alignment_x += hsum256(align_x);
+    sums->alignment_y += hsum256(align_y);
+    sums->offset_x += hsum256(off_x);
+    sums->offset_y += hsum256(off_y);
+    sums->nearNeighborCount += hsum256i(near_n);
+    sums->neighborCount += hsum256i(neighbor_n);
+    sums->coincident += hsum256i(same_n);
+}
+
+// The vector species kernels are built once per species count, so the
+// boundaries stay in registers and the compares unroll
+#define FLOCK_SPECIES_DISPATCH(body) \
+    switch (row->count) { \
+        case 1: body(px, py, self, candidates, count, row, sums, 0); break; \
+        case 2: body(px, py, self, candidates, count, row, sums, 1); break; \
+        case 3: body(px, py, self, candidates, count, row, sums, 2); break; \
+        case 4: body(px, py, self, candidates, count, row, sums, 3); break; \
+        case 5: body(px, py, self, candidates, count, row, sums, 4); break; \
+        case 6: body(px, py, self, candidates, count, row, sums, 5); break; \
+        case 7: body(px, py, self, candidates, count, row, sums, 6); break; \
+        default: body(px, py, self, candidates, count, row, sums, 7); break; \
+    }
+
+__attribute__((target("avx2"), always_inline))
+static inline void flock_species_avx2(float px, float py, uint32_t self,
+                                      const uint32_t *candidates, uint32_t count,
+                                      const FlockSpeciesRow *row, FlockSpeciesSums *sums,
+                                      const int boundaries) {
+    WorldExtent world = world_extent();
+    const __m256 vpx = _mm256_set1_ps(px), vpy = _mm256_set1_ps(py);
+    const __m256 width = _mm256_set1_ps(world.width), half_width = _mm256_set1_ps(world.half_width);
+    const __m256 height = _mm256_set1_ps(world.height), half_height = _mm256_set1_ps(world.half_height);
+    const __m256 protected2 = _mm256_set1_ps(PROTECTED_RADIUS * PROTECTED_RADIUS);
+    const __m256 neighbor2 = _mm256_set1_ps(NEIGHBOR_RADIUS * NEIGHBOR_RADIUS);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256i vself = _mm256_set1_epi32((int)self);
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    // The row, one lane per species
+    const __m256 row_align = _mm256_loadu_ps(row->alignment);
+    const __m256 row_cohesion = _mm256_loadu_ps(row->cohesion);
+    const __m256 row_separation = _mm256_loadu_ps(row->separation);
+    const __m256 row_flee = _mm256_loadu_ps(row->flee);
+    const __m256 row_heeded = _mm256_loadu_ps(row->heeded);
+    __m256i before[FLOCK_KERNEL_SPECIES - 1];
+    for (int b = 0; b < boundaries; b++) before[b] = _mm256_set1_epi32(row->before[b]);
+
+    __m256 sep_x = zero, sep_y = zero, align_x = zero, align_y = zero, off_x = zero, off_y = zero;
+    __m256 flee_x = zero, flee_y = zero, matched = zero;
+    __m256i near_n = _mm256_setzero_si256(), neighbor_n = _mm256_setzero_si256(), same_n = _mm256_setzero_si256();
+
+    for (uint32_t k = 0; k < count; k += 8) {
+        __m256i live = _mm256_cmpgt_epi32(_mm256_set1_epi32((int)(count - k)), lane);
+        __m256i idx = _mm256_maskload_epi32((const int *)(candidates + k), live);
+        __m256 live_ps = _mm256_castsi256_ps(live);
+        __m256 xj = _mm256_mask_i32gather_ps(zero, boids.x, idx, live_ps, 4);
+        __m256 yj = _mm256_mask_i32gather_ps(zero, boids.y, idx, live_ps, 4);
+        __m256 vxj = _mm256_mask_i32gather_ps(zero, boids.vx, idx, live_ps, 4);
+        __m256 vyj = _mm256_mask_i32gather_ps(zero, boids.vy, idx, live_ps, 4);
+
+        __m256i species = _mm256_setzero_si256();
+        for (int b = 0; b < boundaries; b++) species = _mm256_sub_epi32(species, _mm256_cmpgt_epi32(idx, before[b]));
+        __m256 w_align = _mm256_permutevar8x32_ps(row_align, species);
+        __m256 w_cohesion = _mm256_permutevar8x32_ps(row_cohesion, species);
+        __m256 w_separation = _mm256_permutevar8x32_ps(row_separation, species);
+        __m256 w_flee = _mm256_permutevar8x32_ps(row_flee, species);
+        __m256 heeded = _mm256_cmp_ps(_mm256_permutevar8x32_ps(row_heeded, species), zero, _CMP_NEQ_OQ);
+
+        __m256 valid = _mm256_and_ps(heeded, _mm256_castsi256_ps(_mm256_andnot_si256(_mm256_cmpeq_epi32(idx, vself), live)));
+        __m256 dx = WRAP256(_mm256_sub_ps(xj, vpx), half_width, width);
+        __m256 dy = WRAP256(_mm256_sub_ps(yj, vpy), half_height, height);
+        __m256 dist = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+
+        __m256 same = _mm256_and_ps(valid, _mm256_cmp_ps(dist, zero, _CMP_EQ_OQ));
+        __m256 inside = _mm256_andnot_ps(same, valid);
+        __m256 is_near = _mm256_and_ps(inside, _mm256_cmp_ps(dist, protected2, _CMP_LT_OQ));
+        __m256 is_neighbor = _mm256_andnot_ps(is_near, _mm256_and_ps(inside, _mm256_cmp_ps(dist, neighbor2, _CMP_LT_OQ)));
+
+        __m256 inv = _mm256_div_ps(w_separation, dist);
+        sep_x = _mm256_sub_ps(sep_x, _mm256_and_ps(is_near, _mm256_mul_ps(dx, inv)));
+        sep_y = _mm256_sub_ps(sep_y, _mm256_and_ps(is_near, _mm256_mul_ps(dy, inv)));
+        align_x = _mm256_add_ps(align_x, _mm256_and_ps(is_neighbor, _mm256_mul_ps(vxj, w_align)));
+        align_y = _mm256_add_ps(align_y, _mm256_and_ps(is_neighbor, _mm256_mul_ps(vyj, w_align)));
+        off_x = _mm256_add_ps(off_x, _mm256_and_ps(is_neighbor, _mm256_mul_ps(dx, w_cohesion)));
+        off_y = _mm256_add_ps(off_y, _mm256_and_ps(is_neighbor, _mm256_mul_ps(dy, w_cohesion)));
+        flee_x = _mm256_add_ps(flee_x, _mm256_and_ps(is_neighbor, _mm256_mul_ps(dx, w_flee)));
+        flee_y = _mm256_add_ps(flee_y, _mm256_and_ps(is_neighbor, _mm256_mul_ps(dy, w_flee)));
+        matched = _mm256_add_ps(matched, _mm256_and_ps(is_neighbor, w_align));
+
+        near_n = _mm256_sub_epi32(near_n, _mm256_castps_si256(is_near));
+        neighbor_n = _mm256_sub_epi32(neighbor_n, _mm256_castps_si256(is_neighbor));
+        same_n = _mm256_sub_epi32(same_n, _mm256_castps_si256(same));
+    }
+
+    sums->sums.separation_x += hsum256(sep_x);
+    sums->sums.separation_y += hsum256(sep_y);
+    sums->sums.alignment_x += hsum256(align_x);
+    sums->sums.alignment_y += hsum256(align_y);
+    sums->sums.offset_x += hsum256(off_x);
+    sums->sums.offset_y += hsum256(off_y);
+    sums->flee_x += hsum256(flee_x);
+    sums->flee_y += hsum256(flee_y);
+    sums->matched += hsum256(matched);
+    sums->sums.nearNeighborCount += hsum256i(near_n);
+    sums->sums.neighborCount += hsum256i(neighbor_n);
+    sums->sums.coincident += hsum256i(same_n);
+}
+
+__attribute__((target("avx2")))
+static void flock_species_kernel_avx2(float px, float py, uint32_t self,
+                                      const uint32_t *candidates, uint32_t count,
+                                      const FlockSpeciesRow *row, FlockSpeciesSums *sums) {
+    FLOCK_SPECIES_DISPATCH(flock_species_avx2)
+}
+
+__attribute__((target("avx512f")))
+static inline __m512 wrap512(__m512 d, __m512 half, __m512 full) {
+    d = _mm512_mask_sub_ps(d, _mm512_cmp_ps_mask(d, half, _CMP_GT_OQ), d, full);
+    __m512 neg_half = _mm512_sub_ps(_mm512_setzero_ps(), half);
+    return _mm512_mask_add_ps(d, _mm512_cmp_ps_mask(d, neg_half, _CMP_LT_OQ), d, full);
+}
+
+__attribute__((target("avx512f")))
+static void flock_kernel_avx512(float px, float py, uint32_t self,
+                                const uint32_t *candidates, uint32_t count,
+                                FlockSums *sums) {
+    WorldExtent world = world_extent();
+    const __m512 vpx = _mm512_set1_ps(px), vpy = _mm512_set1_ps(py);
+    const __m512 width = _mm512_set1_ps(world.width), half_width = _mm512_set1_ps(world.half_width);
+    const __m512 height = _mm512_set1_ps(world.height), half_height = _mm512_set1_ps(world.half_height);
+    const __m512 protected2 = _mm512_set1_ps(PROTECTED_RADIUS * PROTECTED_RADIUS);
+    const __m512 neighbor2 = _mm512_set1_ps(NEIGHBOR_RADIUS * NEIGHBOR_RADIUS);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 one = _mm512_set1_ps(1.0f);
+    const __m512i vself = _mm512_set1_epi32((int)self);
+
+    __m512 sep_x = zero, sep_y = zero, align_x = zero, align_y = zero, off_x = zero, off_y = zero;
+    int near_n = 0, neighbor_n = 0, same_n = 0;
+
+    for (uint32_t k = 0; k < count; k += 16) {
+        uint32_t remaining = count - k;
+        __mmask16 live = remaining >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << remaining) - 1u);
+        __m512i idx = _mm512_maskz_loadu_epi32(live, candidates + k);
+        __m512 xj = _mm512_mask_i32gather_ps(zero, live, idx, boids.x, 4);
+        __m512 yj = _mm512_mask_i32gather_ps(zero, live, idx, boids.y, 4);
+        __m512 vxj = _mm512_mask_i32gather_ps(zero, live, idx, boids.vx, 4);
+        __m512 vyj = _mm512_mask_i32gather_ps(zero, live, idx, boids.vy, 4);
+
+        __mmask16 valid = _mm512_mask_cmpneq_epi32_mask(live, idx, vself);
+        __m512 dx = wrap512(_mm512_sub_ps(xj, vpx), half_width, width);
+        __m512 dy = wrap512(_mm512_sub_ps(yj, vpy), half_height, height);
+        __m512 dist = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+
+        __mmask16 same = _mm512_mask_cmp_ps_mask(valid, dist, zero, _CMP_EQ_OQ);
+        __mmask16 inside = valid & (__mmask16)~same;
+        __mmask16 is_near = _mm512_mask_cmp_ps_mask(inside, dist, protected2, _CMP_LT_OQ);
+        __mmask16 is_neighbor = _mm512_mask_cmp_ps_mask(inside & (__mmask16)~is_near, dist, neighbor2, _CMP_LT_OQ);
+
+        __m512 inv = _mm512_maskz_div_ps(is_near, one, dist);
+        sep_x = _mm512_mask_sub_ps(sep_x, is_near, sep_x, _mm512_mul_ps(dx, inv));
+        sep_y = _mm512_mask_sub_ps(sep_y, is_near, sep_y, _mm512_mul_ps(dy, inv));
+        align_x = _mm512_mask_add_ps(align_x, is_neighbor, align_x, vxj);
+        align_y = _mm512_mask_add_ps(align_y, is_neighbor, align_y, vyj);
+        off_x = _mm512_mask_add_ps(off_x, is_neighbor, off_x, dx);
+        off_y = _mm512_mask_add_ps(off_y, is_neighbor, off_y, dy);
+
+        near_n += __builtin_popcount(is_near);
+        neighbor_n += __builtin_popcount(is_neighbor);
+        same_n += __builtin_popcount(same);
+    }
+
+    sums->separation_x += _mm512_reduce_add_ps(sep_x);
+    sums->separation_y += _mm512_reduce_add_ps(sep_y);
+    sums->alignment_x += _mm512_reduce_add_ps(align_x);
+    sums->alignment_y += _mm512_reduce_add_ps(align_y);
+    sums->offset_x += _mm512_reduce_add_ps(off_x);
+    sums->offset_y += _mm512_reduce_add_ps(off_y);
+    sums->nearNeighborCount += near_n;
+    sums->neighborCount += neighbor_n;
+    sums->coincident += same_n;
+}
+
+__attribute__((target("avx512f"), always_inline))
+static inline void flock_species_avx512(float px, float py, uint32_t self,
+                                        const uint32_t *candidates, uint32_t count,
+                                        const FlockSpeciesRow *row, FlockSpeciesSums *sums,
+                                        const int boundaries) {
+    WorldExtent world = world_extent();
+    const __m512 vpx = _mm512_set1_ps(px), vpy = _mm512_set1_ps(py);
+    const __m512 width = _mm512_set1_ps(world.width), half_width = _mm512_set1_ps(world.half_width);
+    const __m512 height = _mm512_set1_ps(world.height), half_height = _mm512_set1_ps(world.half_height);
+    const __m512 protected2 = _mm512_set1_ps(PROTECTED_RADIUS * PROTECTED_RADIUS);
+    const __m512 neighbor2 = _mm512_set1_ps(NEIGHBOR_RADIUS * NEIGHBOR_RADIUS);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512i vself = _mm512_set1_epi32((int)self);
+    const __m512i one_i = _mm512_set1_epi32(1);
+    // The row in the low eight lanes; species never index past them
+    const __m512 row_align = _mm512_castps256_ps512(_mm256_loadu_ps(row->alignment));
+    const __m512 row_cohesion = _mm512_castps256_ps512(_mm256_loadu_ps(row->cohesion));
+    const __m512 row_separation = _mm512_castps256_ps512(_mm256_loadu_ps(row->separation));
+    const __m512 row_flee = _mm512_castps256_ps512(_mm256_loadu_ps(row->flee));
+    const __m512 row_heeded = _mm512_castps256_ps512(_mm256_loadu_ps(row->heeded));
+    __m512i before[FLOCK_KERNEL_SPECIES - 1];
+    for (int b = 0; b < boundaries; b++) before[b] = _mm512_set1_epi32(row->before[b]);
+
+    __m512 sep_x = zero, sep_y = zero, align_x = zero, align_y = zero, off_x = zero, off_y = zero;
+    __m512 flee_x = zero, flee_y = zero, matched = zero;
+    int near_n = 0, neighbor_n = 0, same_n = 0;
+
+    for (uint32_t k = 0; k < count; k += 16) {
+        uint32_t remaining = count - k;
+        __mmask16 live = remaining >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << remaining) - 1u);
+        __m512i idx = _mm512_maskz_loadu_epi32(live, candidates + k);
+        __m512 xj = _mm512_mask_i32gather_ps(zero, live, idx, boids.x, 4);
+        __m512 yj = _mm512_mask_i32gather_ps(zero, live, idx, boids.y, 4);
+        __m512 vxj = _mm512_mask_i32gather_ps(zero, live, idx, boids.vx, 4);
+        __m512 vyj = _mm512_mask_i32gather_ps(zero, live, idx, boids.vy, 4);
+
+        __m512i species = _mm512_setzero_si512();
+        for (int b = 0; b < boundaries; b++) {
+            species = _mm512_mask_add_epi32(species, _mm512_cmpgt_epi32_mask(idx, before[b]), species, one_i);
+        }
+        __m512 w_align = _mm512_permutexvar_ps(species, row_align);
+        __m512 w_cohesion = _mm512_permutexvar_ps(species, row_cohesion);
+        __m512 w_separation = _mm512_permutexvar_ps(species, row_separation);
+        __m512 w_flee = _mm512_permutexvar_ps(species, row_flee);
+        __mmask16 heeded = _mm512_cmp_ps_mask(_mm512_permutexvar_ps(species, row_heeded), zero, _CMP_NEQ_OQ);
+
+        __mmask16 valid = _mm512_mask_cmpneq_epi32_mask(live & heeded, idx, vself);
+        __m512 dx = wrap512(_mm512_sub_ps(xj, vpx), half_width, width);
+        __m512 dy = wrap512(_mm512_sub_ps(yj, vpy), half_height, height);
+        __m512 dist = _mm512_add_ps(_mm512_mul_ps(dx, dx), _mm512_mul_ps(dy, dy));
+
+        __mmask16 same = _mm512_mask_cmp_ps_mask(valid, dist, zero, _CMP_EQ_OQ);
+        __mmask16 inside = valid & (__mmask16)~same;
+        __mmask16 is_near = _mm512_mask_cmp_ps_mask(inside, dist, protected2, _CMP_LT_OQ);
+        __mmask16 is_neighbor = _mm512_mask_cmp_ps_mask(inside & (__mmask16)~is_near, dist, neighbor2, _CMP_LT_OQ);
+
+        __m512 inv = _mm512_maskz_div_ps(is_near, w_separation, dist);
+        sep_x = _mm512_mask_sub_ps(sep_x, is_near, sep_x, _mm512_mul_ps(dx, inv));
+        sep_y = _mm512_mask_sub_ps(sep_y, is_near, sep_y, _mm512_mul_ps(dy, inv));
+        // Fused, as a weight of one leaves the product exact
+        align_x = _mm512_mask3_fmadd_ps(vxj, w_align, align_x, is_neighbor);
+        align_y = _mm512_mask3_fmadd_ps(vyj, w_align, align_y, is_neighbor);
+        off_x = _mm512_mask3_fmadd_ps(dx, w_cohesion, off_x, is_neighbor);
+        off_y = _mm512_mask3_fmadd_ps(dy, w_cohesion, off_y, is_neighbor);
+        flee_x = _mm512_mask3_fmadd_ps(dx, w_flee, flee_x, is_neighbor);
+        flee_y = _mm512_mask3_fmadd_ps(dy, w_flee, flee_y, is_neighbor);
+        matched = _mm512_mask_add_ps(matched, is_neighbor, matched, w_align);
+
+        near_n += __builtin_popcount(is_near);
+        neighbor_n += __builtin_popcount(is_neighbor);
+        same_n += __builtin_popcount(same);
+    }
+
+    sums->sums.separation_x += _mm512_reduce_add_ps(sep_x);
+    sums->sums.separation_y += _mm512_reduce_add_ps(sep_y);
+    sums->sums.alignment_x += _mm512_reduce_add_ps(align_x);
+    sums->sums.alignment_y += _mm512_reduce_add_ps(align_y);
+    sums->sums.offset_x += _mm512_reduce_add_ps(off_x);
+    sums->sums.offset_y += _mm512_reduce_add_ps(off_y);
+    sums->flee_x += _mm512_reduce_add_ps(flee_x);
+    sums->flee_y += _mm512_reduce_add_ps(flee_y);
+    sums->matched += _mm512_reduce_add_ps(matched);
+    sums->sums.nearNeighborCount += near_n;
+    sums->sums.neighborCount += neighbor_n;
+    sums->sums.coincident += same_n;
+}
+
+__attribute__((target("avx512f")))
+static void flock_species_kernel_avx512(float px, float py, uint32_t self,
+                                        const uint32_t *candidates, uint32_t count,
+                                        const FlockSpeciesRow *row, FlockSpeciesSums *sums) {
+    FLOCK_SPECIES_DISPATCH(flock_species_avx512)
+}
+
+#endif // FLOCK_KERNEL_X86
+
+static const char *kernel_names[FLOCK_KERNEL_COUNT] = { "scalar", "sse4.2", "avx2", "avx512" };
+
+static bool isa_chosen = false;
+static FlockKernelIsa current_isa = FLOCK_KERNEL_SCALAR;
+FlockKernelFn flock_kernel = flock_kernel_scalar;
+FlockSpeciesKernelFn flock_species_kernel = flock_species_kernel_scalar;
+
+void flock_kernel_init(void) {
+    if (!isa_chosen) flock_kernel_select(flock_kernel_best());
+}
+
+const char *flock_kernel_name(FlockKernelIsa isa) {
+    return (isa >= 0 && isa < FLOCK_KERNEL_COUNT) ? kernel_names[isa] : "unknown";
+}
+
+bool flock_kernel_supported(FlockKernelIsa isa) {
+    switch (isa) {
+        case FLOCK_KERNEL_SCALAR: return true;
+#ifdef FLOCK_KERNEL_X86
+        case FLOCK_KERNEL_SSE42: return __builtin_cpu_supports("sse4.2");
+        case FLOCK_KERNEL_AVX2: return __builtin_cpu_supports("avx2");
+        case FLOCK_KERNEL_AVX512: return __builtin_cpu_supports("avx512f");
+#endif
+        default: return false;
+    }
+}
+
+FlockKernelFn flock_kernel_get(FlockKernelIsa isa) {
+    if (!flock_kernel_supported(isa)) return NULL;
+    switch (isa) {
+#ifdef FLOCK_KERNEL_X86
+        case FLOCK_KERNEL_SSE42: return flock_kernel_sse42;
+        case FLOCK_KERNEL_AVX2: return flock_kernel_avx2;
+        case FLOCK_KERNEL_AVX512: return flock_kernel_avx512;
+#endif
+        default: return flock_kernel_scalar;
+    }
+}
+
+FlockSpeciesKernelFn flock_species_kernel_get(FlockKernelIsa isa) {
+    if (!flock_kernel_supported(isa)) return NULL;
+    switch (isa) {
+#ifdef FLOCK_KERNEL_X86
+        case FLOCK_KERNEL_SSE42: return flock_species_kernel_sse42;
+        case FLOCK_KERNEL_AVX2: return flock_species_kernel_avx2;
+        case FLOCK_KERNEL_AVX512: return flock_species_kernel_avx512;
+#endif
+        default: return flock_species_kernel_scalar;
+    }
+}
+
+FlockKernelIsa flock_kernel_best(void) {
+    for (int isa = FLOCK_KERNEL_COUNT - 1; isa > FLOCK_KERNEL_SCALAR; isa--) {
+        if (flock_kernel_supported((FlockKernelIsa)isa)) return (FlockKernelIsa)isa;
+    }
+    return FLOCK_KERNEL_SCALAR;
+}
+
+FlockKernelIsa flock_kernel_current(void) {
+    return current_isa;
+}
+
+bool flock_kernel_select(FlockKernelIsa isa) {
+    FlockKernelFn fn = flock_kernel_get(isa);
+    if (!fn) return false;
+    flock_kernel = fn;
+    flock_species_kernel = flock_species_kernel_get(isa);
+    current_isa = isa;
+    isa_chosen = true;
+    return true;
+}
@@ -0,0 +1,97 @@
+#ifndef FLOCK_KERNEL_H
+#define FLOCK_KERNEL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Neighbour-interaction kernel used by ComputeFlockForces.
+//
+// A kernel takes one boid and a run of candidate neighbours (indices into the
+// boid arrays) and accumulates the raw flocking sums. Wrapping onto the torus
+// is branchless (minimum image) and the protected/neighbour radius cases are
+// selected with masks, so the vector kernels handle a whole block of
+// candidates per step.
+//
+// Tolerance: the vector kernels add the terms in a different order from the
+// scalar kernel, so only the neighbour counts are guaranteed identical. Per
+// component, with n the neighbour count, a vector kernel stays within
+// FLOCK_KERNEL_TOLERANCE times
+//   separation:  1 + sum of 1 / dist over the protected neighbours
+//   alignment:   1 + n * MAX_SPEED        (speed limit of a boid)
+//   offset:      1 + n * NEIGHBOR_RADIUS  (largest offset of any neighbour)
+// Each scales with the summed magnitudes of its terms because the sums cancel.
+
+#define FLOCK_KERNEL_TOLERANCE 1e-5f
+
+typedef struct FlockSums {
+    float separation_x;   // sum of -offset / dist^2 inside PROTECTED_RADIUS
+    float separation_y;
+    float alignment_x;    // sum of neighbour velocities inside NEIGHBOR_RADIUS
+    float alignment_y;
+    float offset_x;       // sum of wrapped offsets to those neighbours
+    float offset_y;
+    int neighborCount;
+    int nearNeighborCount;
+    int coincident;       // candidates at exactly the boid's position (skipped)
+} FlockSums;
+
+typedef void (*FlockKernelFn)(float px, float py, uint32_t self,
+                              const uint32_t *candidates, uint32_t count,
+                              FlockSums *sums);
+
+// The species kernels (species.h) weight each candidate by the entry of its
+// species in one row of the interaction matrix. The slots are grouped by
+// species, so a candidate's species is the number of species starts at or
+// below its slot: a few compares, and the weights then come out of the row
+// held in one 8-lane register, without a load or a branch per candidate.
+#define FLOCK_KERNEL_SPECIES 8
+
+typedef struct FlockSpeciesRow {
+    float alignment[FLOCK_KERNEL_SPECIES];
+    float cohesion[FLOCK_KERNEL_SPECIES];
+    float separation[FLOCK_KERNEL_SPECIES];
+    float flee[FLOCK_KERNEL_SPECIES];
+    float heeded[FLOCK_KERNEL_SPECIES];  // 1 where any weight is non-zero, else 0
+    int32_t before[FLOCK_KERNEL_SPECIES - 1]; // slot before species k + 1 starts
+    int count;                           // species
+    int uniform;                         // every column the same, and heeded
+} FlockSpeciesRow;
+
+// Sums of the neighbours of heeded species only; the separation, alignment
+// and offset sums are weighted by the row
+typedef struct FlockSpeciesSums {
+    FlockSums sums;
+    float matched;          // neighbours weighted by alignment
+    float flee_x;           // offsets weighted by flee
+    float flee_y;
+} FlockSpeciesSums;
+
+typedef void (*FlockSpeciesKernelFn)(float px, float py, uint32_t self,
+                                     const uint32_t *candidates, uint32_t count,
+                                     const FlockSpeciesRow *row, FlockSpeciesSums *sums);
+
+typedef enum FlockKernelIsa {
+    FLOCK_KERNEL_SCALAR = 0,
+    FLOCK_KERNEL_SSE42,
+    FLOCK_KERNEL_AVX2,
+    FLOCK_KERNEL_AVX512,
+    FLOCK_KERNEL_COUNT
+} FlockKernelIsa;
+
+// The kernels ComputeFlockForces and ComputeSpeciesFlockForces call,
+// chosen by flock_kernel_select()
+extern FlockKernelFn flock_kernel;
+extern FlockSpeciesKernelFn flock_species_kernel;
+
+// Picks the widest supported kernel unless one was selected explicitly
+void flock_kernel_init(void);
+
+const char *flock_kernel_name(FlockKernelIsa isa);
+bool flock_kernel_supported(FlockKernelIsa isa);
+FlockKernelIsa flock_kernel_best(void);   // widest ISA this CPU supports
+FlockKernelIsa flock_kernel_current(void);
+FlockKernelFn flock_kernel_get(FlockKernelIsa isa); // NULL if unsupported
+FlockSpeciesKernelFn flock_species_kernel_get(FlockKernelIsa isa); // the same for the species kernels
+bool flock_kernel_select(FlockKernelIsa isa);      // false if unsupported
+
+#endif // FLOCK_KERNEL_H
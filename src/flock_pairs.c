@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+#include "flock_pairs.h"
+#include "spatial_hash.h"
+#include "boids.h"
+
+// Boid state copied into cell order, and the sums accumulated per sorted
+// slot, so the pair loops only touch contiguous runs.
+typedef struct PairBuffers {
+    size_t capacity;
+    float *x, *y, *vx, *vy;
+    float *separation_x, *separation_y;
+    float *alignment_x, *alignment_y;
+    float *offset_x, *offset_y;
+    int *neighborCount, *nearNeighborCount, *coincident;
+    uint32_t *rank; // sorted slot of each boid
+} PairBuffers;
+
+static PairBuffers pairs = {0};
+
+static void *pairs_realloc(void *ptr, size_t size) {
+    void *p = realloc(ptr, size);
+    if (!p) {
+        fprintf(stderr, "Failed to allocate pair buffers!\n");
+        exit(1);
+    }
+    return p;
+}
+
+static void reserve_pairs(size_t n) {
+    if (n <= pairs.capacity) return;
+    float **floats[] = { &pairs.x, &pairs.y, &pairs.vx, &pairs.vy,
+                         &pairs.separation_x, &pairs.separation_y,
+                         &pairs.alignment_x, &pairs.alignment_y,
+                         &pairs.offset_x, &pairs.offset_y };
+    for (size_t f = 0; f < sizeof(floats) / sizeof(floats[0]); f++) {
+        *floats[f] = pairs_realloc(*floats[f], n * sizeof(float));
+    }
+    pairs.neighborCount = pairs_realloc(pairs.neighborCount, n * sizeof(int));
+    pairs.nearNeighborCount = pairs_realloc(pairs.nearNeighborCount, n * sizeof(int));
+    pairs.coincident = pairs_realloc(pairs.coincident, n * sizeof(int));
+    pairs.rank = pairs_realloc(pairs.rank, n * sizeof(uint32_t));
+    pairs.capacity = n;
+}
+
+// Pairs every slot of [a0, a1) with every slot of [b0, b1); the ranges never
+// overlap. Written so the compiler vectorises the inner loop for the ISA of
+// the function it is inlined into.
+static inline __attribute__((always_inline))
+void pair_runs(uint32_t a0, uint32_t a1, uint32_t b0, uint32_t b1) {
+    const float width = (float)SCREEN_WIDTH, height = (float)SCREEN_HEIGHT;
+    const float half_width = HALF_SCREEN_WIDTH, half_height = HALF_SCREEN_HEIGHT;
+
+    const float *restrict bx = pairs.x, *restrict by = pairs.y;
+    const float *restrict bvx = pairs.vx, *restrict bvy = pairs.vy;
+    float *restrict sep_x = pairs.separation_x, *restrict sep_y = pairs.separation_y;
+    float *restrict align_x = pairs.alignment_x, *restrict align_y = pairs.alignment_y;
+    float *restrict off_x = pairs.offset_x, *restrict off_y = pairs.offset_y;
+    int *restrict neighbors = pairs.neighborCount, *restrict near = pairs.nearNeighborCount;
+    int *restrict same = pairs.coincident;
+
+    for (uint32_t a = a0; a < a1; a++) {
+        const float ax = bx[a], ay = by[a], avx = bvx[a], avy = bvy[a];
+        float a_sep_x = 0.0f, a_sep_y = 0.0f, a_align_x = 0.0f, a_align_y = 0.0f;
+        float a_off_x = 0.0f, a_off_y = 0.0f;
+        int a_neighbors = 0, a_near = 0, a_same = 0;
+
+        #pragma omp simd reduction(+:a_sep_x, a_sep_y, a_align_x, a_align_y, a_off_x, a_off_y, a_neighbors, a_near, a_same)
+        for (size_t b = b0; b < b1; b++) {
+            // Offset from a to b; the offset from b to a is its negation
+            float dx = bx[b] - ax;
+            float dy = by[b] - ay;
+            // Selects written as arithmetic so the loop needs no if-conversion
+            dx -= width * (float)((dx > half_width) - (dx < -half_width));
+            dy -= height * (float)((dy > half_height) - (dy < -half_height));
+
+            float dist = dx * dx + dy * dy;
+            int is_same = dist == 0.0f;
+            int is_near = !is_same & (dist < PROTECTED_RADIUS * PROTECTED_RADIUS);
+            int is_neighbor = !is_same & !is_near & (dist < NEIGHBOR_RADIUS * NEIGHBOR_RADIUS);
+
+            // Outside the protected radius this is 0 / 1; a select, as
+            // dist + 1 - 1 would lose the low bits of a small dist
+            float near_mask = (float)is_near;
+            float denominator = is_near ? dist : 1.0f;
+            float push_x = dx * near_mask / denominator;
+            float push_y = dy * near_mask / denominator;
+            a_sep_x -= push_x;
+            a_sep_y -= push_y;
+            sep_x[b] += push_x;
+            sep_y[b] += push_y;
+
+            float in = (float)is_neighbor;
+            a_align_x += in * bvx[b];
+            a_align_y += in * bvy[b];
+            align_x[b] += in * avx;
+            align_y[b] += in * avy;
+            a_off_x += in * dx;
+            a_off_y += in * dy;
+            off_x[b] -= in * dx;
+            off_y[b] -= in * dy;
+
+            a_neighbors += is_neighbor;
+            a_near += is_near;
+            a_same += is_same;
+            neighbors[b] += is_neighbor;
+            near[b] += is_near;
+            same[b] += is_same;
+        }
+
+        sep_x[a] += a_sep_x;
+        sep_y[a] += a_sep_y;
+        align_x[a] += a_align_x;
+        align_y[a] += a_align_y;
+        off_x[a] += a_off_x;
+        off_y[a] += a_off_y;
+        neighbors[a] += a_neighbors;
+        near[a] += a_near;
+        same[a] += a_same;
+    }
+}
+
+typedef void (*PairKernelFn)(uint32_t a0, uint32_t a1, uint32_t b0, uint32_t b1);
+
+static void pair_kernel_scalar(uint32_t a0, uint32_t a1, uint32_t b0, uint32_t b1) {
+    pair_runs(a0, a1, b0, b1);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("sse4.2")))
+static void pair_kernel_sse42(uint32_t a0, uint32_t a1, uint32_t b0, uint32_t b1) {
+    pair_runs(a0, a1, b0, b1);
+}
+
+__attribute__((target("avx2")))
+static void pair_kernel_avx2(uint32_t a0, uint32_t a1, uint32_t b0, uint32_t b1) {
+    pair_runs(a0, a1, b0, b1);
+}
+
+__attribute__((target("avx512f")))
+static void pair_kernel_avx512(uint32_t a0, uint32_t a1, uint32_t b0, uint32_t b1) {
+    pair_runs(a0, a1, b0, b1);
+}
+
+static const PairKernelFn pair_kernels[FLOCK_KERNEL_COUNT] = {
+    pair_kernel_scalar, pair_kernel_sse42, pair_kernel_avx2, pair_kernel_avx512
+};
+#else
+static const PairKernelFn pair_kernels[FLOCK_KERNEL_COUNT] = { pair_kernel_scalar };
+#endif
+
+// Colouring of one axis. A cell's writes reach `period` - 1 cells ahead (and
+// as far behind on the x axis), so cells `period` apart never collide. Whole
+// blocks of `period` share colours 0..period-1; the leftover cells at the
+// end of the axis each get a colour of their own so the seam stays safe.
+static int axis_colours(int n, int period) {
+    return period + n % period;
+}
+
+static int axis_members(int colour, int n, int period) {
+    return colour < period ? (n - n % period) / period : 1;
+}
+
+static int axis_member(int colour, int index, int n, int period) {
+    return colour < period ? colour + index * period : n - n % period + (colour - period);
+}
+
+// All pairs with a boid in cell (x, y) on the a side
+static void pair_cell(PairKernelFn kernel, int x, int y, int reach) {
+    uint32_t c = (uint32_t)(y * grid.width + x);
+    uint32_t a0 = grid.cell_start[c], a1 = grid.cell_start[c + 1];
+    if (a0 == a1) return;
+
+    for (uint32_t a = a0; a + 1 < a1; a++) {
+        kernel(a, a + 1, a + 1, a1);
+    }
+
+    CellRange ranges[GRID_MAX_RANGES];
+    int n = grid_row_ranges(y, x + 1, reach, ranges);
+    for (int dy = 1; dy <= reach; dy++) {
+        n += grid_row_ranges((y + dy) % grid.height, x - reach, 2 * reach + 1, ranges + n);
+    }
+    for (int r = 0; r < n; r++) {
+        if (ranges[r].begin != ranges[r].end) kernel(a0, a1, ranges[r].begin, ranges[r].end);
+    }
+}
+
+bool ComputeSymmetricFlockSums(void) {
+    const int reach = ceil_div(NEIGHBOR_RADIUS, cellSize);
+    const int period_x = 2 * reach + 1;
+    const int period_y = reach + 1;
+    // Narrower worlds would pair some cells twice
+    if (grid.width < period_x || grid.height < period_x || reach > GRID_MAX_REACH) return false;
+
+    const size_t n = grid.count;
+    reserve_pairs(n);
+    PairKernelFn kernel = pair_kernels[flock_kernel_current()];
+    const int colours_x = axis_colours(grid.width, period_x);
+    const int colours_y = axis_colours(grid.height, period_y);
+
+    #pragma omp parallel
+    {
+        #pragma omp for schedule(static)
+        for (size_t k = 0; k < n; k++) {
+            uint32_t j = grid.cell_boids[k];
+            pairs.x[k] = boids.x[j];
+            pairs.y[k] = boids.y[j];
+            pairs.vx[k] = boids.vx[j];
+            pairs.vy[k] = boids.vy[j];
+            pairs.separation_x[k] = pairs.separation_y[k] = 0.0f;
+            pairs.alignment_x[k] = pairs.alignment_y[k] = 0.0f;
+            pairs.offset_x[k] = pairs.offset_y[k] = 0.0f;
+            pairs.neighborCount[k] = pairs.nearNeighborCount[k] = pairs.coincident[k] = 0;
+            pairs.rank[j] = (uint32_t)k;
+        }
+
+        for (int colour_y = 0; colour_y < colours_y; colour_y++) {
+            for (int colour_x = 0; colour_x < colours_x; colour_x++) {
+                const int columns = axis_members(colour_x, grid.width, period_x);
+                const int rows = axis_members(colour_y, grid.height, period_y);
+                #pragma omp for schedule(dynamic, 4)
+                for (int m = 0; m < columns * rows; m++) {
+                    int x = axis_member(colour_x, m % columns, grid.width, period_x);
+                    int y = axis_member(colour_y, m / columns, grid.height, period_y);
+                    pair_cell(kernel, x, y, reach);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+FlockSums SymmetricFlockSums(size_t i) {
+    uint32_t k = pairs.rank[i];
+    return (FlockSums){
+        .separation_x = pairs.separation_x[k],
+        .separation_y = pairs.separation_y[k],
+        .alignment_x = pairs.alignment_x[k],
+        .alignment_y = pairs.alignment_y[k],
+        .offset_x = pairs.offset_x[k],
+        .offset_y = pairs.offset_y[k],
+        .neighborCount = pairs.neighborCount[k],
+        .nearNeighborCount = pairs.nearNeighborCount[k],
+        .coincident = pairs.coincident[k],
+    };
+}
@@ -0,0 +1,32 @@
+#ifndef FLOCK_PAIRS_H
+#define FLOCK_PAIRS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "flock_kernel.h"
+
+// Symmetric pair evaluation.
+//
+// The per-boid gather visits every pair inside NEIGHBOR_RADIUS twice, once
+// from each side. The symmetric mode walks a half stencil instead: each cell
+// is paired with itself and with the cells after it (the rest of its row
+// within reach, then the full span of the next rows), so every pair is
+// computed once and the result is added to both boids. Separation and the
+// cohesion offset are antisymmetric, alignment swaps the two velocities.
+//
+// Cells are coloured so that no two cells of the same colour write the same
+// boid, and each colour is processed as one parallel loop. A boid therefore
+// receives its terms in a fixed order and the sums do not depend on the
+// thread count. They differ from the gather sums only by rounding, within
+// the tolerance documented in flock_kernel.h.
+
+// Accumulates the sums of every indexed boid from the current grid.
+// Returns false, leaving the gather to be used, if the world is too small
+// for the half stencil (fewer than 2 * reach + 1 cells across or down).
+bool ComputeSymmetricFlockSums(void);
+
+// Boid i's sums from the last ComputeSymmetricFlockSums()
+FlockSums SymmetricFlockSums(size_t i);
+
+#endif // FLOCK_PAIRS_H
@@ -0,0 +1,213 @@
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "frame_timer.h"
+#include "boids.h"
+
+// One ring entry. `seq` works as a per-entry seqlock: odd while a writer
+// fills it in, 2 * index + 2 once sample `index` is complete.
+typedef struct TimerSlot {
+    _Atomic uint64_t seq;
+    _Atomic uint64_t start;
+    _Atomic uint64_t frame;
+    _Atomic uint64_t packed;  // duration << 32 | stage << 16 | lane
+} TimerSlot;
+
+static TimerSlot ring[TIMER_RING];
+static _Atomic uint64_t writeIndex = 0;
+static _Atomic uint64_t firstIndex = 0;  // samples before TimerClear() are ignored
+static uint64_t renderFrame = 0;
+
+static const char *stageNames[STAGE_COUNT] = {
+    "interactions", "forces", "predator", "commit", "reorder", "grid", "knn", "record",
+    "transforms", "draw", "gui"
+};
+
+const char *timer_stage_name(TimerStage stage) {
+    return stage < STAGE_COUNT ? stageNames[stage] : "unknown";
+}
+
+TimerDomain timer_stage_domain(TimerStage stage) {
+    return stage >= STAGE_TRANSFORMS ? TIMER_RENDER : TIMER_SIMULATION;
+}
+
+uint64_t TimerNow(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+void TimerRecord(TimerStage stage, uint32_t lane, uint64_t start, uint64_t end) {
+    uint64_t frame = timer_stage_domain(stage) == TIMER_RENDER ? renderFrame : frameCounter;
+    uint64_t duration = end > start ? end - start : 0;
+    if (duration > UINT32_MAX) duration = UINT32_MAX;
+
+    uint64_t index = atomic_fetch_add_explicit(&writeIndex, 1, memory_order_relaxed);
+    TimerSlot *slot = &ring[index & (TIMER_RING - 1)];
+    atomic_store_explicit(&slot->seq, 2 * index + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    atomic_store_explicit(&slot->start, start, memory_order_relaxed);
+    atomic_store_explicit(&slot->frame, frame, memory_order_relaxed);
+    atomic_store_explicit(&slot->packed, duration << 32 | (uint64_t)stage << 16 | (lane & 0xffff),
+                          memory_order_relaxed);
+    atomic_store_explicit(&slot->seq, 2 * index + 2, memory_order_release);
+}
+
+void TimerClear(void) {
+    atomic_store_explicit(&firstIndex, atomic_load(&writeIndex), memory_order_relaxed);
+}
+
+void TimerNextRenderFrame(void) {
+    renderFrame++;
+}
+
+// False if sample index is not (or no longer) in its slot
+static bool read_sample(uint64_t index, TimerSample *out) {
+    TimerSlot *slot = &ring[index & (TIMER_RING - 1)];
+    uint64_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+    if (seq != 2 * index + 2) return false;
+    uint64_t start = atomic_load_explicit(&slot->start, memory_order_relaxed);
+    uint64_t frame = atomic_load_explicit(&slot->frame, memory_order_relaxed);
+    uint64_t packed = atomic_load_explicit(&slot->packed, memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    if (atomic_load_explicit(&slot->seq, memory_order_relaxed) != seq) return false;
+
+    *out = (TimerSample){
+        .start_ns = start,
+        .frame = frame,
+        .duration_ns = (uint32_t)(packed >> 32),
+        .stage = (uint16_t)(packed >> 16),
+        .lane = (uint16_t)packed,
+    };
+    return true;
+}
+
+size_t TimerSamples(uint64_t *cursor, TimerSample *out, size_t max) {
+    uint64_t end = atomic_load_explicit(&writeIndex, memory_order_acquire);
+    uint64_t first = atomic_load_explicit(&firstIndex, memory_order_relaxed);
+    if (*cursor < first) *cursor = first;
+    if (end - *cursor > TIMER_RING) *cursor = end - TIMER_RING;
+
+    size_t n = 0;
+    while (*cursor < end && n < max) {
+        // A sample still being written stops the read; it is picked up next time
+        TimerSlot *slot = &ring[*cursor & (TIMER_RING - 1)];
+        if (atomic_load_explicit(&slot->seq, memory_order_acquire) < 2 * *cursor + 2) break;
+        if (read_sample(*cursor, &out[n])) n++;
+        (*cursor)++;
+    }
+    return n;
+}
+
+static int compare_float(const void *a, const void *b) {
+    float x = *(const float *)a;
+    float y = *(const float *)b;
+    return (x > y) - (x < y);
+}
+
+void UpdateTimerSummary(TimerSummary *summary) {
+    TimerSample samples[1024];
+    size_t n;
+    while ((n = TimerSamples(&summary->cursor, samples, 1024)) > 0) {
+        for (size_t k = 0; k < n; k++) {
+            const TimerSample *s = &samples[k];
+            if (s->stage >= STAGE_COUNT) continue;
+            float ms = s->duration_ns * 1e-6f;
+            TimerDomain domain = timer_stage_domain((TimerStage)s->stage);
+            if (s->frame > summary->latest[domain]) summary->latest[domain] = s->frame;
+
+            if (s->lane == 0) {
+                size_t h = s->frame % TIMER_HISTORY;
+                if (summary->frames[s->stage][h] != s->frame) {
+                    summary->frames[s->stage][h] = s->frame;
+                    summary->ms[s->stage][h] = 0.0f;
+                }
+                summary->ms[s->stage][h] += ms;
+            } else if (s->lane <= TIMER_MAX_LANES && s->frame >= summary->threadFrame) {
+                if (s->frame > summary->threadFrame) {
+                    summary->threadFrame = s->frame;
+                    summary->threads = 0;
+                }
+                if (s->lane > summary->threads) {
+                    for (int t = summary->threads; t < s->lane; t++) summary->threadMs[t] = 0.0f;
+                    summary->threads = s->lane;
+                }
+                summary->threadMs[s->lane - 1] += ms;
+            }
+        }
+    }
+
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        uint64_t latest = summary->latest[timer_stage_domain((TimerStage)stage)];
+        float values[TIMER_HISTORY];
+        size_t count = 0;
+        for (size_t h = 0; h < TIMER_HISTORY; h++) {
+            uint64_t frame = summary->frames[stage][h];
+            if (frame != 0 && frame + TIMER_HISTORY > latest) values[count++] = summary->ms[stage][h];
+        }
+        summary->p50[stage] = summary->p99[stage] = 0.0f;
+        if (count == 0) continue;
+        qsort(values, count, sizeof(float), compare_float);
+        summary->p50[stage] = values[(count - 1) / 2];
+        summary->p99[stage] = values[(count * 99 + 99) / 100 - 1];
+    }
+}
+
+float TimerStageMs(const TimerSummary *summary, TimerStage stage, uint64_t frame) {
+    size_t h = frame % TIMER_HISTORY;
+    return summary->frames[stage][h] == frame ? summary->ms[stage][h] : 0.0f;
+}
+
+// Calls emit for every sample still in the ring, oldest first
+static void for_each_sample(void (*emit)(FILE *, const TimerSample *, bool), FILE *file) {
+    uint64_t cursor = 0;
+    TimerSample samples[1024];
+    size_t n;
+    bool first = true;
+    while ((n = TimerSamples(&cursor, samples, 1024)) > 0) {
+        for (size_t k = 0; k < n; k++) {
+            emit(file, &samples[k], first);
+            first = false;
+        }
+    }
+}
+
+static void emit_csv(FILE *file, const TimerSample *s, bool first) {
+    (void)first;
+    fprintf(file, "%s,%s,%" PRIu64 ",%u,%.3f,%.3f\n",
+            timer_stage_domain((TimerStage)s->stage) == TIMER_RENDER ? "render" : "simulation",
+            timer_stage_name((TimerStage)s->stage), s->frame, s->lane,
+            s->start_ns * 1e-3, s->duration_ns * 1e-3);
+}
+
+// Complete events; simulation lanes and the render thread get a row each
+static void emit_trace(FILE *file, const TimerSample *s, bool first) {
+    TimerDomain domain = timer_stage_domain((TimerStage)s->stage);
+    fprintf(file, "%s\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, "
+            "\"pid\": 1, \"tid\": %u, \"args\": {\"frame\": %" PRIu64 "}}",
+            first ? "" : ",", timer_stage_name((TimerStage)s->stage),
+            domain == TIMER_RENDER ? "render" : "simulation",
+            s->start_ns * 1e-3, s->duration_ns * 1e-3,
+            domain == TIMER_RENDER ? 1000u : s->lane, s->frame);
+}
+
+bool WriteTimerCsv(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) return false;
+    fprintf(file, "domain,stage,frame,lane,start_us,duration_us\n");
+    for_each_sample(emit_csv, file);
+    return fclose(file) == 0;
+}
+
+bool WriteTimerTrace(const char *path) {
+    FILE *file = fopen(path, "w");
+    if (!file) return false;
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+    for_each_sample(emit_trace, file);
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
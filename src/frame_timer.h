@@ -0,0 +1,97 @@
+#ifndef FRAME_TIMER_H
+#define FRAME_TIMER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Per-stage frame timing.
+//
+// Each stage of a simulation tick or a rendered frame records a sample
+// (stage, lane, frame, start, duration) into one lock-free ring that any
+// thread may write. Lane 0 is the stage as a whole; inside the parallel force
+// pass every OpenMP thread also records its own share on lane thread + 1, so
+// load imbalance shows up as spread between the lanes.
+//
+// One reader folds the ring into rolling per-stage history and percentiles
+// for the overlay, or exports it as CSV or Chrome trace JSON.
+
+typedef enum TimerStage {
+    // Simulation, once per tick
+    STAGE_INTERACTIONS = 0,  // symmetric pair or neighbour list sums
+    STAGE_FORCES,            // parallel force pass
+    STAGE_PREDATOR,          // UpdatePredators
+    STAGE_COMMIT,            // commit loop
+    STAGE_REORDER,           // space-filling-curve reorder of the boids
+    STAGE_GRID,              // spatial grid rebuild
+    STAGE_KNN,               // k-nearest-neighbour graph
+    STAGE_RECORD,            // handing the frame to the recorder
+    // Rendering, once per frame
+    STAGE_TRANSFORMS,        // dart transforms
+    STAGE_DRAW,              // dart draw calls
+    STAGE_GUI,               // HUD and controls
+    STAGE_COUNT
+} TimerStage;
+
+typedef enum TimerDomain {
+    TIMER_SIMULATION = 0,
+    TIMER_RENDER,
+    TIMER_DOMAIN_COUNT
+} TimerDomain;
+
+#define TIMER_RING (1u << 16)     // samples kept
+#define TIMER_HISTORY 240         // frames per domain in the summary
+#define TIMER_MAX_LANES 256
+
+#define TIMER_THREAD_LANE(thread) ((uint32_t)(thread) + 1)
+
+typedef struct TimerSample {
+    uint64_t start_ns;
+    uint64_t frame;
+    uint32_t duration_ns;
+    uint16_t stage;
+    uint16_t lane;
+} TimerSample;
+
+const char *timer_stage_name(TimerStage stage);
+TimerDomain timer_stage_domain(TimerStage stage);
+
+// Monotonic nanoseconds
+uint64_t TimerNow(void);
+
+// Records [start, end) for a stage. Simulation stages belong to frameCounter,
+// render stages to the current render frame.
+void TimerRecord(TimerStage stage, uint32_t lane, uint64_t start, uint64_t end);
+
+// Drops the samples recorded so far
+void TimerClear(void);
+
+// Starts the next render frame
+void TimerNextRenderFrame(void);
+
+// Copies up to max samples from *cursor onwards and advances it; samples
+// that have already been overwritten are skipped
+size_t TimerSamples(uint64_t *cursor, TimerSample *out, size_t max);
+
+typedef struct TimerSummary {
+    uint64_t cursor;
+    uint64_t latest[TIMER_DOMAIN_COUNT];             // newest frame seen per domain
+    float ms[STAGE_COUNT][TIMER_HISTORY];            // lane 0, by frame % TIMER_HISTORY
+    uint64_t frames[STAGE_COUNT][TIMER_HISTORY];
+    float p50[STAGE_COUNT], p99[STAGE_COUNT];        // over the history
+    uint64_t threadFrame;                            // force pass the lanes below belong to
+    float threadMs[TIMER_MAX_LANES];
+    int threads;
+} TimerSummary;
+
+// Folds the new samples into the summary and refreshes the percentiles
+void UpdateTimerSummary(TimerSummary *summary);
+
+// Lane 0 time of a stage in a frame of its domain, 0 if not in the history
+float TimerStageMs(const TimerSummary *summary, TimerStage stage, uint64_t frame);
+
+// Every sample still in the ring; false if the file cannot be written
+bool WriteTimerCsv(const char *path);
+bool WriteTimerTrace(const char *path);
+
+#endif // FRAME_TIMER_H
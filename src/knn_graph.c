@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <omp.h>
+
+#include "knn_graph.h"
+#include "spatial_query.h"
+#include "spatial_hash.h"
+#include "boids.h"
+
+KnnGraph knnGraph = {0};
+int knnK = 0;
+
+void BuildKnnGraph(void) {
+    const int k = knnK < KNN_MAX_K ? knnK : KNN_MAX_K;
+    const size_t n = boidCount;
+    if (k <= 0) {
+        knnGraph.count = 0;
+        knnGraph.k = 0;
+        return;
+    }
+
+    if (n * k > knnGraph.capacity) {
+        uint32_t *p = realloc(knnGraph.neighbors, n * k * sizeof(uint32_t));
+        if (!p) {
+            fprintf(stderr, "Failed to allocate the neighbour graph!\n");
+            exit(1);
+        }
+        knnGraph.neighbors = p;
+        knnGraph.capacity = n * k;
+    }
+
+    // In cell order, so neighbouring searches touch the same cells
+    #pragma omp parallel for schedule(static)
+    for (size_t e = 0; e < n; e++) {
+        uint32_t i = grid.cell_boids[e];
+        uint32_t *out = knnGraph.neighbors + (size_t)i * k;
+        int found = QueryNearest(BoidPosition(i), k, i, out, NULL);
+        for (int m = found; m < k; m++) out[m] = KNN_NONE;
+    }
+
+    knnGraph.count = n;
+    knnGraph.k = k;
+}
@@ -0,0 +1,35 @@
+#ifndef KNN_GRAPH_H
+#define KNN_GRAPH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "spatial_query.h"
+
+// k-nearest-neighbour graph of the boids.
+//
+// Rebuilt after the grid on every tick while knnK > 0, one QueryNearest per
+// boid: rings of grid cells searched outwards with a bounded max-heap on the
+// thread's stack, skipping cells wholly farther than the current k-th and
+// stopping once the next ring cannot hold anything nearer. The boids are
+// split statically over the threads in grid order; ties go to the lower
+// index, so the result does not depend on the thread count.
+
+#define DEFAULT_KNN_K 6
+#define KNN_MAX_K QUERY_MAX_K
+#define KNN_NONE QUERY_NONE
+
+typedef struct KnnGraph {
+    size_t count;        // boids the graph was built for
+    int k;
+    uint32_t *neighbors; // count * k, nearest first, KNN_NONE past the last found
+    size_t capacity;     // entries allocated
+} KnnGraph;
+
+extern KnnGraph knnGraph;
+extern int knnK; // neighbours per boid, 0 for no graph
+
+// Builds the graph for the current boids and grid
+void BuildKnnGraph(void);
+
+#endif // KNN_GRAPH_H
@@ -6,6 +6,11 @@ in vec2 vertexTexCoord;
 in vec3 vertexNormal;
 in vec4 vertexColor;
 
+#ifdef INSTANCING
+// Per-instance model matrix, fed by DrawMeshInstanced
+in mat4 instanceTransform;
+#endif
+
 // Input uniform values
 uniform mat4 mvp;
 uniform mat4 matModel;
@@ -21,12 +26,26 @@ out vec3 fragNormal;
 
 void main()
 {
+#ifdef INSTANCING
+    // mvp is projection * view only; instance matrices are rotation, uniform
+    // scale and translation, so their upper 3x3 transforms normals too
+    mat4 model = instanceTransform;
+    mat3 normalMatrix = mat3(instanceTransform);
+#else
+    mat4 model = matModel;
+    mat3 normalMatrix = mat3(matNormal);
+#endif
+
     // Send vertex attributes to fragment shader
-    fragPosition = vec3(matModel*vec4(vertexPosition, 1.0));
+    fragPosition = vec3(model*vec4(vertexPosition, 1.0));
     fragTexCoord = vertexTexCoord;
     fragColor = vertexColor;
-    fragNormal = normalize(vec3(matNormal*vec4(vertexNormal, 1.0)));
+    fragNormal = normalize(normalMatrix*vertexNormal);
 
     // Calculate final vertex position
+#ifdef INSTANCING
+    gl_Position = mvp*model*vec4(vertexPosition, 1.0);
+#else
     gl_Position = mvp*vec4(vertexPosition, 1.0);
+#endif
 }
@@ -14,10 +14,27 @@
     #define GLSL_VERSION            100
 #endif
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <omp.h>
 #include "boids.h"
+#include "boids_draw.h"
 #include "spatial_hash.h"
+#include "normal_random.h"
+#include "flock_kernel.h"
+#include "neighbor_list.h"
+#include "predators.h"
+#include "knn_graph.h"
+#include "autotune.h"
+#include "domain.h"
+#include "boid_order.h"
+#include "species.h"
+#include "sim_thread.h"
+#include "recorder.h"
+#include "frame_timer.h"
+#include "timer_overlay.h"
 #define RAYGUI_IMPLEMENTATION
 #include "raygui.h"
 
@@ -25,26 +42,136 @@
 
 #include "torus.h"
 
-#define TORUS_MAJOR_SEGMENTS 128
-#define TORUS_MINOR_SEGMENTS 64
 
 
-int SCREEN_WIDTH;
-int SCREEN_HEIGHT;
-float HALF_SCREEN_WIDTH;
-float HALF_SCREEN_HEIGHT;
 bool drawFullGlyph = false;
 bool drawDensity = false;
 bool nearestNeighboursNetwork = false;
-bool pauseSimulation = false;
+bool interpolate = true;
+bool showTimers = true;
 bool flat = true;
-size_t frameCounter = 0;
 
 Model dart;
 Model transparentSphere;  // <-- global scope, outside of main()
 
-int main(void)
+static void usage(const char *program)
 {
+    printf("Usage: %s [--boids N] [--predators N] [--knn K] [--tick-rate HZ] [--autotune] [--reorder N] [--species N | --species-file FILE] [--workers N [--transport T]] [--no-instancing] [--record FILE | --replay FILE]\n", program);
+    printf("  --boids N       initial number of boids (default %d)\n", DEFAULT_BOIDS);
+    printf("  --predators N   initial number of predators (default %d)\n", DEFAULT_PREDATORS);
+    printf("  --knn K         neighbours per boid in the network (default %d, up to %d)\n", DEFAULT_KNN_K, KNN_MAX_K);
+    printf("  --tick-rate HZ  simulation ticks per second (default %.0f)\n", DEFAULT_TICK_RATE);
+    printf("  --autotune      pick the grid cell size and force schedule for this machine,\n");
+    printf("                  cached in %s\n", AUTOTUNE_CACHE);
+    printf("  --reorder N     put the boids in space-filling-curve order every N ticks\n");
+    printf("                  (default %d, 0 for never)\n", DEFAULT_REORDER_INTERVAL);
+    printf("  --species N     boids of N species, each flocking with its own kind (default 1, up to %d)\n", MAX_SPECIES);
+    printf("  --species-file FILE  species and interaction matrix from FILE (see species.h)\n");
+    printf("  --workers N     split the world into N strips, each simulated by a worker process\n");
+    printf("  --transport T   shm or socket, between the workers (default shm)\n");
+    printf("  --no-instancing draw each dart with its own call\n");
+    printf("  --record FILE   record every tick to FILE\n");
+    printf("  --replay FILE   play back a recording instead of simulating\n");
+    printf("At runtime [ and ] halve and double the number of boids, comma and period the\n");
+    printf("number of predators. I toggles interpolation, M toggles instancing, C culling\n");
+    printf("and level of detail, D the density overlay and N the nearest-neighbour network.\n");
+    printf("The boid under the mouse is picked and shown in the HUD. U retunes the cell\n");
+    printf("size and schedule. In a replay, Left and Right step while paused.\n");
+    printf("T toggles the stage timings; F9 saves them as CSV, F10 as a Chrome trace.\n");
+}
+
+// The lighting shader again, with INSTANCING defined so the model matrix
+// comes from a per-instance attribute
+static Shader LoadInstancingShader(const char *vsFileName, const char *fsFileName)
+{
+    char *vs = LoadFileText(vsFileName);
+    char *fs = LoadFileText(fsFileName);
+    if (vs == NULL || fs == NULL) {
+        fprintf(stderr, "Failed to load %s and %s!\n", vsFileName, fsFileName);
+        exit(1);
+    }
+    // #version has to stay the first line
+    char *body = strchr(vs, '\n');
+    body = body ? body + 1 : vs + strlen(vs);
+    char *source = malloc(strlen(vs) + 32);
+    if (!source) {
+        fprintf(stderr, "Failed to allocate shader source!\n");
+        exit(1);
+    }
+    sprintf(source, "%.*s#define INSTANCING\n%s", (int)(body - vs), vs, body);
+
+    Shader shader = LoadShaderFromMemory(source, fs);
+    shader.locs[SHADER_LOC_MATRIX_MODEL] = GetShaderLocationAttrib(shader, "instanceTransform");
+
+    free(source);
+    UnloadFileText(vs);
+    UnloadFileText(fs);
+    return shader;
+}
+
+// The light's uniform locations in another shader; CreateLight() only binds
+// the first MAX_LIGHTS lights it is called for
+static Light BindLight(Light light, Shader shader, int index)
+{
+    light.enabledLoc = GetShaderLocation(shader, TextFormat("lights[%i].enabled", index));
+    light.typeLoc = GetShaderLocation(shader, TextFormat("lights[%i].type", index));
+    light.positionLoc = GetShaderLocation(shader, TextFormat("lights[%i].position", index));
+    light.targetLoc = GetShaderLocation(shader, TextFormat("lights[%i].target", index));
+    light.colorLoc = GetShaderLocation(shader, TextFormat("lights[%i].color", index));
+    return light;
+}
+
+int main(int argc, char **argv)
+{
+    size_t initialBoids = DEFAULT_BOIDS;
+    float tickRate = DEFAULT_TICK_RATE;
+    int networkK = DEFAULT_KNN_K;
+    const char *recordPath = NULL;
+    const char *replayPath = NULL;
+    bool autotune = false;
+    int speciesWanted = 1;
+    const char *speciesPath = NULL;
+    int workers = 0;
+    TransportKind transport = TRANSPORT_SHM;
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "--boids") == 0 || strcmp(argv[i], "-n") == 0) && i + 1 < argc) {
+            initialBoids = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--predators") == 0 && i + 1 < argc) {
+            predatorCount = strtoul(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--knn") == 0 && i + 1 < argc) {
+            networkK = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--tick-rate") == 0 && i + 1 < argc) {
+            tickRate = strtof(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--reorder") == 0 && i + 1 < argc) {
+            reorderInterval = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--autotune") == 0) {
+            autotune = true;
+        } else if (strcmp(argv[i], "--species") == 0 && i + 1 < argc) {
+            speciesWanted = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--species-file") == 0 && i + 1 < argc) {
+            speciesPath = argv[++i];
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--transport") == 0 && i + 1 < argc &&
+                   transport_kind(argv[i + 1]) != TRANSPORT_KIND_COUNT) {
+            transport = transport_kind(argv[++i]);
+        } else if (strcmp(argv[i], "--no-instancing") == 0) {
+            drawInstanced = false;
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordPath = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replayPath = argv[++i];
+        } else {
+            usage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+    }
+    if (initialBoids == 0) initialBoids = 1;
+    if (!(tickRate > 0.0f)) tickRate = DEFAULT_TICK_RATE;
+    if (networkK < 1) networkK = 1;
+    if (networkK > KNN_MAX_K) networkK = KNN_MAX_K;
+    if (speciesPath ? !LoadSpecies(speciesPath) : !SetSpeciesCount(speciesWanted)) return 1;
+
     printf("Linked Raylib version: %s\n", RAYLIB_VERSION);
     const int glslVer = rlGetVersion();
     printf("GL version: %i\n", glslVer);
@@ -54,23 +181,46 @@ int main(void)
 
     // Get the primary monitor's resolution before window creation
     int monitor = GetCurrentMonitor();
-    SCREEN_HEIGHT = GetMonitorHeight(monitor);
-    SCREEN_WIDTH = GetMonitorWidth(monitor);
-    printf("Monitor %d: %d x %d\n", monitor, SCREEN_WIDTH, SCREEN_HEIGHT);
-    SCREEN_WIDTH = (SCREEN_WIDTH/CELL_SIZE)*CELL_SIZE;
-    SCREEN_HEIGHT = (SCREEN_HEIGHT/CELL_SIZE)*CELL_SIZE;
+    printf("Monitor %d: %d x %d\n", monitor, GetMonitorWidth(monitor), GetMonitorHeight(monitor));
+    // A replay brings its own world size
+    if (replayPath) {
+        OpenReplay(replayPath);
+        SetWorldDimensions(ReplayHeader()->width, ReplayHeader()->height);
+        printf("Replaying %zu frames from %s\n", ReplayFrameCount(), replayPath);
+    } else {
+        SetWorldDimensions(GetMonitorWidth(monitor), GetMonitorHeight(monitor));
+    }
     printf("Monitor %d: %d x %d\n", monitor, SCREEN_WIDTH, SCREEN_HEIGHT);
-    HALF_SCREEN_WIDTH = SCREEN_WIDTH / 2.0f;
-    HALF_SCREEN_HEIGHT = SCREEN_HEIGHT / 2.0f;
 
-    SetTargetFPS(60);
+    // Rendering runs at the display's rate; the simulation ticks on its own thread
+    SetTargetFPS(GetMonitorRefreshRate(monitor));
 
-    InitBoids();
+    if (!replayPath) {
+        random_seed((uint64_t)time(NULL));
+        InitBoids(initialBoids);
+        if (autotune) Autotune(AUTOTUNE_CACHE, false);
+        if (workers > 0 && !StartDomain(workers, transport)) fprintf(stderr, "Simulating in this process instead\n");
+        if (recordPath) StartRecording(recordPath);
+    }
 
     static float alignmentWeight = 1.0f;
     static float cohesionWeight = 1.0f;
     static float separationWeight = 1.0f;
 
+    SimSettings sim = {
+        .alignmentWeight = alignmentWeight,
+        .cohesionWeight = cohesionWeight,
+        .separationWeight = separationWeight,
+        .paused = false,
+        .boidCount = boidCount,
+        .predatorCount = predatorCount,
+        .interaction = flockInteraction,
+        .tickRate = tickRate,
+    };
+    if (!replayPath) StartSimulationThread(sim);
+    size_t replayFrame = 0;
+    float replayClock = 0.0f; // seconds into the current replay frame
+
     Camera3D camera = { 0 };
     camera.position = (Vector3){ 0.0f, 0.0f, 0.0f};  // Positioned out along +Z axis
     camera.target = (Vector3){ 0.0f, 0.0f, 0.0f };       // Looking at the quad at origin
@@ -90,12 +240,20 @@ int main(void)
     int ambientLoc = GetShaderLocation(shader, "ambient");
     SetShaderValue(shader, ambientLoc, (float[4]){ 0.1f, 0.1f, 0.1f, 1.0f }, SHADER_UNIFORM_VEC4);
 
+    // Same lighting for the instanced darts
+    Shader instancingShader = LoadInstancingShader("src/lighting.vs", "src/lighting.fs");
+    instancingShader.locs[SHADER_LOC_VECTOR_VIEW] = GetShaderLocation(instancingShader, "viewPos");
+    SetShaderValue(instancingShader, GetShaderLocation(instancingShader, "ambient"),
+                   (float[4]){ 0.1f, 0.1f, 0.1f, 1.0f }, SHADER_UNIFORM_VEC4);
+
     // Create lights
     Light lights[MAX_LIGHTS] = { 0 };
+    Light instancingLights[MAX_LIGHTS] = { 0 };
     lights[0] = CreateLight(LIGHT_POINT, (Vector3){ -HALF_SCREEN_WIDTH, 200, -HALF_SCREEN_HEIGHT }, Vector3Zero(), YELLOW, shader);
     lights[1] = CreateLight(LIGHT_POINT, (Vector3){ HALF_SCREEN_WIDTH, 200, HALF_SCREEN_HEIGHT }, Vector3Zero(), RED, shader);
     lights[2] = CreateLight(LIGHT_POINT, (Vector3){ -HALF_SCREEN_WIDTH, 200, HALF_SCREEN_HEIGHT }, Vector3Zero(), GREEN, shader);
     lights[3] = CreateLight(LIGHT_POINT, (Vector3){ HALF_SCREEN_WIDTH, 200, -HALF_SCREEN_HEIGHT }, Vector3Zero(), BLUE, shader);
+    for (int i = 0; i < MAX_LIGHTS; i++) instancingLights[i] = BindLight(lights[i], instancingShader, i);
 
     // Load dart model exported from Blender or dart_export
     dart = LoadModel("blender_dart.obj");
@@ -104,6 +262,8 @@ int main(void)
         exit(0);   
      }
      dart.materials[0].shader = shader;  // <== Required for lighting to take effect
+    dartInstancedMaterial = dart.materials[0];
+    dartInstancedMaterial.shader = instancingShader;
 
     if (dart.meshes[0].normals == NULL) {
         exit(0);
@@ -113,23 +273,58 @@ int main(void)
     float R = SCREEN_WIDTH / (2.0f * PI);
     float r = SCREEN_HEIGHT / (2.0f * PI);
     SetTorusDimensions(R, r);
-    Mesh torus_mesh = MyGenTorusMesh(TORUS_MAJOR_SEGMENTS, TORUS_MINOR_SEGMENTS);
-    GenMeshTangents(&torus_mesh);
-    Model torus_model = LoadModelFromMesh(torus_mesh);
+    // Drawn at the level SelectTorusLod() picks each frame
+    static TorusMeshes torusMeshes;
+    LoadTorusMeshes(&torusMeshes);
+    Model torus_model = LoadModelFromMesh(torusMeshes.lod[0]);
     torus_model.materials[0].shader = shader;  // <== Required for lighting to take effect
+    Texture2D torusTexture = torus_model.materials[0].maps[MATERIAL_MAP_DIFFUSE].texture;
+
+    // The flat world with the density overlay on it
+    Model densityPlane = LoadModelFromMesh(GenMeshPlane(SCREEN_WIDTH, SCREEN_HEIGHT, 1, 1));
+    densityPlane.materials[0].shader = shader;
 
 
+    static TimerSummary timerSummary;
     //int number_of_frame = 0;
     while (!WindowShouldClose())
     {
-        frameCounter++;
+        TimerNextRenderFrame();
+        UpdateTimerSummary(&timerSummary);
+
+        const BoidSnapshot *snapshot;
+        float alpha;
+        if (replayPath) {
+            // Each frame is shown moving in from the previous one over its own tick
+            size_t frames = ReplayFrameCount();
+            if (sim.paused) {
+                if (IsKeyPressed(KEY_RIGHT) && replayFrame + 1 < frames) replayFrame++;
+                if (IsKeyPressed(KEY_LEFT) && replayFrame > 0) replayFrame--;
+                replayClock = ReplayFrameTime(replayFrame);
+            } else {
+                replayClock += GetFrameTime();
+                while (replayFrame + 1 < frames && replayClock >= ReplayFrameTime(replayFrame)) {
+                    replayClock -= ReplayFrameTime(replayFrame);
+                    replayFrame++;
+                }
+            }
+            snapshot = ReplaySeek(replayFrame);
+            alpha = interpolate && snapshot->interval > 0.0 ? replayClock / (float)snapshot->interval : 1.0f;
+            if (alpha > 1.0f) alpha = 1.0f;
+        } else {
+            snapshot = AcquireSnapshot();
+            alpha = interpolate ? SnapshotAlpha(snapshot, SimulationClock()) : 1.0f;
+        }
 
         // Update camera
         UpdateCameraManual(&camera);
+        // The simulation picks the boid under the mouse on its next tick
+        if (!replayPath) sim.picking = PickWorldPoint(GetMouseRay(GetMousePosition(), camera), &sim.pick);
 
         // Update the shader with the camera view vector (points towards { 0.0f, 0.0f, 0.0f })
         float cameraPos[3] = { camera.position.x, camera.position.y, camera.position.z };
         SetShaderValue(shader, shader.locs[SHADER_LOC_VECTOR_VIEW], cameraPos, SHADER_UNIFORM_VEC3);
+        SetShaderValue(instancingShader, instancingShader.locs[SHADER_LOC_VECTOR_VIEW], cameraPos, SHADER_UNIFORM_VEC3);
 
         // Check key inputs to enable/disable lights
         if (IsKeyPressed(KEY_Y)) { lights[0].enabled = !lights[0].enabled; }
@@ -138,11 +333,37 @@ int main(void)
         if (IsKeyPressed(KEY_B)) { lights[3].enabled = !lights[3].enabled; }
         
         // Update light values (actually, only enable/disable them)
-        for (int i = 0; i < MAX_LIGHTS; i++) UpdateLightValues(shader, lights[i]);
-
-
-        if (IsKeyPressed(KEY_SPACE)) pauseSimulation = !pauseSimulation;
-        if (!pauseSimulation) UpdateBoids(alignmentWeight, cohesionWeight, separationWeight);
+        for (int i = 0; i < MAX_LIGHTS; i++) {
+            UpdateLightValues(shader, lights[i]);
+            instancingLights[i].enabled = lights[i].enabled;
+            UpdateLightValues(instancingShader, instancingLights[i]);
+        }
+
+
+        if (IsKeyPressed(KEY_SPACE)) sim.paused = !sim.paused;
+        if (IsKeyPressed(KEY_I)) interpolate = !interpolate;
+        if (IsKeyPressed(KEY_M)) drawInstanced = !drawInstanced;
+        if (IsKeyPressed(KEY_C)) drawCulling = !drawCulling;
+        if (IsKeyPressed(KEY_D)) drawDensity = !drawDensity;
+        if (IsKeyPressed(KEY_N)) nearestNeighboursNetwork = !nearestNeighboursNetwork;
+        sim.knnK = nearestNeighboursNetwork ? networkK : 0;
+        if (IsKeyPressed(KEY_T)) showTimers = !showTimers;
+        if (IsKeyPressed(KEY_U)) sim.retune++;
+        if (IsKeyPressed(KEY_F9)) {
+            printf(WriteTimerCsv("boids_timings.csv") ? "Wrote boids_timings.csv\n" : "Failed to write boids_timings.csv\n");
+        }
+        if (IsKeyPressed(KEY_F10)) {
+            printf(WriteTimerTrace("boids_trace.json") ? "Wrote boids_trace.json\n" : "Failed to write boids_trace.json\n");
+        }
+        if (IsKeyPressed(KEY_RIGHT_BRACKET)) sim.boidCount *= 2;
+        if (IsKeyPressed(KEY_LEFT_BRACKET) && sim.boidCount > 1) sim.boidCount /= 2;
+        if (IsKeyPressed(KEY_PERIOD)) sim.predatorCount = sim.predatorCount ? sim.predatorCount * 2 : 1;
+        if (IsKeyPressed(KEY_COMMA)) sim.predatorCount /= 2;
+
+        Texture2D densityTexture = { 0 };
+        if (drawDensity) densityTexture = UpdateDensityTexture(snapshot);
+        bool showDensity = densityTexture.id != 0;
+        torus_model.materials[0].maps[MATERIAL_MAP_DIFFUSE].texture = showDensity ? densityTexture : torusTexture;
 
         BeginDrawing();
             ClearBackground(RAYWHITE);
@@ -159,14 +380,24 @@ int main(void)
                 
                 BeginShaderMode(shader);
                     if (flat) {
-                        DrawPlane(Vector3Zero(), (Vector2) { SCREEN_WIDTH, SCREEN_HEIGHT }, DARKGRAY);
-                        DrawBoids3D();
+                        if (showDensity) {
+                            densityPlane.materials[0].maps[MATERIAL_MAP_DIFFUSE].texture = densityTexture;
+                            DrawModel(densityPlane, Vector3Zero(), 1.0f, WHITE);
+                        } else {
+                            DrawPlane(Vector3Zero(), (Vector2) { SCREEN_WIDTH, SCREEN_HEIGHT }, DARKGRAY);
+                        }
+                        DrawBoids3D(snapshot, alpha);
                     } else {
+                        UpdateTorusMeshes(&torusMeshes);
+                        float pixelsPerUnit = 0.5f * GetScreenHeight() / tanf(0.5f * DEG2RAD * camera.fovy);
+                        torus_model.meshes[0] = torusMeshes.lod[SelectTorusLod(camera.position, pixelsPerUnit)];
                         DrawModel(torus_model, (Vector3){ 0.0f, 0.0f, 0.0f }, 1.0f, WHITE);
-                        DrawBoids3DTorus();
+                        DrawBoids3DTorus(snapshot, alpha);
 
                     }
                 EndShaderMode();
+                if (nearestNeighboursNetwork) DrawNeighbourNetwork(snapshot, alpha);
+                DrawPickedBoid(snapshot, alpha);
 
                 // Draw spheres to show where the lights are
                 for (int i = 0; i < MAX_LIGHTS; i++)
@@ -176,17 +407,101 @@ int main(void)
                 }
             EndMode3D();
 
+            uint64_t guiStart = TimerNow();
 
             DrawText("Boids with Predator Simulation", 20, 10, 20, DARKGRAY);
             DrawText("Current Resolution:", 20, 30, 20, DARKGRAY);
             DrawText(TextFormat("%d x %d", SCREEN_WIDTH, SCREEN_HEIGHT), 20, 50, 30, BLUE);
-            DrawText(TextFormat("Boids drawn: %d", number_drawn), 20, 80, 30, BLUE);
+            DrawText(TextFormat("Boids drawn: %d of %zu (%zu predators)", number_drawn,
+                                snapshot->count + snapshot->predators, snapshot->predators), 20, 80, 30, BLUE);
             DrawText(TextFormat("Frame Time: %0.2f ms", GetFrameTime() * 1000), 20, 110, 30, BLUE);
-            DrawText(TextFormat("OpenMP threads: %d", omp_get_max_threads()), 20, 140, 30, BLUE);
-
-            GuiCheckBox((Rectangle){ 20, 170, 28, 28 }, "Draw flat", &flat);
+            if (snapshot->workers > 0) {
+                DrawText(TextFormat("Worker processes: %d over %s", snapshot->workers, transport_name(domainTransport)),
+                         20, 140, 30, BLUE);
+            } else {
+                DrawText(TextFormat("OpenMP threads: %d", omp_get_max_threads()), 20, 140, 30, BLUE);
+            }
+            if (snapshot->cell_size > 0) {
+                char schedule[32];
+                schedule_name(snapshot->schedule, snapshot->chunk, schedule, sizeof(schedule));
+                DrawText(TextFormat("Kernel: %s, cell %d px, %s", flock_kernel_name(flock_kernel_current()),
+                                    snapshot->cell_size, schedule), 20, 170, 30, BLUE);
+            } else {
+                DrawText(TextFormat("Kernel: %s", flock_kernel_name(flock_kernel_current())), 20, 170, 30, BLUE);
+            }
+
+            GuiCheckBox((Rectangle){ 20, 200, 28, 28 }, "Draw flat", &flat);
+            // More than one species only gathers (species.h)
+            if (speciesCount > 1) {
+                sim.interaction = FLOCK_GATHER;
+                GuiDisable();
+            }
+            int interaction = sim.interaction;
+            GuiToggleGroup((Rectangle){ 20, 235, 110, 28 }, "Gather;Symmetric;Lists", &interaction);
+            sim.interaction = (FlockInteraction)interaction;
+            GuiEnable();
+            if (sim.interaction == FLOCK_NEIGHBOR_LIST && snapshot->lists.rebuilds > 0) {
+                const NeighborListStats *stats = &snapshot->lists;
+                DrawText(TextFormat("Lists: rebuilt every %.1f frames, hit rate %.0f%%",
+                                    (float)stats->frames / stats->rebuilds,
+                                    stats->entries ? 100.0f * stats->hits / stats->entries : 0.0f),
+                         20, 270, 20, DARKGRAY);
+            }
 
             DrawFPS(SCREEN_WIDTH - 100, 10);
+            DrawText(TextFormat("Sim: %.0f ticks/s, %.2f ms/tick%s", snapshot->interval > 0.0 ? 1.0 / snapshot->interval : 0.0,
+                                snapshot->tick_ms, sim.paused ? " (paused)" : ""),
+                     20, 300, 20, DARKGRAY);
+            if (drawCulling && drawInstanced) {
+                DrawText(TextFormat("Draw: %.2f ms, instanced, %d full, %d simple, %d streaks, %d culled",
+                                    timerSummary.p50[STAGE_TRANSFORMS] + timerSummary.p50[STAGE_DRAW],
+                                    drawStats.full, drawStats.simple, drawStats.points, drawStats.culled),
+                         20, 325, 20, DARKGRAY);
+            } else {
+                DrawText(TextFormat("Draw: %.2f ms, %s%s", timerSummary.p50[STAGE_TRANSFORMS] + timerSummary.p50[STAGE_DRAW],
+                                    drawInstanced ? "instanced" : "per dart",
+                                    drawCulling ? TextFormat(", %d culled", drawStats.culled) : ", no culling"),
+                         20, 325, 20, DARKGRAY);
+            }
+            if (!replayPath) {
+                const ReorderStats *order = &snapshot->reorder;
+                const char *misses = order->misses < 0.0f ? "" :
+                    TextFormat(", %.2f -> %.2f LLC misses", order->misses_before, order->misses_after);
+                DrawText(order->reorders == 0 ?
+                             TextFormat("Forces: %.1f ns/boid", order->ns) :
+                             TextFormat("Forces: %.1f ns/boid, reorder %.1f -> %.1f%s", order->ns,
+                                        order->ns_before, order->ns_after, misses),
+                         20, 350, 20, DARKGRAY);
+            }
+            if (snapshot->picked < snapshot->count) {
+                uint32_t b = snapshot->picked;
+                DrawText(TextFormat("Boid %u at (%.0f, %.0f), speed %.1f", snapshot->picked_id, snapshot->x[b], snapshot->y[b],
+                                    sqrtf(snapshot->vx[b] * snapshot->vx[b] + snapshot->vy[b] * snapshot->vy[b])),
+                         20, 400, 20, DARKGRAY);
+            }
+            if (showTimers) DrawTimerOverlay(&timerSummary, SCREEN_WIDTH - 520, 40);
+
+            if (replayPath) {
+                const uint8_t *predated = ReplayPredated();
+                size_t predatedCount = 0;
+                for (size_t b = 0; b < (snapshot->count + 7) / 8; b++) predatedCount += __builtin_popcount(predated[b]);
+
+                // Scrub bar
+                float scrub = (float)replayFrame;
+                GuiSliderBar((Rectangle){ 20, 375, 400, 24 }, NULL,
+                             TextFormat("Replay frame %zu of %zu, %zu predated", replayFrame + 1,
+                                        ReplayFrameCount(), predatedCount),
+                             &scrub, 0.0f, (float)(ReplayFrameCount() - 1));
+                if ((size_t)scrub != replayFrame) {
+                    replayFrame = (size_t)scrub;
+                    replayClock = 0.0f;
+                }
+            } else if (recordPath) {
+                RecorderStats recorded = GetRecorderStats();
+                DrawText(TextFormat("Recording: %zu frames, %.1f MB, %zu dropped", recorded.frames,
+                                    recorded.bytes / 1e6, recorded.dropped),
+                         20, 375, 20, RED);
+            }
 
             // Start the sliders below the text stats
             Rectangle sliderBounds = { 500, 50, 300, 30 };
@@ -212,9 +527,22 @@ int main(void)
                 TextFormat("Separation (%.2f)", separationWeight),
                 NULL,
                 &separationWeight, 0.0f, 10.0f);
+            TimerRecord(STAGE_GUI, 0, guiStart, TimerNow());
         EndDrawing();
+
+        sim.alignmentWeight = alignmentWeight;
+        sim.cohesionWeight = cohesionWeight;
+        sim.separationWeight = separationWeight;
+        SetSimulationSettings(sim);
     }
 
+    StopSimulationThread();
+    StopDomain();
+    StopRecording();
+    CloseReplay();
+    UnloadModel(densityPlane);
+    UnloadTorusMeshes(&torusMeshes);
+    UnloadShader(instancingShader);
     CloseWindow();
 
     return 0;
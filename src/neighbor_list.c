@@ -0,0 +1,230 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+#include "neighbor_list.h"
+#include "spatial_hash.h"
+#include "boids.h"
+
+float neighborListSkin = DEFAULT_NEIGHBOR_LIST_SKIN;
+NeighborListStats neighborListStats = {0};
+
+// A thread's lists while building
+typedef struct ThreadEntries {
+    uint32_t *entries;
+    uint32_t count;
+    uint32_t capacity;
+} ThreadEntries;
+
+typedef struct NeighborLists {
+    size_t count;           // boids the lists were built for, 0 when stale
+    size_t capacity;        // boid slots allocated
+    size_t *start;          // count + 1 offsets into entries
+    uint32_t *entries;      // neighbour indices, grouped by boid
+    size_t entry_capacity;
+    float *x, *y;           // positions at the last build
+    float *sorted_x;        // the same, in grid order
+    float *sorted_y;
+    FlockSums *sums;        // per boid, from the last evaluation
+    float skin;             // settings the lists were built with
+    int width, height;
+    ThreadEntries *thread_entries;
+    int threads;            // thread_entries allocated
+} NeighborLists;
+
+static NeighborLists lists = {0};
+
+static void *lists_realloc(void *ptr, size_t size) {
+    void *p = realloc(ptr, size);
+    if (!p) {
+        fprintf(stderr, "Failed to allocate neighbour lists!\n");
+        exit(1);
+    }
+    return p;
+}
+
+static void reserve_lists(size_t n) {
+    if (n <= lists.capacity) return;
+    lists.start = lists_realloc(lists.start, (n + 1) * sizeof(size_t));
+    lists.x = lists_realloc(lists.x, n * sizeof(float));
+    lists.y = lists_realloc(lists.y, n * sizeof(float));
+    lists.sorted_x = lists_realloc(lists.sorted_x, n * sizeof(float));
+    lists.sorted_y = lists_realloc(lists.sorted_y, n * sizeof(float));
+    lists.sums = lists_realloc(lists.sums, n * sizeof(FlockSums));
+    lists.capacity = n;
+}
+
+void InvalidateNeighborLists(void) {
+    lists.count = 0;
+}
+
+// True once any boid has moved more than half the skin since the build
+static bool lists_stale(void) {
+    if (lists.count != boidCount || lists.skin != neighborListSkin ||
+        lists.width != SCREEN_WIDTH || lists.height != SCREEN_HEIGHT) return true;
+
+    const size_t n = boidCount;
+    float worst = 0.0f;
+    #pragma omp parallel for schedule(static) reduction(max:worst)
+    for (size_t i = 0; i < n; i++) {
+        float moved = DistanceOnTorusSquared(BoidPosition(i), (Vec2){ lists.x[i], lists.y[i] });
+        if (moved > worst) worst = moved;
+    }
+    float limit = 0.5f * neighborListSkin;
+    return worst > limit * limit;
+}
+
+// Candidates are tested in blocks so the distance loop vectorises
+#define LIST_BLOCK 256
+
+// Runs of cell_boids covering every cell that reaches within radius of
+// (px, py): per row, only the columns under the circle's chord
+static int list_ranges(float px, float py, float radius, CellRange *ranges) {
+    int row0 = (int)floorf((py - radius) / cellSize);
+    int rows = (int)floorf((py + radius) / cellSize) - row0 + 1;
+    if (rows > grid.height) { row0 = 0; rows = grid.height; }
+
+    int n = 0;
+    for (int r = row0; r < row0 + rows; r++) {
+        float top = (float)r * cellSize;
+        float gap = fmaxf(0.0f, fmaxf(top - py, py - (top + cellSize)));
+        float half = sqrtf(fmaxf(0.0f, radius * radius - gap * gap));
+        int column0 = (int)floorf((px - half) / cellSize);
+        int columns = (int)floorf((px + half) / cellSize) - column0 + 1;
+        if (columns > grid.width) { column0 = 0; columns = grid.width; }
+        n += grid_row_ranges(WRAP_MOD(r, grid.height), column0, columns, ranges + n);
+    }
+    return n;
+}
+
+// Appends the other boids within radius of boid i to a
+// thread's buffer, in grid order. Returns how many were added.
+static size_t collect_neighbors(size_t i, float radius, ThreadEntries *out) {
+    const float width = (float)SCREEN_WIDTH, height = (float)SCREEN_HEIGHT;
+    const float radius_squared = radius * radius;
+    const float px = boids.x[i], py = boids.y[i];
+
+    CellRange ranges[GRID_MAX_RANGES];
+    int range_count = list_ranges(px, py, radius, ranges);
+
+    size_t count = 0;
+    float dist[LIST_BLOCK];
+    for (int r = 0; r < range_count; r++) {
+        uint32_t needed = out->count + (ranges[r].end - ranges[r].begin);
+        if (needed > out->capacity) {
+            out->capacity = 2 * needed;
+            out->entries = lists_realloc(out->entries, out->capacity * sizeof(uint32_t));
+        }
+        for (uint32_t k0 = ranges[r].begin; k0 < ranges[r].end; k0 += LIST_BLOCK) {
+            uint32_t length = ranges[r].end - k0 < LIST_BLOCK ? ranges[r].end - k0 : LIST_BLOCK;
+            const float *sx = lists.sorted_x + k0, *sy = lists.sorted_y + k0;
+            #pragma omp simd
+            for (size_t u = 0; u < length; u++) {
+                float dx = fabsf(sx[u] - px);
+                float dy = fabsf(sy[u] - py);
+                dx = dx < width - dx ? dx : width - dx;
+                dy = dy < height - dy ? dy : height - dy;
+                dist[u] = dx * dx + dy * dy;
+            }
+            // Branch-free append: always write, advance only on a hit
+            for (uint32_t u = 0; u < length; u++) {
+                uint32_t j = grid.cell_boids[k0 + u];
+                out->entries[out->count] = j;
+                uint32_t hit = (dist[u] < radius_squared) & (j != i);
+                out->count += hit;
+                count += hit;
+            }
+        }
+    }
+    return count;
+}
+
+// Each thread collects the lists of its share of the boids into its own
+// buffer; the counts are then scanned into offsets and the buffers copied
+// into place
+static void build_lists(void) {
+    const size_t n = boidCount;
+    const float radius = NEIGHBOR_RADIUS + neighborListSkin;
+    reserve_lists(n);
+
+    int threads = omp_get_max_threads();
+    if (threads > lists.threads) {
+        lists.thread_entries = lists_realloc(lists.thread_entries, threads * sizeof(ThreadEntries));
+        for (int t = lists.threads; t < threads; t++) lists.thread_entries[t] = (ThreadEntries){0};
+        lists.threads = threads;
+    }
+
+    #pragma omp parallel
+    {
+        const int t = omp_get_thread_num();
+        const int team = omp_get_num_threads();
+        const size_t i0 = n * t / team;
+        const size_t i1 = n * (t + 1) / team;
+        ThreadEntries *out = &lists.thread_entries[t];
+
+        #pragma omp for schedule(static)
+        for (size_t k = 0; k < grid.count; k++) {
+            lists.sorted_x[k] = boids.x[grid.cell_boids[k]];
+            lists.sorted_y[k] = boids.y[grid.cell_boids[k]];
+        }
+
+        out->count = 0;
+        for (size_t i = i0; i < i1; i++) {
+            lists.start[i + 1] = collect_neighbors(i, radius, out);
+            lists.x[i] = boids.x[i];
+            lists.y[i] = boids.y[i];
+        }
+        #pragma omp barrier
+
+        #pragma omp single
+        {
+            lists.start[0] = 0;
+            for (size_t i = 0; i < n; i++) lists.start[i + 1] += lists.start[i];
+            if (lists.start[n] > lists.entry_capacity) {
+                lists.entry_capacity = lists.start[n] + lists.start[n] / 4;
+                lists.entries = lists_realloc(lists.entries, lists.entry_capacity * sizeof(uint32_t));
+            }
+        }
+
+        memcpy(lists.entries + lists.start[i0], out->entries, out->count * sizeof(uint32_t));
+    }
+
+    lists.count = n;
+    lists.skin = neighborListSkin;
+    lists.width = SCREEN_WIDTH;
+    lists.height = SCREEN_HEIGHT;
+    neighborListStats.rebuilds++;
+}
+
+bool ComputeNeighborListFlockSums(void) {
+    const int reach = (int)ceilf((NEIGHBOR_RADIUS + neighborListSkin) / cellSize);
+    if (reach > GRID_MAX_REACH) return false;
+
+    if (lists_stale()) build_lists();
+
+    const size_t n = boidCount;
+    size_t entries = 0, hits = 0;
+    #pragma omp parallel for schedule(static) reduction(+:entries, hits)
+    for (size_t i = 0; i < n; i++) {
+        const float px = boids.x[i];
+        const float py = boids.y[i];
+        const uint32_t length = (uint32_t)(lists.start[i + 1] - lists.start[i]);
+
+        FlockSums sums = {0};
+        flock_kernel(px, py, (uint32_t)i, lists.entries + lists.start[i], length, &sums);
+        entries += length;
+        hits += sums.neighborCount + sums.nearNeighborCount + sums.coincident;
+        lists.sums[i] = sums;
+    }
+
+    neighborListStats.frames++;
+    neighborListStats.entries += entries;
+    neighborListStats.hits += hits;
+    return true;
+}
+
+FlockSums NeighborListFlockSums(size_t i) {
+    return lists.sums[i];
+}
@@ -0,0 +1,47 @@
+#ifndef NEIGHBOR_LIST_H
+#define NEIGHBOR_LIST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "flock_kernel.h"
+
+// Verlet neighbour lists.
+//
+// Each boid keeps the other boids within NEIGHBOR_RADIUS + neighborListSkin
+// in one compact CSR buffer. The lists stay valid until some boid has moved
+// more than half the skin since they were built, since no pair can have
+// closed the gap before then; only then are they rebuilt from the grid.
+// Between rebuilds the forces come from walking the lists with the current
+// flock kernel.
+//
+// The neighbour counts match the grid path exactly. The sums visit the
+// neighbours in a different order, so they match it within the tolerance
+// documented in flock_kernel.h.
+
+#define DEFAULT_NEIGHBOR_LIST_SKIN 10.0f
+
+extern float neighborListSkin;
+
+typedef struct NeighborListStats {
+    size_t frames;    // frames evaluated from the lists
+    size_t rebuilds;
+    size_t entries;   // list entries walked
+    size_t hits;      // of those, entries inside NEIGHBOR_RADIUS
+} NeighborListStats;
+
+extern NeighborListStats neighborListStats;
+
+// Forces a rebuild on the next frame; call when boid slots are moved
+void InvalidateNeighborLists(void);
+
+// Rebuilds the lists if they have gone stale, then accumulates the sums of
+// every active boid from them. Returns false, leaving the gather to be used,
+// if the list radius needs a wider block than the grid supports.
+bool ComputeNeighborListFlockSums(void);
+
+// Boid i's sums from the last ComputeNeighborListFlockSums()
+FlockSums NeighborListFlockSums(size_t i);
+
+#endif // NEIGHBOR_LIST_H
@@ -6,12 +6,68 @@
 #define M_PI 3.14159265358979323846
 #endif
 
-// Returns a normally distributed value with given mean and standard deviation
-float random_normal(float mean, float stddev) {
-    // Use Box-Muller transform
-    float u1 = ((float)random() + 1.0f) / ((float)RAND_MAX + 2.0f);
-    float u2 = ((float)random() + 1.0f) / ((float)RAND_MAX + 2.0f);
-
-    float z0 = sqrtf(-2.0f * logf(u1)) * cosf(2.0f * M_PI * u2);
-    return z0 * stddev + mean;
+#define GOLDEN_GAMMA 0x9e3779b97f4a7c15ULL
+
+static uint64_t randomSeed = 0;
+
+void random_seed(uint64_t seed) {
+    randomSeed = seed;
+}
+
+// SplitMix64's output function: a bijection that scatters nearby inputs
+static inline uint64_t mix64(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t stream_key(RandomStream stream, uint64_t frame) {
+    return mix64(mix64(randomSeed + GOLDEN_GAMMA * ((uint64_t)stream + 1)) ^ frame);
+}
+
+// The index steps a SplitMix64 sequence started at the key
+static inline uint64_t keyed_bits(uint64_t key, uint64_t index) {
+    return mix64(key + GOLDEN_GAMMA * (index + 1));
+}
+
+// Top 24 bits as a float in [0, 1)
+static inline float unit_float(uint64_t bits) {
+    return (float)(bits >> 40) * (1.0f / 16777216.0f);
+}
+
+// Box-Muller on two 24-bit halves of one draw
+static inline float normal_float(uint64_t bits) {
+    float u1 = (float)((bits >> 40) + 1) * (1.0f / 16777216.0f); // (0, 1]
+    float u2 = (float)(bits & 0xffffff) * (1.0f / 16777216.0f);
+    return sqrtf(-2.0f * logf(u1)) * cosf(2.0f * (float)M_PI * u2);
+}
+
+uint64_t random_bits(RandomStream stream, uint64_t frame, uint64_t index) {
+    return keyed_bits(stream_key(stream, frame), index);
+}
+
+float random_uniform(RandomStream stream, uint64_t frame, uint64_t index, float min, float max) {
+    return min + unit_float(random_bits(stream, frame, index)) * (max - min);
+}
+
+float random_normal(RandomStream stream, uint64_t frame, uint64_t index, float mean, float stddev) {
+    return normal_float(random_bits(stream, frame, index)) * stddev + mean;
+}
+
+void random_uniform_fill(float *out, size_t count, RandomStream stream, uint64_t frame, uint64_t first,
+                         float min, float max) {
+    const uint64_t key = stream_key(stream, frame);
+    #pragma omp parallel for simd schedule(static)
+    for (size_t k = 0; k < count; k++) {
+        out[k] = min + unit_float(keyed_bits(key, first + k)) * (max - min);
+    }
+}
+
+void random_normal_fill(float *out, size_t count, RandomStream stream, uint64_t frame, uint64_t first,
+                        float mean, float stddev) {
+    const uint64_t key = stream_key(stream, frame);
+    #pragma omp parallel for schedule(static)
+    for (size_t k = 0; k < count; k++) {
+        out[k] = normal_float(keyed_bits(key, first + k)) * stddev + mean;
+    }
 }
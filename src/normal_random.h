@@ -1,6 +1,41 @@
 #ifndef NORMAL_RANDOM_H
 #define NORMAL_RANDOM_H
 
-float random_normal(float mean, float stddev);
+#include <stddef.h>
+#include <stdint.h>
 
-#endif
\ No newline at end of file
+// Counter-based random numbers. Every value is a hash of (seed, stream,
+// frame, index) rather than the next state of a shared generator, so it
+// does not depend on which thread asks for it or in what order: the same
+// seed gives the same run with any number of threads.
+
+// One stream per quantity, so draws for different purposes never collide
+typedef enum RandomStream {
+    RANDOM_POSITION_X = 0,
+    RANDOM_POSITION_Y,
+    RANDOM_HEADING,
+    RANDOM_SPEED,
+    RANDOM_NUDGE,
+    RANDOM_PREDATOR_X,
+    RANDOM_PREDATOR_Y,
+    RANDOM_PREDATOR_HEADING,
+} RandomStream;
+
+void random_seed(uint64_t seed);
+
+// 64 random bits for (stream, frame, index)
+uint64_t random_bits(RandomStream stream, uint64_t frame, uint64_t index);
+
+// Uniformly distributed value in [min, max)
+float random_uniform(RandomStream stream, uint64_t frame, uint64_t index, float min, float max);
+
+// Normally distributed value with given mean and standard deviation
+float random_normal(RandomStream stream, uint64_t frame, uint64_t index, float mean, float stddev);
+
+// out[k] = random_uniform / random_normal at index first + k, in parallel
+void random_uniform_fill(float *out, size_t count, RandomStream stream, uint64_t frame, uint64_t first,
+                         float min, float max);
+void random_normal_fill(float *out, size_t count, RandomStream stream, uint64_t frame, uint64_t first,
+                        float mean, float stddev);
+
+#endif
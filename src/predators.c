@@ -0,0 +1,188 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <omp.h>
+
+#include "predators.h"
+#include "boids.h"
+#include "spatial_hash.h"
+#include "normal_random.h"
+#include "density_field.h"
+
+Predators predators = {0};
+size_t predatorCount = DEFAULT_PREDATORS;
+size_t predatorHaloCount = 0;
+PredatorGrid predatorGrid = {0};
+
+static size_t predatorCapacity = 0;
+
+// Cells around a predator's own that PREDATOR_RADIUS can reach into
+#define PREDATOR_REACH ((int)((PREDATOR_RADIUS + cellSize - 1) / cellSize))
+
+// How far ahead a predator looks for boids, and the fraction of the way to
+// their centre of mass it turns each frame (the mean front weighting of the
+// boids it used to scan one by one)
+#define PREDATOR_LOOKAHEAD (PREDATOR_VISUAL_RADIUS * 0.5f)
+#define PREDATOR_PURSUIT 0.25f
+
+static void *predator_realloc(void *ptr, size_t size) {
+    void *p = realloc(ptr, size);
+    if (!p && size > 0) {
+        fprintf(stderr, "Failed to allocate predators!\n");
+        exit(1);
+    }
+    return p;
+}
+
+static void ReservePredators(size_t count) {
+    if (count <= predatorCapacity) return;
+    size_t capacity = predatorCapacity * 2 > count ? predatorCapacity * 2 : count;
+    predators.x = predator_realloc(predators.x, capacity * sizeof(float));
+    predators.y = predator_realloc(predators.y, capacity * sizeof(float));
+    predators.vx = predator_realloc(predators.vx, capacity * sizeof(float));
+    predators.vy = predator_realloc(predators.vy, capacity * sizeof(float));
+    predatorGrid.cell_predators = predator_realloc(predatorGrid.cell_predators, capacity * sizeof(uint32_t));
+    predatorGrid.capacity = capacity;
+    predatorCapacity = capacity;
+}
+
+// Places predators [first, end) at random at full speed, keyed on the
+// current frame and the predator
+static void RandomizePredators(size_t first, size_t end) {
+    for (size_t p = first; p < end; p++) {
+        float angle = random_uniform(RANDOM_PREDATOR_HEADING, frameCounter, p, 0.0f, 2.0f * PI);
+        predators.x[p] = random_uniform(RANDOM_PREDATOR_X, frameCounter, p, 0.0f, SCREEN_WIDTH);
+        predators.y[p] = random_uniform(RANDOM_PREDATOR_Y, frameCounter, p, 0.0f, SCREEN_HEIGHT);
+        predators.vx[p] = cosf(angle) * PREDATOR_SPEED;
+        predators.vy[p] = sinf(angle) * PREDATOR_SPEED;
+    }
+}
+
+void init_predator_grid(void) {
+    predatorGrid.width = grid.width;
+    predatorGrid.height = grid.height;
+    size_t cells = (size_t)grid.width * grid.height;
+    predatorGrid.cell_start = predator_realloc(predatorGrid.cell_start, (cells + 1) * sizeof(uint32_t));
+    predatorGrid.near = predator_realloc(predatorGrid.near, cells);
+    build_predator_grid();
+}
+
+void InitPredators(size_t count) {
+    ReservePredators(count);
+    predatorCount = count;
+    RandomizePredators(0, count);
+    if (count > 0) {
+        predators.x[0] = HALF_SCREEN_WIDTH;
+        predators.y[0] = HALF_SCREEN_HEIGHT;
+        predators.vx[0] = PREDATOR_SPEED;
+        predators.vy[0] = PREDATOR_SPEED;
+    }
+    init_predator_grid();
+}
+
+void ResizePredators(size_t count) {
+    ReservePredators(count);
+    predatorCount = count;
+}
+
+void SetPredatorCount(size_t count) {
+    if (count == predatorCount) return;
+    ReservePredators(count);
+    RandomizePredators(predatorCount, count);
+    predatorCount = count;
+    build_predator_grid();
+}
+
+// Serial counting sort: there are few predators, and the near flags cost a
+// block of cells per predator
+void build_predator_grid(void) {
+    const int width = predatorGrid.width, height = predatorGrid.height;
+    const size_t cells = (size_t)width * height;
+    uint32_t *start = predatorGrid.cell_start;
+
+    memset(start, 0, (cells + 1) * sizeof(uint32_t));
+    memset(predatorGrid.near, 0, cells);
+    for (size_t p = 0; p < predatorCount; p++) start[grid_cell_of(predators.x[p], predators.y[p]) + 1]++;
+    for (size_t c = 0; c < cells; c++) start[c + 1] += start[c];
+    for (size_t p = 0; p < predatorCount; p++) {
+        uint32_t cell = grid_cell_of(predators.x[p], predators.y[p]);
+        predatorGrid.cell_predators[start[cell]++] = (uint32_t)p;
+
+        int cell_x = (int)(cell % width), cell_y = (int)(cell / width);
+        for (int dy = -PREDATOR_REACH; dy <= PREDATOR_REACH; dy++) {
+            for (int dx = -PREDATOR_REACH; dx <= PREDATOR_REACH; dx++) {
+                predatorGrid.near[WRAP_MOD(cell_y + dy, height) * width + WRAP_MOD(cell_x + dx, width)] = 1;
+            }
+        }
+    }
+    // The scatter advanced every start to the next cell's; shift them back
+    memmove(start + 1, start, cells * sizeof(uint32_t));
+    start[0] = 0;
+}
+
+Vec2 PredatorAvoidance(float x, float y, uint32_t cell, bool *predated) {
+    Vec2 push = { 0.0f, 0.0f };
+    *predated = false;
+    if (!predatorGrid.near[cell]) return push;
+
+    const int width = predatorGrid.width, height = predatorGrid.height;
+    const Vec2 position = { x, y };
+
+    // A block wider than the world would visit cells twice, so clamp it
+    int span = 2 * PREDATOR_REACH + 1;
+    int x0 = (int)(cell % width) - PREDATOR_REACH, columns = span;
+    int y0 = (int)(cell / width) - PREDATOR_REACH, rows = span;
+    if (span >= width) { x0 = 0; columns = width; }
+    if (span >= height) { y0 = 0; rows = height; }
+
+    for (int r = 0; r < rows; r++) {
+        int row = WRAP_MOD(y0 + r, height) * width;
+        for (int c = 0; c < columns; c++) {
+            int neighbor_cell = row + WRAP_MOD(x0 + c, width);
+            for (uint32_t k = predatorGrid.cell_start[neighbor_cell]; k < predatorGrid.cell_start[neighbor_cell + 1]; k++) {
+                Vec2 predator_position = PredatorPosition(predatorGrid.cell_predators[k]);
+                float dist = DistanceOnTorusSquared(predator_position, position);
+                if (dist < PREDATOR_RADIUS * PREDATOR_RADIUS) {
+                    *predated = true;
+                    if (dist != 0) {
+                        Vec2 away = Vec2Normalize(Vector2SubtractTorus(position, predator_position));
+                        push = Vec2Add(push, Vec2Scale(away, PREDATOR_AVOID_FACTOR / sqrtf(dist)));
+                    }
+                }
+            }
+        }
+    }
+    return push;
+}
+
+// Turns predator p towards the centre of mass of the boids in the block
+// ahead of it, or around it when that is empty: two density field lookups
+// instead of a scan of every boid in sight
+static Vec2 PreditorAjustment(size_t p) {
+    Vec2 predator_position = PredatorPosition(p);
+    Vec2 predator_dir = Vec2Normalize(PredatorVelocity(p));
+
+    Vec2 ahead = Vector2Wrap(Vec2Add(predator_position, Vec2Scale(predator_dir, PREDATOR_LOOKAHEAD)),
+                             SCREEN_WIDTH, SCREEN_HEIGHT);
+    DensitySample sample = SampleDensity(ahead.x, ahead.y);
+    if (sample.count == 0.0f) sample = SampleDensity(predator_position.x, predator_position.y);
+    if (sample.count == 0.0f) return (Vec2){ 0.0f, 0.0f };
+
+    return Vec2Scale(Vector2SubtractTorus(sample.centroid, predator_position), PREDATOR_PURSUIT);
+}
+
+void UpdatePredators(float step) {
+    #pragma omp parallel for schedule(static)
+    for (size_t p = 0; p < predatorCount - predatorHaloCount; p++) {
+        Vec2 velocity = Vec2ClampValue(Vec2Add(PredatorVelocity(p), PreditorAjustment(p)),
+                                       MIN_SPEED, PREDATOR_SPEED);
+        Vec2 position = Vector2Wrap(Vec2Add(PredatorPosition(p), Vec2Scale(velocity, step)),
+                                    SCREEN_WIDTH, SCREEN_HEIGHT);
+        predators.vx[p] = velocity.x;
+        predators.vy[p] = velocity.y;
+        predators.x[p] = position.x;
+        predators.y[p] = position.y;
+    }
+    build_predator_grid();
+}
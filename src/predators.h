@@ -0,0 +1,72 @@
+#ifndef PREDATORS_H
+#define PREDATORS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vec2.h"
+
+// Predators.
+//
+// The predators are a population of their own, apart from the boids, with
+// their own grid over the same cells as the boid grid. A tick has two passes
+// and neither writes anything another thread reads:
+//  - in the force pass every boid gathers the push away from the predators
+//    within PREDATOR_RADIUS of it (PredatorAvoidance);
+//  - then every predator, in parallel, steers towards the boids in front of
+//    it, as seen in the density field (density_field.h), and moves
+//    (UpdatePredators), and the predator grid is rebuilt.
+
+#define DEFAULT_PREDATORS 1
+
+typedef struct Predators {
+    float *x;   // position
+    float *y;
+    float *vx;  // velocity
+    float *vy;
+} Predators;
+
+// Counting sort of the predators by boid grid cell, rebuilt every tick.
+// The predators of cell c are cell_predators[cell_start[c] .. cell_start[c + 1]).
+typedef struct PredatorGrid {
+    int width;                  // cells across, as the boid grid
+    int height;
+    uint32_t *cell_start;       // width * height + 1 offsets into cell_predators
+    uint32_t *cell_predators;   // predator indices sorted by cell
+    uint8_t *near;              // per cell, 1 if a predator may be within PREDATOR_RADIUS
+    size_t capacity;            // slots in cell_predators
+} PredatorGrid;
+
+extern Predators predators;
+extern size_t predatorCount;
+// Trailing predators that belong to another process (domain.h): boids flee
+// them, UpdatePredators() leaves them be
+extern size_t predatorHaloCount;
+extern PredatorGrid predatorGrid;
+
+static inline Vec2 PredatorPosition(size_t p) { return (Vec2){ predators.x[p], predators.y[p] }; }
+static inline Vec2 PredatorVelocity(size_t p) { return (Vec2){ predators.vx[p], predators.vy[p] }; }
+
+// Places count predators, the first in the middle of the world and the rest
+// at random, and sizes the predator grid for the boid grid. After
+// init_spatial_grid().
+void InitPredators(size_t count);
+// Grows or shrinks the predators at runtime; new ones are placed at random
+void SetPredatorCount(size_t count);
+// Sets predatorCount, keeping their contents and leaving new ones and the
+// predator grid for the caller
+void ResizePredators(size_t count);
+// Sizes the predator grid for the boid grid and builds it
+void init_predator_grid(void);
+void build_predator_grid(void);
+
+// Push on a boid at (x, y), in boid grid cell `cell`, away from every
+// predator within PREDATOR_RADIUS; *predated is set if there is one
+Vec2 PredatorAvoidance(float x, float y, uint32_t cell, bool *predated);
+
+// Steers each predator towards the boids ahead of it and moves it, in
+// parallel, then rebuilds the predator grid. Reads the boids only.
+void UpdatePredators(float step);
+
+#endif // PREDATORS_H
@@ -0,0 +1,482 @@
+#include <fcntl.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "recorder.h"
+#include "boids.h"
+#include "predators.h"
+
+// Frames waiting for the writer
+#define RECORDER_QUEUE 8
+
+// Worst-case bytes of a zigzag varint of an int32
+#define VARINT_MAX 5
+
+typedef struct RecordSlot {
+    size_t count;
+    size_t predators;
+    uint64_t frame;
+    float frame_time;
+    size_t capacity;
+    float *x, *y, *vx, *vy;   // count + predators slots
+    uint8_t *predated;        // count bits
+} RecordSlot;
+
+typedef struct Recorder {
+    FILE *file;
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    bool running;             // guarded by lock
+    size_t head, tail;        // guarded by lock; slots [head, tail) are queued
+    RecordSlot slots[RECORDER_QUEUE];
+    RecorderStats stats;      // guarded by lock
+    bool failed;              // a write came up short
+
+    // Writer state: the last frame it stored, quantised
+    int32_t *q[4];
+    size_t q_capacity;
+    size_t last_count;
+    size_t last_predators;
+    uint64_t last_frame;
+    size_t since_keyframe;
+    bool have_last;
+    int32_t periods[2];       // world size in position steps
+    uint8_t *buffer;
+    size_t buffer_capacity;
+} Recorder;
+
+static Recorder recorder = { .lock = PTHREAD_MUTEX_INITIALIZER, .ready = PTHREAD_COND_INITIALIZER };
+static bool recording = false;
+
+typedef struct Replay {
+    int fd;
+    const uint8_t *map;
+    size_t size;
+    RecordingHeader header;
+    size_t frames;
+    size_t *offsets;          // of each record in the mapping
+    size_t *keyframes;        // the keyframe at or before each record
+    size_t current;           // record decoded into the snapshot
+    bool decoded;
+    int32_t periods[2];
+    int32_t *q[4];            // quantised channels of the current record
+    size_t capacity;
+    BoidSnapshot snapshot;
+    const uint8_t *predated;
+} Replay;
+
+static Replay replay = { .fd = -1 };
+
+static void *recorder_realloc(void *ptr, size_t size) {
+    void *p = realloc(ptr, size);
+    if (!p) {
+        fprintf(stderr, "Failed to allocate recording buffers!\n");
+        exit(1);
+    }
+    return p;
+}
+
+static inline uint8_t *put_varint(uint8_t *p, int32_t value) {
+    uint32_t z = ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+    while (z >= 0x80) {
+        *p++ = (uint8_t)(z | 0x80);
+        z >>= 7;
+    }
+    *p++ = (uint8_t)z;
+    return p;
+}
+
+// NULL if the varint runs past end
+static inline const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, int32_t *value) {
+    uint32_t z = 0;
+    for (int shift = 0; shift < 7 * VARINT_MAX; shift += 7) {
+        if (p == end) return NULL;
+        uint8_t byte = *p++;
+        z |= (uint32_t)(byte & 0x7f) << shift;
+        if (byte < 0x80) {
+            *value = (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static inline int32_t wrap_position(int32_t q, int32_t period) {
+    q %= period;
+    return q < 0 ? q + period : q;
+}
+
+// The shorter way round the seam
+static inline int32_t wrap_delta(int32_t d, int32_t period) {
+    if (d >= period / 2) d -= period;
+    if (d < -(period / 2)) d += period;
+    return d;
+}
+
+// Encodes a queued frame and writes it; runs on the writer thread
+static void write_record(const RecordSlot *slot) {
+    const size_t n = slot->count + slot->predators;
+    const size_t flag_bytes = (slot->count + 7) / 8;
+    bool keyframe = !recorder.have_last || slot->count != recorder.last_count ||
+                    slot->predators != recorder.last_predators ||
+                    slot->frame != recorder.last_frame + 1 ||
+                    recorder.since_keyframe >= RECORDING_KEYFRAME_INTERVAL;
+
+    if (n > recorder.q_capacity) {
+        for (int c = 0; c < 4; c++) recorder.q[c] = recorder_realloc(recorder.q[c], n * sizeof(int32_t));
+        recorder.q_capacity = n;
+    }
+    size_t worst = sizeof(RecordHeader) + 4 * VARINT_MAX * n + flag_bytes;
+    if (worst > recorder.buffer_capacity) {
+        recorder.buffer = recorder_realloc(recorder.buffer, worst);
+        recorder.buffer_capacity = worst;
+    }
+
+    const float *channels[4] = { slot->x, slot->y, slot->vx, slot->vy };
+    uint8_t *p = recorder.buffer + sizeof(RecordHeader);
+    for (int c = 0; c < 4; c++) {
+        const float scale = c < 2 ? 1.0f / RECORDING_POSITION_STEP : 1.0f / RECORDING_VELOCITY_STEP;
+        const int32_t period = c < 2 ? recorder.periods[c] : 0;
+        int32_t *q = recorder.q[c];
+        for (size_t i = 0; i < n; i++) {
+            int32_t value = (int32_t)lrintf(channels[c][i] * scale);
+            if (period) value = wrap_position(value, period);
+            int32_t delta = value - (keyframe ? 0 : q[i]);
+            if (period) delta = wrap_delta(delta, period);
+            p = put_varint(p, delta);
+            q[i] = value;
+        }
+    }
+    memcpy(p, slot->predated, flag_bytes);
+    p += flag_bytes;
+
+    RecordHeader header = {
+        .size = (uint32_t)(p - recorder.buffer),
+        .count = (uint32_t)slot->count,
+        .frame = slot->frame,
+        .frame_time = slot->frame_time,
+        .keyframe = keyframe,
+        .predators = (uint32_t)slot->predators,
+    };
+    memcpy(recorder.buffer, &header, sizeof(header));
+    if (fwrite(recorder.buffer, 1, header.size, recorder.file) != header.size) recorder.failed = true;
+
+    recorder.have_last = true;
+    recorder.last_count = slot->count;
+    recorder.last_predators = slot->predators;
+    recorder.last_frame = slot->frame;
+    recorder.since_keyframe = keyframe ? 1 : recorder.since_keyframe + 1;
+
+    pthread_mutex_lock(&recorder.lock);
+    recorder.stats.frames++;
+    recorder.stats.keyframes += keyframe;
+    recorder.stats.bytes += header.size;
+    pthread_mutex_unlock(&recorder.lock);
+}
+
+static void *writer_main(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&recorder.lock);
+    for (;;) {
+        while (recorder.head == recorder.tail && recorder.running) {
+            pthread_cond_wait(&recorder.ready, &recorder.lock);
+        }
+        if (recorder.head == recorder.tail) break;
+        const RecordSlot *slot = &recorder.slots[recorder.head % RECORDER_QUEUE];
+        pthread_mutex_unlock(&recorder.lock);
+
+        write_record(slot);
+
+        pthread_mutex_lock(&recorder.lock);
+        recorder.head++;
+    }
+    pthread_mutex_unlock(&recorder.lock);
+    return NULL;
+}
+
+void StartRecording(const char *path) {
+    if (recording) StopRecording();
+
+    recorder.file = fopen(path, "wb");
+    if (!recorder.file) {
+        fprintf(stderr, "Failed to open %s for recording!\n", path);
+        exit(1);
+    }
+    setvbuf(recorder.file, NULL, _IOFBF, 1 << 20);
+
+    RecordingHeader header = {
+        .version = RECORDING_VERSION,
+        .width = SCREEN_WIDTH,
+        .height = SCREEN_HEIGHT,
+        .position_step = RECORDING_POSITION_STEP,
+        .velocity_step = RECORDING_VELOCITY_STEP,
+        .keyframe_interval = RECORDING_KEYFRAME_INTERVAL,
+    };
+    memcpy(header.magic, RECORDING_MAGIC, sizeof(header.magic));
+    if (fwrite(&header, sizeof(header), 1, recorder.file) != 1) recorder.failed = true;
+
+    recorder.periods[0] = (int32_t)lrintf(SCREEN_WIDTH / RECORDING_POSITION_STEP);
+    recorder.periods[1] = (int32_t)lrintf(SCREEN_HEIGHT / RECORDING_POSITION_STEP);
+    recorder.have_last = false;
+    recorder.head = recorder.tail = 0;
+    recorder.stats = (RecorderStats){ .bytes = sizeof(header) };
+    recorder.running = true;
+    if (pthread_create(&recorder.writer, NULL, writer_main, NULL) != 0) {
+        fprintf(stderr, "Failed to start the recording writer!\n");
+        exit(1);
+    }
+    recording = true;
+}
+
+void StopRecording(void) {
+    if (!recording) return;
+    recording = false;
+
+    pthread_mutex_lock(&recorder.lock);
+    recorder.running = false;
+    pthread_cond_signal(&recorder.ready);
+    pthread_mutex_unlock(&recorder.lock);
+    pthread_join(recorder.writer, NULL);
+
+    if (fclose(recorder.file) != 0) recorder.failed = true;
+    recorder.file = NULL;
+    if (recorder.failed) fprintf(stderr, "Failed to write the whole recording!\n");
+    recorder.failed = false;
+}
+
+bool IsRecording(void) {
+    return recording;
+}
+
+RecorderStats GetRecorderStats(void) {
+    pthread_mutex_lock(&recorder.lock);
+    RecorderStats stats = recorder.stats;
+    pthread_mutex_unlock(&recorder.lock);
+    return stats;
+}
+
+void RecordFrame(float frameTime) {
+    if (!recording) return;
+
+    pthread_mutex_lock(&recorder.lock);
+    bool full = recorder.tail - recorder.head == RECORDER_QUEUE;
+    recorder.stats.dropped += full;
+    pthread_mutex_unlock(&recorder.lock);
+    if (full) return;
+
+    // The writer does not touch the tail slot until it is queued
+    RecordSlot *slot = &recorder.slots[recorder.tail % RECORDER_QUEUE];
+    const size_t n = boidCount, p = predatorCount;
+    const size_t flag_bytes = (n + 7) / 8;
+    if (n + p > slot->capacity) {
+        slot->x = recorder_realloc(slot->x, (n + p) * sizeof(float));
+        slot->y = recorder_realloc(slot->y, (n + p) * sizeof(float));
+        slot->vx = recorder_realloc(slot->vx, (n + p) * sizeof(float));
+        slot->vy = recorder_realloc(slot->vy, (n + p) * sizeof(float));
+        slot->predated = recorder_realloc(slot->predated, (n + p + 7) / 8);
+        slot->capacity = n + p;
+    }
+    memcpy(slot->x, boids.x, n * sizeof(float));
+    memcpy(slot->y, boids.y, n * sizeof(float));
+    memcpy(slot->vx, boids.vx, n * sizeof(float));
+    memcpy(slot->vy, boids.vy, n * sizeof(float));
+    memcpy(slot->x + n, predators.x, p * sizeof(float));
+    memcpy(slot->y + n, predators.y, p * sizeof(float));
+    memcpy(slot->vx + n, predators.vx, p * sizeof(float));
+    memcpy(slot->vy + n, predators.vy, p * sizeof(float));
+
+    #pragma omp parallel for schedule(static)
+    for (size_t b = 0; b < flag_bytes; b++) {
+        uint8_t bits = 0;
+        for (size_t k = 0; k < 8 && 8 * b + k < n; k++) bits |= (uint8_t)boids.info[8 * b + k].predated << k;
+        slot->predated[b] = bits;
+    }
+    slot->count = n;
+    slot->predators = p;
+    slot->frame = frameCounter;
+    slot->frame_time = frameTime;
+
+    pthread_mutex_lock(&recorder.lock);
+    recorder.tail++;
+    pthread_cond_signal(&recorder.ready);
+    pthread_mutex_unlock(&recorder.lock);
+}
+
+void OpenReplay(const char *path) {
+    CloseReplay();
+
+    replay.fd = open(path, O_RDONLY);
+    struct stat st;
+    if (replay.fd < 0 || fstat(replay.fd, &st) != 0) {
+        fprintf(stderr, "Failed to open recording %s!\n", path);
+        exit(1);
+    }
+    replay.size = (size_t)st.st_size;
+    if (replay.size < sizeof(RecordingHeader)) {
+        fprintf(stderr, "%s is not a boids recording!\n", path);
+        exit(1);
+    }
+    replay.map = mmap(NULL, replay.size, PROT_READ, MAP_PRIVATE, replay.fd, 0);
+    if (replay.map == MAP_FAILED) {
+        fprintf(stderr, "Failed to map recording %s!\n", path);
+        exit(1);
+    }
+    memcpy(&replay.header, replay.map, sizeof(replay.header));
+    if (memcmp(replay.header.magic, RECORDING_MAGIC, sizeof(replay.header.magic)) != 0 ||
+        replay.header.version != RECORDING_VERSION ||
+        replay.header.width <= 0 || replay.header.height <= 0) {
+        fprintf(stderr, "%s is not a boids recording!\n", path);
+        exit(1);
+    }
+    replay.periods[0] = (int32_t)lrintf(replay.header.width / replay.header.position_step);
+    replay.periods[1] = (int32_t)lrintf(replay.header.height / replay.header.position_step);
+
+    // Index the records; a recording cut short ends at its last whole record
+    size_t capacity = 1024;
+    replay.offsets = recorder_realloc(NULL, capacity * sizeof(size_t));
+    replay.keyframes = recorder_realloc(NULL, capacity * sizeof(size_t));
+    size_t offset = sizeof(RecordingHeader);
+    size_t keyframe = SIZE_MAX;
+    while (offset + sizeof(RecordHeader) <= replay.size) {
+        RecordHeader header;
+        memcpy(&header, replay.map + offset, sizeof(header));
+        if (header.size < sizeof(RecordHeader) || header.size > replay.size - offset) break;
+        if (header.keyframe) keyframe = replay.frames;
+        if (keyframe != SIZE_MAX) {
+            if (replay.frames == capacity) {
+                capacity *= 2;
+                replay.offsets = recorder_realloc(replay.offsets, capacity * sizeof(size_t));
+                replay.keyframes = recorder_realloc(replay.keyframes, capacity * sizeof(size_t));
+            }
+            replay.offsets[replay.frames] = offset;
+            replay.keyframes[replay.frames] = keyframe;
+            replay.frames++;
+        }
+        offset += header.size;
+    }
+    if (replay.frames == 0) {
+        fprintf(stderr, "%s has no frames!\n", path);
+        exit(1);
+    }
+    replay.snapshot.picked = QUERY_NONE; // recordings cannot be queried
+}
+
+void CloseReplay(void) {
+    if (replay.fd < 0) return;
+    munmap((void *)replay.map, replay.size);
+    close(replay.fd);
+    free(replay.offsets);
+    free(replay.keyframes);
+    for (int c = 0; c < 4; c++) free(replay.q[c]);
+    BoidSnapshot *s = &replay.snapshot;
+    free(s->x); free(s->y); free(s->prev_x); free(s->prev_y); free(s->vx); free(s->vy);
+    replay = (Replay){ .fd = -1 };
+}
+
+const RecordingHeader *ReplayHeader(void) {
+    return &replay.header;
+}
+
+size_t ReplayFrameCount(void) {
+    return replay.frames;
+}
+
+float ReplayFrameTime(size_t index) {
+    RecordHeader header;
+    memcpy(&header, replay.map + replay.offsets[index], sizeof(header));
+    return header.frame_time;
+}
+
+static void reserve_replay(size_t n) {
+    if (n <= replay.capacity) return;
+    for (int c = 0; c < 4; c++) replay.q[c] = recorder_realloc(replay.q[c], n * sizeof(int32_t));
+    BoidSnapshot *s = &replay.snapshot;
+    float **arrays[] = { &s->x, &s->y, &s->prev_x, &s->prev_y, &s->vx, &s->vy };
+    for (size_t a = 0; a < sizeof(arrays) / sizeof(arrays[0]); a++) {
+        *arrays[a] = recorder_realloc(*arrays[a], n * sizeof(float));
+    }
+    replay.capacity = n;
+    s->capacity = n;
+}
+
+static void corrupt_replay(size_t index) {
+    fprintf(stderr, "Recording is corrupt at record %zu!\n", index);
+    exit(1);
+}
+
+// Applies record index on top of the current state
+static void decode_record(size_t index) {
+    const uint8_t *record = replay.map + replay.offsets[index];
+    RecordHeader header;
+    memcpy(&header, record, sizeof(header));
+    const size_t n = (size_t)header.count + header.predators;
+    if (!header.keyframe && (!replay.decoded || header.count != replay.snapshot.count ||
+                             header.predators != replay.snapshot.predators)) corrupt_replay(index);
+    reserve_replay(n);
+
+    BoidSnapshot *s = &replay.snapshot;
+    float *channels[4] = { s->x, s->y, s->vx, s->vy };
+    const uint8_t *p = record + sizeof(header);
+    const uint8_t *end = record + header.size;
+    for (int c = 0; c < 4; c++) {
+        const float step = c < 2 ? replay.header.position_step : replay.header.velocity_step;
+        const int32_t period = c < 2 ? replay.periods[c] : 0;
+        int32_t *q = replay.q[c];
+        float *out = channels[c];
+        for (size_t i = 0; i < n; i++) {
+            int32_t delta;
+            p = get_varint(p, end, &delta);
+            if (!p) corrupt_replay(index);
+            int32_t value = (header.keyframe ? 0 : q[i]) + delta;
+            if (period) value = wrap_position(value, period);
+            q[i] = value;
+            out[i] = (float)value * step;
+        }
+    }
+    if ((size_t)(end - p) < ((size_t)header.count + 7) / 8) corrupt_replay(index);
+    replay.predated = p;
+
+    s->count = header.count;
+    s->predators = header.predators;
+    s->frame = header.frame;
+    s->interval = header.frame_time;
+    s->published = 0.0;
+    s->tick_ms = 0.0f;
+    replay.current = index;
+    replay.decoded = true;
+}
+
+const BoidSnapshot *ReplaySeek(size_t index) {
+    if (index >= replay.frames) index = replay.frames - 1;
+    BoidSnapshot *s = &replay.snapshot;
+    if (replay.decoded && index == replay.current) return s;
+
+    if (replay.decoded && index == replay.current + 1) {
+        size_t previous = s->count, previous_predators = s->predators;
+        memcpy(s->prev_x, s->x, (previous + previous_predators) * sizeof(float));
+        memcpy(s->prev_y, s->y, (previous + previous_predators) * sizeof(float));
+        decode_record(index);
+        if (s->count == previous && s->predators == previous_predators) return s;
+    } else {
+        // Carry on from the current record when it lies between the keyframe and the target
+        size_t from = replay.keyframes[index];
+        if (replay.decoded && replay.current >= from && replay.current < index) from = replay.current + 1;
+        for (size_t r = from; r <= index; r++) decode_record(r);
+    }
+
+    // No interpolation across a jump or a change of population
+    memcpy(s->prev_x, s->x, (s->count + s->predators) * sizeof(float));
+    memcpy(s->prev_y, s->y, (s->count + s->predators) * sizeof(float));
+    return s;
+}
+
+const uint8_t *ReplayPredated(void) {
+    return replay.predated;
+}
@@ -0,0 +1,85 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sim_thread.h"
+
+// Trajectory recording and replay.
+//
+// A recording is a header followed by one record per simulated frame:
+// positions, velocities (boids, then predators) and the boids' predated flags.
+// Positions and velocities are quantised to fixed steps and stored as the
+// zigzag varint delta from the previous frame, positions wrapped across the
+// torus seam. Every RECORDING_KEYFRAME_INTERVAL frames, and whenever the
+// population changes or a frame was dropped, a keyframe is stored against
+// zero instead, so replay can seek without decoding the whole file.
+//
+// UpdateBoids() hands each frame to a background writer thread that does
+// the encoding and the I/O. If the writer falls behind and its queue is
+// full, the frame is dropped rather than making the simulation wait.
+//
+// All fields are little-endian.
+
+#define RECORDING_MAGIC "BOIDREC1"
+#define RECORDING_VERSION 2
+#define RECORDING_KEYFRAME_INTERVAL 60
+#define RECORDING_POSITION_STEP (1.0f / 64.0f)   // px
+#define RECORDING_VELOCITY_STEP (1.0f / 256.0f)  // px per frame
+
+typedef struct RecordingHeader {
+    char magic[8];
+    uint32_t version;
+    int32_t width, height;        // world size
+    float position_step;
+    float velocity_step;
+    uint32_t keyframe_interval;
+} RecordingHeader;
+
+typedef struct RecordHeader {
+    uint32_t size;        // bytes, including this header
+    uint32_t count;       // boids
+    uint64_t frame;       // frameCounter after the update
+    float frame_time;     // seconds simulated by the update
+    uint32_t keyframe;    // 1 if stored against zero
+    uint32_t predators;   // follow the boids in every channel
+    uint32_t reserved;    // 0
+} RecordHeader;
+// Then four channels of count + predators varints (x, y, vx, vy) and
+// (count + 7) / 8 bytes of predated flags, one bit per boid
+
+typedef struct RecorderStats {
+    size_t frames;        // written
+    size_t keyframes;
+    size_t dropped;       // skipped because the writer was behind
+    uint64_t bytes;
+} RecorderStats;
+
+// Starts recording every UpdateBoids() to path
+void StartRecording(const char *path);
+// Writes out the queued frames and closes the file
+void StopRecording(void);
+bool IsRecording(void);
+// Called by UpdateBoids() with the frame it has just finished
+void RecordFrame(float frameTime);
+RecorderStats GetRecorderStats(void);
+
+// Maps a recording for replay; exits if it cannot be read
+void OpenReplay(const char *path);
+void CloseReplay(void);
+const RecordingHeader *ReplayHeader(void);
+size_t ReplayFrameCount(void);
+float ReplayFrameTime(size_t index);
+
+// Decodes record `index` straight from the mapping into the replay's
+// snapshot. Stepping forward one record applies a single delta and keeps the
+// previous positions for interpolation; any other jump decodes from the
+// nearest keyframe before it.
+const BoidSnapshot *ReplaySeek(size_t index);
+
+// Predated flags of the current record's boids, pointing into the mapping
+const uint8_t *ReplayPredated(void);
+
+#endif // RECORDER_H
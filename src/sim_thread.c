@@ -0,0 +1,284 @@
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sim_thread.h"
+#include "spatial_hash.h"
+#include "autotune.h"
+#include "domain.h"
+
+// Triple buffer. `middle` holds the index of the shared buffer, with
+// SNAPSHOT_FRESH set while it has not been picked up by the reader.
+#define SNAPSHOT_FRESH 4u
+#define SNAPSHOT_INDEX 3u
+
+static BoidSnapshot snapshots[3];
+static _Atomic unsigned int middle = 1;
+static unsigned int back = 0;   // written by the simulation thread
+static unsigned int front = 2;  // read by the renderer
+
+static pthread_t simThread;
+static atomic_bool running = false;
+
+static pthread_mutex_t settingsLock = PTHREAD_MUTEX_INITIALIZER;
+static SimSettings settings;
+
+double SimulationClock(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+static void reserve_snapshot(BoidSnapshot *snapshot, size_t slots) {
+    if (slots <= snapshot->capacity) return;
+    float **arrays[] = { &snapshot->x, &snapshot->y, &snapshot->prev_x, &snapshot->prev_y,
+                         &snapshot->vx, &snapshot->vy };
+    for (size_t a = 0; a < sizeof(arrays) / sizeof(arrays[0]); a++) {
+        float *p = realloc(*arrays[a], slots * sizeof(float));
+        if (!p) {
+            fprintf(stderr, "Failed to allocate boid snapshot!\n");
+            exit(1);
+        }
+        *arrays[a] = p;
+    }
+    snapshot->capacity = slots;
+}
+
+static void reserve_snapshot_field(BoidSnapshot *snapshot, size_t cells) {
+    if (cells <= snapshot->field_capacity) return;
+    float **arrays[] = { &snapshot->density, &snapshot->momentum_x, &snapshot->momentum_y };
+    for (size_t a = 0; a < sizeof(arrays) / sizeof(arrays[0]); a++) {
+        float *p = realloc(*arrays[a], cells * sizeof(float));
+        if (!p) {
+            fprintf(stderr, "Failed to allocate boid snapshot!\n");
+            exit(1);
+        }
+        *arrays[a] = p;
+    }
+    snapshot->field_capacity = cells;
+}
+
+static void copy_snapshot_graph(BoidSnapshot *snapshot) {
+    snapshot->knn_k = knnGraph.count == boidCount ? knnGraph.k : 0;
+    size_t entries = boidCount * snapshot->knn_k;
+    if (entries > snapshot->knn_capacity) {
+        uint32_t *p = realloc(snapshot->knn, entries * sizeof(uint32_t));
+        if (!p) {
+            fprintf(stderr, "Failed to allocate boid snapshot!\n");
+            exit(1);
+        }
+        snapshot->knn = p;
+        snapshot->knn_capacity = entries;
+    }
+    if (entries > 0) memcpy(snapshot->knn, knnGraph.neighbors, entries * sizeof(uint32_t));
+}
+
+// Copies the positions before a tick into the back buffer
+static void record_previous(void) {
+    BoidSnapshot *snapshot = &snapshots[back];
+    reserve_snapshot(snapshot, boidCount + predatorCount);
+    memcpy(snapshot->prev_x, boids.x, boidCount * sizeof(float));
+    memcpy(snapshot->prev_y, boids.y, boidCount * sizeof(float));
+    memcpy(snapshot->prev_x + boidCount, predators.x, predatorCount * sizeof(float));
+    memcpy(snapshot->prev_y + boidCount, predators.y, predatorCount * sizeof(float));
+}
+
+// After a tick that reordered the boids, puts the back buffer's previous
+// positions in the new order, going through its current ones as scratch
+static void reorder_previous(void) {
+    BoidSnapshot *snapshot = &snapshots[back];
+    if (boidOrder.frame != frameCounter || boidOrder.count != boidCount) return;
+    float *prev[2] = { snapshot->prev_x, snapshot->prev_y };
+    for (int a = 0; a < 2; a++) {
+        for (size_t i = 0; i < boidCount; i++) snapshot->x[i] = prev[a][boidOrder.from[i]];
+        memcpy(prev[a], snapshot->x, boidCount * sizeof(float));
+    }
+}
+
+// The boid within PICK_RADIUS of the pick point, if any
+static uint32_t pick_boid(const SimSettings *current) {
+    uint32_t nearest;
+    float dist2;
+    if (!current->picking || !QueryNearest(current->pick, 1, QUERY_NONE, &nearest, &dist2) ||
+        dist2 > PICK_RADIUS * PICK_RADIUS) {
+        return QUERY_NONE;
+    }
+    return nearest;
+}
+
+// Fills the back buffer with the state after a tick and swaps it into the middle
+static void publish(float tick_ms, uint32_t picked) {
+    BoidSnapshot *snapshot = &snapshots[back];
+    const size_t n = boidCount, p = predatorCount;
+    reserve_snapshot(snapshot, n + p);
+    memcpy(snapshot->x, boids.x, n * sizeof(float));
+    memcpy(snapshot->y, boids.y, n * sizeof(float));
+    memcpy(snapshot->vx, boids.vx, n * sizeof(float));
+    memcpy(snapshot->vy, boids.vy, n * sizeof(float));
+    memcpy(snapshot->x + n, predators.x, p * sizeof(float));
+    memcpy(snapshot->y + n, predators.y, p * sizeof(float));
+    memcpy(snapshot->vx + n, predators.vx, p * sizeof(float));
+    memcpy(snapshot->vy + n, predators.vy, p * sizeof(float));
+    snapshot->count = n;
+    snapshot->predators = p;
+
+    const size_t cells = (size_t)densityField.width * densityField.height;
+    reserve_snapshot_field(snapshot, cells);
+    memcpy(snapshot->density, densityField.count, cells * sizeof(float));
+    memcpy(snapshot->momentum_x, densityField.momentum_x, cells * sizeof(float));
+    memcpy(snapshot->momentum_y, densityField.momentum_y, cells * sizeof(float));
+    snapshot->field_width = densityField.width;
+    snapshot->field_height = densityField.height;
+    copy_snapshot_graph(snapshot);
+    snapshot->picked = picked;
+    snapshot->picked_id = picked < n ? boids.info[picked].id : 0;
+    snapshot->cell_size = cellSize;
+    snapshot->schedule = forceSchedule;
+    snapshot->chunk = forceChunk;
+    snapshot->workers = domainWorkers;
+    snapshot->frame = frameCounter;
+    snapshot->tick_ms = tick_ms;
+    snapshot->lists = neighborListStats;
+    snapshot->reorder = reorderStats;
+
+    static double last_published = 0.0;
+    double now = SimulationClock();
+    snapshot->published = now;
+    snapshot->interval = last_published > 0.0 ? now - last_published : 0.0;
+    last_published = now;
+
+    back = atomic_exchange_explicit(&middle, back | SNAPSHOT_FRESH, memory_order_acq_rel) & SNAPSHOT_INDEX;
+}
+
+const BoidSnapshot *AcquireSnapshot(void) {
+    if (atomic_load_explicit(&middle, memory_order_relaxed) & SNAPSHOT_FRESH) {
+        front = atomic_exchange_explicit(&middle, front, memory_order_acq_rel) & SNAPSHOT_INDEX;
+    }
+    return &snapshots[front];
+}
+
+float SnapshotAlpha(const BoidSnapshot *snapshot, double now) {
+    if (snapshot->interval <= 0.0) return 1.0f;
+    double alpha = (now - snapshot->published) / snapshot->interval;
+    return alpha < 0.0 ? 0.0f : alpha > 1.0 ? 1.0f : (float)alpha;
+}
+
+void SetSimulationSettings(SimSettings next) {
+    pthread_mutex_lock(&settingsLock);
+    settings = next;
+    pthread_mutex_unlock(&settingsLock);
+}
+
+SimSettings GetSimulationSettings(void) {
+    pthread_mutex_lock(&settingsLock);
+    SimSettings current = settings;
+    pthread_mutex_unlock(&settingsLock);
+    return current;
+}
+
+static void add_seconds(struct timespec *ts, double seconds) {
+    long long ns = ts->tv_nsec + (long long)(seconds * 1e9);
+    ts->tv_sec += ns / 1000000000LL;
+    ts->tv_nsec = ns % 1000000000LL;
+}
+
+// The workers own the population, so changing it goes through this process
+static int suspend_domain(void) {
+    int workers = domainWorkers;
+    StopDomain();
+    return workers;
+}
+
+static void resume_domain(int workers) {
+    if (workers > 0 && !StartDomain(workers, domainTransport)) {
+        fprintf(stderr, "Simulating in this process instead\n");
+    }
+}
+
+static void *simulation_main(void *arg) {
+    (void)arg;
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    SimSettings published = GetSimulationSettings(); // as of the last publish
+
+    while (atomic_load_explicit(&running, memory_order_acquire)) {
+        SimSettings current = GetSimulationSettings();
+        float period = 1.0f / current.tickRate;
+
+        flockInteraction = current.interaction;
+        if (current.boidCount != boidCount || current.predatorCount != predatorCount || current.knnK != knnK) {
+            bool population = current.boidCount != boidCount || current.predatorCount != predatorCount;
+            int workers = population ? suspend_domain() : 0;
+            SetBoidCount(current.boidCount);
+            SetPredatorCount(current.predatorCount);
+            resume_domain(workers);
+            knnK = current.knnK;
+            BuildKnnGraph();
+            if (current.paused) {
+                record_previous();
+                publish(0.0f, pick_boid(&current));
+            }
+        }
+        if (current.retune != published.retune) {
+            int workers = suspend_domain();
+            Autotune(AUTOTUNE_CACHE, true);
+            resume_domain(workers);
+            if (current.paused) {
+                record_previous();
+                publish(0.0f, pick_boid(&current));
+            }
+        }
+
+        if (!current.paused) {
+            double t0 = SimulationClock();
+            record_previous();
+            frameCounter++;
+            if (domainWorkers > 0) {
+                DomainStep(period, current.alignmentWeight, current.cohesionWeight, current.separationWeight, true);
+            } else {
+                UpdateBoids(period, current.alignmentWeight, current.cohesionWeight, current.separationWeight);
+            }
+            reorder_previous();
+            publish((float)((SimulationClock() - t0) * 1e3), pick_boid(&current));
+        } else if (current.picking != published.picking ||
+                   current.pick.x != published.pick.x || current.pick.y != published.pick.y) {
+            // Paused, but the mouse moved
+            record_previous();
+            publish(0.0f, pick_boid(&current));
+        }
+        published = current;
+
+        // Sleep until the next tick; after falling behind, restart the schedule
+        // from now instead of running a burst of catch-up ticks
+        add_seconds(&deadline, period);
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        if (now.tv_sec > deadline.tv_sec || (now.tv_sec == deadline.tv_sec && now.tv_nsec > deadline.tv_nsec)) {
+            deadline = now;
+        } else {
+            while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR) {}
+        }
+    }
+    return NULL;
+}
+
+void StartSimulationThread(SimSettings initial) {
+    settings = initial;
+    record_previous();
+    publish(0.0f, pick_boid(&initial));
+
+    atomic_store(&running, true);
+    if (pthread_create(&simThread, NULL, simulation_main, NULL) != 0) {
+        fprintf(stderr, "Failed to start the simulation thread!\n");
+        exit(1);
+    }
+}
+
+void StopSimulationThread(void) {
+    if (!atomic_exchange(&running, false)) return;
+    pthread_join(simThread, NULL);
+}
@@ -0,0 +1,110 @@
+#ifndef SIM_THREAD_H
+#define SIM_THREAD_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "boids.h"
+#include "neighbor_list.h"
+#include "predators.h"
+#include "density_field.h"
+#include "knn_graph.h"
+#include "spatial_query.h"
+#include "boid_order.h"
+
+// Runs the simulation on its own thread at a fixed tick rate.
+//
+// Each tick publishes an immutable snapshot of the boid state through a
+// lock-free triple buffer: the simulation always owns one buffer, the reader
+// another, and the third holds the newest published snapshot. Neither side
+// ever waits for the other. A snapshot keeps the positions from before the
+// tick as well, so the renderer can interpolate between the last two ticks.
+//
+// While the thread runs, the simulation globals (boids, boidCount,
+// predators, flockInteraction, ...) belong to it; other threads go through snapshots
+// and settings only.
+
+#define DEFAULT_TICK_RATE 60.0f
+// How far from the pick point a boid can be picked, in world units
+#define PICK_RADIUS 20.0f
+
+typedef struct BoidSnapshot {
+    size_t count;           // boids
+    size_t predators;       // predators, in the slots after the boids
+    size_t capacity;
+    float *x, *y;           // count + predators positions after the tick
+    float *prev_x, *prev_y; // and before it
+    float *vx, *vy;
+    int field_width;        // density field after the tick, 0 x 0 in a replay
+    int field_height;
+    size_t field_capacity;
+    float *density;         // blurred boids per cell (density_field.h)
+    float *momentum_x, *momentum_y;
+    int knn_k;              // neighbours per boid in knn, 0 for none
+    uint32_t *knn;          // count * knn_k, as KnnGraph.neighbors
+    size_t knn_capacity;
+    uint32_t picked;        // boid nearest the settings' pick point, QUERY_NONE for none
+    uint32_t picked_id;     // its BoidInfo.id
+    int cell_size;          // grid cell and force schedule (autotune.h), 0 in a replay
+    int schedule, chunk;
+    int workers;            // processes the world is split over (domain.h), 0 for this one
+    size_t frame;           // frameCounter after the tick
+    double published;       // SimulationClock() when published
+    double interval;        // seconds since the previous publish
+    float tick_ms;          // cost of the tick
+    NeighborListStats lists; // neighborListStats after the tick
+    ReorderStats reorder;   // reorderStats after the tick
+} BoidSnapshot;
+
+typedef struct SimSettings {
+    float alignmentWeight;
+    float cohesionWeight;
+    float separationWeight;
+    bool paused;
+    size_t boidCount;              // requested population
+    size_t predatorCount;
+    FlockInteraction interaction;
+    int knnK;                      // neighbour graph k, 0 for no graph
+    bool picking;                  // whether to pick the boid nearest pick
+    Vec2 pick;                     // world point under the mouse
+    unsigned retune;               // bump to rerun Autotune() on the simulation thread
+    float tickRate;                // ticks per second
+} SimSettings;
+
+// Publishes the current state, then starts ticking. InitBoids() first.
+void StartSimulationThread(SimSettings settings);
+void StopSimulationThread(void);
+
+// Applied at the start of the next tick
+void SetSimulationSettings(SimSettings settings);
+SimSettings GetSimulationSettings(void);
+
+// Newest published snapshot. It stays valid, and unchanged, until the
+// next call; only one thread may read snapshots.
+const BoidSnapshot *AcquireSnapshot(void);
+
+// Monotonic seconds, the clock snapshots are stamped with
+double SimulationClock(void);
+
+// How far the renderer is from the snapshot's previous tick (0) to its
+// own tick (1), assuming the next one comes after the same interval
+float SnapshotAlpha(const BoidSnapshot *snapshot, double now);
+
+// Position of slot i interpolated across the seam of the torus
+static inline Vec2 SnapshotPosition(const BoidSnapshot *snapshot, size_t i, float alpha) {
+    float dx = snapshot->x[i] - snapshot->prev_x[i];
+    float dy = snapshot->y[i] - snapshot->prev_y[i];
+    dx -= (dx > HALF_SCREEN_WIDTH) ? SCREEN_WIDTH : 0.0f;
+    dx += (dx < -HALF_SCREEN_WIDTH) ? SCREEN_WIDTH : 0.0f;
+    dy -= (dy > HALF_SCREEN_HEIGHT) ? SCREEN_HEIGHT : 0.0f;
+    dy += (dy < -HALF_SCREEN_HEIGHT) ? SCREEN_HEIGHT : 0.0f;
+    float x = snapshot->prev_x[i] + alpha * dx;
+    float y = snapshot->prev_y[i] + alpha * dy;
+    x += (x < 0.0f) ? SCREEN_WIDTH : 0.0f;
+    x -= (x >= SCREEN_WIDTH) ? SCREEN_WIDTH : 0.0f;
+    y += (y < 0.0f) ? SCREEN_HEIGHT : 0.0f;
+    y -= (y >= SCREEN_HEIGHT) ? SCREEN_HEIGHT : 0.0f;
+    return (Vec2){ x, y };
+}
+
+#endif // SIM_THREAD_H
@@ -1,82 +1,183 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
+#include <omp.h>
 #include "spatial_hash.h"
 #include "boids.h"
+#include "flock_kernel.h"
+#include "normal_random.h"
+#include "density_field.h"
+#include "spatial_query.h"
+#include "species.h"
 
 #include <assert.h>
 
-HashCell hash_table[HASH_SIZE];
+SpatialGrid grid = {0};
+int cellSize = DEFAULT_CELL_SIZE;
 
-unsigned int hash_cell(int cell_x, int cell_y) {
-    unsigned int hash = (unsigned)(cell_x * 73856093) ^ (cell_y * 19349669);
-    return hash % HASH_SIZE;
+static void *grid_realloc(void *ptr, size_t size) {
+    void *p = realloc(ptr, size);
+    if (!p) {
+        fprintf(stderr, "Failed to allocate spatial grid!\n");
+        exit(1);
+    }
+    return p;
 }
 
-void init_spatial_hash(void) {
-    for (int i = 0; i < HASH_SIZE; ++i) {
-        hash_table[i].length = 0;
-        hash_table[i].max_length = INITIAL_MAX_BOIDS_PER_CELL;
-        hash_table[i].boids = malloc(INITIAL_MAX_BOIDS_PER_CELL * sizeof(Boid*));
-        if (!hash_table[i].boids) {
-            fprintf(stderr, "Failed to allocate boid array!\n");
-            exit(1);
-        }
+// Sizes the grid for the current world and for up to max_boids indexed boids.
+// Safe to call again when either changes.
+void init_spatial_grid(size_t max_boids) {
+    grid.width = SCREEN_WIDTH / cellSize;
+    grid.height = SCREEN_HEIGHT / cellSize;
+    size_t cells = (size_t)grid.width * grid.height;
+
+    grid.cell_start = grid_realloc(grid.cell_start, (cells + 1) * sizeof(uint32_t));
+    if (max_boids > grid.capacity) {
+        grid.cell_boids = grid_realloc(grid.cell_boids, max_boids * sizeof(uint32_t));
+        grid.boid_cell = grid_realloc(grid.boid_cell, max_boids * sizeof(uint32_t));
+        grid.capacity = max_boids;
     }
+    grid.thread_base = grid_realloc(grid.thread_base, (size_t)omp_get_max_threads() * sizeof(uint32_t));
+    grid.parts = 0; // histograms are sized on the next build
+    memset(grid.cell_start, 0, (cells + 1) * sizeof(uint32_t));
+    grid.count = 0;
+    init_density_field();
 }
 
-void clear_spatial_hash(void) {
-    for (int i = 0; i < HASH_SIZE; ++i) {
-        hash_table[i].length = 0;
-    }
+// Number of per-thread histograms for a build. Sparse grids use fewer, so
+// histogram memory and scan work stay O(boids + cells) at any thread count.
+static int grid_histogram_parts(int threads, size_t n, size_t cells) {
+    size_t parts = 1 + n / cells;
+    return parts < (size_t)threads ? (int)parts : threads;
 }
 
-void insert_boid(Boid* p) {
-    int cell_x = (int)(p->position.x / CELL_SIZE);
-    int cell_y = (int)(p->position.y / CELL_SIZE);
-    //assert(cell_x >= 0 && cell_x < CELL_WIDTH);
-    //assert(cell_y >= 0 && cell_y < CELL_HEIGHT);
+// Parallel counting sort of the active boids by cell, then the density field
+// (density_field.h) from the sorted cells.
+// Each histogram part covers a contiguous run of slots, so within a cell the
+// boids end up in slot order whatever the thread count.
+void build_spatial_grid(void) {
+    const size_t cells = (size_t)grid.width * grid.height;
+    const size_t n = boidCount;
+    assert(n <= grid.capacity);
 
-    unsigned int index = hash_cell(cell_x, cell_y);
+    int max_parts = grid_histogram_parts(omp_get_max_threads(), n, cells);
+    if (max_parts > grid.parts) {
+        grid.parts = max_parts;
+        grid.thread_hist = grid_realloc(grid.thread_hist, (size_t)grid.parts * cells * sizeof(uint32_t));
+        grid.thread_base = grid_realloc(grid.thread_base, (size_t)omp_get_max_threads() * sizeof(uint32_t));
+    }
 
-    HashCell* cell = &hash_table[index];
+    #pragma omp parallel
+    {
+        const int t = omp_get_thread_num();
+        const int threads = omp_get_num_threads();
+        const int parts = grid_histogram_parts(threads, n, cells);
+        uint32_t *hist = t < parts ? grid.thread_hist + (size_t)t * cells : NULL;
 
-    if (cell->length < cell->max_length) {
-        cell->boids[cell->length++] = p;
-    } else {
-        printf("Cell (%d, %d) full current max %d, reallocating...\n", cell_x, cell_y, cell->max_length);
-        cell->max_length *= 2;
-        Boid** new_boids = realloc(cell->boids, cell->max_length * sizeof(Boid*));
-        if (!new_boids) {
-            fprintf(stderr, "Failed to realloc boid array!\n");
-            exit(1);
+        // 1. Cell histogram of each part's slots
+        const size_t e0 = t < parts ? n * t / parts : 0;
+        const size_t e1 = t < parts ? n * (t + 1) / parts : 0;
+        if (t < parts) {
+            memset(hist, 0, cells * sizeof(uint32_t));
+            for (size_t e = e0; e < e1; e++) {
+                uint32_t c = grid_cell_of(boids.x[e], boids.y[e]);
+                grid.boid_cell[e] = c;
+                hist[c]++;
+            }
+        }
+        #pragma omp barrier
+
+        // 2. Scan this thread's share of the cells across all histograms,
+        // turning each count into an offset relative to the start of the share
+        const size_t c0 = cells * t / threads;
+        const size_t c1 = cells * (t + 1) / threads;
+        uint32_t running = 0;
+        for (size_t c = c0; c < c1; c++) {
+            for (int u = 0; u < parts; u++) {
+                uint32_t *h = &grid.thread_hist[(size_t)u * cells + c];
+                uint32_t count = *h;
+                *h = running;
+                running += count;
+            }
+        }
+        grid.thread_base[t] = running;
+        #pragma omp barrier
+
+        // 3. Exclusive scan of the share totals
+        #pragma omp single
+        {
+            uint32_t base = 0;
+            for (int u = 0; u < threads; u++) {
+                uint32_t total = grid.thread_base[u];
+                grid.thread_base[u] = base;
+                base += total;
+            }
+        }
+
+        // 4. Make the offsets absolute and publish the cell starts
+        const uint32_t base = grid.thread_base[t];
+        for (size_t c = c0; c < c1; c++) {
+            grid.cell_start[c] = base + grid.thread_hist[c];
+            for (int u = 0; u < parts; u++) {
+                grid.thread_hist[(size_t)u * cells + c] += base;
+            }
+        }
+        #pragma omp barrier
+
+        // 5. Scatter, each part walking its own slots in order
+        for (size_t e = e0; e < e1; e++) {
+            grid.cell_boids[hist[grid.boid_cell[e]]++] = (uint32_t)e;
         }
-        cell->boids = new_boids;
-        cell->boids[cell->length++] = p;
-    
-        printf("Cell (%d, %d) new max %d\n", cell_x, cell_y, cell->max_length);
+        #pragma omp barrier
+
+        // 6. Density sums of this thread's share of the cells
+        #pragma omp single
+        grid.cell_start[cells] = (uint32_t)n;
+        accumulate_density_cells(c0, c1);
+    }
+    grid.count = n;
+    blur_density_field();
+}
+
+int grid_row_ranges(int row, int x0, int columns, CellRange *ranges) {
+    x0 = WRAP_MOD(x0, grid.width);
+    int base = row * grid.width;
+    if (x0 + columns <= grid.width) {
+        ranges[0] = (CellRange){ grid.cell_start[base + x0], grid.cell_start[base + x0 + columns] };
+        return 1;
     }
+    // The row wraps around the seam: split it in two runs
+    ranges[0] = (CellRange){ grid.cell_start[base + x0], grid.cell_start[base + grid.width] };
+    ranges[1] = (CellRange){ grid.cell_start[base], grid.cell_start[base + x0 + columns - grid.width] };
+    return 2;
 }
 
-void DrawCells(Vector2 position) {
+int grid_cell_ranges(int cell_x, int cell_y, int radius, CellRange *ranges) {
+    assert(radius <= GRID_MAX_REACH);
+    int span = 2 * radius + 1;
 
-    int cell_x = (int)(position.x / CELL_SIZE);
-    int cell_y = (int)(position.y / CELL_SIZE);
+    // A block wider than the world would visit cells twice, so clamp it
+    int x0 = cell_x - radius;
+    int columns = span;
+    if (span >= grid.width) { x0 = 0; columns = grid.width; }
 
-    for (int dx = -1; dx <= 1; ++dx) {  
-        for (int dy = -1; dy <= 1; ++dy) {
-            int nx = cell_x + dx;
-            int ny = cell_y + dy;
-            DrawRectangleLines(WRAP_MOD(nx, CELL_WIDTH) * CELL_SIZE, WRAP_MOD(ny, CELL_HEIGHT) * CELL_SIZE, CELL_SIZE, CELL_SIZE, BLUE);
-        }
+    int y0 = WRAP_MOD(cell_y - radius, grid.height);
+    int rows = span;
+    if (span >= grid.height) { y0 = 0; rows = grid.height; }
+
+    int n = 0;
+    for (int r = 0; r < rows; r++) {
+        n += grid_row_ranges((y0 + r) % grid.height, x0, columns, ranges + n);
     }
+    return n;
 }
 
-// Returns a random unit vector (uniformly distributed on the circle)
-Vector2 RandomUnitVector2() {
-    //float angle = 2.0f * PI * GetRandomValue(0, 10000) / 10000.0f;
-    float angle = (float)(rand() % 360) * DEG2RAD; // Random angle in radians
-    return (Vector2){ cosf(angle), sinf(angle) };
+// Returns a random unit vector (uniformly distributed on the circle),
+// the same for a given stream, frame and index whichever thread asks
+static Vec2 RandomUnitVector2(RandomStream stream, uint64_t frame, uint64_t index) {
+    float angle = random_uniform(stream, frame, index, 0.0f, 2.0f * PI);
+    return (Vec2){ cosf(angle), sinf(angle) };
 }
 
 // Function to calculate the ceiling of integer division
@@ -85,132 +186,95 @@ int ceil_div(int a, int b) {
     return (a + b - 1) / b;
 }
 
-FlockForces ComputeFlockForces(Boid *boid) {
-    FlockForces forces = {0};
+FlockForces ComputeFlockForces(size_t i) {
+    int width = ceil_div(NEIGHBOR_RADIUS, cellSize);
 
-    int width = ceil_div(NEIGHBOR_RADIUS, CELL_SIZE);
-
-    int cell_x = (int)(boid->position.x / CELL_SIZE);
-    int cell_y = (int)(boid->position.y / CELL_SIZE);
-
-    for (int dx = -width; dx <= width; ++dx) {  
-        for (int dy = -width; dy <= width; ++dy) {
-            int nx = cell_x + dx;
-            int ny = cell_y + dy;
-            unsigned int index = hash_cell(WRAP_MOD(nx, CELL_WIDTH), WRAP_MOD(ny, CELL_HEIGHT));
-            HashCell* cell = &hash_table[index];
-            for (int j = 0; j < cell->length; ++j) {
-                Boid* neighbor = cell->boids[j];
-                if (neighbor != boid) {
-                    float dist = DistanceOnTorusSquared(boid->position, neighbor->position);
-                    if( dist == 0.0f) {// HACK!!!
-                        printf("HACK!!! Frame %zu: Boid %zu and neighbor %zu are at the same position!\n", frameCounter, boid->index, neighbor->index);
-                        boid->velocity_update = Vector2Add(
-                                                    boid->velocity_update,
-                                                    Vector2Scale(RandomUnitVector2(), TINY_SPEED));
-
-                        // Reset forces
-                        forces.neighborCount = 0;
-                        forces.nearNeighborCount = 0;
-                        forces.alignment = (Vector2){0, 0};
-                        forces.cohesion = (Vector2){0, 0};
-                        forces.separation = (Vector2){0, 0};
-                        break;
-                    }
-                    if (dist < PROTECTED_RADIUS * PROTECTED_RADIUS) {
-                        Vector2 diff = Vector2SubtractTorus(boid->position, neighbor->position);
-                        if (dist != 0) diff = Vector2Scale(diff, 1.0f / dist) ;
-                        forces.separation = Vector2Add(forces.separation, diff);
-                        forces.nearNeighborCount++;
-                    } else if (dist < NEIGHBOR_RADIUS * NEIGHBOR_RADIUS) {
-                        forces.alignment = Vector2Add(forces.alignment, neighbor->velocity);
-                        Vector2 diff = Vector2SubtractTorus(neighbor->position, boid->position);
-                        forces.cohesion = Vector2Add(forces.cohesion, Vector2Add(diff, boid->position));
-                        forces.neighborCount++;
-                    }
-                }
-            }
+    const float px = boids.x[i];
+    const float py = boids.y[i];
+    uint32_t cell = grid.boid_cell[i];
+
+    CellRange ranges[GRID_MAX_RANGES];
+    int range_count = grid_cell_ranges(cell % grid.width, cell / grid.width, width, ranges);
+
+    FlockSums sums = {0};
+    for (int r = 0; r < range_count; ++r) {
+        flock_kernel(px, py, (uint32_t)i, grid.cell_boids + ranges[r].begin,
+                     ranges[r].end - ranges[r].begin, &sums);
+    }
+    return FlockForcesFromSums(i, &sums);
+}
+
+FlockForces ComputeSpeciesFlockForces(size_t i, int s) {
+    int width = ceil_div(NEIGHBOR_RADIUS, cellSize);
+
+    const float px = boids.x[i];
+    const float py = boids.y[i];
+    uint32_t cell = grid.boid_cell[i];
+
+    CellRange ranges[GRID_MAX_RANGES];
+    int range_count = grid_cell_ranges(cell % grid.width, cell / grid.width, width, ranges);
+
+    const FlockSpeciesRow *row = &speciesRows[s];
+    FlockSpeciesSums sums = {0};
+    if (row->uniform) {
+        // Every neighbour weighted alike: the single-species kernel, its sums
+        // scaled after, which a weight of one leaves exact
+        for (int r = 0; r < range_count; ++r) {
+            flock_kernel(px, py, (uint32_t)i, grid.cell_boids + ranges[r].begin,
+                         ranges[r].end - ranges[r].begin, &sums.sums);
+        }
+        sums.sums.separation_x *= row->separation[0];
+        sums.sums.separation_y *= row->separation[0];
+        sums.sums.alignment_x *= row->alignment[0];
+        sums.sums.alignment_y *= row->alignment[0];
+        sums.flee_x = sums.sums.offset_x * row->flee[0];
+        sums.flee_y = sums.sums.offset_y * row->flee[0];
+        sums.sums.offset_x *= row->cohesion[0];
+        sums.sums.offset_y *= row->cohesion[0];
+        sums.matched = sums.sums.neighborCount * row->alignment[0];
+    } else {
+        for (int r = 0; r < range_count; ++r) {
+            flock_species_kernel(px, py, (uint32_t)i, grid.cell_boids + ranges[r].begin,
+                                 ranges[r].end - ranges[r].begin, row, &sums);
         }
     }
+
+    FlockForces forces = FlockForcesFromSums(i, &sums.sums);
     if (forces.neighborCount > 0) {
-        forces.alignment = Vector2Scale(forces.alignment, 1.0f / forces.neighborCount);
-        forces.cohesion = Vector2Scale(forces.cohesion, 1.0f / forces.neighborCount);
+        // So that alignment - velocity in UpdateBoids() sums each
+        // neighbour's velocity less the boid's, weighted
+        float inv = 1.0f / forces.neighborCount;
+        float unmatched = (forces.neighborCount - sums.matched) * inv;
+        forces.alignment.x += boids.vx[i] * unmatched;
+        forces.alignment.y += boids.vy[i] * unmatched;
+        forces.flee = (Vec2){ sums.flee_x * inv, sums.flee_y * inv };
     }
     return forces;
 }
 
-Boid *FindNearestBoid(Vector2 position) {
-    int cell_x = (int)(position.x / CELL_SIZE);
-    int cell_y = (int)(position.y / CELL_SIZE);
-
-    Boid *nearest_boid = NULL;
-    float nearest_distance = 10000.0f;
-
-    for (int dx = -1; dx <= 1; ++dx) {
-        for (int dy = -1; dy <= 1; ++dy) {
-            int nx = cell_x + dx;
-            int ny = cell_y + dy;
-            unsigned int index = hash_cell(WRAP_MOD(nx, CELL_WIDTH), WRAP_MOD(ny, CELL_HEIGHT));
-            HashCell* cell = &hash_table[index];
-            for (int j = 0; j < cell->length; ++j) {
-                Boid* neighbor = cell->boids[j];
-                if (neighbor != &boids[MOUSE_INDEX]) {
-                    float dist = DistanceOnTorus(position, neighbor->position);
-                    if (dist < nearest_distance) {
-                        nearest_distance = dist;
-                        nearest_boid = neighbor;
-                    }
-                }
-            }
-        }
-    }
-    return nearest_boid;
-}
+FlockForces FlockForcesFromSums(size_t i, const FlockSums *sums) {
+    FlockForces forces = {0};
 
-Vector2 PreditorAjustment(){
-    Vector2 preditor_adjustment = {0.0f, 0.0f};
-
-    Vector2 predator_dir = Vector2Normalize(boids[PREDATOR_INDEX].velocity);
-
-    int width = ceil_div(PREDATOR_VISUAL_RADIUS, CELL_SIZE);
-
-    Boid* predator = &boids[PREDATOR_INDEX];
-    int cell_x = (int)(predator->position.x / CELL_SIZE);
-    int cell_y = (int)(predator->position.y / CELL_SIZE);
-
-    int count = 0;
-    for (int dx = -width; dx <= width; ++dx) {
-        for (int dy = -width; dy <= width; ++dy) {
-            int nx = cell_x + dx;
-            int ny = cell_y + dy;
-            unsigned int index = hash_cell(WRAP_MOD(nx, CELL_WIDTH), WRAP_MOD(ny, CELL_HEIGHT));
-            HashCell* cell = &hash_table[index];
-            for (int j = 0; j < cell->length; ++j) {
-                Boid* neighbor = cell->boids[j];
-                if (neighbor != predator) {
-                    float dist = DistanceOnTorusSquared(predator->position, neighbor->position);
-                    if (dist < PREDATOR_VISUAL_RADIUS * PREDATOR_VISUAL_RADIUS) {
-                        count++;
-                        Vector2 diff = Vector2SubtractTorus(neighbor->position, predator->position);
-                        Vector2 to_neighbor = Vector2Normalize(diff);
-                        float alignment = Vector2DotProduct(predator_dir, to_neighbor);  // ranges from -1.0 back to 1.0 front
-                        float scale = (alignment + 1.0f) * 0.5f; // scale from 0.0 back to 1.0 front
-                        Vector2 scaled_diff = Vector2Scale(diff, scale*scale*scale);
-                        preditor_adjustment = Vector2Add(preditor_adjustment, scaled_diff);
-                        // Supposing that PREDATOR_RADIUS < PREDATOR_VISUAL_RADIUS
-                        if (dist < PREDATOR_RADIUS * PREDATOR_RADIUS) {
-                            neighbor->predated = true;
-                            if (dist != 0) neighbor->velocity_update = Vector2Add(neighbor->velocity_update, Vector2Scale(to_neighbor, PREDATOR_AVOID_FACTOR / sqrt(dist)));
-                        }
-                    }
-                }
-            }
-        }
+    if (sums->coincident > 0) { // HACK!!!
+        // Boids at exactly the same position are left out of the sums; nudge this one apart
+        printf("HACK!!! Frame %zu: Boid %u shares its position with %d neighbours!\n", frameCounter, boids.info[i].id, sums->coincident);
+        Vec2 nudge = Vec2Scale(RandomUnitVector2(RANDOM_NUDGE, frameCounter, i), TINY_SPEED);
+        boids.ux[i] += nudge.x;
+        boids.uy[i] += nudge.y;
     }
 
-    if (count > 0) {
-        preditor_adjustment = Vector2Scale(preditor_adjustment, 1.0f / count);
+    forces.separation = (Vec2){ sums->separation_x, sums->separation_y };
+    forces.nearNeighborCount = sums->nearNeighborCount;
+    forces.neighborCount = sums->neighborCount;
+    if (forces.neighborCount > 0) {
+        float inv = 1.0f / forces.neighborCount;
+        forces.alignment = (Vec2){ sums->alignment_x * inv, sums->alignment_y * inv };
+        forces.cohesion = (Vec2){ boids.x[i] + sums->offset_x * inv, boids.y[i] + sums->offset_y * inv };
     }
+    return forces;
+}
 
-    return preditor_adjustment;
-}
\ No newline at end of file
+size_t FindNearestBoid(Vec2 position) {
+    uint32_t nearest;
+    return QueryNearest(position, 1, QUERY_NONE, &nearest, NULL) ? nearest : SENTINEL;
+}
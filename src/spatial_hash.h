@@ -3,44 +3,86 @@
 
 #include <stdbool.h>
 #include "boids.h"
+#include "flock_kernel.h"
 
-#define HASH_SIZE 10007
-#define CELL_SIZE 50
-#define CELL_WIDTH (SCREEN_WIDTH / CELL_SIZE)
-#define CELL_HEIGHT (SCREEN_HEIGHT / CELL_SIZE)
+// Edge of a grid cell, dividing the world's width and height. Set it before
+// SetWorldDimensions(), or through SetCellSize() once the boids exist
+// (autotune.h picks it per machine).
+#define DEFAULT_CELL_SIZE 50
+extern int cellSize;
 
-
-#define INITIAL_MAX_BOIDS_PER_CELL 1024 // Tweak as needed
+// Largest block radius, in cells, that grid_cell_ranges() supports
+#define GRID_MAX_REACH 16
+// Worst case number of runs for a block: two per row when it straddles the seam
+#define GRID_MAX_RANGES (2 * (2 * GRID_MAX_REACH + 1))
 
 typedef struct {
-    Vector2 alignment;
-    Vector2 cohesion;
-    Vector2 separation;
+    Vec2 alignment;
+    Vec2 cohesion;
+    Vec2 separation;
+    Vec2 flee;              // offset of the neighbours fled, species.h only
     int neighborCount;
     int nearNeighborCount;
 } FlockForces;
 
+// Dense uniform grid over the torus, rebuilt every frame by a parallel
+// counting sort.
+// The boids of cell c are cell_boids[cell_start[c] .. cell_start[c + 1]),
+// with cells numbered row-major (c = cell_y * width + cell_x).
+typedef struct {
+    int width;              // cells across
+    int height;             // cells down
+    uint32_t *cell_start;   // width * height + 1 offsets into cell_boids
+    uint32_t *cell_boids;   // boid indices sorted by cell
+    uint32_t *boid_cell;    // cell of each boid, indexed by boid
+    size_t count;           // indexed boids
+    size_t capacity;        // slots in cell_boids
+    int parts;              // histograms the build scratch is sized for
+    uint32_t *thread_hist;  // parts * cells per-thread histograms
+    uint32_t *thread_base;  // per-thread offsets while scanning
+} SpatialGrid;
+
+// A run of cell_boids covering consecutive cells of one row
 typedef struct {
-    int length;
-    int max_length;
-    Boid** boids;  // dynamically allocated array
-} HashCell;
+    uint32_t begin;
+    uint32_t end;
+} CellRange;
+
+extern SpatialGrid grid;
+
+void init_spatial_grid(size_t max_boids);
+void build_spatial_grid(void);
 
-extern HashCell hash_table[HASH_SIZE];
+// Collects the (2 * radius + 1)^2 block of cells around (cell_x, cell_y) as
+// runs of cell_boids, wrapping around the torus. Returns the number of runs.
+int grid_cell_ranges(int cell_x, int cell_y, int radius, CellRange *ranges);
+// Runs of cell_boids for `columns` cells of one row starting at column x0
+// (taken modulo the width). Returns 1, or 2 when the run crosses the seam.
+int grid_row_ranges(int row, int x0, int columns, CellRange *ranges);
 
-void init_spatial_hash(void);
-void clear_spatial_hash(void);
-unsigned int hash_cell(int cell_x, int cell_y);
+static inline uint32_t grid_cell_of(float x, float y) {
+    int cell_x = (int)(x / cellSize);
+    int cell_y = (int)(y / cellSize);
+    // Positions exactly on the far edge belong to the last cell
+    if (cell_x >= grid.width) cell_x = grid.width - 1;
+    if (cell_y >= grid.height) cell_y = grid.height - 1;
+    return (uint32_t)(cell_y * grid.width + cell_x);
+}
 
-FlockForces ComputeFlockForces(Boid *boid);
-Vector2 PreditorAjustment();
+FlockForces ComputeFlockForces(size_t i);
+// ComputeFlockForces() for boid i of species s, each neighbour weighted by
+// its species' entry in the row of s (species.h)
+FlockForces ComputeSpeciesFlockForces(size_t i, int s);
+// Turns boid i's raw neighbour sums into forces (nudging coincident boids apart)
+FlockForces FlockForcesFromSums(size_t i, const FlockSums *sums);
+int ceil_div(int a, int b);
 
-Vector2 Vector2SubtractTorus(Vector2 a, Vector2 b);
-float DistanceOnTorus(Vector2 a, Vector2 b);
-float DistanceOnTorusSquared(Vector2 a, Vector2 b);
+Vec2 Vector2SubtractTorus(Vec2 a, Vec2 b);
+Vec2 Vector2Wrap(Vec2 v, float width, float height);
+float DistanceOnTorus(Vec2 a, Vec2 b);
+float DistanceOnTorusSquared(Vec2 a, Vec2 b);
 
-Boid *FindNearestBoid(Vector2 position);
+size_t FindNearestBoid(Vec2 position); // SENTINEL if there are no boids; see spatial_query.h
 
-void DrawCells(Vector2 position);
 #endif // SPATIAL_HASH_H
 
@@ -0,0 +1,309 @@
+#include <math.h>
+#include <stdbool.h>
+#include <omp.h>
+
+#include "spatial_query.h"
+#include "spatial_hash.h"
+#include "boids.h"
+#include "density_field.h"
+
+typedef struct QueryEntry {
+    float dist;       // squared
+    uint32_t index;
+} QueryEntry;
+
+// Ordered by distance, then index, so ties do not depend on visiting order
+static inline bool entry_less(QueryEntry a, QueryEntry b) {
+    return a.dist < b.dist || (a.dist == b.dist && a.index < b.index);
+}
+
+static void heap_sift_down(QueryEntry *heap, int size, int at) {
+    for (;;) {
+        int largest = at, left = 2 * at + 1, right = left + 1;
+        if (left < size && entry_less(heap[largest], heap[left])) largest = left;
+        if (right < size && entry_less(heap[largest], heap[right])) largest = right;
+        if (largest == at) return;
+        QueryEntry t = heap[at]; heap[at] = heap[largest]; heap[largest] = t;
+        at = largest;
+    }
+}
+
+// Keeps the k smallest entries in a max-heap
+static inline void heap_offer(QueryEntry *heap, int *size, int k, QueryEntry entry) {
+    if (*size < k) {
+        int at = (*size)++;
+        while (at > 0 && entry_less(heap[(at - 1) / 2], entry)) {
+            heap[at] = heap[(at - 1) / 2];
+            at = (at - 1) / 2;
+        }
+        heap[at] = entry;
+    } else if (entry_less(entry, heap[0])) {
+        heap[0] = entry;
+        heap_sift_down(heap, *size, 0);
+    }
+}
+
+// Squared distance on the torus, without Vector2SubtractTorus's branches
+static inline float torus_distance_squared(float ax, float ay, float bx, float by) {
+    const float width = (float)SCREEN_WIDTH, height = (float)SCREEN_HEIGHT;
+    float dx = fabsf(ax - bx), dy = fabsf(ay - by);
+    dx = dx < width - dx ? dx : width - dx;
+    dy = dy < height - dy ? dy : height - dy;
+    return dx * dx + dy * dy;
+}
+
+static void offer_cell(QueryEntry *heap, int *size, int k, float px, float py, uint32_t exclude, uint32_t cell) {
+    const float *restrict x = boids.x, *restrict y = boids.y;
+    const uint32_t *restrict members = grid.cell_boids;
+    const uint32_t end = grid.cell_start[cell + 1];
+    for (uint32_t e = grid.cell_start[cell]; e < end; e++) {
+        uint32_t j = members[e];
+        float dist = torus_distance_squared(x[j], y[j], px, py);
+        // Most candidates are farther than the k-th nearest so far
+        if (*size == k && dist > heap[0].dist) continue;
+        if (j != exclude) heap_offer(heap, size, k, (QueryEntry){ dist, j });
+    }
+}
+
+// Any point into the world; callers may pass points several worlds out
+static inline Vec2 wrap_point(Vec2 p) {
+    const float width = (float)SCREEN_WIDTH, height = (float)SCREEN_HEIGHT;
+    if (p.x < 0.0f || p.x >= width) p.x -= floorf(p.x / width) * width;
+    if (p.y < 0.0f || p.y >= height) p.y -= floorf(p.y / height) * height;
+    return p;
+}
+
+// Wraps a cell coordinate at most one world out, without WRAP_MOD's divisions
+static inline int wrap_index(int a, int m) {
+    return a < 0 ? a + m : (a >= m ? a - m : a);
+}
+
+int QueryNearest(Vec2 point, int k, uint32_t exclude, uint32_t *out, float *dist2) {
+    QueryEntry heap[QUERY_MAX_K];
+    int size = 0;
+    if (k > QUERY_MAX_K) k = QUERY_MAX_K;
+    if (k <= 0 || grid.count == 0) return 0;
+
+    point = wrap_point(point);
+    const float px = point.x, py = point.y;
+    const int width = grid.width, height = grid.height;
+    const uint32_t cell = grid_cell_of(px, py);
+    const int cell_x = (int)(cell % width), cell_y = (int)(cell / width);
+    // Rings up to here never wrap onto each other
+    int max_ring = (width - 1) / 2 < (height - 1) / 2 ? (width - 1) / 2 : (height - 1) / 2;
+    // The point relative to its own cell's corner, and its distance to the
+    // nearest edge of that cell
+    const float ox = px - cell_x * cellSize, oy = py - cell_y * cellSize;
+    const float gap = fminf(fminf(ox, cellSize - ox), fminf(oy, cellSize - oy));
+
+    offer_cell(heap, &size, k, px, py, exclude, cell);
+    bool settled = false;
+    for (int ring = 1; ring <= max_ring; ring++) {
+        // Nothing beyond the rings scanned so far is nearer than this
+        float reach = (ring - 1) * cellSize + gap;
+        if (size == k && heap[0].dist < reach * reach) { settled = true; break; }
+
+        // Top and bottom rows of the ring in full, the sides one cell each;
+        // cells wholly farther than the k-th nearest so far are skipped
+        for (int dy = -ring; dy <= ring; dy++) {
+            int row = wrap_index(cell_y + dy, height) * width;
+            float ey = fmaxf(fmaxf(dy * cellSize - oy, oy - (dy + 1) * cellSize), 0.0f);
+            int step = (dy == -ring || dy == ring) ? 1 : 2 * ring;
+            for (int dx = -ring; dx <= ring; dx += step) {
+                float ex = fmaxf(fmaxf(dx * cellSize - ox, ox - (dx + 1) * cellSize), 0.0f);
+                if (size == k && ex * ex + ey * ey > heap[0].dist) continue;
+                offer_cell(heap, &size, k, px, py, exclude, (uint32_t)(row + wrap_index(cell_x + dx, width)));
+            }
+        }
+    }
+    if (!settled) {
+        float reach = max_ring * cellSize + gap;
+        settled = size == k && heap[0].dist < reach * reach;
+    }
+    // In a long thin or sparse world the rings run out first: the cells they
+    // never reached are scanned whole
+    if (!settled && (2 * max_ring + 1 < width || 2 * max_ring + 1 < height)) {
+        for (int y = 0; y < height; y++) {
+            int dy = y - cell_y;
+            dy = dy < 0 ? -dy : dy;
+            if (height - dy < dy) dy = height - dy;
+            for (int x = 0; x < width; x++) {
+                int dx = x - cell_x;
+                dx = dx < 0 ? -dx : dx;
+                if (width - dx < dx) dx = width - dx;
+                if (dx <= max_ring && dy <= max_ring) continue;
+                offer_cell(heap, &size, k, px, py, exclude, (uint32_t)(y * width + x));
+            }
+        }
+    }
+
+    // Pop the heap from the back, farthest first
+    int found = size;
+    for (int m = size - 1; m >= 0; m--) {
+        out[m] = heap[0].index;
+        if (dist2) dist2[m] = heap[0].dist;
+        heap[0] = heap[m];
+        heap_sift_down(heap, m, 0);
+    }
+    return found;
+}
+
+size_t QueryRadius(Vec2 point, float radius, uint32_t *out, size_t max) {
+    if (grid.count == 0 || !(radius > 0.0f)) return 0;
+
+    point = wrap_point(point);
+    const int width = grid.width, height = grid.height;
+    const uint32_t cell = grid_cell_of(point.x, point.y);
+    const float radius2 = radius * radius;
+
+    // A block wider than the world would visit cells twice, so clamp it
+    int reach = (int)ceilf(radius / cellSize);
+    int span = 2 * reach + 1;
+    int x0 = (int)(cell % width) - reach, columns = span;
+    int y0 = (int)(cell / width) - reach, rows = span;
+    if (span >= width) { x0 = 0; columns = width; }
+    if (span >= height) { y0 = 0; rows = height; }
+
+    size_t found = 0;
+    CellRange ranges[2];
+    for (int r = 0; r < rows; r++) {
+        int n = grid_row_ranges(WRAP_MOD(y0 + r, height), x0, columns, ranges);
+        for (int g = 0; g < n; g++) {
+            for (uint32_t e = ranges[g].begin; e < ranges[g].end; e++) {
+                uint32_t j = grid.cell_boids[e];
+                if (torus_distance_squared(boids.x[j], boids.y[j], point.x, point.y) < radius2) {
+                    if (found < max) out[found] = j;
+                    found++;
+                }
+            }
+        }
+    }
+    return found;
+}
+
+// Nearest distance along one axis from the point, at offset o inside its own
+// cell, to the cell d cells away; when the block covers the whole axis the
+// cell is also looked at one world either way
+static inline float axis_near(int d, float o, int cells, bool whole) {
+    float best = INFINITY;
+    for (int w = whole ? -1 : 0; w <= (whole ? 1 : 0); w++) {
+        float lo = (d + w * cells) * cellSize - o, hi = lo + cellSize;
+        float near = lo > 0.0f ? lo : (hi < 0.0f ? -hi : 0.0f);
+        best = near < best ? near : best;
+    }
+    return best;
+}
+
+static inline void add_boid(RadiusSums *sums, uint32_t j, float dx, float dy) {
+    sums->count += 1.0f;
+    sums->offset.x += dx;
+    sums->offset.y += dy;
+    sums->velocity.x += boids.vx[j];
+    sums->velocity.y += boids.vy[j];
+    sums->spread += dx * dx + dy * dy;
+}
+
+static RadiusSums radius_sums(Vec2 point, float radius, uint32_t exclude, bool use_moments) {
+    RadiusSums sums = {0};
+    if (grid.count == 0 || !(radius > 0.0f)) return sums;
+
+    point = wrap_point(point);
+    const int width = grid.width, height = grid.height;
+    const float half_width = HALF_SCREEN_WIDTH, half_height = HALF_SCREEN_HEIGHT;
+    const float radius2 = radius * radius;
+    const uint32_t cell = grid_cell_of(point.x, point.y);
+    const int cell_x = (int)(cell % width), cell_y = (int)(cell / width);
+    const float ox = point.x - cell_x * cellSize, oy = point.y - cell_y * cellSize;
+
+    // A block wider than the world covers each cell once, nearest way round
+    int reach = (int)ceilf(radius / cellSize);
+    int x_lo = -reach, x_hi = reach, y_lo = -reach, y_hi = reach;
+    bool whole_x = 2 * reach + 1 >= width, whole_y = 2 * reach + 1 >= height;
+    if (whole_x) { x_lo = -((width - 1) / 2); x_hi = x_lo + width - 1; }
+    if (whole_y) { y_lo = -((height - 1) / 2); y_hi = y_lo + height - 1; }
+
+    const uint32_t exclude_cell = exclude < grid.count ? grid.boid_cell[exclude] : UINT32_MAX;
+    for (int dy = y_lo; dy <= y_hi; dy++) {
+        const int row = wrap_index(cell_y + dy, height) * width;
+        const float near_y = axis_near(dy, oy, height, whole_y);
+        if (near_y * near_y >= radius2) continue;
+        const float far_y = fmaxf(fabsf(dy * cellSize - oy), fabsf((dy + 1) * cellSize - oy));
+        const float cy = (dy + 0.5f) * cellSize - oy; // cell centre from the point
+
+        for (int dx = x_lo; dx <= x_hi; dx++) {
+            const float near_x = axis_near(dx, ox, width, whole_x);
+            if (near_x * near_x + near_y * near_y >= radius2) continue;
+            const uint32_t c = (uint32_t)(row + wrap_index(cell_x + dx, width));
+            const float far_x = fmaxf(fabsf(dx * cellSize - ox), fabsf((dx + 1) * cellSize - ox));
+
+            if (use_moments && far_x * far_x + far_y * far_y < radius2 &&
+                far_x <= half_width && far_y <= half_height) {
+                // Wholly inside: the cell's moments, shifted from its centre to the point
+                const float cx = (dx + 0.5f) * cellSize - ox;
+                const float n = cellMoments.count[c], sx = cellMoments.sum_x[c], sy = cellMoments.sum_y[c];
+                sums.count += n;
+                sums.offset.x += sx + n * cx;
+                sums.offset.y += sy + n * cy;
+                sums.velocity.x += cellMoments.sum_vx[c];
+                sums.velocity.y += cellMoments.sum_vy[c];
+                sums.spread += cellMoments.sum_xx[c] + cellMoments.sum_yy[c] +
+                               2.0f * (cx * sx + cy * sy) + n * (cx * cx + cy * cy);
+                if (c == exclude_cell) {
+                    float ex = boids.x[exclude] - point.x, ey = boids.y[exclude] - point.y;
+                    ex += ex > half_width ? -SCREEN_WIDTH : (ex < -half_width ? SCREEN_WIDTH : 0.0f);
+                    ey += ey > half_height ? -SCREEN_HEIGHT : (ey < -half_height ? SCREEN_HEIGHT : 0.0f);
+                    sums.count -= 1.0f;
+                    sums.offset.x -= ex;
+                    sums.offset.y -= ey;
+                    sums.velocity.x -= boids.vx[exclude];
+                    sums.velocity.y -= boids.vy[exclude];
+                    sums.spread -= ex * ex + ey * ey;
+                }
+                continue;
+            }
+
+            // Cut by the circle: boid by boid
+            for (uint32_t e = grid.cell_start[c]; e < grid.cell_start[c + 1]; e++) {
+                uint32_t j = grid.cell_boids[e];
+                float ex = boids.x[j] - point.x, ey = boids.y[j] - point.y;
+                ex += ex > half_width ? -SCREEN_WIDTH : (ex < -half_width ? SCREEN_WIDTH : 0.0f);
+                ey += ey > half_height ? -SCREEN_HEIGHT : (ey < -half_height ? SCREEN_HEIGHT : 0.0f);
+                if (ex * ex + ey * ey < radius2 && j != exclude) add_boid(&sums, j, ex, ey);
+            }
+        }
+    }
+    return sums;
+}
+
+RadiusSums QueryRadiusSums(Vec2 point, float radius, uint32_t exclude) {
+    return radius_sums(point, radius, exclude, true);
+}
+
+RadiusSums QueryRadiusSumsExact(Vec2 point, float radius, uint32_t exclude) {
+    return radius_sums(point, radius, exclude, false);
+}
+
+void QueryRadiusSumsBatch(const Vec2 *points, size_t count, float radius, RadiusSums *out) {
+    #pragma omp parallel for schedule(static)
+    for (size_t q = 0; q < count; q++) out[q] = QueryRadiusSums(points[q], radius, QUERY_NONE);
+}
+
+void QueryRadiusBatch(const Vec2 *points, size_t count, float radius,
+                      uint32_t *out, size_t max, size_t *found) {
+    #pragma omp parallel for schedule(static)
+    for (size_t q = 0; q < count; q++) found[q] = QueryRadius(points[q], radius, out + q * max, max);
+}
+
+void QueryNearestBatch(const Vec2 *points, size_t count, int k, uint32_t *out, float *dist2) {
+    if (k <= 0) return;
+    #pragma omp parallel for schedule(static)
+    for (size_t q = 0; q < count; q++) {
+        uint32_t *o = out + q * k;
+        float *d = dist2 ? dist2 + q * k : NULL;
+        int n = QueryNearest(points[q], k, QUERY_NONE, o, d);
+        for (int m = n; m < k; m++) {
+            o[m] = QUERY_NONE;
+            if (d) d[m] = INFINITY;
+        }
+    }
+}
@@ -0,0 +1,63 @@
+#ifndef SPATIAL_QUERY_H
+#define SPATIAL_QUERY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "vec2.h"
+
+// Spatial queries over the boid grid.
+//
+// Every query reads the boids and the grid as last built, so it belongs on
+// the simulation thread between ticks (or in the bench), never during one.
+// Results go into buffers the caller supplies; nothing here allocates. The
+// batch forms split their queries statically over the OpenMP threads, and
+// every answer is exact and independent of the thread count.
+
+#define QUERY_NONE UINT32_MAX
+#define QUERY_MAX_K 32 // largest k a nearest query keeps
+
+// The boids within radius of point on the torus, in grid order, up to max
+// of them into out. Returns how many there are, which may be more than max.
+size_t QueryRadius(Vec2 point, float radius, uint32_t *out, size_t max);
+
+// The k (at most QUERY_MAX_K) nearest boids to point other than `exclude`
+// (QUERY_NONE for none), nearest first and ties to the lower index, into out
+// and their squared distances into dist2 unless it is NULL. Returns how many
+// were found: k unless there are fewer boids.
+int QueryNearest(Vec2 point, int k, uint32_t exclude, uint32_t *out, float *dist2);
+
+typedef struct RadiusSums {
+    float count;      // boids within the radius
+    Vec2 offset;      // their summed offsets from the point, the short way round
+    Vec2 velocity;    // their summed velocities
+    float spread;     // their summed squared distances from the point
+} RadiusSums;
+
+// Sums over the boids within radius of point other than `exclude`, for
+// large radii. Cells wholly inside the circle (and within half the world of
+// the point) add their moments from the last grid build (density_field.h),
+// shifted to the point; only cells the circle cuts are visited boid by boid,
+// so the per-boid work grows with the radius rather than its square.
+//
+// The moments are linear, so this is not an approximation of which boids
+// count: it differs from QueryRadiusSumsExact only by float rounding. Each
+// whole cell's sums are rounded once at the build and again when shifted, so
+// count is exact, offset and velocity agree to a few parts in a million of
+// count * radius and count * MAX_SPEED, and spread, which is shifted through
+// sum_xx + sum_yy + 2 c . sum + n |c|^2, to a few parts in a million of
+// count * radius^2 (boids_bench --queries reports the worst case).
+RadiusSums QueryRadiusSums(Vec2 point, float radius, uint32_t exclude);
+// The same boid by boid, as a reference
+RadiusSums QueryRadiusSumsExact(Vec2 point, float radius, uint32_t exclude);
+
+// QueryRadius for count points: query q writes out[q * max ..] and found[q]
+void QueryRadiusBatch(const Vec2 *points, size_t count, float radius,
+                      uint32_t *out, size_t max, size_t *found);
+// QueryNearest for count points: query q writes out[q * k ..] and, unless it
+// is NULL, dist2[q * k ..], padded with QUERY_NONE and INFINITY
+void QueryNearestBatch(const Vec2 *points, size_t count, int k, uint32_t *out, float *dist2);
+// QueryRadiusSums for count points, excluding none
+void QueryRadiusSumsBatch(const Vec2 *points, size_t count, float radius, RadiusSums *out);
+
+#endif // SPATIAL_QUERY_H
@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "species.h"
+#include "boids.h"
+
+int speciesCount = 1;
+SpeciesParams species[MAX_SPECIES] = {
+    { 1.0f, MATCH_FACTOR, CENTER_FACTOR, AVOID_FACTOR, SPECIES_FLEE_FACTOR, 1.0f, MIN_SPEED, MAX_SPEED },
+};
+SpeciesWeights speciesMatrix[MAX_SPECIES][MAX_SPECIES] = {
+    { { 1.0f, 1.0f, 1.0f, 0.0f } },
+};
+size_t speciesStart[MAX_SPECIES] = {0};
+FlockSpeciesRow speciesRows[MAX_SPECIES];
+size_t speciesBlockStart[MAX_SPECIES][SPECIES_BLOCKS + 1];
+
+// Scratch of GroupSpecies()
+static uint32_t *groupFrom = NULL, *groupPool = NULL;
+static BoidInfo *groupInfo = NULL;
+static size_t groupCapacity = 0;
+
+bool SetSpeciesCount(int count) {
+    if (count < 1 || count > MAX_SPECIES) {
+        fprintf(stderr, "Species count must be between 1 and %d\n", MAX_SPECIES);
+        return false;
+    }
+    speciesCount = count;
+    for (int a = 0; a < count; a++) {
+        species[a] = species[0];
+        species[a].share = 1.0f;
+        for (int b = 0; b < count; b++) {
+            speciesMatrix[a][b] = a == b ? (SpeciesWeights){ 1.0f, 1.0f, 1.0f, 0.0f }
+                                         : (SpeciesWeights){ 0.0f, 0.0f, 1.0f, 0.0f };
+        }
+        speciesStart[a] = 0;
+    }
+    return true;
+}
+
+bool LoadSpecies(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        fprintf(stderr, "Cannot open species file %s\n", path);
+        return false;
+    }
+
+    SpeciesParams params[MAX_SPECIES];
+    int count = 0;
+    struct { int a, b; SpeciesWeights w; } weights[MAX_SPECIES * MAX_SPECIES];
+    int weightCount = 0;
+    char line[256];
+    int number = 0;
+    bool ok = true;
+    while (ok && fgets(line, sizeof(line), file)) {
+        number++;
+        char *text = line + strspn(line, " \t");
+        if (*text == '#' || *text == '\n' || *text == '\0') continue;
+
+        SpeciesParams p;
+        int a, b;
+        SpeciesWeights w;
+        if (sscanf(text, "species %f %f %f %f %f %f %f %f", &p.share, &p.match, &p.center, &p.avoid,
+                   &p.flee, &p.predator, &p.minSpeed, &p.maxSpeed) == 8) {
+            if (count == MAX_SPECIES || !(p.share > 0.0f) || !(p.minSpeed > 0.0f) || !(p.maxSpeed >= p.minSpeed)) {
+                fprintf(stderr, "%s:%d: more than %d species, or a share or speed out of range\n", path, number, MAX_SPECIES);
+                ok = false;
+            } else {
+                params[count++] = p;
+            }
+        } else if (sscanf(text, "weights %d %d %f %f %f %f", &a, &b, &w.alignment, &w.cohesion,
+                          &w.separation, &w.flee) == 6) {
+            if (a < 0 || a >= MAX_SPECIES || b < 0 || b >= MAX_SPECIES) {
+                fprintf(stderr, "%s:%d: species out of range\n", path, number);
+                ok = false;
+            } else if (weightCount < MAX_SPECIES * MAX_SPECIES) {
+                weights[weightCount].a = a;
+                weights[weightCount].b = b;
+                weights[weightCount++].w = w;
+            }
+        } else {
+            fprintf(stderr, "%s:%d: expected a species or weights line\n", path, number);
+            ok = false;
+        }
+    }
+    fclose(file);
+    if (!ok) return false;
+    if (count == 0) {
+        fprintf(stderr, "%s: no species\n", path);
+        return false;
+    }
+    for (int k = 0; k < weightCount; k++) {
+        if (weights[k].a >= count || weights[k].b >= count) {
+            fprintf(stderr, "%s: weights for species %d and %d, of %d\n", path, weights[k].a, weights[k].b, count);
+            return false;
+        }
+    }
+
+    SetSpeciesCount(count);
+    memcpy(species, params, count * sizeof(SpeciesParams));
+    for (int k = 0; k < weightCount; k++) speciesMatrix[weights[k].a][weights[k].b] = weights[k].w;
+    return true;
+}
+
+// Gathers one float array into ux, which is scratch between ticks, and swaps the two
+static void group_floats(float **array, size_t count) {
+    float *src = *array, *dst = boids.ux;
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < count; i++) dst[i] = src[groupFrom[i]];
+    *array = dst;
+    boids.ux = src;
+}
+
+void GroupSpecies(size_t old, size_t count) {
+    if (speciesCount == 1) return; // already in order
+    // Where each species is, and where its share puts it
+    size_t have[MAX_SPECIES], haveStart[MAX_SPECIES], want[MAX_SPECIES], wantStart[MAX_SPECIES];
+    double total = 0.0;
+    for (int s = 0; s < speciesCount; s++) total += species[s].share;
+    double cumulative = 0.0;
+    for (int s = 0; s < speciesCount; s++) {
+        haveStart[s] = old ? speciesStart[s] : 0;
+        wantStart[s] = (size_t)(count * (cumulative / total));
+        cumulative += species[s].share;
+    }
+    for (int s = 0; s < speciesCount; s++) {
+        have[s] = (s + 1 < speciesCount ? haveStart[s + 1] : old) - haveStart[s];
+        want[s] = (s + 1 < speciesCount ? wantStart[s + 1] : count) - wantStart[s];
+    }
+
+    size_t slots = old > count ? old : count;
+    if (slots > groupCapacity) {
+        groupFrom = realloc(groupFrom, slots * sizeof(uint32_t));
+        groupPool = realloc(groupPool, slots * sizeof(uint32_t));
+        groupInfo = realloc(groupInfo, slots * sizeof(BoidInfo));
+        if (!groupFrom || !groupPool || !groupInfo) {
+            fprintf(stderr, "Failed to allocate species scratch!\n");
+            exit(1);
+        }
+        groupCapacity = slots;
+    }
+
+    // Each species keeps its first boids up to its share; the species short
+    // of theirs take the others' surplus and then the new boids
+    size_t pooled = 0;
+    for (int s = 0; s < speciesCount; s++) {
+        for (size_t k = want[s] < have[s] ? want[s] : have[s]; k < have[s]; k++) {
+            groupPool[pooled++] = (uint32_t)(haveStart[s] + k);
+        }
+    }
+    for (size_t i = old; i < count; i++) groupPool[pooled++] = (uint32_t)i;
+    size_t next = 0;
+    for (int s = 0; s < speciesCount; s++) {
+        size_t keep = want[s] < have[s] ? want[s] : have[s];
+        for (size_t k = 0; k < want[s]; k++) {
+            groupFrom[wantStart[s] + k] = k < keep ? (uint32_t)(haveStart[s] + k) : groupPool[next++];
+        }
+        speciesStart[s] = wantStart[s];
+    }
+
+    group_floats(&boids.x, count);
+    group_floats(&boids.y, count);
+    group_floats(&boids.vx, count);
+    group_floats(&boids.vy, count);
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < count; i++) groupInfo[i] = boids.info[groupFrom[i]];
+    for (int s = 0; s < speciesCount; s++) {
+        for (size_t i = wantStart[s]; i < wantStart[s] + want[s]; i++) groupInfo[i].species = (uint8_t)s;
+        for (int b = 0; b <= SPECIES_BLOCKS; b++) speciesBlockStart[s][b] = wantStart[s] + want[s] * b / SPECIES_BLOCKS;
+    }
+    memcpy(boids.info, groupInfo, count * sizeof(BoidInfo));
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < count; i++) {
+        boids.ux[i] = boids.vx[i];
+        boids.uy[i] = boids.vy[i];
+    }
+}
+
+void BuildSpeciesRows(void) {
+    for (int a = 0; a < speciesCount; a++) {
+        FlockSpeciesRow *row = &speciesRows[a];
+        *row = (FlockSpeciesRow){ .count = speciesCount };
+        for (int b = 0; b < speciesCount; b++) {
+            SpeciesWeights w = speciesMatrix[a][b];
+            row->alignment[b] = w.alignment;
+            row->cohesion[b] = w.cohesion;
+            row->separation[b] = w.separation;
+            row->flee[b] = w.flee;
+            row->heeded[b] = w.alignment != 0.0f || w.cohesion != 0.0f || w.separation != 0.0f || w.flee != 0.0f;
+            if (b > 0) row->before[b - 1] = (int32_t)speciesStart[b] - 1;
+        }
+        row->uniform = row->heeded[0] != 0.0f;
+        for (int b = 1; b < speciesCount; b++) {
+            row->uniform = row->uniform && memcmp(&speciesMatrix[a][b], &speciesMatrix[a][0], sizeof(SpeciesWeights)) == 0;
+        }
+    }
+}
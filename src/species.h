@@ -0,0 +1,92 @@
+#ifndef SPECIES_H
+#define SPECIES_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "boids.h"
+#include "flock_kernel.h"
+
+// Species of boids.
+//
+// Every boid belongs to one of speciesCount species, each with its own
+// steering factors and speed limits, and an interaction matrix says how much
+// a boid of species a heeds a neighbour of species b: how far it matches its
+// velocity, steers towards it, keeps clear of it and flees it. The slots are
+// grouped by species, species s in [speciesStart[s], species_end(s)), so the
+// force pass takes each run of slots with one species' factors, and the
+// species kernels (flock_kernel.h) tell a neighbour's species from its slot
+// and take its weights from the boid's row of the matrix, loaded once per
+// cell range (ComputeSpeciesFlockForces). A row that weights every species
+// alike runs the single-species kernel and scales its sums instead.
+//
+// The radii stay global, as the grid and the kernels are built around them.
+// One species, the default, runs the single-species force pass unchanged;
+// more than one always gathers (the bench refuses the symmetric and list
+// modes, the viewer greys them out) and is not split over worker processes.
+
+#define MAX_SPECIES FLOCK_KERNEL_SPECIES
+
+typedef struct SpeciesParams {
+    float share;        // of the population, relative to the other species
+    float match;        // MATCH_FACTOR
+    float center;       // CENTER_FACTOR
+    float avoid;        // AVOID_FACTOR
+    float flee;         // steering away from the neighbours it flees
+    float predator;     // scale of PredatorAvoidance()
+    float minSpeed;
+    float maxSpeed;
+} SpeciesParams;
+
+// How much a boid heeds one neighbour species; all zero ignores it, and it
+// does not count towards the boid's neighbours either
+typedef struct SpeciesWeights {
+    float alignment;
+    float cohesion;
+    float separation;
+    float flee;
+} SpeciesWeights;
+
+#define SPECIES_FLEE_FACTOR 0.05f
+
+extern int speciesCount;
+extern SpeciesParams species[MAX_SPECIES];
+// Row: the boid's species, column: its neighbour's
+extern SpeciesWeights speciesMatrix[MAX_SPECIES][MAX_SPECIES];
+// First slot of each species
+extern size_t speciesStart[MAX_SPECIES];
+// The matrix as the species kernels take it, by BuildSpeciesRows()
+extern FlockSpeciesRow speciesRows[MAX_SPECIES];
+
+// Each species' slots split into SPECIES_BLOCKS runs: block b of every
+// species covers the same stretch of the reorder curve, with about equal
+// boids overall (ReorderBoids()), or an even split of the slots before the
+// first reorder. The force pass runs block by block, every species in each,
+// so their neighbours share the cache as one species' do.
+#define SPECIES_BLOCKS 256
+extern size_t speciesBlockStart[MAX_SPECIES][SPECIES_BLOCKS + 1];
+
+static inline size_t species_end(int s) {
+    return s + 1 < speciesCount ? speciesStart[s + 1] : boidCount;
+}
+
+// count species with the default factors and equal shares, each flocking
+// with its own kind and only keeping clear of the others. Before InitBoids().
+bool SetSpeciesCount(int count);
+// Reads the species from a text file; false, with a message, if it cannot.
+// One line per species, then any matrix entries that differ from
+// SetSpeciesCount()'s:
+//   species <share> <match> <center> <avoid> <flee> <predator> <min speed> <max speed>
+//   weights <a> <b> <alignment> <cohesion> <separation> <flee>
+// Blank lines and lines starting with # are skipped.
+bool LoadSpecies(const char *path);
+
+// Puts the boids back in species order after boidCount went from old to
+// count, slots [old, count) being new: each species keeps or gets its share,
+// new boids first filling the species short of theirs. Slots move, so the
+// grid is for the caller to rebuild; the blocks are split evenly.
+void GroupSpecies(size_t old, size_t count);
+// Fills in speciesRows from the matrix and speciesStart
+void BuildSpeciesRows(void);
+
+#endif // SPECIES_H
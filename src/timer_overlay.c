@@ -0,0 +1,95 @@
+#include <math.h>
+
+#include "timer_overlay.h"
+
+#define GRAPH_HEIGHT 90
+#define BAR_WIDTH 2
+#define LEGEND_LINE 18
+
+static const Color stageColors[STAGE_COUNT] = {
+    PURPLE, RED, ORANGE, GOLD, BEIGE, DARKGREEN, LIME, MAROON,   // simulation
+    SKYBLUE, BLUE, DARKBLUE                         // render
+};
+
+// Smallest 1, 2 or 5 times a power of ten that is at least ms
+static float graph_scale(float ms) {
+    float scale = 1.0f;
+    while (scale < ms) {
+        if (scale * 2.0f >= ms) return scale * 2.0f;
+        if (scale * 5.0f >= ms) return scale * 5.0f;
+        scale *= 10.0f;
+    }
+    return scale;
+}
+
+static int DrawDomain(const TimerSummary *summary, TimerDomain domain, const char *title, int x, int y) {
+    const int width = TIMER_HISTORY * BAR_WIDTH;
+    const uint64_t latest = summary->latest[domain];
+    const uint64_t first = latest >= TIMER_HISTORY ? latest - TIMER_HISTORY + 1 : 1;
+
+    float peak = 0.0f;
+    for (uint64_t frame = first; frame <= latest; frame++) {
+        float total = 0.0f;
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            if (timer_stage_domain((TimerStage)stage) == domain) total += TimerStageMs(summary, (TimerStage)stage, frame);
+        }
+        if (total > peak) peak = total;
+    }
+    float scale = graph_scale(peak);
+
+    DrawText(TextFormat("%s (scale %g ms)", title, scale), x, y, 20, DARKGRAY);
+    y += 22;
+    DrawRectangle(x, y, width, GRAPH_HEIGHT, Fade(LIGHTGRAY, 0.6f));
+    for (uint64_t frame = first; frame <= latest; frame++) {
+        int column = x + (int)(frame - first) * BAR_WIDTH;
+        float bottom = (float)(y + GRAPH_HEIGHT);
+        for (int stage = 0; stage < STAGE_COUNT; stage++) {
+            if (timer_stage_domain((TimerStage)stage) != domain) continue;
+            float height = TimerStageMs(summary, (TimerStage)stage, frame) / scale * GRAPH_HEIGHT;
+            if (height <= 0.0f) continue;
+            DrawRectangle(column, (int)(bottom - height), BAR_WIDTH, (int)ceilf(height), stageColors[stage]);
+            bottom -= height;
+        }
+    }
+    DrawRectangleLines(x, y, width, GRAPH_HEIGHT, GRAY);
+    y += GRAPH_HEIGHT + 4;
+
+    for (int stage = 0; stage < STAGE_COUNT; stage++) {
+        if (timer_stage_domain((TimerStage)stage) != domain) continue;
+        DrawRectangle(x, y + 3, 12, 12, stageColors[stage]);
+        DrawText(TextFormat("%-12s p50 %6.2f  p99 %6.2f ms", timer_stage_name((TimerStage)stage),
+                            summary->p50[stage], summary->p99[stage]),
+                 x + 18, y, 16, DARKGRAY);
+        y += LEGEND_LINE;
+    }
+    return y + 6;
+}
+
+int DrawTimerOverlay(const TimerSummary *summary, int x, int y) {
+    const int top = y;
+    y = DrawDomain(summary, TIMER_SIMULATION, "Simulation tick", x, y);
+
+    // The last force pass per thread; uneven bars mean load imbalance
+    if (summary->threads > 0) {
+        float slowest = 0.0f, total = 0.0f;
+        for (int t = 0; t < summary->threads; t++) {
+            total += summary->threadMs[t];
+            if (summary->threadMs[t] > slowest) slowest = summary->threadMs[t];
+        }
+        float mean = total / summary->threads;
+        DrawText(TextFormat("Force pass per thread: max %.2f ms, mean %.2f ms (%.0f%% imbalance)", slowest, mean,
+                            mean > 0.0f ? 100.0f * (slowest / mean - 1.0f) : 0.0f),
+                 x, y, 16, DARKGRAY);
+        y += LEGEND_LINE;
+        int shown = summary->threads < TIMER_HISTORY ? summary->threads : TIMER_HISTORY;
+        int bar = (TIMER_HISTORY * BAR_WIDTH) / shown;
+        for (int t = 0; t < shown; t++) {
+            float height = slowest > 0.0f ? summary->threadMs[t] / slowest * 30.0f : 0.0f;
+            DrawRectangle(x + t * bar, y + 30 - (int)height, bar > 1 ? bar - 1 : 1, (int)height, stageColors[STAGE_FORCES]);
+        }
+        y += 36;
+    }
+
+    y = DrawDomain(summary, TIMER_RENDER, "Render frame", x, y);
+    return y - top;
+}
@@ -0,0 +1,13 @@
+#ifndef TIMER_OVERLAY_H
+#define TIMER_OVERLAY_H
+
+#include "raylib.h"
+
+#include "frame_timer.h"
+
+// Stacked per-stage bar graphs of the last TIMER_HISTORY simulation ticks and
+// render frames, with rolling p50/p99 and the force pass time per thread.
+// Returns the height drawn.
+int DrawTimerOverlay(const TimerSummary *summary, int x, int y);
+
+#endif // TIMER_OVERLAY_H
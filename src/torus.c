@@ -1,81 +1,171 @@
-#include "torus.h"
-
-typedef struct TorusCoords {
-    float theta, phi;
-    float cosTheta, sinTheta;
-    float cosPhi, sinPhi;
-} TorusCoords;
+#include <stdio.h>
+#include <stdlib.h>
 
-static TorusCoords torusCoords = {-1.0f, -1.0f, -1.0f, -1.0f, -1.0f, -1.0f};
+#include "torus.h"
+#include "spatial_hash.h"
 
 static float R = -1.0f;
 static float r = -1.0f;
 
+// cos and sin of theta at every whole column and of phi at every whole row,
+// built by SetTorusDimensions() and only read afterwards
+static float *cosThetaTable = NULL, *sinThetaTable = NULL;
+static float *cosPhiTable = NULL, *sinPhiTable = NULL;
+static int thetaSteps = 0, phiSteps = 0;
+
+static void build_angle_table(int steps, float **cosTable, float **sinTable) {
+    float *c = realloc(*cosTable, steps * sizeof(float));
+    float *s = realloc(*sinTable, steps * sizeof(float));
+    if (!c || !s) {
+        fprintf(stderr, "Failed to allocate torus tables!\n");
+        exit(1);
+    }
+    for (int i = 0; i < steps; i++) {
+        double angle = 2.0 * PI * i / steps;
+        c[i] = (float)cos(angle);
+        s[i] = (float)sin(angle);
+    }
+    *cosTable = c;
+    *sinTable = s;
+}
+
 void SetTorusDimensions(float major, float minor) {
     R = major;
     r = minor;
+    thetaSteps = SCREEN_WIDTH;
+    phiSteps = SCREEN_HEIGHT;
+    build_angle_table(thetaSteps, &cosThetaTable, &sinThetaTable);
+    build_angle_table(phiSteps, &cosPhiTable, &sinPhiTable);
 }
 
 
-Mesh MyGenTorusMesh(int rings, int sides) {
-    int vertexCount = rings * sides * 6;
-    Vector3 *vertices = (Vector3 *)MemAlloc(vertexCount * sizeof(Vector3));
-    Vector3 *normals = (Vector3 *)MemAlloc(vertexCount * sizeof(Vector3));
-    Vector2 *texcoords = (Vector2 *)MemAlloc(vertexCount * sizeof(Vector2));
-
-    int index = 0;
-    for (int i = 0; i < rings; i++) {
-        float theta1 = ((float)i / rings) * 2.0f * PI;
-        float theta2 = ((float)(i + 1) / rings) * 2.0f * PI;
-
-        for (int j = 0; j < sides; j++) {
-            float phi1 = ((float)j / sides) * 2.0f * PI;
-            float phi2 = ((float)(j + 1) / sides) * 2.0f * PI;
+float get_torus_major_radius(void) { return R; }
+float get_torus_minor_radius(void) { return r; }
+
+// Ring and side counts of each level, coarsest first; (rings + 1) * (sides + 1)
+// must stay within 16-bit indices
+static const int torusLodRings[TORUS_LODS] = { 48, 128, 360 };
+static const int torusLodSides[TORUS_LODS] = { 24, 64, 180 };
+
+// Positions of an indexed torus from per-ring and per-side tables; ring
+// `rings` and side `sides` repeat the first so the texture wraps
+static void torus_mesh_positions(float *vertices, int rings, int sides,
+                                 const float *cosTheta, const float *sinTheta,
+                                 const float *cosPhi, const float *sinPhi) {
+    for (int i = 0; i <= rings; i++) {
+        int ti = i % rings;
+        for (int j = 0; j <= sides; j++) {
+            int pj = j % sides;
+            float ring = R + r * cosPhi[pj];
+            float *v = vertices + 3 * (i * (sides + 1) + j);
+            v[0] = ring * cosTheta[ti];
+            v[1] = r * sinPhi[pj];
+            v[2] = ring * sinTheta[ti];
+        }
+    }
+}
 
-            Vector3 p[4];
-            Vector3 n[4];
-            Vector2 t[4];
+Mesh MyGenTorusMesh(int rings, int sides) {
+    int vertexCount = (rings + 1) * (sides + 1);
+    if (vertexCount > 65535) {
+        fprintf(stderr, "Torus mesh of %dx%d needs more than 16-bit indices!\n", rings, sides);
+        exit(1);
+    }
 
-            for (int k = 0; k < 4; k++) {
-                float theta = (k < 2) ? theta1 : theta2;
-                float phi   = (k % 2 == 0) ? phi1 : phi2;
+    float *cosTheta = NULL, *sinTheta = NULL, *cosPhi = NULL, *sinPhi = NULL;
+    build_angle_table(rings, &cosTheta, &sinTheta);
+    build_angle_table(sides, &cosPhi, &sinPhi);
 
-                float cosTheta = cosf(theta), sinTheta = sinf(theta);
-                float cosPhi   = cosf(phi),   sinPhi   = sinf(phi);
+    Mesh mesh = { 0 };
+    mesh.vertexCount = vertexCount;
+    mesh.triangleCount = rings * sides * 2;
+    mesh.vertices = (float *)MemAlloc(vertexCount * 3 * sizeof(float));
+    mesh.normals = (float *)MemAlloc(vertexCount * 3 * sizeof(float));
+    mesh.tangents = (float *)MemAlloc(vertexCount * 4 * sizeof(float));
+    mesh.texcoords = (float *)MemAlloc(vertexCount * 2 * sizeof(float));
+    mesh.indices = (unsigned short *)MemAlloc(mesh.triangleCount * 3 * sizeof(unsigned short));
+
+    torus_mesh_positions(mesh.vertices, rings, sides, cosTheta, sinTheta, cosPhi, sinPhi);
+    for (int i = 0; i <= rings; i++) {
+        int ti = i % rings;
+        for (int j = 0; j <= sides; j++) {
+            int pj = j % sides;
+            int k = i * (sides + 1) + j;
+            float *n = mesh.normals + 3 * k;
+            n[0] = cosPhi[pj] * cosTheta[ti];
+            n[1] = sinPhi[pj];
+            n[2] = cosPhi[pj] * sinTheta[ti];
+            // Along theta, the direction u grows in, so GenMeshTangents() is not needed
+            float *t = mesh.tangents + 4 * k;
+            t[0] = -sinTheta[ti];
+            t[1] = 0.0f;
+            t[2] = cosTheta[ti];
+            t[3] = 1.0f;
+            mesh.texcoords[2 * k] = (float)i / rings;
+            mesh.texcoords[2 * k + 1] = (float)j / sides;
+        }
+    }
 
-                float x = (R + r * cosPhi) * cosTheta;
-                float y = r * sinPhi;
-                float z = (R + r * cosPhi) * sinTheta;
+    // Two triangles per quad
+    unsigned short *index = mesh.indices;
+    for (int i = 0; i < rings; i++) {
+        for (int j = 0; j < sides; j++) {
+            unsigned short p0 = (unsigned short)(i * (sides + 1) + j);
+            unsigned short p1 = p0 + 1;
+            unsigned short p2 = p0 + (sides + 1);
+            unsigned short p3 = p2 + 1;
+            *index++ = p0; *index++ = p1; *index++ = p2;
+            *index++ = p2; *index++ = p1; *index++ = p3;
+        }
+    }
 
-                float nx = cosPhi * cosTheta;
-                float ny = sinPhi;
-                float nz = cosPhi * sinTheta;
+    free(cosTheta); free(sinTheta); free(cosPhi); free(sinPhi);
 
-                p[k] = (Vector3){ x, y, z };
-                n[k] = (Vector3){ nx, ny, nz };
-                t[k] = (Vector2){ (float)i / rings, (float)j / sides };
-            }
+    UploadMesh(&mesh, false);
+    return mesh;
+}
 
-            // Two triangles per quad
-            vertices[index] = p[0]; normals[index] = n[0]; texcoords[index++] = t[0];
-            vertices[index] = p[1]; normals[index] = n[1]; texcoords[index++] = t[1];
-            vertices[index] = p[2]; normals[index] = n[2]; texcoords[index++] = t[2];
+void LoadTorusMeshes(TorusMeshes *meshes) {
+    for (int lod = 0; lod < TORUS_LODS; lod++) {
+        meshes->lod[lod] = MyGenTorusMesh(torusLodRings[lod], torusLodSides[lod]);
+    }
+    meshes->major = R;
+    meshes->minor = r;
+}
 
-            vertices[index] = p[2]; normals[index] = n[2]; texcoords[index++] = t[2];
-            vertices[index] = p[1]; normals[index] = n[1]; texcoords[index++] = t[1];
-            vertices[index] = p[3]; normals[index] = n[3]; texcoords[index++] = t[3];
-        }
+void UpdateTorusMeshes(TorusMeshes *meshes) {
+    if (meshes->major == R && meshes->minor == r) return;
+
+    // Normals, tangents, texcoords and indices do not depend on the radii
+    for (int lod = 0; lod < TORUS_LODS; lod++) {
+        Mesh *mesh = &meshes->lod[lod];
+        int rings = torusLodRings[lod], sides = torusLodSides[lod];
+        float *cosTheta = NULL, *sinTheta = NULL, *cosPhi = NULL, *sinPhi = NULL;
+        build_angle_table(rings, &cosTheta, &sinTheta);
+        build_angle_table(sides, &cosPhi, &sinPhi);
+        torus_mesh_positions(mesh->vertices, rings, sides, cosTheta, sinTheta, cosPhi, sinPhi);
+        free(cosTheta); free(sinTheta); free(cosPhi); free(sinPhi);
+        UpdateMeshBuffer(*mesh, 0, mesh->vertices, mesh->vertexCount * 3 * sizeof(float), 0);
     }
+    meshes->major = R;
+    meshes->minor = r;
+}
 
-    Mesh mesh = { 0 };
-    mesh.vertexCount = vertexCount;
-    mesh.triangleCount = vertexCount / 3;
-    mesh.vertices = (float *)vertices;
-    mesh.normals = (float *)normals;
-    mesh.texcoords = (float *)texcoords;
+void UnloadTorusMeshes(TorusMeshes *meshes) {
+    for (int lod = 0; lod < TORUS_LODS; lod++) UnloadMesh(meshes->lod[lod]);
+}
 
-    UploadMesh(&mesh, false);
-    return mesh;
+int SelectTorusLod(Vector3 eye, float pixelsPerUnit) {
+    // Distance from the eye to the surface, and the most a level's flat
+    // quads stray from it, around the tube and around the hole
+    float distance = fabsf(hypotf(hypotf(eye.x, eye.z) - R, eye.y) - r);
+    if (distance < 1.0f) distance = 1.0f;
+    for (int lod = 0; lod < TORUS_LODS - 1; lod++) {
+        float sag = fmaxf(r * (1.0f - cosf(PI / torusLodSides[lod])),
+                          (R + r) * (1.0f - cosf(PI / torusLodRings[lod])));
+        if (sag * pixelsPerUnit / distance <= TORUS_LOD_PIXELS) return lod;
+    }
+    return TORUS_LODS - 1;
 }
 
 float get_theta(float u) {
@@ -129,47 +219,85 @@ Vector3 get_torus_position(float u, float v) {
     return (Vector3){ x, y, z };
 }
 
-void set_torus_coords(float u, float v) {
-    torusCoords.theta = get_theta(u);
-    torusCoords.phi = get_phi(v);
-    torusCoords.cosTheta = cosf(torusCoords.theta);
-    torusCoords.sinTheta = sinf(torusCoords.theta);
-    torusCoords.cosPhi = cosf(torusCoords.phi);
-    torusCoords.sinPhi = sinf(torusCoords.phi);
+bool get_torus_ray_hit(Ray ray, float height, Vec2 *point) {
+    // Sphere tracing against the torus's distance function, r grown by height
+    const float shell = r + height;
+    const float far = 4.0f * (R + shell) + Vector3Length(ray.position);
+    Vector3 d = Vector3Normalize(ray.direction);
+    float t = 0.0f;
+    for (int i = 0; i < 256 && t < far; i++) {
+        Vector3 p = Vector3Add(ray.position, Vector3Scale(d, t));
+        float ring = sqrtf(p.x * p.x + p.z * p.z) - R;
+        float distance = sqrtf(ring * ring + p.y * p.y) - shell;
+        if (i == 0 && distance < 0.0f) return false; // starting inside
+        if (distance < 0.01f) {
+            float u = atan2f(p.z, p.x) * SCREEN_WIDTH / (2.0f * PI);
+            float v = atan2f(p.y, ring) * SCREEN_HEIGHT / (2.0f * PI);
+            *point = Vector2Wrap((Vec2){ u, v }, SCREEN_WIDTH, SCREEN_HEIGHT);
+            return true;
+        }
+        t += distance;
+    }
+    return false;
+}
+
+// cos and sin of 2 pi t / steps: the table entry for the whole part of t,
+// rotated by the small remaining angle d (below 2 pi / steps), using
+// cos d ~ 1 - d^2 / 2 and sin d ~ d - d^3 / 6
+static inline void table_sincos(const float *cosTable, const float *sinTable, int steps,
+                                float t, float *c, float *s) {
+    float whole = floorf(t);
+    float d = (t - whole) * (2.0f * PI / steps);
+    int k = (int)whole % steps;
+    k += (k < 0) ? steps : 0;
+    float d2 = d * d;
+    float cd = 1.0f - 0.5f * d2;
+    float sd = d - d * d2 * (1.0f / 6.0f);
+    *c = cosTable[k] * cd - sinTable[k] * sd;
+    *s = sinTable[k] * cd + cosTable[k] * sd;
 }
 
-Vector3 get_torus_position_fast() {
-    return (Vector3){ (R + r * torusCoords.cosPhi) * torusCoords.cosTheta,
-                      r * torusCoords.sinPhi,
-                      (R + r * torusCoords.cosPhi) * torusCoords.sinTheta };
+TorusCoords get_torus_coords(float u, float v) {
+    TorusCoords coords;
+    coords.theta = get_theta(u);
+    coords.phi = get_phi(v);
+    table_sincos(cosThetaTable, sinThetaTable, thetaSteps, u, &coords.cosTheta, &coords.sinTheta);
+    table_sincos(cosPhiTable, sinPhiTable, phiSteps, v, &coords.cosPhi, &coords.sinPhi);
+    return coords;
 }
 
-Vector3 get_torus_normal_fast() {
-    return (Vector3){ torusCoords.cosPhi * torusCoords.cosTheta,
-                      torusCoords.sinPhi,
-                      torusCoords.cosPhi * torusCoords.sinTheta };
+Vector3 get_torus_position_fast(const TorusCoords *c) {
+    return (Vector3){ (R + r * c->cosPhi) * c->cosTheta,
+                      r * c->sinPhi,
+                      (R + r * c->cosPhi) * c->sinTheta };
 }
-Vector3 get_theta_tangent_fast() {
-    return (Vector3){ -torusCoords.sinTheta, 0.0f, torusCoords.cosTheta };
+
+Vector3 get_torus_normal_fast(const TorusCoords *c) {
+    return (Vector3){ c->cosPhi * c->cosTheta,
+                      c->sinPhi,
+                      c->cosPhi * c->sinTheta };
+}
+Vector3 get_theta_tangent_fast(const TorusCoords *c) {
+    return (Vector3){ -c->sinTheta, 0.0f, c->cosTheta };
 }
-Vector3 get_phi_tangent_fast() {
-    return (Vector3){ -torusCoords.sinPhi * torusCoords.cosTheta,
-                      torusCoords.cosPhi,
-                      -torusCoords.sinPhi * torusCoords.sinTheta };
+Vector3 get_phi_tangent_fast(const TorusCoords *c) {
+    return (Vector3){ -c->sinPhi * c->cosTheta,
+                      c->cosPhi,
+                      -c->sinPhi * c->sinTheta };
 }
 
-Matrix get_torus_transform(Boid *boid, float scale) {
-    set_torus_coords(boid->position.x, boid->position.y);
+Matrix get_torus_transform(float x, float y, float vx, float vy, float scale) {
+    TorusCoords coords = get_torus_coords(x, y);
     Vector3 position = Vector3Add(
-        get_torus_position_fast(),
-        Vector3Scale(get_torus_normal_fast(), BOID_HEIGHT));
+        get_torus_position_fast(&coords),
+        Vector3Scale(get_torus_normal_fast(&coords), BOID_HEIGHT));
 
     Vector3 velocity = Vector3Add(
-        Vector3Scale(get_theta_tangent_fast(), boid->velocity.x),
-        Vector3Scale(get_phi_tangent_fast(), boid->velocity.y));
+        Vector3Scale(get_theta_tangent_fast(&coords), vx),
+        Vector3Scale(get_phi_tangent_fast(&coords), vy));
 
     Vector3 forward = Vector3Normalize(velocity);
-    Vector3 up = get_torus_normal_fast();
+    Vector3 up = get_torus_normal_fast(&coords);
     Vector3 right = Vector3CrossProduct(forward, up);
 
     Matrix transform = {
@@ -180,4 +308,12 @@ Matrix get_torus_transform(Boid *boid, float scale) {
     };
 
     return transform;
-}
\ No newline at end of file
+}
+
+void get_torus_transforms(const float *x, const float *y, const float *vx, const float *vy,
+                          size_t count, float scale, Matrix *transforms) {
+    #pragma omp parallel for schedule(static)
+    for (size_t i = 0; i < count; i++) {
+        transforms[i] = get_torus_transform(x[i], y[i], vx[i], vy[i], scale);
+    }
+}
@@ -10,19 +10,55 @@ extern int SCREEN_WIDTH;
 extern int SCREEN_HEIGHT;
 
 void SetTorusDimensions(float major, float minor);
+float get_torus_major_radius(void);
+float get_torus_minor_radius(void);
+// Indexed, with (rings + 1) * (sides + 1) shared vertices and tangents
 Mesh MyGenTorusMesh(int rings, int sides);
 
+// The torus at a few resolutions, for the current dimensions
+#define TORUS_LODS 3
+#define TORUS_LOD_PIXELS 1.0f   // most a level may stray from the surface on screen
+
+typedef struct TorusMeshes {
+    Mesh lod[TORUS_LODS];       // coarsest first
+    float major, minor;         // dimensions the vertices were built for
+} TorusMeshes;
+
+void LoadTorusMeshes(TorusMeshes *meshes);
+// Moves the vertices if SetTorusDimensions() has changed them since
+void UpdateTorusMeshes(TorusMeshes *meshes);
+void UnloadTorusMeshes(TorusMeshes *meshes);
+// Coarsest level that looks right from eye; pixelsPerUnit is the projection's
+// pixels per world unit at unit distance
+int SelectTorusLod(Vector3 eye, float pixelsPerUnit);
+
 
 Vector3 get_torus_position(float u, float v);
 Vector3 get_torus_normal(float u, float v);
 Vector3 get_phi_tangent(float u, float v);
 Vector3 get_theta_tangent(float u, float v);
 
-void set_torus_coords(float u, float v);
-Vector3 get_torus_position_fast();
-Vector3 get_torus_normal_fast();
-Vector3 get_theta_tangent_fast();
-Vector3 get_phi_tangent_fast();
-Matrix get_torus_transform(Boid *boid, float scale);
+// Angles of a point on the torus with their cos and sin
+typedef struct TorusCoords {
+    float theta, phi;
+    float cosTheta, sinTheta;
+    float cosPhi, sinPhi;
+} TorusCoords;
+
+// Table lookups instead of sinf/cosf; SetTorusDimensions() first. Everything
+// below only reads shared state, so it is safe to call from many threads.
+TorusCoords get_torus_coords(float u, float v);
+Vector3 get_torus_position_fast(const TorusCoords *c);
+Vector3 get_torus_normal_fast(const TorusCoords *c);
+Vector3 get_theta_tangent_fast(const TorusCoords *c);
+Vector3 get_phi_tangent_fast(const TorusCoords *c);
+Matrix get_torus_transform(float x, float y, float vx, float vy, float scale);
+// Where a ray first meets the torus grown by height along its normals, in
+// world coordinates; false if it misses
+bool get_torus_ray_hit(Ray ray, float height, Vec2 *point);
+
+// get_torus_transform for count boids at once, in parallel
+void get_torus_transforms(const float *x, const float *y, const float *vx, const float *vy,
+                          size_t count, float scale, Matrix *transforms);
 
 #endif // TORUS_H
\ No newline at end of file
@@ -0,0 +1,495 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+#include "transport.h"
+
+const char *transport_name(TransportKind kind) {
+    static const char *names[TRANSPORT_KIND_COUNT] = { "shm", "socket" };
+    return kind < TRANSPORT_KIND_COUNT ? names[kind] : "unknown";
+}
+
+TransportKind transport_kind(const char *name) {
+    for (int kind = 0; kind < TRANSPORT_KIND_COUNT; kind++) {
+        if (strcmp(name, transport_name((TransportKind)kind)) == 0) return (TransportKind)kind;
+    }
+    return TRANSPORT_KIND_COUNT;
+}
+
+void message_reserve(Message *m, size_t capacity) {
+    if (capacity <= m->capacity) return;
+    size_t grown = m->capacity * 2 > capacity ? m->capacity * 2 : capacity;
+    uint8_t *p = realloc(m->data, grown);
+    if (!p) {
+        fprintf(stderr, "Failed to allocate message!\n");
+        exit(1);
+    }
+    m->data = p;
+    m->capacity = grown;
+}
+
+void *message_append(Message *m, const void *data, size_t size) {
+    message_reserve(m, m->size + size);
+    void *at = m->data + m->size;
+    if (data) memcpy(at, data, size);
+    m->size += size;
+    return at;
+}
+
+void message_free(Message *m) {
+    free(m->data);
+    *m = (Message){0};
+}
+
+static void *transport_alloc(size_t size) {
+    void *p = calloc(1, size);
+    if (!p) {
+        fprintf(stderr, "Failed to allocate transport!\n");
+        exit(1);
+    }
+    return p;
+}
+
+// Unordered pair (a, b) to a channel index
+static int channel_index(int ranks, int a, int b) {
+    if (a > b) { int t = a; a = b; b = t; }
+    return a * ranks - a * (a + 1) / 2 + (b - a - 1);
+}
+
+// One message in flight each way on a channel: an 8-byte length, then the bytes
+typedef struct Transfer {
+    const Message *out;
+    uint64_t out_size;
+    size_t sent;        // of 8 + out_size
+    Message *in;
+    uint64_t in_size;
+    size_t received;    // of 8 + in_size, the size known once 8 are in
+} Transfer;
+
+static size_t transfer_send_left(const Transfer *x) {
+    return x->out ? 8 + x->out_size - x->sent : 0;
+}
+
+static size_t transfer_receive_left(const Transfer *x) {
+    if (!x->in) return 0;
+    return x->received < 8 ? 8 - x->received : 8 + x->in_size - x->received;
+}
+
+// The next n outgoing bytes start here, at most `max` of them contiguous
+static const uint8_t *transfer_out_bytes(const Transfer *x, size_t *max) {
+    if (x->sent < 8) {
+        *max = 8 - x->sent;
+        return (const uint8_t *)&x->out_size + x->sent;
+    }
+    *max = 8 + x->out_size - x->sent;
+    return x->out->data + (x->sent - 8);
+}
+
+static uint8_t *transfer_in_bytes(Transfer *x, size_t *max) {
+    if (x->received < 8) {
+        *max = 8 - x->received;
+        return (uint8_t *)&x->in_size + x->received;
+    }
+    *max = 8 + x->in_size - x->received;
+    return x->in->data + (x->received - 8);
+}
+
+static void transfer_received(Transfer *x, size_t n) {
+    x->received += n;
+    if (x->received == 8) {
+        x->in->size = 0;
+        message_reserve(x->in, x->in_size);
+        x->in->size = x->in_size;
+    }
+}
+
+static void transfer_start(Transfer *x, const Message *out, Message *in) {
+    *x = (Transfer){ .out = out, .out_size = out ? out->size : 0, .in = in };
+    if (in) in->size = 0;
+}
+
+// ---------------------------------------------------------------------------
+// Shared memory
+
+typedef struct Ring {
+    uint64_t head;      // bytes written so far
+    uint64_t tail;      // bytes read so far
+    uint8_t data[TRANSPORT_RING];
+} Ring;
+
+#define SHM_POLL_MS 100    // how often a waiting rank checks that its peer lives
+
+typedef struct Channel {
+    pthread_mutex_t lock;   // robust: a peer dying with it held closes the channel
+    pthread_cond_t changed;
+    int closed;
+    pid_t pid[2];       // of the lower rank and the higher, 0 until known
+    Ring ring[2];       // [0] from the lower rank to the higher, [1] back
+} Channel;
+
+typedef struct ShmTransport {
+    char name[64];
+    Channel *channels;
+    size_t bytes;
+    bool linked;        // name still in the namespace
+} ShmTransport;
+
+static size_t ring_write(Ring *r, const uint8_t *data, size_t n) {
+    size_t room = TRANSPORT_RING - (size_t)(r->head - r->tail);
+    if (n > room) n = room;
+    size_t at = (size_t)(r->head % TRANSPORT_RING);
+    size_t first = n < TRANSPORT_RING - at ? n : TRANSPORT_RING - at;
+    memcpy(r->data + at, data, first);
+    memcpy(r->data, data + first, n - first);
+    r->head += n;
+    return n;
+}
+
+static size_t ring_read(Ring *r, uint8_t *data, size_t n) {
+    size_t ready = (size_t)(r->head - r->tail);
+    if (n > ready) n = ready;
+    size_t at = (size_t)(r->tail % TRANSPORT_RING);
+    size_t first = n < TRANSPORT_RING - at ? n : TRANSPORT_RING - at;
+    memcpy(data, r->data + at, first);
+    memcpy(data + first, r->data, n - first);
+    r->tail += n;
+    return n;
+}
+
+// Whether the process has exited. A dead worker stays a zombie until the
+// coordinator reaps it, which kill() cannot tell, so its state is read too.
+static bool process_gone(pid_t pid) {
+    if (kill(pid, 0) != 0) return errno == ESRCH;
+    char path[64], stat[512];
+    snprintf(path, sizeof(path), "/proc/%ld/stat", (long)pid);
+    FILE *file = fopen(path, "r");
+    if (!file) return false;
+    size_t n = fread(stat, 1, sizeof(stat) - 1, file);
+    fclose(file);
+    stat[n] = '\0';
+    const char *state = strrchr(stat, ')'); // the name may hold spaces and parentheses
+    return state && (state[2] == 'Z' || state[2] == 'X');
+}
+
+// False, with the channel closed, if the last owner of the lock died holding
+// it, as the rings may then be half written
+static bool channel_locked(Channel *c, int status) {
+    if (status != EOWNERDEAD) return true;
+    c->closed = 1;
+    pthread_mutex_consistent(&c->lock);
+    return false;
+}
+
+static bool shm_exchange(Transport *t, int peer, const Message *out, Message *in) {
+    ShmTransport *s = t->impl;
+    Channel *c = &s->channels[channel_index(t->ranks, t->rank, peer)];
+    Ring *tx = &c->ring[t->rank < peer ? 0 : 1];
+    Ring *rx = &c->ring[t->rank < peer ? 1 : 0];
+    Transfer x;
+    transfer_start(&x, out, in);
+
+    const pid_t *peerPid = &c->pid[t->rank < peer ? 1 : 0];
+    bool ok = channel_locked(c, pthread_mutex_lock(&c->lock));
+    while (ok && (transfer_send_left(&x) > 0 || transfer_receive_left(&x) > 0)) {
+        bool progress = false;
+        while (transfer_send_left(&x) > 0) {
+            size_t max;
+            const uint8_t *bytes = transfer_out_bytes(&x, &max);
+            size_t n = ring_write(tx, bytes, max);
+            if (n == 0) break;
+            x.sent += n;
+            progress = true;
+        }
+        while (transfer_receive_left(&x) > 0) {
+            size_t max;
+            uint8_t *bytes = transfer_in_bytes(&x, &max);
+            size_t n = ring_read(rx, bytes, max);
+            if (n == 0) break;
+            transfer_received(&x, n);
+            progress = true;
+        }
+        if (progress) {
+            pthread_cond_broadcast(&c->changed);
+        } else if (c->closed) {
+            ok = false;
+        } else {
+            struct timespec until;
+            clock_gettime(CLOCK_MONOTONIC, &until);
+            until.tv_nsec += SHM_POLL_MS * 1000000L;
+            if (until.tv_nsec >= 1000000000L) {
+                until.tv_sec++;
+                until.tv_nsec -= 1000000000L;
+            }
+            int status = pthread_cond_timedwait(&c->changed, &c->lock, &until);
+            pid_t pid = __atomic_load_n(peerPid, __ATOMIC_ACQUIRE);
+            if (!channel_locked(c, status)) {
+                ok = false;
+            } else if (status == ETIMEDOUT && pid > 0 && process_gone(pid)) {
+                c->closed = 1;
+                ok = false;
+            }
+        }
+    }
+    pthread_mutex_unlock(&c->lock);
+    return ok;
+}
+
+static void shm_close(Transport *t) {
+    ShmTransport *s = t->impl;
+    for (int peer = 0; peer < t->ranks; peer++) {
+        if (peer == t->rank) continue;
+        Channel *c = &s->channels[channel_index(t->ranks, t->rank, peer)];
+        channel_locked(c, pthread_mutex_lock(&c->lock));
+        c->closed = 1;
+        pthread_cond_broadcast(&c->changed);
+        pthread_mutex_unlock(&c->lock);
+    }
+    if (s->linked) shm_unlink(s->name);
+    munmap(s->channels, s->bytes);
+    free(s);
+    free(t);
+}
+
+// Publishes the worker's pid, which exec keeps, for its peers to watch
+static void shm_prepare_child(Transport *t, int rank) {
+    ShmTransport *s = t->impl;
+    for (int peer = 0; peer < t->ranks; peer++) {
+        if (peer == rank) continue;
+        Channel *c = &s->channels[channel_index(t->ranks, rank, peer)];
+        __atomic_store_n(&c->pid[rank < peer ? 0 : 1], getpid(), __ATOMIC_RELEASE);
+    }
+}
+
+static void shm_attached(Transport *t) {
+    ShmTransport *s = t->impl;
+    if (s->linked) shm_unlink(s->name);
+    s->linked = false;
+}
+
+static void shm_address(Transport *t, int rank, char *buffer, size_t size) {
+    (void)rank;
+    ShmTransport *s = t->impl;
+    snprintf(buffer, size, "%s", s->name);
+}
+
+static Transport *shm_transport(int rank, int ranks, ShmTransport *s) {
+    Transport *t = transport_alloc(sizeof(Transport));
+    *t = (Transport){
+        .kind = TRANSPORT_SHM, .rank = rank, .ranks = ranks,
+        .exchange = shm_exchange, .close = shm_close, .prepare_child = shm_prepare_child,
+        .attached = shm_attached, .address = shm_address, .impl = s,
+    };
+    return t;
+}
+
+static bool shm_map(ShmTransport *s, int ranks, bool create) {
+    s->bytes = (size_t)(ranks * (ranks - 1) / 2) * sizeof(Channel);
+    int fd = shm_open(s->name, create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open shared memory %s: %s\n", s->name, strerror(errno));
+        return false;
+    }
+    if (create && ftruncate(fd, (off_t)s->bytes) != 0) {
+        fprintf(stderr, "Failed to size shared memory %s: %s\n", s->name, strerror(errno));
+        close(fd);
+        shm_unlink(s->name);
+        return false;
+    }
+    s->channels = mmap(NULL, s->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (s->channels == MAP_FAILED) {
+        fprintf(stderr, "Failed to map shared memory %s: %s\n", s->name, strerror(errno));
+        if (create) shm_unlink(s->name);
+        return false;
+    }
+    return true;
+}
+
+static Transport *open_shm(int ranks) {
+    ShmTransport *s = transport_alloc(sizeof(ShmTransport));
+    snprintf(s->name, sizeof(s->name), "/boids-%ld-%ld", (long)getpid(), (long)time(NULL));
+    if (!shm_map(s, ranks, true)) {
+        free(s);
+        return NULL;
+    }
+    s->linked = true;
+
+    pthread_mutexattr_t mutex;
+    pthread_condattr_t cond;
+    pthread_mutexattr_init(&mutex);
+    pthread_mutexattr_setpshared(&mutex, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mutex, PTHREAD_MUTEX_ROBUST);
+    pthread_condattr_init(&cond);
+    pthread_condattr_setpshared(&cond, PTHREAD_PROCESS_SHARED);
+    pthread_condattr_setclock(&cond, CLOCK_MONOTONIC);
+    for (int i = 0; i < ranks * (ranks - 1) / 2; i++) {
+        pthread_mutex_init(&s->channels[i].lock, &mutex);
+        pthread_cond_init(&s->channels[i].changed, &cond);
+    }
+    // Rank 0 is the lower rank of all its channels
+    for (int peer = 1; peer < ranks; peer++) s->channels[channel_index(ranks, 0, peer)].pid[0] = getpid();
+    pthread_mutexattr_destroy(&mutex);
+    pthread_condattr_destroy(&cond);
+    return shm_transport(0, ranks, s);
+}
+
+static Transport *attach_shm(int rank, int ranks, const char *address) {
+    ShmTransport *s = transport_alloc(sizeof(ShmTransport));
+    snprintf(s->name, sizeof(s->name), "%s", address);
+    if (!shm_map(s, ranks, false)) {
+        free(s);
+        return NULL;
+    }
+    return shm_transport(rank, ranks, s);
+}
+
+// ---------------------------------------------------------------------------
+// Unix domain sockets
+
+typedef struct SocketTransport {
+    int *fds;           // ranks * ranks: fds[a * ranks + b] is a's end of the a-b socket, -1 if none
+} SocketTransport;
+
+static bool socket_exchange(Transport *t, int peer, const Message *out, Message *in) {
+    SocketTransport *s = t->impl;
+    int fd = s->fds[t->rank * t->ranks + peer];
+    Transfer x;
+    transfer_start(&x, out, in);
+
+    while (transfer_send_left(&x) > 0 || transfer_receive_left(&x) > 0) {
+        struct pollfd p = { .fd = fd, .events = 0 };
+        if (transfer_send_left(&x) > 0) p.events |= POLLOUT;
+        if (transfer_receive_left(&x) > 0) p.events |= POLLIN;
+        if (poll(&p, 1, -1) < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        if (p.revents & (POLLERR | POLLNVAL)) return false;
+        if (p.revents & POLLOUT) {
+            size_t max;
+            const uint8_t *bytes = transfer_out_bytes(&x, &max);
+            ssize_t n = send(fd, bytes, max, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (n < 0 && errno != EAGAIN && errno != EINTR) return false;
+            if (n > 0) x.sent += (size_t)n;
+        }
+        if (p.revents & (POLLIN | POLLHUP)) {
+            size_t max;
+            uint8_t *bytes = transfer_in_bytes(&x, &max);
+            ssize_t n = recv(fd, bytes, max, MSG_DONTWAIT);
+            if (n == 0) return false;
+            if (n < 0 && errno != EAGAIN && errno != EINTR) return false;
+            if (n > 0) transfer_received(&x, (size_t)n);
+        }
+    }
+    return true;
+}
+
+static void socket_close_others(SocketTransport *s, int ranks, int keep) {
+    for (int i = 0; i < ranks * ranks; i++) {
+        if (i / ranks != keep && s->fds[i] >= 0) {
+            close(s->fds[i]);
+            s->fds[i] = -1;
+        }
+    }
+}
+
+static void socket_close(Transport *t) {
+    SocketTransport *s = t->impl;
+    for (int i = 0; i < t->ranks * t->ranks; i++) {
+        if (s->fds[i] >= 0) close(s->fds[i]);
+    }
+    free(s->fds);
+    free(s);
+    free(t);
+}
+
+static void socket_prepare_child(Transport *t, int rank) {
+    SocketTransport *s = t->impl;
+    for (int i = 0; i < t->ranks * t->ranks; i++) {
+        if (i / t->ranks != rank && s->fds[i] >= 0) close(s->fds[i]);
+    }
+}
+
+static void socket_attached(Transport *t) {
+    socket_close_others(t->impl, t->ranks, t->rank);
+}
+
+static void socket_address(Transport *t, int rank, char *buffer, size_t size) {
+    SocketTransport *s = t->impl;
+    size_t used = 0;
+    buffer[0] = '\0';
+    for (int peer = 0; peer < t->ranks && used < size; peer++) {
+        used += (size_t)snprintf(buffer + used, size - used, "%s%d", peer ? "," : "",
+                                 s->fds[rank * t->ranks + peer]);
+    }
+}
+
+static Transport *socket_transport(int rank, int ranks, SocketTransport *s) {
+    Transport *t = transport_alloc(sizeof(Transport));
+    *t = (Transport){
+        .kind = TRANSPORT_SOCKET, .rank = rank, .ranks = ranks,
+        .exchange = socket_exchange, .close = socket_close, .prepare_child = socket_prepare_child,
+        .attached = socket_attached, .address = socket_address, .impl = s,
+    };
+    return t;
+}
+
+static Transport *open_socket(int ranks) {
+    SocketTransport *s = transport_alloc(sizeof(SocketTransport));
+    s->fds = transport_alloc((size_t)ranks * ranks * sizeof(int));
+    for (int i = 0; i < ranks * ranks; i++) s->fds[i] = -1;
+    for (int a = 0; a < ranks; a++) {
+        for (int b = a + 1; b < ranks; b++) {
+            int pair[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) {
+                fprintf(stderr, "Failed to create sockets: %s\n", strerror(errno));
+                Transport *t = socket_transport(0, ranks, s);
+                socket_close(t);
+                return NULL;
+            }
+            s->fds[a * ranks + b] = pair[0];
+            s->fds[b * ranks + a] = pair[1];
+        }
+    }
+    return socket_transport(0, ranks, s);
+}
+
+static Transport *attach_socket(int rank, int ranks, const char *address) {
+    SocketTransport *s = transport_alloc(sizeof(SocketTransport));
+    s->fds = transport_alloc((size_t)ranks * ranks * sizeof(int));
+    for (int i = 0; i < ranks * ranks; i++) s->fds[i] = -1;
+    const char *p = address;
+    for (int peer = 0; peer < ranks; peer++) {
+        char *end;
+        s->fds[rank * ranks + peer] = (int)strtol(p, &end, 10);
+        if (end == p || (peer + 1 < ranks && *end != ',')) {
+            fprintf(stderr, "Bad socket address '%s'\n", address);
+            free(s->fds);
+            free(s);
+            return NULL;
+        }
+        p = end + 1;
+    }
+    return socket_transport(rank, ranks, s);
+}
+
+// ---------------------------------------------------------------------------
+
+Transport *OpenTransport(TransportKind kind, int ranks) {
+    if (ranks < 2) return NULL;
+    return kind == TRANSPORT_SHM ? open_shm(ranks) : open_socket(ranks);
+}
+
+Transport *AttachTransport(TransportKind kind, int rank, int ranks, const char *address) {
+    if (rank < 1 || rank >= ranks) return NULL;
+    return kind == TRANSPORT_SHM ? attach_shm(rank, ranks, address) : attach_socket(rank, ranks, address);
+}
@@ -0,0 +1,83 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Message passing between the processes of a decomposed simulation
+// (domain.h).
+//
+// Rank 0 is the coordinator and ranks 1 .. ranks - 1 the workers; every pair
+// of ranks has a channel that delivers whole messages in order. Two kinds:
+//  - shm: one POSIX shared memory segment holding a pair of byte rings per
+//    channel, each channel guarded by a process-shared mutex and condition
+//    variable;
+//  - socket: one Unix domain socketpair per channel.
+// Both stay on one machine. A socket transport over TCP would take the same
+// operations across machines; messages are in host byte order.
+//
+// The coordinator opens the transport and starts the workers; each worker
+// attaches with the address the coordinator gives it (the segment's name, or
+// the socket descriptors it inherits).
+
+typedef enum TransportKind {
+    TRANSPORT_SHM = 0,
+    TRANSPORT_SOCKET,
+    TRANSPORT_KIND_COUNT
+} TransportKind;
+
+#define TRANSPORT_RING (1u << 18) // bytes per direction of a shm channel
+
+// A growable byte buffer
+typedef struct Message {
+    uint8_t *data;
+    size_t size;
+    size_t capacity;
+} Message;
+
+typedef struct Transport Transport;
+
+struct Transport {
+    TransportKind kind;
+    int rank;
+    int ranks;
+    // Sends `out` to peer (unless NULL) while receiving the peer's next
+    // message into `in` (unless NULL), interleaved, so two ranks exchanging
+    // with each other never wait on each other's full buffers. False if the
+    // peer has gone.
+    bool (*exchange)(Transport *t, int peer, const Message *out, Message *in);
+    // Closes the channels; peers see the transport go
+    void (*close)(Transport *t);
+    // In a forked child about to exec rank's worker: closes every descriptor
+    // the worker does not need. Async-signal-safe.
+    void (*prepare_child)(Transport *t, int rank);
+    // Once every worker has attached: drops what attaching needed
+    void (*attached)(Transport *t);
+    // Writes what rank needs to attach
+    void (*address)(Transport *t, int rank, char *buffer, size_t size);
+    void *impl;
+};
+
+const char *transport_name(TransportKind kind);
+// TRANSPORT_KIND_COUNT for an unknown name
+TransportKind transport_kind(const char *name);
+
+// The coordinator's end, as rank 0; NULL with a message on failure
+Transport *OpenTransport(TransportKind kind, int ranks);
+// A worker's end; NULL with a message on failure
+Transport *AttachTransport(TransportKind kind, int rank, int ranks, const char *address);
+
+static inline bool TransportSend(Transport *t, int peer, const Message *out) {
+    return t->exchange(t, peer, out, NULL);
+}
+static inline bool TransportReceive(Transport *t, int peer, Message *in) {
+    return t->exchange(t, peer, NULL, in);
+}
+
+void message_reserve(Message *m, size_t capacity);
+// Appends size bytes and returns where they went
+void *message_append(Message *m, const void *data, size_t size);
+void message_free(Message *m);
+
+#endif // TRANSPORT_H
@@ -0,0 +1,54 @@
+#ifndef VEC2_H
+#define VEC2_H
+
+// Minimal 2D vector maths for the simulation core.
+// Mirrors the raymath functions the simulation used so the core can be built
+// without raylib; the names differ so both headers can share a translation unit.
+
+#include <math.h>
+
+#ifndef PI
+#define PI 3.14159265358979323846f
+#endif
+#ifndef DEG2RAD
+#define DEG2RAD (PI/180.0f)
+#endif
+
+typedef struct Vec2 {
+    float x;
+    float y;
+} Vec2;
+
+static inline Vec2 Vec2Add(Vec2 a, Vec2 b) { return (Vec2){ a.x + b.x, a.y + b.y }; }
+static inline Vec2 Vec2Subtract(Vec2 a, Vec2 b) { return (Vec2){ a.x - b.x, a.y - b.y }; }
+static inline Vec2 Vec2Scale(Vec2 v, float s) { return (Vec2){ v.x * s, v.y * s }; }
+static inline float Vec2DotProduct(Vec2 a, Vec2 b) { return a.x * b.x + a.y * b.y; }
+static inline float Vec2Length(Vec2 v) { return sqrtf(v.x * v.x + v.y * v.y); }
+
+static inline Vec2 Vec2Normalize(Vec2 v)
+{
+    float length = Vec2Length(v);
+    if (length > 0.0f) {
+        float ilength = 1.0f / length;
+        v.x *= ilength;
+        v.y *= ilength;
+    }
+    return v;
+}
+
+// Same as raymath's Vector2ClampValue: rescale v so its length lies in [min, max]
+static inline Vec2 Vec2ClampValue(Vec2 v, float min, float max)
+{
+    float length = v.x * v.x + v.y * v.y;
+    if (length > 0.0f) {
+        length = sqrtf(length);
+        float scale = 1.0f;
+        if (length < min) scale = min / length;
+        else if (length > max) scale = max / length;
+        v.x *= scale;
+        v.y *= scale;
+    }
+    return v;
+}
+
+#endif // VEC2_H
@@ -0,0 +1,47 @@
+// Worker process of a decomposed simulation (domain.h).
+//
+// Started by the viewer or boids_bench, one per strip of the world; not meant
+// to be run by hand.
+//
+// Usage:
+//   ./boids_worker --rank 1 --ranks 3 --transport shm --address /boids-...
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "domain.h"
+#include "transport.h"
+
+int main(int argc, char **argv)
+{
+    static const struct option long_options[] = {
+        { "rank",      required_argument, NULL, 'r' },
+        { "ranks",     required_argument, NULL, 'n' },
+        { "transport", required_argument, NULL, 't' },
+        { "address",   required_argument, NULL, 'a' },
+        { NULL, 0, NULL, 0 }
+    };
+
+    int rank = 0, ranks = 0;
+    TransportKind kind = TRANSPORT_KIND_COUNT;
+    const char *address = NULL;
+    int c;
+    while ((c = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (c) {
+            case 'r': rank = atoi(optarg); break;
+            case 'n': ranks = atoi(optarg); break;
+            case 't': kind = transport_kind(optarg); break;
+            case 'a': address = optarg; break;
+            default: return 1;
+        }
+    }
+    if (rank < 1 || rank >= ranks || kind == TRANSPORT_KIND_COUNT || !address) {
+        fprintf(stderr, "Usage: %s --rank R --ranks N --transport shm|socket --address A\n", argv[0]);
+        return 1;
+    }
+
+    Transport *transport = AttachTransport(kind, rank, ranks, address);
+    if (!transport) return 1;
+    return RunDomainWorker(transport);
+}